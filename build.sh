@@ -15,6 +15,11 @@ echo "Building for Mac OS X ..."
 ./build.sh || exit 1
 cd ..
 
+cd linux
+echo "Building for Linux ..."
+./build.sh || exit 1
+cd ..
+
 cd win32
 echo
 echo "`basename $0`: You'll need to build for Win32 on a Windows host"
@@ -0,0 +1,130 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef _EpollAsyncRequestSessionData_H_
+#define _EpollAsyncRequestSessionData_H_
+
+#include "WinHttpRequestError.h"
+
+#include "WindowsNetworkSupport.h"
+
+#define EPOLL_SESSION_TX_BUFFER_SIZE 65536
+
+/// Stores the information exchanged between the event loop thread and the main thread for one request.
+/// This is the Linux counterpart of WinHttpAsyncRequestSessionData. All fields are guarded by the owning
+/// EpollRequestOperation's session mutex.
+struct EpollAsyncRequestSessionData
+{
+	/// Signal indicating that the event loop thread is done with all resources associated
+	/// with this request (its socket has been closed and it will not touch the operation again).
+	bool RequestComplete;
+
+	bool IsFirstProcessingPassForRequest;
+
+	long long RequestBodyBytesCurrent;   // Number of request body bytes sent by the event loop thread
+	long long RequestBodyBytesProcessed; // Number of request body bytes processed by the main thread
+	long long RequestBodyBytesTotal;     // Total number of request body bytes to be sent
+	long long RequestBodyEncodedBytesCurrent; // Number of compressed request body bytes sent, if compressing it
+
+	/// Chunks of a streamed request body (params.body = function) read by the main thread and not yet taken by the
+	/// event loop thread, and the number of body bytes read up to the end of them. The event loop thread takes
+	/// ownership of the chunks by swapping them out.
+	UTF8String RequestBodyStreamBytes;
+	long long RequestBodyStreamBytesRead;
+
+	/// Set by the main thread once the last chunk of a streamed body is in "RequestBodyStreamBytes", or once the
+	/// body could not be read, which fails the request.
+	bool IsRequestBodyStreamEnded;
+	bool HasRequestBodyStreamFailed;
+
+	/// Set by the event loop thread when it has sent every chunk of a streamed body it was given and waits for
+	/// more. The main thread clears it (and re-posts the operation) after adding to "RequestBodyStreamBytes".
+	bool IsRequestBodyStreamStarved;
+
+	/// Raw response headers (status line first, CRLF separated) and flag indicating that headers
+	/// have been received and may be read.
+	UTF8String ResponseHeaders;
+	bool ResponseHeadersReady;
+
+	/// Response body bytes received by the event loop thread that have not yet been consumed
+	/// by the main thread. The main thread takes ownership of these bytes by swapping them out.
+	UTF8String ReceivedBytes;
+
+	/// Number of response body bytes read off the connection behind "ReceivedBytes". Only differs from its size
+	/// when the response body is decoded.
+	long long ReceivedByteCount;
+
+	/// Number of response body bytes the event loop thread has written to the download file that have not
+	/// yet been reported as progress by the main thread.
+	long long WrittenByteCount;
+
+	/// The number of decoded bytes behind "WrittenByteCount", which only differs from it for compressed responses.
+	long long DecodedWrittenByteCount;
+
+	/// Set by the event loop thread when it has stopped reading because "ReceivedBytes" holds the request's
+	/// "receiveBufferCount" times "receiveBufferSize" bytes.
+	/// The main thread clears it (and re-posts the operation) after draining "ReceivedBytes".
+	bool IsReceivePaused;
+
+	/// The HTTP status code that was received in the HTTP response's header.
+	/// Set to -1 if a response has not been received.
+	int ReceivedStatusCode;
+
+	/// Set true to have the async operation aborted. This flag is monitored by the event loop
+	/// thread, which will close the connection when it next services the operation.
+	bool WasAbortRequested;
+
+	/// Set true when the request operation has ended.
+	bool HasAsyncOperationEnded;
+
+	/// Set to true by the main thread to indicate that HasAsyncOperationEnded has been processed.
+	bool EndOfOperationProcessed;
+
+	/// Indicates if an error has occurred by the end of the async operation.
+	/// This field should be ignored by the main thread until "HasAsyncOperationEnded" has been set true.
+	WinHttpRequestError ErrorResult;
+
+
+	/// Initializes this session object for a new asynchronous HTTP request operation.
+	/// Never call this function if it is currently being used by an active async operation.
+	void Reset()
+	{
+		RequestComplete = false;
+		IsFirstProcessingPassForRequest = true;
+		RequestBodyBytesCurrent = 0;
+		RequestBodyBytesProcessed = 0;
+		RequestBodyBytesTotal = 0;
+		RequestBodyEncodedBytesCurrent = -1;
+		RequestBodyStreamBytes.clear();
+		RequestBodyStreamBytesRead = 0;
+		IsRequestBodyStreamEnded = false;
+		HasRequestBodyStreamFailed = false;
+		IsRequestBodyStreamStarved = false;
+		ResponseHeaders.clear();
+		ResponseHeadersReady = false;
+		ReceivedBytes.clear();
+		ReceivedByteCount = 0;
+		WrittenByteCount = 0;
+		DecodedWrittenByteCount = 0;
+		IsReceivePaused = false;
+		ReceivedStatusCode = -1;
+		WasAbortRequested = false;
+		HasAsyncOperationEnded = false;
+		EndOfOperationProcessed = false;
+		ErrorResult = kWinHttpRequestErrorNone;
+	}
+
+	/// Creates a new session object for an asynchronous HTTP request operation.
+	EpollAsyncRequestSessionData()
+	{
+		Reset();
+	}
+};
+
+#endif
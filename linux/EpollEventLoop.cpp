@@ -0,0 +1,392 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "EpollEventLoop.h"
+#include "EpollRequestOperation.h"
+#include "WindowsNetworkSupport.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+/// Number of epoll events fetched per call to epoll_wait().
+#define EPOLL_EVENT_LOOP_MAX_EVENTS 64
+
+/// Interval at which attached operations are given a chance to check their timeouts.
+#define EPOLL_EVENT_LOOP_TIMER_INTERVAL_MS 250
+
+
+#pragma region Constructors and Destructors
+/// Creates a new event loop. The loop does not do anything until Start() is called.
+EpollEventLoop::EpollEventLoop()
+:	fEpollDescriptor( -1 ),
+	fWakeDescriptor( -1 ),
+	fIsRunning( false ),
+	fNextTimerTick( 0 )
+{
+#ifndef NETWORK_NO_OPENSSL
+	fTlsContext = NULL;
+#endif
+}
+
+/// Stops the loop thread (if running) and releases the epoll and TLS resources.
+EpollEventLoop::~EpollEventLoop()
+{
+	Stop();
+
+	if (fWakeDescriptor >= 0)
+	{
+		::close(fWakeDescriptor);
+		fWakeDescriptor = -1;
+	}
+	if (fEpollDescriptor >= 0)
+	{
+		::close(fEpollDescriptor);
+		fEpollDescriptor = -1;
+	}
+
+#ifndef NETWORK_NO_OPENSSL
+	if (fTlsContext)
+	{
+		SSL_CTX_free(fTlsContext);
+		fTlsContext = NULL;
+	}
+#endif
+}
+
+#pragma endregion
+
+
+#pragma region Public Functions
+/// Creates the epoll instance (if not done already) and starts the loop thread.
+/// @return Returns true if the loop is running. Returns false if it could not be started.
+bool EpollEventLoop::Start()
+{
+	if (IsRunning())
+	{
+		return true;
+	}
+
+	if (fEpollDescriptor < 0)
+	{
+		fEpollDescriptor = ::epoll_create1(EPOLL_CLOEXEC);
+		if (fEpollDescriptor < 0)
+		{
+			debug("epoll_create1 failed (%d)", errno);
+			return false;
+		}
+	}
+
+	if (fWakeDescriptor < 0)
+	{
+		fWakeDescriptor = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (fWakeDescriptor < 0)
+		{
+			debug("eventfd failed (%d)", errno);
+			return false;
+		}
+
+		// The wake descriptor is registered with a NULL operation, which is how the loop tells it apart.
+		struct epoll_event event;
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN;
+		event.data.ptr = NULL;
+		if (::epoll_ctl(fEpollDescriptor, EPOLL_CTL_ADD, fWakeDescriptor, &event) != 0)
+		{
+			debug("Failed to register eventfd with epoll (%d)", errno);
+			return false;
+		}
+	}
+
+	// Writing to a socket whose peer has gone away must fail with EPIPE instead of killing the process.
+	::signal(SIGPIPE, SIG_IGN);
+
+	fIsRunning = true;
+	fThread = std::thread(&EpollEventLoop::Run, this);
+	return true;
+}
+
+/// Stops the loop thread and blocks until it has exited. Any operations still attached to the loop are
+/// shut down (their sockets closed and their sessions flagged as aborted) before this function returns.
+void EpollEventLoop::Stop()
+{
+	if (fThread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(fPostedMutex);
+			fIsRunning = false;
+		}
+
+		uint64_t value = 1;
+		if (::write(fWakeDescriptor, &value, sizeof(value)) < 0)
+		{
+			debug("Failed to wake event loop (%d)", errno);
+		}
+
+		// Operations hold a reference to this loop, so Stop() can end up being called on the loop
+		// thread itself when the last operation lets go. Never join ourselves.
+		if (std::this_thread::get_id() == fThread.get_id())
+		{
+			fThread.detach();
+		}
+		else
+		{
+			fThread.join();
+		}
+	}
+}
+
+/// Determines if the loop thread is currently running.
+bool EpollEventLoop::IsRunning()
+{
+	return fIsRunning;
+}
+
+/// Hands the given operation to the loop thread, which will call its OnLoopPosted() function.
+/// Can be called from any thread. Used to start an operation, to notify it that it has been aborted,
+/// that its host name has been resolved, or that the main thread has drained its receive buffer.
+void EpollEventLoop::Post( const std::shared_ptr<EpollRequestOperation>& operation )
+{
+	if (!operation)
+	{
+		return;
+	}
+
+	bool wasEmpty;
+	bool isRunning;
+	{
+		std::lock_guard<std::mutex> lock(fPostedMutex);
+		isRunning = fIsRunning;
+		wasEmpty = fPostedOperations.empty();
+		if (isRunning)
+		{
+			fPostedOperations.push_back(operation);
+		}
+	}
+
+	// Nobody is going to service the operation, so end it here. Once the loop has stopped, its
+	// thread no longer touches any operation, so this can't race with it.
+	if (!isRunning)
+	{
+		operation->OnLoopShutdown();
+		return;
+	}
+
+	// Only the first post needs to wake the loop; it drains the whole queue in one go.
+	if (wasEmpty && (fWakeDescriptor >= 0))
+	{
+		uint64_t value = 1;
+		if (::write(fWakeDescriptor, &value, sizeof(value)) < 0)
+		{
+			debug("Failed to wake event loop (%d)", errno);
+		}
+	}
+}
+
+/// Registers a socket with the loop. Socket events will be delivered to the given operation.
+/// Must be called from the loop thread.
+bool EpollEventLoop::Watch( int fileDescriptor, uint32_t events, EpollRequestOperation *operation )
+{
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = events;
+	event.data.ptr = operation;
+	return (::epoll_ctl(fEpollDescriptor, EPOLL_CTL_ADD, fileDescriptor, &event) == 0);
+}
+
+/// Changes the set of events a registered socket is being watched for.
+/// Must be called from the loop thread.
+bool EpollEventLoop::Modify( int fileDescriptor, uint32_t events, EpollRequestOperation *operation )
+{
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = events;
+	event.data.ptr = operation;
+	return (::epoll_ctl(fEpollDescriptor, EPOLL_CTL_MOD, fileDescriptor, &event) == 0);
+}
+
+/// Unregisters a socket from the loop. Must be called before the socket is closed.
+/// Must be called from the loop thread.
+void EpollEventLoop::Unwatch( int fileDescriptor )
+{
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	::epoll_ctl(fEpollDescriptor, EPOLL_CTL_DEL, fileDescriptor, &event);
+}
+
+#ifndef NETWORK_NO_OPENSSL
+/// Gets the TLS client context shared by all HTTPS requests, creating it on first use.
+/// Peer verification uses the system's default trust store. Must be called from the loop thread.
+/// @return Returns the shared context, or NULL if it could not be created.
+SSL_CTX* EpollEventLoop::GetTlsContext()
+{
+	if (NULL == fTlsContext)
+	{
+		fTlsContext = SSL_CTX_new(TLS_client_method());
+		if (fTlsContext)
+		{
+			SSL_CTX_set_min_proto_version(fTlsContext, TLS1_2_VERSION);
+			SSL_CTX_set_verify(fTlsContext, SSL_VERIFY_PEER, NULL);
+			SSL_CTX_set_default_verify_paths(fTlsContext);
+			SSL_CTX_set_mode(fTlsContext, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+		}
+		else
+		{
+			debug("Failed to create TLS context");
+		}
+	}
+	return fTlsContext;
+}
+#endif
+
+#pragma endregion
+
+
+#pragma region Private Functions
+/// The loop thread's entry point. Waits for socket events and posted operations until Stop() is called.
+void EpollEventLoop::Run()
+{
+	// Keep ourselves alive for as long as the thread runs, in case the last outside reference goes away.
+	std::shared_ptr<EpollEventLoop> thiz = shared_from_this();
+
+	struct epoll_event events[EPOLL_EVENT_LOOP_MAX_EVENTS];
+
+	fNextTimerTick = ::GetTickCount() + EPOLL_EVENT_LOOP_TIMER_INTERVAL_MS;
+	while (fIsRunning)
+	{
+		// Sleep indefinitely if there is nothing to time out, otherwise wake up for the next timer tick.
+		int timeout = -1;
+		if (!fAttachedOperations.empty())
+		{
+			int untilTick = compareTicks(fNextTimerTick, ::GetTickCount()) > 0 ? (int)(fNextTimerTick - ::GetTickCount()) : 0;
+			timeout = untilTick;
+		}
+
+		int eventCount = ::epoll_wait(fEpollDescriptor, events, EPOLL_EVENT_LOOP_MAX_EVENTS, timeout);
+		if (eventCount < 0)
+		{
+			if (EINTR == errno)
+			{
+				continue;
+			}
+			debug("epoll_wait failed (%d)", errno);
+			break;
+		}
+
+		for (int index = 0; index < eventCount; index++)
+		{
+			EpollRequestOperation *operation = (EpollRequestOperation*)events[index].data.ptr;
+			if (NULL == operation)
+			{
+				uint64_t value;
+				while (::read(fWakeDescriptor, &value, sizeof(value)) > 0) { }
+				continue;
+			}
+
+			// An earlier event in this batch may have completed (and detached) this operation.
+			if (fAttachedOperations.find(operation) == fAttachedOperations.end())
+			{
+				continue;
+			}
+			operation->OnLoopSocketEvent();
+			DetachIfComplete(operation);
+		}
+
+		RunPostedOperations();
+
+		if (compareTicks(::GetTickCount(), fNextTimerTick) >= 0)
+		{
+			RunTimers();
+			fNextTimerTick = ::GetTickCount() + EPOLL_EVENT_LOOP_TIMER_INTERVAL_MS;
+		}
+	}
+
+	// Shut down everything that is still attached. This also breaks the reference cycle between the
+	// operations (which reference this loop) and the loop (which references them).
+	RunPostedOperations();
+	EpollRequestOperationMap attachedOperations;
+	attachedOperations.swap(fAttachedOperations);
+	for (EpollRequestOperationMap::iterator iter = attachedOperations.begin(); iter != attachedOperations.end(); iter++)
+	{
+		iter->second->OnLoopShutdown();
+	}
+	attachedOperations.clear();
+
+	std::lock_guard<std::mutex> lock(fPostedMutex);
+	fPostedOperations.clear();
+}
+
+/// Services all operations posted since the last pass.
+void EpollEventLoop::RunPostedOperations()
+{
+	std::vector< std::shared_ptr<EpollRequestOperation> > postedOperations;
+	{
+		std::lock_guard<std::mutex> lock(fPostedMutex);
+		postedOperations.swap(fPostedOperations);
+	}
+
+	for (size_t index = 0; index < postedOperations.size(); index++)
+	{
+		const std::shared_ptr<EpollRequestOperation>& operation = postedOperations[index];
+		if (!fIsRunning)
+		{
+			operation->OnLoopShutdown();
+			continue;
+		}
+		Attach(operation);
+		operation->OnLoopPosted();
+		DetachIfComplete(operation.get());
+	}
+}
+
+/// Gives every attached operation a chance to check its timeout.
+void EpollEventLoop::RunTimers()
+{
+	if (fAttachedOperations.empty())
+	{
+		return;
+	}
+
+	// Operations may detach while being ticked, so iterate over a snapshot.
+	std::vector<EpollRequestOperation*> operations;
+	operations.reserve(fAttachedOperations.size());
+	for (EpollRequestOperationMap::iterator iter = fAttachedOperations.begin(); iter != fAttachedOperations.end(); iter++)
+	{
+		operations.push_back(iter->first);
+	}
+
+	DWORD now = ::GetTickCount();
+	for (size_t index = 0; index < operations.size(); index++)
+	{
+		if (fAttachedOperations.find(operations[index]) != fAttachedOperations.end())
+		{
+			operations[index]->OnLoopTick(now);
+			DetachIfComplete(operations[index]);
+		}
+	}
+}
+
+/// Keeps the given operation alive while the loop is servicing it.
+void EpollEventLoop::Attach( const std::shared_ptr<EpollRequestOperation>& operation )
+{
+	fAttachedOperations[operation.get()] = operation;
+}
+
+/// Releases the loop's reference to the given operation if it has no more work for the loop.
+void EpollEventLoop::DetachIfComplete( EpollRequestOperation *operation )
+{
+	if (operation->IsLoopWorkComplete())
+	{
+		fAttachedOperations.erase(operation);
+	}
+}
+
+#pragma endregion
@@ -0,0 +1,84 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef _EpollEventLoop_H_
+#define _EpollEventLoop_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifndef NETWORK_NO_OPENSSL
+#include <openssl/ssl.h>
+#endif
+
+class EpollRequestOperation;
+
+
+/// Owns the epoll instance and the single thread that performs all socket I/O for Linux requests.
+///
+/// Operations are handed to the loop with Post(), which may be called from any thread. The loop then calls
+/// back into the operation on its own thread (OnLoopPosted(), OnLoopSocketEvent(), OnLoopTick()) and keeps
+/// the operation alive until it reports that its loop work is complete.
+class EpollEventLoop : public std::enable_shared_from_this<EpollEventLoop>
+{
+public:
+	EpollEventLoop();
+	virtual ~EpollEventLoop();
+
+	bool Start();
+	void Stop();
+	bool IsRunning();
+
+	void Post( const std::shared_ptr<EpollRequestOperation>& operation );
+
+	// The following may only be called from the event loop thread.
+	bool Watch( int fileDescriptor, uint32_t events, EpollRequestOperation *operation );
+	bool Modify( int fileDescriptor, uint32_t events, EpollRequestOperation *operation );
+	void Unwatch( int fileDescriptor );
+
+#ifndef NETWORK_NO_OPENSSL
+	SSL_CTX* GetTlsContext();
+#endif
+
+private:
+	void Run();
+	void RunPostedOperations();
+	void RunTimers();
+	void Attach( const std::shared_ptr<EpollRequestOperation>& operation );
+	void DetachIfComplete( EpollRequestOperation *operation );
+
+	/// Typedef for the collection of operations the loop is currently servicing, keyed by raw pointer
+	/// (which is what epoll hands back to us).
+	typedef std::unordered_map< EpollRequestOperation*, std::shared_ptr<EpollRequestOperation> > EpollRequestOperationMap;
+
+	int fEpollDescriptor;
+	int fWakeDescriptor;
+	std::thread fThread;
+	std::atomic<bool> fIsRunning;
+
+	/// Operations posted from other threads, waiting to be serviced by the loop thread.
+	std::mutex fPostedMutex;
+	std::vector< std::shared_ptr<EpollRequestOperation> > fPostedOperations;
+
+	/// Operations attached to the loop. Only accessed from the loop thread.
+	EpollRequestOperationMap fAttachedOperations;
+	uint32_t fNextTimerTick;
+
+#ifndef NETWORK_NO_OPENSSL
+	SSL_CTX* fTlsContext;
+#endif
+};
+
+#endif
@@ -0,0 +1,306 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "CoronaLua.h"
+
+#include "EpollRequestManager.h"
+#include "EpollRequestOperation.h"
+
+#include <unistd.h>
+
+
+#pragma region Constructors and Destructors
+/// Creates a new manager object for handling concurrent async HTTP requests.
+EpollRequestManager::EpollRequestManager()
+:	fEventLoop( std::make_shared<EpollEventLoop>() )
+{
+	fIsProcessingRequests = false;
+}
+
+/// Destructor. Aborts any active HTTP requests and stops the event loop thread.
+EpollRequestManager::~EpollRequestManager()
+{
+	AbortAllRequests();
+	ProcessRequestsUntil(5000);
+	fRequestSlots.Clear();
+	Stop();
+}
+
+#pragma endregion
+
+
+#pragma region Public Functions
+/// Starts the event loop thread that performs the socket I/O for all requests.
+/// @return Returns true if the event loop is running.
+bool EpollRequestManager::Start()
+{
+	return fEventLoop->Start();
+}
+
+/// Stops the event loop thread. Requests still in flight are ended as aborted.
+void EpollRequestManager::Stop()
+{
+	fEventLoop->Stop();
+}
+
+RequestCanceller* EpollRequestManager::SendNetworkRequest( NetworkRequestParameters *requestParams )
+{
+	// A download split over several connections is driven by an object of its own, which makes the requests for it.
+	if (SegmentedDownload::isRequestSegmentable(requestParams))
+	{
+		std::shared_ptr<SegmentedDownload> download = std::make_shared<SegmentedDownload>(requestParams);
+		fSegmentedDownloads.push_back(download);
+		RequestCanceller* requestCanceller = download->Start(download);
+		SendSegmentedDownloadRequests(download);
+		return requestCanceller;
+	}
+
+	// A request for a small response that is in memory and still fresh needs neither an operation nor any I/O.
+	// It is answered on the next update, as the listener is never called from within network.request().
+	HttpMemoryResponseCache::Entry cacheEntry;
+	if (fMemoryCache.find(requestParams, &cacheEntry))
+	{
+		debug("Serving fresh response from memory cache");
+		std::shared_ptr<HttpMemoryResponseCache::Delivery> delivery = std::make_shared<HttpMemoryResponseCache::Delivery>(requestParams, cacheEntry);
+		fPendingDeliveries.push_back(delivery);
+		return delivery->Start(delivery);
+	}
+
+	// An identical request in flight answers this one too. Its events are dispatched to this request's listener
+	// with this request's own requestId.
+	if (CoalescedRequest::isRequestCoalescable(requestParams))
+	{
+		HttpRequestOperation::CoalescingMap::iterator iter = fCoalescingMap.find(CoalescedRequest::getKey(requestParams));
+		if (iter != fCoalescingMap.end())
+		{
+			std::shared_ptr<HttpRequestOperation> operation = iter->second.lock();
+			RequestCanceller* requestCanceller = operation ? operation->CoalesceRequest(requestParams, iter->first, operation) : NULL;
+			if (NULL != requestCanceller)
+			{
+				return requestCanceller;
+			}
+		}
+	}
+
+	return ScheduleRequest(requestParams);
+}
+
+/// Gets the number of concurrent HTTP requests that are currently being executed by this object.
+/// @return The number of HTTP requests being exected. Returns zero if there are no active requests.
+int EpollRequestManager::ActiveRequestCount()
+{
+	return fRequestSlots.GetActiveCount() + fScheduler.getQueuedCount() + (int)fPendingDeliveries.size() +
+		(int)fSegmentedDownloads.size();
+}
+
+/// Polls all active HTTP requests to see if they have completed their work.
+/// This function is expected to be called at regular intervals. It polls every asynchronous
+/// HTTP request, synchs their data to the main thread, checks if request operation have completed,
+/// and invokes LuaResource listeners if assigned.
+void EpollRequestManager::ProcessRequests()
+{
+	EpollRequestOperationSlotTable::Slot* slot;
+	int remainingCount;
+
+	// Do not continue if this function is in the middle of processing requests.
+	// This can happen if a processed request has ended whose Lua listener calls this function again.
+	if (fIsProcessingRequests)
+	{
+		return;
+	}
+
+	// Flag that we're processing requests.
+	fIsProcessingRequests = true;
+
+	// Process the active requests only. A processed request that finishes may invoke a Lua listener which
+	// sends another HTTP request. That request's slot gets appended to the end of the active list, so we stop
+	// after the slots that were active when we started. Those slots are only ever unlinked here, which keeps
+	// the "Next" pointer we fetched before processing a slot valid.
+	slot = fRequestSlots.GetFirstActiveSlot();
+	remainingCount = fRequestSlots.GetActiveCount();
+	while (slot && (remainingCount-- > 0))
+	{
+		EpollRequestOperationSlotTable::Slot* nextSlot = slot->Next;
+		std::shared_ptr<EpollRequestOperation> requestPointer = slot->Operation;
+
+		requestPointer->ProcessExecution();
+		if (!requestPointer->IsExecuting())
+		{
+			fScheduler.requestEnded(requestPointer.get());
+			fRequestSlots.ReleaseSlot(slot);
+		}
+		slot = nextSlot;
+	}
+
+	// Start the queued requests that fit in the room left by the requests that ended.
+	StartQueuedRequests();
+
+	// Move the segmented downloads on, now that their requests have processed their events.
+	ProcessSegmentedDownloads();
+
+	// Deliver the responses found in the memory cache since the last call. Requests answered from it by the
+	// listeners called here are delivered by the next call.
+	if (!fPendingDeliveries.empty())
+	{
+		HttpMemoryResponseCache::DeliveryList deliveries;
+		deliveries.swap(fPendingDeliveries);
+		for (HttpMemoryResponseCache::DeliveryList::iterator iter = deliveries.begin(); iter != deliveries.end(); iter++)
+		{
+			(*iter)->Deliver();
+		}
+	}
+
+	// Finished processing requests. Clearing this flag allows this function to be called again.
+	fIsProcessingRequests = false;
+}
+
+/// Blocking call which polls all active HTTP requests to see if they have completed their work.
+/// @param timeoutInMilliseconds The maximum amount of time to process all active HTTP requests.
+void EpollRequestManager::ProcessRequestsUntil(int timeoutInMilliseconds)
+{
+	int endTime = (int)::GetTickCount() + timeoutInMilliseconds;
+	do
+	{
+		ProcessRequests();
+		if (ActiveRequestCount() > 0)
+		{
+			::usleep(10000);
+		}
+	} while (((endTime - (int)::GetTickCount()) > 0) && (ActiveRequestCount() > 0));
+}
+
+/// Aborts all active HTTP requests.
+/// This is a non-blocking call and HTTP requests will not be aborted immediately. You must still
+/// call the ProcessRequests() function repeatedly to process the abort.
+void EpollRequestManager::AbortAllRequests()
+{
+	EpollRequestOperationSlotTable::Slot* slot;
+
+	// Queued requests are dropped first, so that none starts as the active ones end.
+	fScheduler.dropAll();
+	for (SegmentedDownload::List::iterator iter = fSegmentedDownloads.begin(); iter != fSegmentedDownloads.end(); iter++)
+	{
+		(*iter)->RequestAbort();
+	}
+
+	for (slot = fRequestSlots.GetFirstActiveSlot(); slot != NULL; slot = slot->Next)
+	{
+		slot->Operation->RequestAbort();
+	}
+	for (HttpMemoryResponseCache::DeliveryList::iterator iter = fPendingDeliveries.begin(); iter != fPendingDeliveries.end(); iter++)
+	{
+		(*iter)->RequestAbort();
+	}
+}
+
+/// Gets the cache of small responses that are answered without a request operation, whose size can be changed.
+HttpMemoryResponseCache& EpollRequestManager::GetMemoryCache()
+{
+	return fMemoryCache;
+}
+
+/// Sets how many requests may be executed at once, in all and per host. Queued requests that now fit are started.
+void EpollRequestManager::SetRequestLimits(int maxActiveRequests, int maxActiveRequestsPerHost)
+{
+	fScheduler.setLimits(maxActiveRequests, maxActiveRequestsPerHost);
+	StartQueuedRequests();
+}
+
+#pragma endregion
+
+
+#pragma region Private Functions
+/// Gets an operation to execute a request on: the most recently idled one, or a new one.
+std::shared_ptr<EpollRequestOperation> EpollRequestManager::AcquireRequestOperation()
+{
+	if (!fEventLoop->IsRunning())
+	{
+		Start();
+	}
+
+	// Take the most recently idled slot (or a new one) and move it to the active list.
+	EpollRequestOperationSlotTable::Slot* slot = fRequestSlots.AcquireSlot();
+
+	// Re-use the slot's operation object unless something else still references it, such as a RequestCanceller
+	// held by Lua for an earlier request. That reference must not be able to cancel the new request.
+	if ((NULL == slot->Operation) || (slot->Operation.use_count() > 1))
+	{
+		slot->Operation = std::make_shared<EpollRequestOperation>(fEventLoop, &fResponseCache, &fMemoryCache, &fCoalescingMap);
+	}
+	return slot->Operation;
+}
+
+/// Executes the given request, or queues it if the scheduler's limits on active requests are reached.
+/// @return Returns the request's canceller.
+RequestCanceller* EpollRequestManager::ScheduleRequest( NetworkRequestParameters *requestParams )
+{
+	// Requests wait in the scheduler's queues while the limits on active requests are reached, and behind any
+	// requests already waiting, which go first.
+	if (fScheduler.hasQueuedRequests() || !fScheduler.canStart(requestParams))
+	{
+		RequestCanceller* requestCanceller = fScheduler.enqueue(requestParams);
+		StartQueuedRequests();
+		return requestCanceller;
+	}
+
+	// Execute HTTP request.
+	std::shared_ptr<EpollRequestOperation> requestPointer = AcquireRequestOperation();
+	fScheduler.requestStarted(requestPointer.get(), requestParams);
+	return requestPointer->ExecuteRequest( requestParams, requestPointer );
+}
+
+/// Starts the queued requests that the scheduler's limits let through, in order.
+void EpollRequestManager::StartQueuedRequests()
+{
+	std::shared_ptr<RequestScheduler::QueuedRequest> queuedRequest;
+	while ((queuedRequest = fScheduler.dequeue()) != NULL)
+	{
+		std::shared_ptr<EpollRequestOperation> requestPointer = AcquireRequestOperation();
+		NetworkRequestParameters* requestParams = queuedRequest->TakeRequestParams(requestPointer);
+		fScheduler.requestStarted(requestPointer.get(), requestParams);
+		requestPointer->ExecuteRequest( requestParams, requestPointer, queuedRequest->GetRequestCanceller() );
+		queuedRequest->Started();
+	}
+}
+
+/// Sends the requests the given segmented download has to make, through the scheduler like any others.
+void EpollRequestManager::SendSegmentedDownloadRequests( const std::shared_ptr<SegmentedDownload>& download )
+{
+	NetworkRequestParameters* requestParams;
+	while ((requestParams = download->TakeRequestParams()) != NULL)
+	{
+		download->RequestSent( ScheduleRequest(requestParams) );
+	}
+}
+
+/// Processes the segmented downloads, sending the requests they make and releasing those that have ended. A
+/// download started by a listener called here is first processed by the next call.
+void EpollRequestManager::ProcessSegmentedDownloads()
+{
+	size_t count = fSegmentedDownloads.size();
+	for (size_t index = 0; index < count; index++)
+	{
+		std::shared_ptr<SegmentedDownload> download = fSegmentedDownloads[index];
+		download->ProcessExecution();
+		SendSegmentedDownloadRequests(download);
+	}
+	for (SegmentedDownload::List::iterator iter = fSegmentedDownloads.begin(); iter != fSegmentedDownloads.end(); )
+	{
+		if ((*iter)->IsExecuting())
+		{
+			iter++;
+		}
+		else
+		{
+			iter = fSegmentedDownloads.erase(iter);
+		}
+	}
+}
+
+#pragma endregion
@@ -0,0 +1,91 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "CoronaLua.h"
+
+#ifndef _EpollRequestManager_H_
+#define _EpollRequestManager_H_
+
+#include "EpollEventLoop.h"
+
+#include "EpollRequestOperation.h"
+#include "HttpMemoryResponseCache.h"
+#include "RequestScheduler.h"
+#include "SegmentedDownload.h"
+
+#include "RequestSlotTable.h"
+#include "WindowsNetworkSupport.h"
+
+#include <memory>
+
+
+/// Class supporting concurrent asynchronous HTTP requests on Linux.
+/// Can set up a LuaResource listener to notify a Lua script the result of this operation.
+///
+/// Offers the same interface as WinHttpRequestManager. All requests share one EpollEventLoop thread, which
+/// is started by Start() (or by the first request). ProcessRequests() must be called on the main thread at
+/// regular intervals, for example once per frame, to deliver results to Lua.
+class EpollRequestManager
+{
+public:
+	EpollRequestManager();
+	virtual ~EpollRequestManager();
+
+	bool Start();
+	void Stop();
+
+	RequestCanceller* SendNetworkRequest( NetworkRequestParameters *requestParams );
+
+	int ActiveRequestCount();
+	void ProcessRequests();
+	void ProcessRequestsUntil(int timeoutInMilliseconds);
+	void AbortAllRequests();
+	HttpMemoryResponseCache& GetMemoryCache();
+	void SetRequestLimits(int maxActiveRequests, int maxActiveRequestsPerHost);
+
+private:
+	/// Typedef for the table of request operation slots.
+	typedef RequestSlotTable<EpollRequestOperation> EpollRequestOperationSlotTable;
+
+	/// The event loop performing the socket I/O for all of this manager's requests.
+	std::shared_ptr<EpollEventLoop> fEventLoop;
+
+	/// Disk cache of responses to requests made with params.cache, opened by the first such request.
+	/// Declared before the request slots so that it is destroyed after every request operation.
+	HttpResponseCache fResponseCache;
+
+	/// Small fresh responses to requests made with params.cache, which are answered without a request operation.
+	/// The requests answered since the last update are delivered by the next one.
+	HttpMemoryResponseCache fMemoryCache;
+	HttpMemoryResponseCache::DeliveryList fPendingDeliveries;
+
+	/// Decides when each request is executed, queueing those over the limits on active requests.
+	RequestScheduler fScheduler;
+
+	/// Downloads split over several connections, which make their requests through the scheduler.
+	SegmentedDownload::List fSegmentedDownloads;
+
+	/// The operations in flight that identical requests are coalesced onto, by request key. Declared before the
+	/// request slots, since the operations leave it when they are destroyed.
+	HttpRequestOperation::CoalescingMap fCoalescingMap;
+
+	/// Slots holding this manager's HTTP request operations, split into active and idle lists.
+	EpollRequestOperationSlotTable fRequestSlots;
+
+	/// Set true if in the middle of processing requests.
+	bool fIsProcessingRequests;
+
+	std::shared_ptr<EpollRequestOperation> AcquireRequestOperation();
+	RequestCanceller* ScheduleRequest( NetworkRequestParameters *requestParams );
+	void StartQueuedRequests();
+	void SendSegmentedDownloadRequests( const std::shared_ptr<SegmentedDownload>& download );
+	void ProcessSegmentedDownloads();
+};
+
+#endif
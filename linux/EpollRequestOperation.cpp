@@ -0,0 +1,2002 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "CoronaLog.h"
+#include "CoronaLua.h"
+#include "EpollRequestOperation.h"
+#include "WindowsNetworkSupport.h"
+#include "CharsetTranscoder.h"
+#include "MultipartBody.h"
+#include "HttpHeaderParser.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <thread>
+
+#ifndef NETWORK_NO_OPENSSL
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+#endif
+
+/// Maximum number of redirects followed for one request (WinHttp's default limit).
+#define EPOLL_REQUEST_MAX_REDIRECTS 10
+
+/// Maximum size of a response head (status line and headers) before the response is rejected.
+#define EPOLL_REQUEST_MAX_HEAD_SIZE 65536
+
+/// Maximum length of a chunk size line or trailer line in a chunked response body.
+#define EPOLL_REQUEST_MAX_CHUNK_LINE 1024
+
+/// Number of bytes of a streamed request body's chunks that the main thread reads ahead of the event loop thread.
+#define EPOLL_REQUEST_MAX_STREAM_AHEAD (4 * EPOLL_SESSION_TX_BUFFER_SIZE)
+
+/// TransportRead()/TransportWrite() results other than a byte count.
+static const long kTransportWouldBlock = -1;
+static const long kTransportError = -2;
+
+
+#pragma region Constructors and Destructors
+/// Creates a new HTTP request operation object whose I/O will be performed by the given event loop.
+/// @param responseCache Disk cache used by requests made with params.cache. Must outlive this object.
+/// @param memoryCache Memory cache used by requests made with params.cache. Must outlive this object.
+/// @param coalescingMap The manager's map of operations that requests can be coalesced onto. Must outlive this object.
+EpollRequestOperation::EpollRequestOperation( const std::shared_ptr<EpollEventLoop>& eventLoop, HttpResponseCache *responseCache, HttpMemoryResponseCache *memoryCache, CoalescingMap *coalescingMap )
+:	HttpRequestOperation( responseCache, memoryCache, coalescingMap ),
+	fEventLoop( eventLoop ),
+	fIsResolveComplete( false )
+{
+	fRequestBody = NULL;
+	fTimeoutMs = 0;
+	fHandleRedirects = true;
+	fIsDecodingResponse = false;
+	fTransferState = kTransferIdle;
+	fRedirectCount = 0;
+	fAddressList = NULL;
+	fNextAddress = NULL;
+	fResolveError = 0;
+	fSocket = -1;
+	fWatchedEvents = 0;
+#ifndef NETWORK_NO_OPENSSL
+	fTls = NULL;
+#endif
+	fDeadline = 0;
+	fIsReceivePaused = false;
+	fIsSendPaused = false;
+	fMaxPendingReceiveBytes = 0;
+	fDownloadFile = -1;
+	fDownloadFileOffset = 0;
+	fHasOpenedDownloadFile = false;
+	fSendData = NULL;
+	fSendLength = 0;
+	fSendOffset = 0;
+	fIsSendingBody = false;
+	fBodyBytesSent = 0;
+	fBodyBytesTotal = 0;
+	fBodyBytesRead = 0;
+	fIsEncodingRequestBody = false;
+	fIsStreamingRequestBody = false;
+	fIsHeadRequest = false;
+	fFraming = kFramingNone;
+	fBodyBytesRemaining = 0;
+	fChunkState = kChunkSize;
+	fAsyncSession.Reset();
+}
+
+/// Destroys the HTTP request operation object. If this object is currently executing a request
+/// operation, then this destructor will block while attempting to abort that operation.
+EpollRequestOperation::~EpollRequestOperation()
+{
+	// The event loop holds a reference to this object for as long as it is doing work for it,
+	// so by the time we get here the loop is done and we only need to finish up on our side.
+	if (IsExecuting())
+	{
+		RequestAbort();
+		ProcessExecutionUntil(5000);
+	}
+
+	CloseConnection();
+	if (fAddressList)
+	{
+		::freeaddrinfo(fAddressList);
+		fAddressList = NULL;
+	}
+	fUploadFile.close();
+	CloseDownloadFile();
+}
+
+#pragma endregion
+
+
+#pragma region Execution Functions
+/// Starts the HTTP request operation.  This method will return true if successful, otherwise false.  Further
+/// asynchronous processing will be required to complete the operation.  You are expected to poll the ProcessExecution()
+/// function at regular intervals until this object flags that it is finished.
+///
+bool EpollRequestOperation::Execute()
+{
+	// Do not continue if this object is already executing an HTTP request operation.
+	if (IsExecuting())
+	{
+		return false;
+	}
+
+	// Initialize variables for a new HTTP request.
+	fIsExecuting = true;
+	fMethod = fRequestParams->getRequestMethod();
+	fRequestUrl = fRequestParams->getRequestUrl();
+	fTimeoutMs = fRequestParams->getTimeout() * 1000;
+	fHandleRedirects = fRequestParams->getHandleRedirects();
+	fIsDecodingResponse = fRequestParams->isCompressionEnabled();
+	fIsHeadRequest = (0 == _strcmpi(fMethod.c_str(), "HEAD"));
+	fTransferState = kTransferIdle;
+	fRedirectCount = 0;
+	fReceiveBuffer.resize((size_t)fRequestParams->getReceiveBufferSize());
+	fMaxPendingReceiveBytes = (size_t)fRequestParams->getReceiveBufferCount() * fReceiveBuffer.size();
+
+	// Pick the file the event loop thread downloads the response body to, if any. It writes a resumed download's
+	// partial file, or a segmented download's file, at the offset the response starts at.
+	fHasOpenedDownloadFile = false;
+	SelectDownloadFile();
+
+	// A fresh stored response needs nothing from the event loop, so the request is complete right away.
+	if (FindCachedResponse())
+	{
+		fAsyncSession.HasAsyncOperationEnded = true;
+		fAsyncSession.RequestComplete = true;
+		return true;
+	}
+
+	// The event loop is not involved in any of the failures below, so they complete the request directly.
+	if (!ParseUrl(fRequestUrl, fUrl))
+	{
+		CORONA_LOG("Failure cracking URL - %s", fRequestUrl.c_str());
+		fAsyncSession.ErrorResult = kWinHttpRequestErrorInvalidUrl;
+		fAsyncSession.HasAsyncOperationEnded = true;
+		fAsyncSession.RequestComplete = true;
+		return false;
+	}
+
+	// Prepare the request headers and body.
+	//
+	fRequestBody = fRequestParams->getRequestBody();
+
+	// When we have a text string request body, we need to apply the charset encoding specified in the
+	// Content-Type header to it if not utf-8, which is the only time a body from a Lua string is copied.
+	//
+	// Note: We check for the presence of a Content-Type request header on param validation whenever a request body
+	// is specified, so we don't need worry about adding a default Content-Type header. A text body's Content-Type
+	// always has a charset by now, as the params add "charset=UTF-8" if it had none.
+	//
+	if (!fRequestParams->transcodeRequestBody())
+	{
+		fAsyncSession.ErrorResult = kWinHttpRequestErrorInternal;
+		fAsyncSession.HasAsyncOperationEnded = true;
+		fAsyncSession.RequestComplete = true;
+		return false;
+	}
+
+	fRequestHeaders = fRequestParams->getRequestHeaderString();
+	if (fIsRevalidatingCacheEntry)
+	{
+		fRequestHeaders += HttpResponseCache::getConditionalHeaders(fCacheEntry);
+	}
+	fRequestHeaders += fResumableDownload.getRangeHeaders();
+	if (NULL != fDownloadSegment)
+	{
+		fRequestHeaders += fDownloadSegment->getRangeHeaders();
+	}
+
+	// If the body is from a file, we need to open it here. The event loop thread sends it straight from the file's
+	// mapping, a window at a time.
+	//
+	if ( TYPE_FILE == fRequestBody->bodyType )
+	{
+		if (!fUploadFile.open(fRequestBody->bodyFile->getFullPath()))
+		{
+			CORONA_LOG("Error opening request body file");
+			fAsyncSession.ErrorResult = kWinHttpRequestErrorInternal;
+			fAsyncSession.HasAsyncOperationEnded = true;
+			fAsyncSession.RequestComplete = true;
+			return false;
+		}
+	}
+
+	fBodyBytesTotal = fRequestParams->getRequestBodySize();
+	fAsyncSession.RequestBodyBytesTotal = fBodyBytesTotal;
+
+	debug("Request body size: %lld", fBodyBytesTotal);
+
+	// A streamed body's length is not known. The main thread reads it as it is sent, starting right away, and hands
+	// its chunks to the event loop thread.
+	//
+	fIsStreamingRequestBody = ( TYPE_STREAM == fRequestBody->bodyType );
+	if (fIsStreamingRequestBody)
+	{
+		if (!fRequestBody->bodyStream->open(fRequestParams->isBodyCompressionEnabled()))
+		{
+			CORONA_LOG("Error creating request body compressor");
+			fAsyncSession.ErrorResult = kWinHttpRequestErrorInternal;
+			fAsyncSession.HasAsyncOperationEnded = true;
+			fAsyncSession.RequestComplete = true;
+			return false;
+		}
+		PumpRequestBodyStream();
+	}
+
+	// Hand the request to the event loop thread. This is a non-blocking call.
+	//
+	fEventLoop->Post(fSelf.lock());
+	return true;
+}
+
+/// Executes the given request.
+/// @param requestParams The request, which this object takes ownership of.
+/// @param thiz Shared pointer to this object.
+/// @param requestCanceller The canceller already handed to Lua for the request, if it was queued. Otherwise one
+///                         is created for it.
+/// @return Returns the request's canceller.
+RequestCanceller* EpollRequestOperation::ExecuteRequest( NetworkRequestParameters *requestParams, const std::shared_ptr<EpollRequestOperation>& thiz, RequestCanceller *requestCanceller )
+{
+	fSelf = thiz;
+	StartRequest( requestParams, thiz, requestCanceller );
+
+	debug("Executing request");
+	Execute(); // No need to check for errors, as they will be handled and dispatched asynchronously.
+
+	return fRequestState->getRequestCanceller();
+}
+
+/// This function is expected to be called at regular intervals after calling Execute(). It polls the
+/// event loop thread handling the asynchronous operation, synchs its data to the main thread, and invokes
+/// the LuaResource listener if the operation has been detected to be finished.
+void EpollRequestOperation::ProcessExecution()
+{
+	// Do not continue if we're not executing an operation.
+	if (!IsExecuting())
+	{
+		return;
+	}
+
+	PumpRequestBodyStream();
+
+	// Take everything the event loop thread has produced since the last pass in one go, so that the
+	// Lua listener below is never invoked while holding the session lock.
+	bool isFirstProcessingPass;
+	long long currentBytes;
+	long long encodedBytes;
+	long long totalBytes;
+	bool areHeadersReady;
+	UTF8String responseHeaders;
+	int receivedStatusCode;
+	UTF8String& receivedBytes = fReceivedBytes;
+	long long receivedByteCount;
+	long long writtenByteCount;
+	long long decodedWrittenByteCount;
+	bool wasReceivePaused;
+	bool wasEndProcessed;
+	bool hasOperationEnded;
+	bool wasAbortRequested;
+	WinHttpRequestError errorResult;
+	bool isRequestComplete;
+	{
+		std::lock_guard<std::mutex> lock(fSessionMutex);
+
+		isFirstProcessingPass = fAsyncSession.IsFirstProcessingPassForRequest;
+		fAsyncSession.IsFirstProcessingPassForRequest = false;
+		currentBytes = fAsyncSession.RequestBodyBytesCurrent;
+		encodedBytes = fAsyncSession.RequestBodyEncodedBytesCurrent;
+		totalBytes = fAsyncSession.RequestBodyBytesTotal;
+		areHeadersReady = fAsyncSession.ResponseHeadersReady;
+		if (areHeadersReady)
+		{
+			responseHeaders.swap(fAsyncSession.ResponseHeaders);
+			fAsyncSession.ResponseHeadersReady = false;
+		}
+		receivedStatusCode = fAsyncSession.ReceivedStatusCode;
+		receivedBytes.clear();
+		receivedBytes.swap(fAsyncSession.ReceivedBytes);
+		receivedByteCount = fAsyncSession.ReceivedByteCount;
+		fAsyncSession.ReceivedByteCount = 0;
+		writtenByteCount = fAsyncSession.WrittenByteCount;
+		fAsyncSession.WrittenByteCount = 0;
+		decodedWrittenByteCount = fAsyncSession.DecodedWrittenByteCount;
+		fAsyncSession.DecodedWrittenByteCount = 0;
+		wasReceivePaused = fAsyncSession.IsReceivePaused;
+		fAsyncSession.IsReceivePaused = false;
+		wasEndProcessed = fAsyncSession.EndOfOperationProcessed;
+		hasOperationEnded = fAsyncSession.HasAsyncOperationEnded;
+		if (hasOperationEnded)
+		{
+			fAsyncSession.EndOfOperationProcessed = true;
+		}
+		wasAbortRequested = fAsyncSession.WasAbortRequested;
+		errorResult = fAsyncSession.ErrorResult;
+		isRequestComplete = fAsyncSession.RequestComplete;
+	}
+
+	// The event loop thread stopped reading because we were not keeping up. We've taken its bytes, so let it resume.
+	if (wasReceivePaused)
+	{
+		fEventLoop->Post(fSelf.lock());
+	}
+
+	// Anything still trickling in after the end was processed (e.g. after an abort) is of no interest.
+	if (wasEndProcessed)
+	{
+		areHeadersReady = false;
+		receivedBytes.clear();
+		writtenByteCount = 0;
+	}
+
+	if (isFirstProcessingPass)
+	{
+		NotifyUploadBegan(totalBytes);
+	}
+
+	if (currentBytes != fAsyncSession.RequestBodyBytesProcessed)
+	{
+		fAsyncSession.RequestBodyBytesProcessed = currentBytes;
+		NotifyUploadProgress(currentBytes, totalBytes, encodedBytes);
+	}
+
+	if (areHeadersReady)
+	{
+		ApplyResponseHeaders(receivedStatusCode, responseHeaders.data(), responseHeaders.size());
+	}
+
+	// If the event loop thread has written data to the download file, all that is left to do is report the progress.
+	//
+	if (writtenByteCount > 0)
+	{
+		ApplyWrittenBytes(writtenByteCount, decodedWrittenByteCount);
+	}
+
+	// If data has been received by the event loop thread, then append it to the result buffer. A compressed body
+	// has already been decoded.
+	//
+	if ((receivedByteCount > 0) && !ApplyReceivedBytes(receivedBytes.data(), receivedBytes.size(), receivedByteCount))
+	{
+		// The request fails once the event loop thread has closed the connection.
+		{
+			std::lock_guard<std::mutex> lock(fSessionMutex);
+			fAsyncSession.ErrorResult = kWinHttpRequestErrorInternal;
+			fAsyncSession.HasAsyncOperationEnded = true;
+		}
+		errorResult = kWinHttpRequestErrorInternal;
+		fEventLoop->Post(fSelf.lock());
+	}
+
+	// If the async operation has been flagged to end, then report the result. The download temp file is deleted
+	// once the event loop thread is done with the request, since it may still be writing to it.
+	if (hasOperationEnded && !wasEndProcessed)
+	{
+		errorResult = EndResponse(errorResult, wasAbortRequested, receivedStatusCode);
+	}
+
+	if (isRequestComplete)
+	{
+		// Release resources. A resumable download's partial file is kept for the next attempt if the download was
+		// interrupted. Only what was written counts, since the space reserved for the rest is not part of it.
+		//
+		bool wasInterrupted = (kWinHttpRequestErrorNone != errorResult) || wasAbortRequested;
+		ReleaseRequest(fHasOpenedDownloadFile, wasInterrupted ? fDownloadFileOffset : -1);
+		fRequestBody = NULL;
+		{
+			std::lock_guard<std::mutex> lock(fSessionMutex);
+			fAsyncSession.Reset();
+		}
+
+		// Flag that execution has ended (puts this object back into the pool).
+		//
+		fIsExecuting = false;
+	}
+}
+
+/// Blocking call which processes the currently executed operation until it has ended or
+/// the given timeout has been reached.
+/// @param timeoutInMilliseconds The maximum amount of time to process the currently active operation.
+void EpollRequestOperation::ProcessExecutionUntil(int timeoutInMilliseconds)
+{
+	// First, process execution before entering the below loop.
+	// This is because the operation may be ready to end now, making the sleep below unnecessary.
+	ProcessExecution();
+
+	// Process execution until the operation has ended or the given timeout has been reached.
+	int endTime = (int)::GetTickCount() + timeoutInMilliseconds;
+	while (fIsExecuting && ((endTime - (int)::GetTickCount()) > 0))
+	{
+		ProcessExecution();
+		::usleep(10000);
+	}
+}
+
+/// Gets the temp file (or partial file, or segmented download's file) the event loop thread downloads the response
+/// body to. Only changed by the main thread while the event loop thread is not using it.
+UTF8String& EpollRequestOperation::GetDownloadFilePath()
+{
+	return fTempDownloadFilePath;
+}
+
+/// Request to have the currently active HTTP request operation be aborted.
+/// The abort will not happen immediately since an HTTP request is executed asynchronously.
+/// You must poll the IsExecuting() function to detect when the abort has occurred.
+void EpollRequestOperation::RequestAbort()
+{
+	// Do not continue if we're not currently executing an operation. Nothing to abort.
+	if (!IsExecuting())
+	{
+		return;
+	}
+	StopCoalescing();
+
+	// Flag that the current operation was aborted.
+	//
+	{
+		std::lock_guard<std::mutex> lock(fSessionMutex);
+		fAsyncSession.ErrorResult = kWinHttpRequestErrorAborted;
+		fAsyncSession.WasAbortRequested = true;
+		fAsyncSession.HasAsyncOperationEnded = true;
+	}
+
+	// Have the event loop thread close the connection.
+	//
+	fEventLoop->Post(fSelf.lock());
+}
+
+/// Reads the next chunks of a streamed request body (params.body = function) and hands them to the event loop
+/// thread, unless it is already holding EPOLL_REQUEST_MAX_STREAM_AHEAD bytes of them. The source is read here, on
+/// the main thread, since it may call into Lua. Wakes the event loop thread if it was waiting for them.
+void EpollRequestOperation::PumpRequestBodyStream()
+{
+	if ((NULL == fRequestBody) || (TYPE_STREAM != fRequestBody->bodyType))
+	{
+		return;
+	}
+
+	size_t pendingLength;
+	{
+		std::lock_guard<std::mutex> lock(fSessionMutex);
+		if (fAsyncSession.HasAsyncOperationEnded || fAsyncSession.IsRequestBodyStreamEnded)
+		{
+			return;
+		}
+		pendingLength = fAsyncSession.RequestBodyStreamBytes.size();
+	}
+	if (pendingLength >= EPOLL_REQUEST_MAX_STREAM_AHEAD)
+	{
+		return;
+	}
+
+	RequestBodyStream* bodyStream = fRequestBody->bodyStream;
+	fStreamedBodyBytes.clear();
+	bool wasSuccessful = bodyStream->read(&fStreamedBodyBytes, EPOLL_REQUEST_MAX_STREAM_AHEAD - pendingLength);
+	if (wasSuccessful && fStreamedBodyBytes.empty() && !bodyStream->isEnded())
+	{
+		return;
+	}
+
+	bool wasStarved;
+	{
+		std::lock_guard<std::mutex> lock(fSessionMutex);
+		fAsyncSession.RequestBodyStreamBytes.append(fStreamedBodyBytes);
+		fAsyncSession.RequestBodyStreamBytesRead = bodyStream->getBytesRead();
+		fAsyncSession.IsRequestBodyStreamEnded = bodyStream->isEnded() || !wasSuccessful;
+		fAsyncSession.HasRequestBodyStreamFailed = !wasSuccessful;
+		wasStarved = fAsyncSession.IsRequestBodyStreamStarved;
+		fAsyncSession.IsRequestBodyStreamStarved = false;
+	}
+	if (wasStarved)
+	{
+		fEventLoop->Post(fSelf.lock());
+	}
+}
+
+#pragma endregion
+
+
+#pragma region Event Loop Functions
+/// Called on the event loop thread whenever this operation has been posted to the loop.
+void EpollRequestOperation::OnLoopPosted()
+{
+	if (kTransferComplete == fTransferState)
+	{
+		return;
+	}
+
+	// While the resolver thread owns this operation, leave it alone. It posts us again once it is done.
+	if ((kTransferResolving == fTransferState) && !fIsResolveComplete)
+	{
+		return;
+	}
+
+	// The main thread ends the request itself when it is aborted, or when it can't store the response.
+	bool hasOperationEnded;
+	bool isReceivePaused;
+	{
+		std::lock_guard<std::mutex> lock(fSessionMutex);
+		hasOperationEnded = fAsyncSession.HasAsyncOperationEnded;
+		isReceivePaused = fAsyncSession.IsReceivePaused;
+	}
+	if (hasOperationEnded)
+	{
+		debug("Closing connection (request ended by main thread)");
+		Finish(kWinHttpRequestErrorAborted);
+		return;
+	}
+
+	switch (fTransferState)
+	{
+		case kTransferIdle:
+			StartResolve();
+			break;
+
+		case kTransferResolving:
+			if (fResolveError != 0)
+			{
+				debug("Failed to resolve %s (%s)", fUrl.Host.c_str(), gai_strerror(fResolveError));
+				Finish(kWinHttpRequestErrorConnectionFailure);
+				break;
+			}
+			fNextAddress = fAddressList;
+			StartConnect();
+			break;
+
+		case kTransferSending:
+			if (fIsSendPaused)
+			{
+				// The main thread has read more of the streamed request body (or all of it).
+				fIsSendPaused = false;
+				ResetDeadline();
+				SetWatchedEvents(EPOLLOUT);
+				ContinueSending();
+			}
+			break;
+
+		case kTransferReceivingHeaders:
+		case kTransferReceivingBody:
+			if (fIsReceivePaused && !isReceivePaused)
+			{
+				// The main thread drained the receive buffer. Read on directly rather than waiting for
+				// epoll, since TLS may already be holding decrypted bytes the socket won't signal for.
+				fIsReceivePaused = false;
+				ResetDeadline();
+				ContinueReceiving();
+			}
+			break;
+
+		default:
+			break;
+	}
+}
+
+/// Called on the event loop thread when this operation's socket becomes ready. Each state only watches the events
+/// it waits for, and reads or writes until the socket would block (or fails), so which events were reported does
+/// not matter.
+void EpollRequestOperation::OnLoopSocketEvent()
+{
+	switch (fTransferState)
+	{
+		case kTransferConnecting:
+		{
+			int socketError = 0;
+			socklen_t socketErrorLength = sizeof(socketError);
+			if ((::getsockopt(fSocket, SOL_SOCKET, SO_ERROR, &socketError, &socketErrorLength) != 0) || (socketError != 0))
+			{
+				// Try the host's next address, if any.
+				debug("Connection attempt failed (%d)", socketError);
+				CloseConnection();
+				StartConnect();
+				break;
+			}
+			OnConnected();
+			break;
+		}
+
+		case kTransferTlsHandshake:
+			ContinueTls();
+			break;
+
+		case kTransferSending:
+			ContinueSending();
+			break;
+
+		case kTransferReceivingHeaders:
+		case kTransferReceivingBody:
+			ContinueReceiving();
+			break;
+
+		default:
+			break;
+	}
+}
+
+/// Called on the event loop thread at regular intervals. Fails the request if nothing has moved on its
+/// connection for longer than the request's timeout.
+void EpollRequestOperation::OnLoopTick( DWORD now )
+{
+	switch (fTransferState)
+	{
+		case kTransferConnecting:
+		case kTransferTlsHandshake:
+		case kTransferSending:
+		case kTransferReceivingHeaders:
+		case kTransferReceivingBody:
+			// A paused receive (or streamed send) is waiting on the main thread, not on the server.
+			if (!fIsReceivePaused && !fIsSendPaused && (compareTicks(now, fDeadline) > 0))
+			{
+				debug("Request timed out");
+				Finish(kWinHttpRequestErrorTimedOut);
+			}
+			break;
+
+		default:
+			break;
+	}
+}
+
+/// Called when the event loop is stopping while this operation is still in flight.
+void EpollRequestOperation::OnLoopShutdown()
+{
+	if (kTransferComplete == fTransferState)
+	{
+		return;
+	}
+
+	// The resolver thread still references this operation and will post it once more when it is done,
+	// at which point the stopped loop hands it back here.
+	if ((kTransferResolving == fTransferState) && !fIsResolveComplete)
+	{
+		return;
+	}
+	Finish(kWinHttpRequestErrorAborted);
+}
+
+/// Determines if the event loop has no further work to do for this operation. That is also the case
+/// while the host name is being resolved: the resolver thread holds the operation and posts it back.
+bool EpollRequestOperation::IsLoopWorkComplete()
+{
+	return (kTransferComplete == fTransferState) || ((kTransferResolving == fTransferState) && !fIsResolveComplete);
+}
+
+#pragma endregion
+
+
+#pragma region Connection Functions
+/// Resolves the current URL's host name on a separate thread, since getaddrinfo() can only block.
+void EpollRequestOperation::StartResolve()
+{
+	fTransferState = kTransferResolving;
+	fIsResolveComplete = false;
+	fResolveError = 0;
+	if (fAddressList)
+	{
+		::freeaddrinfo(fAddressList);
+		fAddressList = NULL;
+	}
+	fNextAddress = NULL;
+
+	std::shared_ptr<EpollRequestOperation> thiz = fSelf.lock();
+	std::shared_ptr<EpollEventLoop> eventLoop = fEventLoop;
+	try
+	{
+		std::thread([thiz, eventLoop]()
+		{
+			thiz->ResolveHost();
+			thiz->fIsResolveComplete = true;
+			eventLoop->Post(thiz);
+		}).detach();
+	}
+	catch (...)
+	{
+		CORONA_LOG("Unable to start host name resolution");
+		fIsResolveComplete = true;
+		Finish(kWinHttpRequestErrorInternal);
+	}
+}
+
+/// Runs on the resolver thread.
+void EpollRequestOperation::ResolveHost()
+{
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_ADDRCONFIG;
+
+	fResolveError = ::getaddrinfo(fUrl.Host.c_str(), fUrl.Port.c_str(), &hints, &fAddressList);
+	if (fResolveError != 0)
+	{
+		fAddressList = NULL;
+	}
+}
+
+/// Starts a non-blocking connect to the next address the host name resolved to.
+void EpollRequestOperation::StartConnect()
+{
+	while (fNextAddress)
+	{
+		struct addrinfo *address = fNextAddress;
+		fNextAddress = address->ai_next;
+
+		fSocket = ::socket(address->ai_family, address->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, address->ai_protocol);
+		if (fSocket < 0)
+		{
+			continue;
+		}
+
+		int noDelay = 1;
+		::setsockopt(fSocket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+		if ((::connect(fSocket, address->ai_addr, address->ai_addrlen) == 0) || (EINPROGRESS == errno))
+		{
+			fTransferState = kTransferConnecting;
+			SetWatchedEvents(EPOLLOUT);
+			if (fWatchedEvents != 0)
+			{
+				ResetDeadline();
+				return;
+			}
+		}
+		CloseConnection();
+	}
+
+	debug("Unable to connect to %s", fUrl.Host.c_str());
+	Finish(kWinHttpRequestErrorConnectionFailure);
+}
+
+/// Called once the TCP connection has been established.
+void EpollRequestOperation::OnConnected()
+{
+	ResetDeadline();
+	if (fUrl.IsHttps)
+	{
+		if (StartTls())
+		{
+			ContinueTls();
+		}
+	}
+	else
+	{
+		StartSending();
+	}
+}
+
+/// Sets up a TLS session on the connected socket, with SNI and host name verification.
+/// @return Returns true if the handshake can proceed. Returns false if the request has been finished.
+bool EpollRequestOperation::StartTls()
+{
+#ifndef NETWORK_NO_OPENSSL
+	SSL_CTX *tlsContext = fEventLoop->GetTlsContext();
+	if (tlsContext)
+	{
+		fTls = SSL_new(tlsContext);
+	}
+	if (NULL == fTls)
+	{
+		Finish(kWinHttpRequestErrorInternal);
+		return false;
+	}
+
+	SSL_set_fd(fTls, fSocket);
+	SSL_set_connect_state(fTls);
+
+	struct in6_addr address;
+	bool isAddressLiteral = (::inet_pton(AF_INET, fUrl.Host.c_str(), &address) == 1) || (::inet_pton(AF_INET6, fUrl.Host.c_str(), &address) == 1);
+	if (isAddressLiteral)
+	{
+		X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(fTls), fUrl.Host.c_str());
+	}
+	else
+	{
+		SSL_set_tlsext_host_name(fTls, fUrl.Host.c_str());
+		SSL_set1_host(fTls, fUrl.Host.c_str());
+	}
+
+	fTransferState = kTransferTlsHandshake;
+	return true;
+#else
+	CORONA_LOG("HTTPS is not supported in this build");
+	Finish(kWinHttpRequestErrorInvalidUrl);
+	return false;
+#endif
+}
+
+/// Advances the TLS handshake.
+void EpollRequestOperation::ContinueTls()
+{
+#ifndef NETWORK_NO_OPENSSL
+	int result = SSL_do_handshake(fTls);
+	if (1 == result)
+	{
+		ResetDeadline();
+		StartSending();
+		return;
+	}
+
+	switch (SSL_get_error(fTls, result))
+	{
+		case SSL_ERROR_WANT_READ:
+			SetWatchedEvents(EPOLLIN);
+			break;
+
+		case SSL_ERROR_WANT_WRITE:
+			SetWatchedEvents(EPOLLOUT);
+			break;
+
+		default:
+		{
+			long verifyResult = SSL_get_verify_result(fTls);
+			if (verifyResult != X509_V_OK)
+			{
+				debug("Server certificate rejected: %s", X509_verify_cert_error_string(verifyResult));
+			}
+			else
+			{
+				debug("TLS handshake failed (%lu)", ERR_peek_last_error());
+			}
+			ERR_clear_error();
+			Finish(kWinHttpRequestErrorConnectionFailure);
+			break;
+		}
+	}
+#endif
+}
+
+#pragma endregion
+
+
+#pragma region Transfer Functions
+/// Builds the request head and starts sending it, followed by the request body.
+void EpollRequestOperation::StartSending()
+{
+	UTF8String value;
+
+	fSendBuffer = fMethod + " " + fUrl.Path + " HTTP/1.1\r\n";
+	fSendBuffer += "Host: " + GetHostHeader(fUrl) + "\r\n";
+
+	// Add basic auth credentials if username/password set in URL
+	//
+	size_t passwordIndex = fUrl.UserInfo.find(':');
+	if ((passwordIndex != std::string::npos) && (passwordIndex > 0) && (passwordIndex + 1 < fUrl.UserInfo.size()) &&
+		!FindHeaderValue(fRequestHeaders, "Authorization", value))
+	{
+		fSendBuffer += "Authorization: Basic " + Base64Encode(fUrl.UserInfo) + "\r\n";
+	}
+
+	fSendBuffer += fRequestHeaders;
+
+	// A compressed body's length is not known until all of it has been compressed, and a streamed body's until it
+	// ends, so they are sent chunked instead. The body is dropped by some redirects, along with its compression.
+	fIsEncodingRequestBody = fRequestParams->isBodyCompressionEnabled() && ((fBodyBytesTotal > 0) || fIsStreamingRequestBody);
+	if (fIsEncodingRequestBody || fIsStreamingRequestBody)
+	{
+		if (fIsEncodingRequestBody && !fIsStreamingRequestBody && !fRequestEncoder.open(true))
+		{
+			CORONA_LOG("Error creating request body compressor");
+			Finish(kWinHttpRequestErrorInternal);
+			return;
+		}
+		fSendBuffer += "Transfer-Encoding: chunked\r\n";
+	}
+	else if (!FindHeaderValue(fRequestHeaders, "Content-Length", value))
+	{
+		if ((fBodyBytesTotal > 0) ||
+			(0 == _strcmpi(fMethod.c_str(), "POST")) || (0 == _strcmpi(fMethod.c_str(), "PUT")) || (0 == _strcmpi(fMethod.c_str(), "PATCH")))
+		{
+			char contentLength[32];
+			snprintf(contentLength, sizeof(contentLength), "%lld", fBodyBytesTotal);
+			fSendBuffer += "Content-Length: ";
+			fSendBuffer += contentLength;
+			fSendBuffer += "\r\n";
+		}
+	}
+
+	// Connections are not kept alive, so the server may use the end of the connection to delimit its response.
+	if (!FindHeaderValue(fRequestHeaders, "Connection", value))
+	{
+		fSendBuffer += "Connection: close\r\n";
+	}
+	fSendBuffer += "\r\n";
+
+	fSendData = fSendBuffer.data();
+	fSendLength = fSendBuffer.size();
+	fSendOffset = 0;
+	fIsSendingBody = false;
+	fBodyBytesSent = 0;
+	fBodyBytesRead = 0;
+
+	fTransferState = kTransferSending;
+	SetWatchedEvents(EPOLLOUT);
+	ContinueSending();
+}
+
+/// Writes as much of the request as the socket will take.
+void EpollRequestOperation::ContinueSending()
+{
+	for (;;)
+	{
+		if (fSendOffset < fSendLength)
+		{
+			uint32_t wantEvents = EPOLLOUT;
+			long result = TransportWrite(fSendData + fSendOffset, fSendLength - fSendOffset, &wantEvents);
+			if (kTransportWouldBlock == result)
+			{
+				SetWatchedEvents(wantEvents);
+				return;
+			}
+			if (result <= 0)
+			{
+				debug("Failed to send request");
+				Finish(kWinHttpRequestErrorConnectionFailure);
+				return;
+			}
+
+			fSendOffset += result;
+			ResetDeadline();
+			if (fIsSendingBody)
+			{
+				fBodyBytesSent += result;
+				std::lock_guard<std::mutex> lock(fSessionMutex);
+				if (fIsEncodingRequestBody || fIsStreamingRequestBody)
+				{
+					// Progress is given in bytes of the body, which are only sent once all of their compressed
+					// (or chunked) bytes are.
+					if (fIsEncodingRequestBody)
+					{
+						fAsyncSession.RequestBodyEncodedBytesCurrent = fBodyBytesSent;
+					}
+					if (fSendOffset >= fSendLength)
+					{
+						fAsyncSession.RequestBodyBytesCurrent = fBodyBytesRead;
+					}
+				}
+				else
+				{
+					fAsyncSession.RequestBodyBytesCurrent = fBodyBytesSent;
+				}
+			}
+			continue;
+		}
+
+		if (fIsStreamingRequestBody)
+		{
+			// A streamed body's chunks come from the main thread (see PumpRequestBodyStream()). Once all of them
+			// have been sent, sending waits for the main thread to read more and post the operation again.
+			bool isStreamEnded;
+			bool hasStreamFailed;
+			fSendBuffer.clear();
+			{
+				std::lock_guard<std::mutex> lock(fSessionMutex);
+				fSendBuffer.swap(fAsyncSession.RequestBodyStreamBytes);
+				fBodyBytesRead = fAsyncSession.RequestBodyStreamBytesRead;
+				isStreamEnded = fAsyncSession.IsRequestBodyStreamEnded;
+				hasStreamFailed = fAsyncSession.HasRequestBodyStreamFailed;
+				fAsyncSession.IsRequestBodyStreamStarved = fSendBuffer.empty() && !isStreamEnded;
+			}
+			if (hasStreamFailed)
+			{
+				CORONA_LOG("Error reading request body");
+				Finish(kWinHttpRequestErrorInternal);
+				return;
+			}
+			if (fSendBuffer.empty())
+			{
+				if (isStreamEnded)
+				{
+					break;
+				}
+				fIsSendPaused = true;
+				SetWatchedEvents(0);
+				return;
+			}
+			fSendData = fSendBuffer.data();
+			fSendLength = fSendBuffer.size();
+			fSendOffset = 0;
+			fIsSendingBody = true;
+			continue;
+		}
+
+		if (fIsEncodingRequestBody ? !fRequestEncoder.isOpen() : (fBodyBytesRead >= fBodyBytesTotal))
+		{
+			break;
+		}
+
+		// Send the next slice of the request body, straight from the body unless it is compressed. The compressor may
+		// hold on to a whole slice without output, so it is fed until it has some (or has been given all of the body).
+		fSendBuffer.clear();
+		fSendData = NULL;
+		fSendLength = 0;
+		while (0 == fSendLength)
+		{
+			if (fBodyBytesRead < fBodyBytesTotal)
+			{
+				size_t sliceLength = 0;
+				const char* slice = ReadRequestBodySlice(&sliceLength);
+				if (NULL == slice)
+				{
+					CORONA_LOG("Error reading request body");
+					Finish(kWinHttpRequestErrorInternal);
+					return;
+				}
+				fBodyBytesRead += sliceLength;
+				if (!fIsEncodingRequestBody)
+				{
+					fSendData = slice;
+					fSendLength = sliceLength;
+					break;
+				}
+				if (!fRequestEncoder.write(slice, sliceLength, &fSendBuffer))
+				{
+					CORONA_LOG("Error compressing request body");
+					Finish(kWinHttpRequestErrorInternal);
+					return;
+				}
+			}
+			else if (!fRequestEncoder.finish(&fSendBuffer))
+			{
+				CORONA_LOG("Error compressing request body");
+				Finish(kWinHttpRequestErrorInternal);
+				return;
+			}
+			fSendData = fSendBuffer.data();
+			fSendLength = fSendBuffer.size();
+		}
+		fSendOffset = 0;
+		fIsSendingBody = true;
+	}
+
+	debug("Request sent, waiting for response");
+	fSendBuffer.clear();
+	fSendData = NULL;
+	fSendLength = 0;
+	fResponseHead.clear();
+	fTransferState = kTransferReceivingHeaders;
+	SetWatchedEvents(EPOLLIN);
+}
+
+/// Gets the next slice of the request body (of up to EPOLL_SESSION_TX_BUFFER_SIZE bytes, starting at
+/// "fBodyBytesRead"), straight from the body's string or the mapping of its file. The slice stays valid until the
+/// next call.
+/// @param sliceLength Set to the number of bytes in the slice.
+/// @return Returns the slice, or NULL if the body could not be read.
+const char* EpollRequestOperation::ReadRequestBodySlice( size_t *sliceLength )
+{
+	long long remaining = fBodyBytesTotal - fBodyBytesRead;
+	size_t length = (remaining < EPOLL_SESSION_TX_BUFFER_SIZE) ? (size_t)remaining : EPOLL_SESSION_TX_BUFFER_SIZE;
+	*sliceLength = 0;
+	switch (fRequestBody->bodyType)
+	{
+		case TYPE_STRING:
+			*sliceLength = length;
+			return fRequestBody->bodyString->data() + fBodyBytesRead;
+
+		case TYPE_BYTES:
+			*sliceLength = length;
+			return (const char *)&(*fRequestBody->bodyBytes)[0] + fBodyBytesRead;
+
+		case TYPE_LUA_STRING:
+			*sliceLength = length;
+			return fRequestBody->bodyLuaString->getData() + fBodyBytesRead;
+
+		case TYPE_FILE:
+			return fUploadFile.getSlice(fBodyBytesRead, length, sliceLength);
+
+		case TYPE_MULTIPART:
+			return fRequestBody->bodyMultipart->getSlice(fBodyBytesRead, length, sliceLength);
+
+		default:
+			return NULL;
+	}
+}
+
+/// Reads as much of the response as is available, until the response ends or the main thread falls behind.
+void EpollRequestOperation::ContinueReceiving()
+{
+	char* buffer = &fReceiveBuffer[0];
+
+	while (((kTransferReceivingHeaders == fTransferState) || (kTransferReceivingBody == fTransferState)) && !fIsReceivePaused)
+	{
+		uint32_t wantEvents = EPOLLIN;
+		long result = TransportRead(buffer, fReceiveBuffer.size(), &wantEvents);
+		if (kTransportWouldBlock == result)
+		{
+			SetWatchedEvents(wantEvents);
+			return;
+		}
+		if (kTransportError == result)
+		{
+			debug("Failed to receive response");
+			Finish(kWinHttpRequestErrorConnectionFailure);
+			return;
+		}
+		ResetDeadline();
+
+		if (0 == result)
+		{
+			// The server closed the connection. That's only a clean end if it was delimiting the body that way.
+			if ((kTransferReceivingBody == fTransferState) && (kFramingUntilClose == fFraming))
+			{
+				Finish(kWinHttpRequestErrorNone);
+			}
+			else
+			{
+				debug("Connection closed before the response was complete");
+				Finish(kWinHttpRequestErrorConnectionFailure);
+			}
+			return;
+		}
+
+		if (kTransferReceivingHeaders == fTransferState)
+		{
+			fResponseHead.append(buffer, result);
+			size_t headEnd = fResponseHead.find("\r\n\r\n");
+			if (std::string::npos == headEnd)
+			{
+				if (fResponseHead.size() > EPOLL_REQUEST_MAX_HEAD_SIZE)
+				{
+					debug("Response head too large");
+					Finish(kWinHttpRequestErrorUnknown);
+					return;
+				}
+				continue;
+			}
+			if (!ProcessResponseHead(headEnd + 4))
+			{
+				return;
+			}
+		}
+		else if (!ConsumeBody(buffer, result))
+		{
+			return;
+		}
+	}
+
+	if (fIsReceivePaused)
+	{
+		SetWatchedEvents(0);
+	}
+}
+
+/// Handles a complete response head at the start of fResponseHead.
+/// @return Returns true if the response continues. Returns false if the request has finished or been redirected.
+bool EpollRequestOperation::ProcessResponseHead( size_t headLength )
+{
+	for (;;)
+	{
+		// Pick the fields needed here out of the head in a single pass, without copying it.
+		HttpHeaderParser parser(fResponseHead.data(), headLength);
+		HttpHeaderField field;
+		if (!parser.next(&field) || !field.IsStatusLine || (field.Value.Length < 5) || (0 != memcmp(field.Value.Data, "HTTP/", 5)) ||
+			(NULL == memchr(field.Value.Data, ' ', field.Value.Length)))
+		{
+			debug("Invalid response status line");
+			Finish(kWinHttpRequestErrorUnknown);
+			return false;
+		}
+		int statusCode = atoi((const char *)memchr(field.Value.Data, ' ', field.Value.Length) + 1);
+
+		// Skip interim responses (100 Continue and friends); the final response follows.
+		if ((statusCode >= 100) && (statusCode < 200) && (statusCode != 101))
+		{
+			fResponseHead.erase(0, headLength);
+			size_t headEnd = fResponseHead.find("\r\n\r\n");
+			if (std::string::npos == headEnd)
+			{
+				return true;
+			}
+			headLength = headEnd + 4;
+			continue;
+		}
+
+		UTF8String location;
+		UTF8String transferEncoding;
+		UTF8String contentLength;
+		UTF8String contentEncoding;
+		bool hasLocation = false;
+		bool hasContentLength = false;
+		while (parser.next(&field))
+		{
+			if (HttpHeaderParser::nameEquals(field.Name, "Location") && !hasLocation)
+			{
+				HttpHeaderParser::appendValue(field, &location);
+				hasLocation = true;
+			}
+			else if (HttpHeaderParser::nameEquals(field.Name, "Transfer-Encoding"))
+			{
+				// Repeated fields are the same as one field listing all of their values.
+				if (transferEncoding.size() > 0)
+				{
+					transferEncoding += ", ";
+				}
+				HttpHeaderParser::appendValue(field, &transferEncoding);
+			}
+			else if (HttpHeaderParser::nameEquals(field.Name, "Content-Length") && !hasContentLength)
+			{
+				HttpHeaderParser::appendValue(field, &contentLength);
+				hasContentLength = true;
+			}
+			else if (fIsDecodingResponse && HttpHeaderParser::nameEquals(field.Name, "Content-Encoding"))
+			{
+				contentEncoding.clear();
+				HttpHeaderParser::appendValue(field, &contentEncoding);
+			}
+		}
+
+		if (fHandleRedirects &&
+			((301 == statusCode) || (302 == statusCode) || (303 == statusCode) || (307 == statusCode) || (308 == statusCode)) &&
+			hasLocation)
+		{
+			if (FollowRedirect(statusCode, location))
+			{
+				return false;
+			}
+		}
+
+		// Work out how the body is delimited.
+		fBodyBytesRemaining = 0;
+		fChunkState = kChunkSize;
+		fChunkLine.clear();
+		if (fIsHeadRequest || (204 == statusCode) || (304 == statusCode) || (statusCode < 200))
+		{
+			fFraming = kFramingNone;
+		}
+		else if (strcasestr(transferEncoding.c_str(), "chunked") != NULL)
+		{
+			fFraming = kFramingChunked;
+		}
+		else if (hasContentLength)
+		{
+			fFraming = kFramingContentLength;
+			fBodyBytesRemaining = strtoll(contentLength.c_str(), NULL, 10);
+		}
+		else
+		{
+			fFraming = kFramingUntilClose;
+		}
+
+		// The body goes to the download file if the response is a 200, or a 206 that continues the partial file of a
+		// resumable download (after its bytes). A range of a segmented download only takes the 206 for its bytes.
+		long long downloadOffset = (HTTP_STATUS_OK == statusCode) ? 0 : -1;
+		if ((HTTP_STATUS_PARTIAL_CONTENT == statusCode) && fResumableDownload.isOpen())
+		{
+			HttpHeaderTable responseHeaders;
+			responseHeaders.parse(fResponseHead.data(), headLength);
+			if (fResumableDownload.isResumedResponse(statusCode, responseHeaders))
+			{
+				downloadOffset = fResumableDownload.getOffset();
+			}
+		}
+		else if (NULL != fDownloadSegment)
+		{
+			HttpHeaderTable responseHeaders;
+			responseHeaders.parse(fResponseHead.data(), headLength);
+			downloadOffset = fDownloadSegment->isSegmentResponse(statusCode, responseHeaders) ? fDownloadSegment->getStart() : -1;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(fSessionMutex);
+			fAsyncSession.ReceivedStatusCode = statusCode;
+			fAsyncSession.ResponseHeaders.assign(fResponseHead, 0, headLength);
+			fAsyncSession.ResponseHeadersReady = true;
+		}
+
+		// Whatever follows the head is the start of the body.
+		UTF8String remainder(fResponseHead, headLength);
+		fResponseHead.clear();
+		fTransferState = kTransferReceivingBody;
+
+		// Decode a compressed body before it goes anywhere, so that neither the download file nor the main thread
+		// ever see the encoded bytes.
+		if (fIsDecodingResponse && fResponseDecoder.open(contentEncoding.c_str()))
+		{
+			debug("Decoding %s response body as it arrives", contentEncoding.c_str());
+		}
+
+		// Create the download file now that we know the response is going to it. Any other response to a range of a
+		// segmented download (such as the whole body, if it changed) is not read, as the download can't use it.
+		if ((downloadOffset >= 0) && (fTempDownloadFilePath.size() > 0) && !OpenDownloadFile(downloadOffset))
+		{
+			CORONA_LOG("Error creating temp file for download");
+			Finish(kWinHttpRequestErrorInternal);
+			return false;
+		}
+		if ((NULL != fDownloadSegment) && (downloadOffset < 0))
+		{
+			CORONA_LOG("Response does not match the requested segment of the download");
+			Finish(kWinHttpRequestErrorInternal);
+			return false;
+		}
+
+		if ((kFramingNone == fFraming) || ((kFramingContentLength == fFraming) && (fBodyBytesRemaining <= 0)))
+		{
+			Finish(kWinHttpRequestErrorNone);
+			return false;
+		}
+		if (remainder.size() > 0)
+		{
+			return ConsumeBody(remainder.data(), remainder.size());
+		}
+		return true;
+	}
+}
+
+/// Removes the transfer framing from received body bytes and passes the payload on to the main thread.
+/// @return Returns true if more body bytes are expected. Returns false if the request has finished.
+bool EpollRequestOperation::ConsumeBody( const char *data, size_t length )
+{
+	switch (fFraming)
+	{
+		case kFramingContentLength:
+		{
+			size_t payloadLength = ((long long)length < fBodyBytesRemaining) ? length : (size_t)fBodyBytesRemaining;
+			if (!DeliverBody(data, payloadLength))
+			{
+				return false;
+			}
+			fBodyBytesRemaining -= payloadLength;
+			if (fBodyBytesRemaining <= 0)
+			{
+				Finish(kWinHttpRequestErrorNone);
+				return false;
+			}
+			return true;
+		}
+
+		case kFramingUntilClose:
+			return DeliverBody(data, length);
+
+		case kFramingChunked:
+			while (length > 0)
+			{
+				if (kChunkData == fChunkState)
+				{
+					size_t payloadLength = ((long long)length < fBodyBytesRemaining) ? length : (size_t)fBodyBytesRemaining;
+					if (!DeliverBody(data, payloadLength))
+					{
+						return false;
+					}
+					data += payloadLength;
+					length -= payloadLength;
+					fBodyBytesRemaining -= payloadLength;
+					if (0 == fBodyBytesRemaining)
+					{
+						fChunkState = kChunkDataEnd;
+					}
+					continue;
+				}
+
+				// Everything else is line based: collect a line, then act on it.
+				char next = *data++;
+				length--;
+				if (next != '\n')
+				{
+					if (fChunkLine.size() >= EPOLL_REQUEST_MAX_CHUNK_LINE)
+					{
+						debug("Invalid chunked response body");
+						Finish(kWinHttpRequestErrorUnknown);
+						return false;
+					}
+					fChunkLine += next;
+					continue;
+				}
+				if ((fChunkLine.size() > 0) && ('\r' == fChunkLine[fChunkLine.size() - 1]))
+				{
+					fChunkLine.erase(fChunkLine.size() - 1);
+				}
+
+				switch (fChunkState)
+				{
+					case kChunkSize:
+					{
+						char *end = NULL;
+						fBodyBytesRemaining = strtoll(fChunkLine.c_str(), &end, 16);
+						if ((end == fChunkLine.c_str()) || (fBodyBytesRemaining < 0))
+						{
+							debug("Invalid chunk size");
+							Finish(kWinHttpRequestErrorUnknown);
+							return false;
+						}
+						fChunkState = (fBodyBytesRemaining > 0) ? kChunkData : kChunkTrailer;
+						break;
+					}
+
+					case kChunkDataEnd:
+						fChunkState = kChunkSize;
+						break;
+
+					case kChunkTrailer:
+						// An empty line ends the trailer section, and with it the body.
+						if (fChunkLine.empty())
+						{
+							Finish(kWinHttpRequestErrorNone);
+							return false;
+						}
+						break;
+
+					default:
+						break;
+				}
+				fChunkLine.clear();
+			}
+			return true;
+
+		default:
+			return true;
+	}
+}
+
+/// Writes body bytes to the download file, or queues them for the main thread, pausing the socket if the
+/// main thread is falling behind.
+/// @return Returns true if more body bytes can be delivered. Returns false if the request has finished.
+bool EpollRequestOperation::DeliverBody( const char *data, size_t length )
+{
+	if (0 == length)
+	{
+		return true;
+	}
+
+	// The progress reports the bytes read off the connection next to the decoded ones.
+	size_t receivedLength = length;
+	if (fResponseDecoder.isOpen())
+	{
+		fDecodedBytes.clear();
+		if (!fResponseDecoder.write(data, length, &fDecodedBytes))
+		{
+			CORONA_LOG("Error decoding compressed response body");
+			Finish(kWinHttpRequestErrorInternal);
+			return false;
+		}
+		data = fDecodedBytes.data();
+		length = fDecodedBytes.size();
+	}
+
+	// Downloading to file - write it out from this thread, so the main thread only has to report the progress.
+	if (fDownloadFile >= 0)
+	{
+		size_t offset = 0;
+		while (offset < length)
+		{
+			ssize_t result = ::pwrite(fDownloadFile, data + offset, length - offset, (off_t)(fDownloadFileOffset + offset));
+			if (result < 0)
+			{
+				if (EINTR == errno)
+				{
+					continue;
+				}
+				CORONA_LOG("Error writing to temp file for download");
+				Finish(kWinHttpRequestErrorInternal);
+				return false;
+			}
+			offset += (size_t)result;
+		}
+		fDownloadFileOffset += (long long)length;
+
+		std::lock_guard<std::mutex> lock(fSessionMutex);
+		fAsyncSession.WrittenByteCount += (long long)receivedLength;
+		fAsyncSession.DecodedWrittenByteCount += (long long)length;
+		return true;
+	}
+
+	std::lock_guard<std::mutex> lock(fSessionMutex);
+	if (fAsyncSession.HasAsyncOperationEnded)
+	{
+		return true;
+	}
+	fAsyncSession.ReceivedBytes.append(data, length);
+	fAsyncSession.ReceivedByteCount += (long long)receivedLength;
+	if (fAsyncSession.ReceivedBytes.size() >= fMaxPendingReceiveBytes)
+	{
+		fAsyncSession.IsReceivePaused = true;
+		fIsReceivePaused = true;
+	}
+	return true;
+}
+
+/// Creates the download temp file, reserving disk space for the response's Content-Length (if given) so the
+/// file does not have to be grown while writing to it. A range of a segmented download opens the download's file
+/// instead, which was created at its full size, and leaves the rest of it as is.
+/// @param offset The number of bytes of the existing file that the response continues, if it resumes a partial
+///               download (anything past them is dropped), or the start of a segmented download's range. The file
+///               is created anew if 0, unless it is a segmented download's.
+/// @return Returns true if the file was created.
+bool EpollRequestOperation::OpenDownloadFile( long long offset )
+{
+	const size_t lastIndex = fTempDownloadFilePath.rfind('/');
+	if (std::string::npos != lastIndex)
+	{
+		CreateDirectoryPath(fTempDownloadFilePath.substr(0, lastIndex+1));
+	}
+
+	CloseDownloadFile();
+	if ((offset > 0) || (NULL != fDownloadSegment))
+	{
+		fDownloadFile = ::open(fTempDownloadFilePath.c_str(), O_WRONLY | O_CLOEXEC);
+	}
+	else
+	{
+		fDownloadFile = ::open(fTempDownloadFilePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	}
+	if (fDownloadFile < 0)
+	{
+		return false;
+	}
+	fHasOpenedDownloadFile = true;
+	fDownloadFileOffset = offset;
+	if (NULL != fDownloadSegment)
+	{
+		return true;
+	}
+	if ((offset > 0) && (::ftruncate(fDownloadFile, (off_t)offset) != 0))
+	{
+		return false;
+	}
+
+	// Not being able to reserve the space is not fatal (the file system may not support it), the writes will tell.
+	// A compressed body is decoded before it is written, so its Content-Length says nothing about the file's size.
+	if ((kFramingContentLength == fFraming) && (fBodyBytesRemaining > 0) && !fResponseDecoder.isOpen())
+	{
+		if (::fallocate(fDownloadFile, FALLOC_FL_KEEP_SIZE, (off_t)offset, (off_t)fBodyBytesRemaining) != 0)
+		{
+			debug("Unable to preallocate download file (%s)", strerror(errno));
+		}
+	}
+	return true;
+}
+
+/// Closes the download temp file, if open.
+void EpollRequestOperation::CloseDownloadFile()
+{
+	if (fDownloadFile >= 0)
+	{
+		::close(fDownloadFile);
+		fDownloadFile = -1;
+	}
+}
+
+/// Follows a redirect response, reusing the request's method and body where the status code allows it.
+/// @return Returns true if the redirect is being followed (or the request has finished).
+///         Returns false if the redirect response should be delivered as-is.
+bool EpollRequestOperation::FollowRedirect( int statusCode, const UTF8String& location )
+{
+	Url url;
+	UTF8String redirectUrl = ResolveRelativeUrl(fUrl, location);
+	if (!ParseUrl(redirectUrl, url))
+	{
+		debug("Invalid redirect location: %s", location.c_str());
+		Finish(kWinHttpRequestErrorInvalidUrl);
+		return true;
+	}
+
+	// Same policy as WinHttp's default: never follow a redirect from HTTPS down to HTTP.
+	if (fUrl.IsHttps && !url.IsHttps)
+	{
+		debug("Not following redirect from HTTPS to HTTP");
+		return false;
+	}
+
+	if (++fRedirectCount > EPOLL_REQUEST_MAX_REDIRECTS)
+	{
+		debug("Too many redirects");
+		Finish(kWinHttpRequestErrorUnknown);
+		return true;
+	}
+
+	// 303, and 301/302 in response to a POST, turn the request into a body-less GET.
+	if ((303 == statusCode) || (((301 == statusCode) || (302 == statusCode)) && (0 == _strcmpi(fMethod.c_str(), "POST"))))
+	{
+		if (0 != _strcmpi(fMethod.c_str(), "HEAD"))
+		{
+			fMethod = "GET";
+		}
+		fBodyBytesTotal = 0;
+		fIsStreamingRequestBody = false;
+	}
+	else if (fIsStreamingRequestBody)
+	{
+		// The part of a streamed body already sent is gone, so it can't be sent again.
+		debug("Not following redirect that would send the streamed request body again");
+		return false;
+	}
+
+	debug("Following redirect to %s", redirectUrl.c_str());
+	CloseConnection();
+	fUrl = url;
+	fResponseHead.clear();
+	StartResolve();
+	return true;
+}
+
+#pragma endregion
+
+
+#pragma region Transport Functions
+/// Reads from the connection, through TLS if the request is HTTPS.
+/// @return Returns the number of bytes read, 0 if the peer closed the connection, or kTransportWouldBlock
+///         (with "wantEvents" set to the events to wait for) or kTransportError.
+long EpollRequestOperation::TransportRead( char *buffer, size_t length, uint32_t *wantEvents )
+{
+#ifndef NETWORK_NO_OPENSSL
+	if (fTls)
+	{
+		int result = SSL_read(fTls, buffer, (int)length);
+		if (result > 0)
+		{
+			return result;
+		}
+		switch (SSL_get_error(fTls, result))
+		{
+			case SSL_ERROR_WANT_READ:
+				*wantEvents = EPOLLIN;
+				return kTransportWouldBlock;
+			case SSL_ERROR_WANT_WRITE:
+				*wantEvents = EPOLLOUT;
+				return kTransportWouldBlock;
+			case SSL_ERROR_ZERO_RETURN:
+				return 0;
+			default:
+				ERR_clear_error();
+				return kTransportError;
+		}
+	}
+#endif
+
+	ssize_t result = ::recv(fSocket, buffer, length, 0);
+	if (result >= 0)
+	{
+		return (long)result;
+	}
+	if ((EAGAIN == errno) || (EWOULDBLOCK == errno) || (EINTR == errno))
+	{
+		*wantEvents = EPOLLIN;
+		return kTransportWouldBlock;
+	}
+	return kTransportError;
+}
+
+/// Writes to the connection, through TLS if the request is HTTPS.
+/// @return Returns the number of bytes written, or kTransportWouldBlock (with "wantEvents" set to the
+///         events to wait for) or kTransportError.
+long EpollRequestOperation::TransportWrite( const char *buffer, size_t length, uint32_t *wantEvents )
+{
+#ifndef NETWORK_NO_OPENSSL
+	if (fTls)
+	{
+		int result = SSL_write(fTls, buffer, (int)length);
+		if (result > 0)
+		{
+			return result;
+		}
+		switch (SSL_get_error(fTls, result))
+		{
+			case SSL_ERROR_WANT_READ:
+				*wantEvents = EPOLLIN;
+				return kTransportWouldBlock;
+			case SSL_ERROR_WANT_WRITE:
+				*wantEvents = EPOLLOUT;
+				return kTransportWouldBlock;
+			default:
+				ERR_clear_error();
+				return kTransportError;
+		}
+	}
+#endif
+
+	ssize_t result = ::send(fSocket, buffer, length, MSG_NOSIGNAL);
+	if (result >= 0)
+	{
+		return (long)result;
+	}
+	if ((EAGAIN == errno) || (EWOULDBLOCK == errno) || (EINTR == errno))
+	{
+		*wantEvents = EPOLLOUT;
+		return kTransportWouldBlock;
+	}
+	return kTransportError;
+}
+
+/// Changes the events the socket is watched for. Watching for no events unregisters the socket, so that
+/// a paused connection that hangs up doesn't keep waking the loop.
+void EpollRequestOperation::SetWatchedEvents( uint32_t events )
+{
+	if ((events == fWatchedEvents) || (fSocket < 0))
+	{
+		return;
+	}
+
+	bool wasSuccessful = true;
+	if (0 == fWatchedEvents)
+	{
+		wasSuccessful = fEventLoop->Watch(fSocket, events, this);
+	}
+	else if (0 == events)
+	{
+		fEventLoop->Unwatch(fSocket);
+	}
+	else
+	{
+		wasSuccessful = fEventLoop->Modify(fSocket, events, this);
+	}
+
+	if (wasSuccessful)
+	{
+		fWatchedEvents = events;
+	}
+	else
+	{
+		debug("Failed to watch socket (%d)", errno);
+	}
+}
+
+/// Closes the connection (and its TLS session), if open.
+void EpollRequestOperation::CloseConnection()
+{
+#ifndef NETWORK_NO_OPENSSL
+	if (fTls)
+	{
+		SSL_free(fTls);
+		fTls = NULL;
+	}
+#endif
+	if (fSocket >= 0)
+	{
+		if (fWatchedEvents != 0)
+		{
+			fEventLoop->Unwatch(fSocket);
+			fWatchedEvents = 0;
+		}
+		::close(fSocket);
+		fSocket = -1;
+	}
+}
+
+/// Ends the event loop's part of the request: closes the connection and upload file, records the result
+/// (unless the main thread already ended the request with an abort) and flags the request as complete.
+void EpollRequestOperation::Finish( WinHttpRequestError error )
+{
+	CloseConnection();
+	if (fAddressList)
+	{
+		::freeaddrinfo(fAddressList);
+		fAddressList = NULL;
+	}
+	fNextAddress = NULL;
+	fUploadFile.close();
+	if (fRequestBody && (TYPE_MULTIPART == fRequestBody->bodyType))
+	{
+		fRequestBody->bodyMultipart->close();
+	}
+	CloseDownloadFile();
+	if (fResponseDecoder.isOpen())
+	{
+		if ((kWinHttpRequestErrorNone == error) && !fResponseDecoder.finish())
+		{
+			// The request fails, which removes the download file along with it.
+			CORONA_LOG("Compressed response ended before the end of its data");
+			error = kWinHttpRequestErrorInternal;
+		}
+		fResponseDecoder.close();
+	}
+	fRequestEncoder.close();
+	fSendBuffer.clear();
+	fSendData = NULL;
+	fSendLength = 0;
+	fResponseHead.clear();
+	fIsReceivePaused = false;
+	fIsSendPaused = false;
+	fTransferState = kTransferComplete;
+
+	std::lock_guard<std::mutex> lock(fSessionMutex);
+	if (!fAsyncSession.HasAsyncOperationEnded)
+	{
+		fAsyncSession.ErrorResult = error;
+		fAsyncSession.HasAsyncOperationEnded = true;
+	}
+	fAsyncSession.RequestComplete = true;
+}
+
+/// Restarts the inactivity timeout after progress has been made on the connection.
+void EpollRequestOperation::ResetDeadline()
+{
+	fDeadline = ::GetTickCount() + (DWORD)fTimeoutMs;
+}
+
+#pragma endregion
+
+
+#pragma region Utility Functions
+/// Splits an "http" or "https" URL into the parts needed to connect to the server and request the resource.
+/// @return Returns true if the URL could be parsed. Returns false if it is invalid or uses another scheme.
+bool EpollRequestOperation::ParseUrl( const UTF8String& urlString, Url& url )
+{
+	size_t schemeEnd = urlString.find("://");
+	if (std::string::npos == schemeEnd)
+	{
+		return false;
+	}
+
+	UTF8String scheme = urlString.substr(0, schemeEnd);
+	if (0 == _strcmpi(scheme.c_str(), "http"))
+	{
+		url.IsHttps = false;
+	}
+	else if (0 == _strcmpi(scheme.c_str(), "https"))
+	{
+		url.IsHttps = true;
+	}
+	else
+	{
+		return false;
+	}
+
+	size_t authorityStart = schemeEnd + 3;
+	size_t authorityEnd = urlString.find_first_of("/?#", authorityStart);
+	UTF8String authority = urlString.substr(authorityStart, (std::string::npos == authorityEnd) ? std::string::npos : authorityEnd - authorityStart);
+
+	url.Path = (std::string::npos == authorityEnd) ? UTF8String() : urlString.substr(authorityEnd);
+	size_t fragmentIndex = url.Path.find('#');
+	if (std::string::npos != fragmentIndex)
+	{
+		url.Path.erase(fragmentIndex);
+	}
+	if (url.Path.empty() || ('/' != url.Path[0]))
+	{
+		url.Path.insert(0, "/");
+	}
+
+	url.UserInfo.clear();
+	size_t userInfoEnd = authority.rfind('@');
+	if (std::string::npos != userInfoEnd)
+	{
+		url.UserInfo = authority.substr(0, userInfoEnd);
+		authority.erase(0, userInfoEnd + 1);
+	}
+
+	url.Port.clear();
+	if ((authority.size() > 0) && ('[' == authority[0]))
+	{
+		size_t addressEnd = authority.find(']');
+		if (std::string::npos == addressEnd)
+		{
+			return false;
+		}
+		url.Host = authority.substr(1, addressEnd - 1);
+		if ((addressEnd + 1 < authority.size()) && (':' == authority[addressEnd + 1]))
+		{
+			url.Port = authority.substr(addressEnd + 2);
+		}
+	}
+	else
+	{
+		size_t portIndex = authority.rfind(':');
+		url.Host = authority.substr(0, portIndex);
+		if (std::string::npos != portIndex)
+		{
+			url.Port = authority.substr(portIndex + 1);
+		}
+	}
+
+	if (url.Port.empty())
+	{
+		url.Port = url.IsHttps ? "443" : "80";
+	}
+	if (url.Host.empty() || (url.Port.find_first_not_of("0123456789") != std::string::npos) || (url.Port.size() > 5))
+	{
+		return false;
+	}
+	return true;
+}
+
+/// Gets the value for the "Host" request header (and the authority of absolute URLs) for the given URL.
+UTF8String EpollRequestOperation::GetHostHeader( const Url& url )
+{
+	UTF8String host = (url.Host.find(':') != std::string::npos) ? "[" + url.Host + "]" : url.Host;
+	if (url.Port != (url.IsHttps ? "443" : "80"))
+	{
+		host += ":" + url.Port;
+	}
+	return host;
+}
+
+/// Resolves a redirect "Location" value against the URL that was redirected.
+UTF8String EpollRequestOperation::ResolveRelativeUrl( const Url& base, const UTF8String& location )
+{
+	size_t schemeEnd = location.find("://");
+	if ((std::string::npos != schemeEnd) && (location.find_first_of("/?#") > schemeEnd))
+	{
+		return location;
+	}
+
+	UTF8String scheme = base.IsHttps ? "https:" : "http:";
+	if (location.compare(0, 2, "//") == 0)
+	{
+		return scheme + location;
+	}
+
+	UTF8String origin = scheme + "//" + GetHostHeader(base);
+	if ((location.size() > 0) && ('/' == location[0]))
+	{
+		return origin + location;
+	}
+
+	UTF8String directory = base.Path.substr(0, base.Path.find('?'));
+	directory.erase(directory.rfind('/') + 1);
+	return origin + directory + location;
+}
+
+/// Finds a header in a CRLF separated block of headers (the first line of a response head is skipped
+/// naturally, since it contains no colon before its first space).
+/// @return Returns true and sets "value" (trimmed) if the header was found.
+bool EpollRequestOperation::FindHeaderValue( const UTF8String& headers, const char *name, UTF8String& value )
+{
+	HttpHeaderParser parser(headers.data(), headers.size());
+	HttpHeaderField field;
+	while (parser.next(&field))
+	{
+		if (!field.IsStatusLine && HttpHeaderParser::nameEquals(field.Name, name))
+		{
+			value.clear();
+			HttpHeaderParser::appendValue(field, &value);
+			return true;
+		}
+	}
+	return false;
+}
+
+/// Encodes the given text as base64, for basic authentication credentials.
+UTF8String EpollRequestOperation::Base64Encode( const UTF8String& text )
+{
+	static const char kAlphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+	UTF8String encoded;
+	encoded.reserve(((text.size() + 2) / 3) * 4);
+	for (size_t index = 0; index < text.size(); index += 3)
+	{
+		uint32_t group = (unsigned char)text[index] << 16;
+		if (index + 1 < text.size())
+		{
+			group |= (unsigned char)text[index + 1] << 8;
+		}
+		if (index + 2 < text.size())
+		{
+			group |= (unsigned char)text[index + 2];
+		}
+		encoded += kAlphabet[(group >> 18) & 0x3F];
+		encoded += kAlphabet[(group >> 12) & 0x3F];
+		encoded += (index + 1 < text.size()) ? kAlphabet[(group >> 6) & 0x3F] : '=';
+		encoded += (index + 2 < text.size()) ? kAlphabet[group & 0x3F] : '=';
+	}
+	return encoded;
+}
+
+/// Creates the given directory and any missing parent directories.
+/// @return Returns true if the directory exists afterwards.
+bool EpollRequestOperation::CreateDirectoryPath( const UTF8String& path )
+{
+	for (size_t index = path.find('/', 1); index != std::string::npos; index = path.find('/', index + 1))
+	{
+		::mkdir(path.substr(0, index).c_str(), 0755);
+	}
+	if (::mkdir(path.c_str(), 0755) != 0 && (errno != EEXIST))
+	{
+		return false;
+	}
+	return true;
+}
+
+#pragma endregion
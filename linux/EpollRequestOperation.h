@@ -0,0 +1,240 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef _EpollRequestOperation_H_
+#define _EpollRequestOperation_H_
+
+#include "CoronaLua.h"
+
+#include "EpollAsyncRequestSessionData.h"
+#include "EpollEventLoop.h"
+
+#include "WinHttpRequestError.h"
+
+#include "ContentDecoder.h"
+#include "ContentEncoder.h"
+#include "HttpRequestOperation.h"
+#include "RequestBodyStream.h"
+#include "UploadFileView.h"
+
+#include "WindowsNetworkSupport.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct addrinfo;
+
+
+/// Class used to send an HTTP request to a server and wait for a response asynchronously on Linux.
+///
+/// This is the Linux counterpart of WinHttpRequestOperation. The main thread drives it through the same
+/// ExecuteRequest()/ProcessExecution()/RequestAbort() contract, while all socket I/O happens on the shared
+/// EpollEventLoop thread through the OnLoop*() functions. What the event loop thread hands over is turned into
+/// the request's state by HttpRequestOperation.
+class EpollRequestOperation : public HttpRequestOperation
+{
+public:
+	EpollRequestOperation( const std::shared_ptr<EpollEventLoop>& eventLoop, HttpResponseCache *responseCache, HttpMemoryResponseCache *memoryCache, CoalescingMap *coalescingMap );
+	virtual ~EpollRequestOperation();
+
+	RequestCanceller* ExecuteRequest( NetworkRequestParameters *requestParams, const std::shared_ptr<EpollRequestOperation>& thiz, RequestCanceller *requestCanceller = NULL );
+	void ProcessExecution();
+	void RequestAbort();
+
+	// Event loop thread interface.
+	void OnLoopPosted();
+	void OnLoopSocketEvent();
+	void OnLoopTick( DWORD now );
+	void OnLoopShutdown();
+	bool IsLoopWorkComplete();
+
+private:
+	/// Progress of the request as seen by the event loop thread.
+	enum TransferState
+	{
+		kTransferIdle,
+		kTransferResolving,
+		kTransferConnecting,
+		kTransferTlsHandshake,
+		kTransferSending,
+		kTransferReceivingHeaders,
+		kTransferReceivingBody,
+		kTransferComplete
+	};
+
+	/// How the end of the response body is determined.
+	enum BodyFraming
+	{
+		kFramingNone,
+		kFramingContentLength,
+		kFramingChunked,
+		kFramingUntilClose
+	};
+
+	/// Parsing state for a chunked response body.
+	enum ChunkState
+	{
+		kChunkSize,
+		kChunkData,
+		kChunkDataEnd,
+		kChunkTrailer
+	};
+
+	/// Components of the URL currently being requested (changes when following redirects).
+	struct Url
+	{
+		bool IsHttps;
+		UTF8String Host;
+		UTF8String Port;
+		UTF8String Path;
+		UTF8String UserInfo;
+	};
+
+	/// Shared with the event loop thread; guarded by fSessionMutex.
+	std::mutex fSessionMutex;
+	EpollAsyncRequestSessionData fAsyncSession;
+
+	std::shared_ptr<EpollEventLoop> fEventLoop;
+	std::weak_ptr<EpollRequestOperation> fSelf;
+
+	/// Temp file path that serves as the destination of the response body, if response body is directed
+	/// to a file. Set by the main thread in Execute(). The event loop thread creates the file once the
+	/// response status is 200 (OK), or opens it for a 206 (Partial Content) resuming a partial download, and writes
+	/// the body to it directly, so the main thread never waits on the disk.
+	UTF8String fTempDownloadFilePath;
+
+	/// Body bytes taken from the session by the main thread's last processing pass. Swapped with the session's
+	/// "ReceivedBytes" on every pass, so the two buffers' allocations are re-used rather than re-grown.
+	UTF8String fReceivedBytes;
+
+	// Request description, prepared by the main thread in Execute() and read-only afterwards
+	// (apart from redirects, which are handled entirely on the event loop thread).
+	UTF8String fMethod;
+	UTF8String fRequestUrl;
+	UTF8String fRequestHeaders;
+	Body* fRequestBody;
+
+	/// The file containing the request body (if any), opened by the main thread in Execute(). The event loop thread
+	/// sends it straight from its mapping, a slice at a time.
+	UploadFileView fUploadFile;
+
+	int fTimeoutMs;
+	bool fHandleRedirects;
+	bool fIsDecodingResponse;
+
+	// Event loop thread state.
+	TransferState fTransferState;
+	Url fUrl;
+	int fRedirectCount;
+	std::atomic<bool> fIsResolveComplete;
+	struct addrinfo* fAddressList;
+	struct addrinfo* fNextAddress;
+	int fResolveError;
+	int fSocket;
+	uint32_t fWatchedEvents;
+#ifndef NETWORK_NO_OPENSSL
+	SSL* fTls;
+#endif
+	DWORD fDeadline;
+	bool fIsReceivePaused;
+
+	/// Set while sending a streamed request body waits for the main thread to read more of it.
+	bool fIsSendPaused;
+
+	/// Socket reads are done in chunks of the request's "receiveBufferSize", and stop once "receiveBufferCount"
+	/// chunks' worth of bytes are waiting for the main thread.
+	std::vector<char> fReceiveBuffer;
+	size_t fMaxPendingReceiveBytes;
+
+	/// What is being written: the request head or a compressed slice of the body built in "fSendBuffer", or a slice
+	/// of the body itself (in its string or file mapping), which is sent as is rather than copied.
+	UTF8String fSendBuffer;
+	const char* fSendData;
+	size_t fSendLength;
+	size_t fSendOffset;
+	bool fIsSendingBody;
+	long long fBodyBytesSent;
+	long long fBodyBytesTotal;
+
+	/// Number of request body bytes taken from the body so far, which runs ahead of "fBodyBytesSent" when the body
+	/// is compressed (params.bodyCompression = "gzip"). A compressed body is sent chunked, built slice by slice
+	/// into the send buffer by "fRequestEncoder". Only used by the event loop thread.
+	long long fBodyBytesRead;
+	bool fIsEncodingRequestBody;
+	ContentEncoder fRequestEncoder;
+
+	/// Set if the request body is streamed (params.body = function), which is sent chunked as the main thread reads
+	/// it (see PumpRequestBodyStream()). Its stream compresses it if it is compressed, rather than "fRequestEncoder".
+	/// Set by the main thread in Execute(), and only used by the event loop thread afterwards.
+	bool fIsStreamingRequestBody;
+
+	/// Chunks of a streamed request body read by the main thread's last pass, before they are handed to the event
+	/// loop thread. Keeps its capacity from one pass to the next.
+	UTF8String fStreamedBodyBytes;
+
+	/// Descriptor of the open download temp file (or -1) and the offset the next body bytes are written at, which
+	/// is where a resumed download starts. Only used by the event loop thread, and read by the main thread once the
+	/// request is complete along with "fHasOpenedDownloadFile".
+	int fDownloadFile;
+	long long fDownloadFileOffset;
+	bool fHasOpenedDownloadFile;
+
+	/// Decodes a compressed response body (params.compression = "auto") before it is delivered to the download file
+	/// or the main thread, into "fDecodedBytes" which keeps its capacity from one read to the next.
+	/// Only used by the event loop thread.
+	ContentDecoder fResponseDecoder;
+	UTF8String fDecodedBytes;
+
+	UTF8String fResponseHead;
+	bool fIsHeadRequest;
+	BodyFraming fFraming;
+	long long fBodyBytesRemaining;
+	ChunkState fChunkState;
+	UTF8String fChunkLine;
+
+	bool Execute();
+	void ProcessExecutionUntil( int timeoutInMilliseconds );
+	void PumpRequestBodyStream();
+	virtual UTF8String& GetDownloadFilePath();
+
+	void StartResolve();
+	void ResolveHost();
+	void StartConnect();
+	void OnConnected();
+	bool StartTls();
+	void ContinueTls();
+	void StartSending();
+	void ContinueSending();
+	const char* ReadRequestBodySlice( size_t *sliceLength );
+	void ContinueReceiving();
+	bool ProcessResponseHead( size_t headLength );
+	bool ConsumeBody( const char *data, size_t length );
+	bool DeliverBody( const char *data, size_t length );
+	bool OpenDownloadFile( long long offset );
+	void CloseDownloadFile();
+	bool FollowRedirect( int statusCode, const UTF8String& location );
+
+	long TransportRead( char *buffer, size_t length, uint32_t *wantEvents );
+	long TransportWrite( const char *buffer, size_t length, uint32_t *wantEvents );
+	void SetWatchedEvents( uint32_t events );
+	void CloseConnection();
+	void Finish( WinHttpRequestError error );
+	void ResetDeadline();
+
+	static bool ParseUrl( const UTF8String& urlString, Url& url );
+	static UTF8String GetHostHeader( const Url& url );
+	static UTF8String ResolveRelativeUrl( const Url& base, const UTF8String& location );
+	static bool FindHeaderValue( const UTF8String& headers, const char *name, UTF8String& value );
+	static UTF8String Base64Encode( const UTF8String& text );
+	static bool CreateDirectoryPath( const UTF8String& path );
+};
+
+#endif
@@ -0,0 +1,94 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef _LinuxNetworkCompat_H_
+#define _LinuxNetworkCompat_H_
+
+// The request parameter/state support code in win32/WindowsNetworkSupport.cpp and win32/CharsetTranscoder.cpp
+// is shared with the Linux request engine. This header supplies the handful of Win32 types and CRT names that
+// code relies on, so that it can be compiled unchanged outside of Windows.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
+#include <wchar.h>
+#include <sys/stat.h>
+
+typedef uint32_t	DWORD;
+typedef int			BOOL;
+typedef wchar_t		WCHAR;
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#define CP_UTF7			65000
+#define CP_UTF8			65001
+
+#define HTTP_STATUS_OK	200
+#define HTTP_STATUS_PARTIAL_CONTENT	206
+#define HTTP_STATUS_NOT_MODIFIED	304
+
+#define _strcmpi		strcasecmp
+#define _stricmp		strcasecmp
+#define _strnicmp		strncasecmp
+#define _strdup			strdup
+#define _strtoi64		strtoll
+#define strtok_s		strtok_r
+#define sprintf_s		snprintf
+#define _stat64			stat
+#define _stati64		stat
+
+#ifndef _countof
+#define _countof(a)		(sizeof(a) / sizeof((a)[0]))
+#endif
+
+inline int strncpy_s( char *dest, size_t destSize, const char *src, size_t count )
+{
+	if ( ( NULL == dest ) || ( 0 == destSize ) )
+	{
+		return -1;
+	}
+	size_t copyLength = ( count < destSize - 1 ) ? count : destSize - 1;
+	memcpy( dest, src, copyLength );
+	dest[copyLength] = 0;
+	return 0;
+}
+
+inline int _strlwr_s( char *str, size_t size )
+{
+	for ( size_t i = 0; ( i < size ) && ( 0 != str[i] ); i++ )
+	{
+		str[i] = (char)tolower( (unsigned char)str[i] );
+	}
+	return 0;
+}
+
+// Millisecond tick count with the same wraparound semantics as the Win32 call.
+inline DWORD GetTickCount( )
+{
+	struct timespec now;
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return (DWORD)( ( (uint64_t)now.tv_sec * 1000 ) + ( now.tv_nsec / 1000000 ) );
+}
+
+inline void OutputDebugStringA( const char *message )
+{
+	fputs( message, stderr );
+}
+
+#endif
@@ -0,0 +1,143 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+// Times the vector ASCII scan, the UTF-8 check and the ASCII shortcut of CharsetTranscoder::transcode() against a
+// full iconv conversion of the same ASCII text, which is what the shortcut skips, for bodies from 1 KB to 10 MB.
+//
+// Usage: network_charset_benchmark [milliseconds per case]
+
+#include "CharsetTranscoder.h"
+
+#include <chrono>
+#include <iconv.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+
+// The transcoder logs through debug(), which lives with the Lua bindings in WindowsNetworkSupport.cpp.
+void debug( char * /*message*/, ... )
+{
+}
+
+// Keeps the compiler from dropping results that are never used.
+static volatile size_t sSink;
+
+/// Makes "size" bytes of ASCII text that looks like a JSON response.
+static std::string makeAsciiText( size_t size )
+{
+	static const char kRecord[] = "{\"id\":12345,\"name\":\"item\",\"tags\":[\"alpha\",\"beta\"],\"price\":19.99},\n";
+	std::string text;
+	text.reserve( size );
+	while ( text.size() < size )
+	{
+		text.append( kRecord, ( size - text.size() < sizeof( kRecord ) - 1 ) ? size - text.size() : sizeof( kRecord ) - 1 );
+	}
+	return text;
+}
+
+/// Runs "step" until "milliseconds" have passed and prints the throughput for a body of "size" bytes.
+template< typename Step >
+static void runCase( const char *name, size_t size, int milliseconds, Step step )
+{
+	typedef std::chrono::steady_clock Clock;
+
+	step();
+
+	long iterations = 0;
+	Clock::time_point start = Clock::now();
+	Clock::duration elapsed;
+	do
+	{
+		step();
+		iterations++;
+		elapsed = Clock::now() - start;
+	}
+	while ( elapsed < std::chrono::milliseconds( milliseconds ) );
+
+	double seconds = std::chrono::duration< double >( elapsed ).count();
+	double nanoseconds = seconds * 1e9 / iterations;
+	double megabytesPerSecond = (double)size * iterations / seconds / ( 1024.0 * 1024.0 );
+	printf( "%-16s %10lu %14.0f %12.1f\n", name, (unsigned long)size, nanoseconds, megabytesPerSecond );
+}
+
+int main( int argc, char *argv[] )
+{
+	int milliseconds = ( argc > 1 ) ? atoi( argv[1] ) : 200;
+	if ( milliseconds < 1 )
+	{
+		milliseconds = 1;
+	}
+
+	static const size_t kSizes[] = { 1024, 16 * 1024, 256 * 1024, 1024 * 1024, 10 * 1024 * 1024 };
+
+	printf( "%-16s %10s %14s %12s\n", "case", "bytes", "ns/body", "MB/s" );
+	for ( size_t index = 0; index < sizeof( kSizes ) / sizeof( kSizes[0] ); index++ )
+	{
+		const size_t size = kSizes[index];
+		const std::string source = makeAsciiText( size );
+
+		runCase( "ascii-scan", size, milliseconds, [&]()
+		{
+			sSink = CharsetTranscoder::getAsciiLength( source.data(), source.size() );
+		} );
+
+		runCase( "utf8-check", size, milliseconds, [&]()
+		{
+			sSink = CharsetTranscoder::isValidUtf8( source.data(), source.size() );
+		} );
+
+		// The copy is part of every case below, so the shortcut is measured the way a response body pays for it.
+		std::string text;
+		runCase( "copy", size, milliseconds, [&]()
+		{
+			text = source;
+			sSink = text.size();
+		} );
+
+		runCase( "transcode", size, milliseconds, [&]()
+		{
+			text = source;
+			if ( !CharsetTranscoder::transcode( &text, "iso-8859-1", "utf-8" ) )
+			{
+				fprintf( stderr, "transcode() failed\n" );
+				exit( 1 );
+			}
+			sSink = text.size();
+		} );
+
+		iconv_t converter = iconv_open( "UTF-8", "ISO-8859-1" );
+		if ( (iconv_t)-1 == converter )
+		{
+			fprintf( stderr, "iconv_open() failed\n" );
+			return 1;
+		}
+		runCase( "full-transcode", size, milliseconds, [&]()
+		{
+			text = source;
+			std::string output( text.size() * 2, '\0' );
+			char *input = &text[0];
+			size_t inputLeft = text.size();
+			char *outputEnd = &output[0];
+			size_t outputLeft = output.size();
+			iconv( converter, NULL, NULL, NULL, NULL );
+			if ( (size_t)-1 == iconv( converter, &input, &inputLeft, &outputEnd, &outputLeft ) )
+			{
+				fprintf( stderr, "iconv() failed\n" );
+				exit( 1 );
+			}
+			output.resize( output.size() - outputLeft );
+			text.swap( output );
+			sSink = text.size();
+		} );
+		iconv_close( converter );
+	}
+
+	return 0;
+}
@@ -0,0 +1,160 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+// Times HttpHeaderParser on a CDN style response with 34 header fields, including repeated and folded ones.
+//
+// Usage: network_header_benchmark [milliseconds per case]
+
+#include "HttpHeaderParser.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+
+static const char kResponseHeaders[] =
+	"HTTP/1.1 200 OK\r\n"
+	"Accept-Ranges: bytes\r\n"
+	"Access-Control-Allow-Origin: *\r\n"
+	"Access-Control-Expose-Headers: Content-Length, Content-Range, ETag\r\n"
+	"Age: 1843\r\n"
+	"Alt-Svc: h3=\":443\"; ma=86400\r\n"
+	"Cache-Control: public, max-age=31536000, immutable\r\n"
+	"CF-Cache-Status: HIT\r\n"
+	"CF-RAY: 7d2a1b3c4d5e6f70-FRA\r\n"
+	"Connection: keep-alive\r\n"
+	"Content-Encoding: gzip\r\n"
+	"Content-Length: 1048576\r\n"
+	"Content-Type: application/json; charset=utf-8\r\n"
+	"Date: Fri, 16 Oct 2026 09:12:44 GMT\r\n"
+	"ETag: \"5f3c2a1b-100000\"\r\n"
+	"Expires: Sat, 16 Oct 2027 09:12:44 GMT\r\n"
+	"Last-Modified: Tue, 13 Oct 2026 17:40:02 GMT\r\n"
+	"NEL: {\"success_fraction\":0,\"report_to\":\"cf-nel\",\"max_age\":604800}\r\n"
+	"Report-To: {\"endpoints\":[{\"url\":\"https://a.nel.example.com/report/v3?s=abcdef0123456789\"}],\r\n"
+	"\t\"group\":\"cf-nel\",\"max_age\":604800}\r\n"
+	"Server: cloudflare\r\n"
+	"Server-Timing: cdn-cache; desc=HIT, edge; dur=1, origin; dur=0\r\n"
+	"Set-Cookie: __cf_bm=0123456789abcdef; path=/; expires=Fri, 16-Oct-26 09:42:44 GMT; HttpOnly; Secure\r\n"
+	"Set-Cookie: _cfuvid=fedcba9876543210; path=/; domain=.example.com; HttpOnly; Secure; SameSite=None\r\n"
+	"Strict-Transport-Security: max-age=31536000; includeSubDomains; preload\r\n"
+	"Timing-Allow-Origin: *\r\n"
+	"Vary: Accept-Encoding\r\n"
+	"Vary: Origin\r\n"
+	"Via: 1.1 varnish, 1.1 cdn-edge-fra\r\n"
+	"X-Amz-Cf-Id: Xyz0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJ==\r\n"
+	"X-Cache: Hit from cloudfront\r\n"
+	"X-Content-Type-Options: nosniff\r\n"
+	"X-Frame-Options: SAMEORIGIN\r\n"
+	"X-Request-Id: 4f1c2b3a-5d6e-7f80-9a1b-2c3d4e5f6a7b\r\n"
+	"X-Served-By: cache-fra-etou8220141-FRA\r\n"
+	"X-XSS-Protection: 0\r\n"
+	"\r\n";
+
+// Keeps the compiler from dropping results that are never used.
+static volatile size_t sSink;
+
+/// Runs "step" until "milliseconds" have passed and prints the time it takes per header block.
+template< typename Step >
+static void runCase( const char *name, int milliseconds, Step step )
+{
+	typedef std::chrono::steady_clock Clock;
+
+	step();
+
+	long iterations = 0;
+	Clock::time_point start = Clock::now();
+	Clock::duration elapsed;
+	do
+	{
+		step();
+		iterations++;
+		elapsed = Clock::now() - start;
+	}
+	while ( elapsed < std::chrono::milliseconds( milliseconds ) );
+
+	double seconds = std::chrono::duration< double >( elapsed ).count();
+	printf( "%-16s %12.0f %14.0f\n", name, seconds * 1e9 / iterations, iterations / seconds );
+}
+
+int main( int argc, char *argv[] )
+{
+	int milliseconds = ( argc > 1 ) ? atoi( argv[1] ) : 500;
+	if ( milliseconds < 1 )
+	{
+		milliseconds = 1;
+	}
+
+	const size_t length = sizeof( kResponseHeaders ) - 1;
+	size_t fieldCount = 0;
+	{
+		HttpHeaderParser parser( kResponseHeaders, length );
+		HttpHeaderField field;
+		while ( parser.next( &field ) )
+		{
+			fieldCount += field.IsStatusLine ? 0 : 1;
+		}
+	}
+	printf( "%lu bytes, %lu fields\n", (unsigned long)length, (unsigned long)fieldCount );
+	printf( "%-16s %12s %14s\n", "case", "ns/block", "blocks/s" );
+
+	// Walking the fields is all that a response pays for the fields nobody asks for.
+	runCase( "parse", milliseconds, [&]()
+	{
+		HttpHeaderParser parser( kResponseHeaders, length );
+		HttpHeaderField field;
+		size_t count = 0;
+		while ( parser.next( &field ) )
+		{
+			count += field.Value.Length;
+		}
+		sSink = count;
+	} );
+
+	// What the engines do with a response: pick out the fields they act on while walking the block.
+	runCase( "parse+lookup", milliseconds, [&]()
+	{
+		HttpHeaderParser parser( kResponseHeaders, length );
+		HttpHeaderField field;
+		size_t count = 0;
+		while ( parser.next( &field ) )
+		{
+			if ( HttpHeaderParser::nameEquals( field.Name, "Content-Length" ) ||
+				 HttpHeaderParser::nameEquals( field.Name, "Content-Type" ) ||
+				 HttpHeaderParser::nameEquals( field.Name, "Content-Encoding" ) ||
+				 HttpHeaderParser::nameEquals( field.Name, "ETag" ) ||
+				 HttpHeaderParser::nameEquals( field.Name, "Last-Modified" ) )
+			{
+				count += field.Value.Length;
+			}
+		}
+		sSink = count;
+	} );
+
+	// Copying out every name and value, which is what the Lua headers table needs.
+	std::string name;
+	std::string value;
+	runCase( "parse+copy", milliseconds, [&]()
+	{
+		HttpHeaderParser parser( kResponseHeaders, length );
+		HttpHeaderField field;
+		size_t count = 0;
+		while ( parser.next( &field ) )
+		{
+			name.assign( field.Name.Data, field.Name.Length );
+			value.clear();
+			HttpHeaderParser::appendValue( field, &value );
+			count += name.size() + value.size();
+		}
+		sSink = count;
+	} );
+
+	return 0;
+}
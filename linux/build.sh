@@ -0,0 +1,55 @@
+#!/bin/bash
+
+path=`dirname $0`
+
+OUTPUT_DIR=$1
+TARGET_NAME=network
+OUTPUT_SUFFIX=a
+CONFIG=Release
+
+#
+# Checks exit value for error
+# 
+checkError() {
+    if [ $? -ne 0 ]
+    then
+        echo "Exiting due to errors (above)"
+        exit -1
+    fi
+}
+
+# 
+# Canonicalize relative paths to absolute paths
+# 
+pushd $path > /dev/null
+dir=`pwd`
+path=$dir
+popd > /dev/null
+
+if [ -z "$OUTPUT_DIR" ]
+then
+    OUTPUT_DIR=$path/../../build-core/$TARGET_NAME/linux
+fi
+
+mkdir -p "$OUTPUT_DIR"
+pushd $OUTPUT_DIR > /dev/null
+dir=`pwd`
+OUTPUT_DIR=$dir
+popd > /dev/null
+
+echo "OUTPUT_DIR: $OUTPUT_DIR"
+
+# Clean
+rm -rf "$path/build"
+
+# Linux
+cmake -S "$path" -B "$path/build" -DCMAKE_BUILD_TYPE=$CONFIG
+checkError
+
+cmake --build "$path/build" --target $TARGET_NAME -j`nproc`
+checkError
+
+cp "$path"/build/lib$TARGET_NAME.$OUTPUT_SUFFIX "$OUTPUT_DIR"/lib$TARGET_NAME.$OUTPUT_SUFFIX
+checkError
+
+echo "$OUTPUT_DIR"/lib$TARGET_NAME.$OUTPUT_SUFFIX
@@ -0,0 +1,62 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+// Stands in for libFuzzer's main() on compilers without -fsanitize=fuzzer. It runs the fuzz target once on each
+// file named on the command line (a corpus or a crash to reproduce), or on standard input if there are none.
+//
+// Usage: network_header_fuzzer [file ...]
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+
+extern "C" int LLVMFuzzerTestOneInput( const uint8_t *data, size_t size );
+
+static bool runFile( FILE *file )
+{
+	std::vector< uint8_t > input;
+	uint8_t buffer[4096];
+	size_t count;
+	while ( ( count = fread( buffer, 1, sizeof( buffer ), file ) ) > 0 )
+	{
+		input.insert( input.end(), buffer, buffer + count );
+	}
+	if ( ferror( file ) )
+	{
+		return false;
+	}
+
+	LLVMFuzzerTestOneInput( input.empty() ? NULL : &input[0], input.size() );
+	return true;
+}
+
+int main( int argc, char *argv[] )
+{
+	if ( argc < 2 )
+	{
+		return runFile( stdin ) ? 0 : 1;
+	}
+
+	int result = 0;
+	for ( int index = 1; index < argc; index++ )
+	{
+		FILE *file = fopen( argv[index], "rb" );
+		if ( ( NULL == file ) || !runFile( file ) )
+		{
+			fprintf( stderr, "Could not read %s\n", argv[index] );
+			result = 1;
+		}
+		if ( NULL != file )
+		{
+			fclose( file );
+		}
+	}
+	return result;
+}
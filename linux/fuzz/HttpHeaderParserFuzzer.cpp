@@ -0,0 +1,81 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+// libFuzzer target for HttpHeaderParser. Every field must point into the parsed buffer, the parser must move
+// forward with each field, and folded values must copy out without growing.
+
+#include "HttpHeaderParser.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+
+static void checkSlice( const StringSlice& slice, const char *headers, size_t length )
+{
+	if ( ( slice.Data < headers ) || ( slice.Data > headers + length ) ||
+		 ( slice.Length > (size_t)( headers + length - slice.Data ) ) )
+	{
+		abort();
+	}
+}
+
+extern "C" int LLVMFuzzerTestOneInput( const uint8_t *data, size_t size )
+{
+	// Parse a copy of exactly "size" bytes, so the address sanitizer catches reads past the end of the block.
+	char *headers = (char *)malloc( size ? size : 1 );
+	if ( size > 0 )
+	{
+		memcpy( headers, data, size );
+	}
+
+	HttpHeaderParser parser( headers, size );
+	HttpHeaderField field;
+	size_t fieldCount = 0;
+	size_t lastOffset = 0;
+	while ( parser.next( &field ) )
+	{
+		// Every field takes at least one byte of input, so more fields than bytes means the parser is stuck.
+		fieldCount++;
+		if ( ( fieldCount > size ) || ( parser.getOffset() <= lastOffset ) || ( parser.getOffset() > size ) )
+		{
+			abort();
+		}
+		lastOffset = parser.getOffset();
+
+		checkSlice( field.Name, headers, size );
+		checkSlice( field.Value, headers, size );
+		if ( field.IsStatusLine && ( ( 0 != field.Name.Length ) || field.IsFolded ) )
+		{
+			abort();
+		}
+		if ( !field.IsStatusLine && ( 0 == field.Name.Length ) )
+		{
+			abort();
+		}
+
+		std::string value;
+		HttpHeaderParser::appendValue( field, &value );
+		if ( value.size() > field.Value.Length )
+		{
+			abort();
+		}
+
+		HttpHeaderParser::nameEquals( field.Name, "Content-Length" );
+		HttpHeaderParser::nameEquals( field.Name, "" );
+	}
+	if ( parser.getOffset() > size )
+	{
+		abort();
+	}
+
+	free( headers );
+	return 0;
+}
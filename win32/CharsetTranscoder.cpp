@@ -13,10 +13,29 @@
 
 #include <algorithm>
 
+#ifndef _WIN32
+#include <errno.h>
+#include <iconv.h>
+#endif
+
+// Vector instructions used to scan text for non-ASCII bytes. SSE2 is part of every x64 target (and of x86 targets
+// built for it), NEON of every ARM64 target. AVX2 is only used if the build targets it (/arch:AVX2 or -mavx2), since
+// choosing at runtime would cost more than it saves on the response sizes we see. Other targets scan 8 bytes at a time.
+#if defined(__AVX2__)
+#define CHARSET_SCAN_AVX2
+#include <immintrin.h>
+#elif defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__) || ( defined(_M_IX86_FP) && ( _M_IX86_FP >= 2 ) )
+#define CHARSET_SCAN_SSE2
+#include <emmintrin.h>
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#define CHARSET_SCAN_NEON
+#include <arm_neon.h>
+#endif
+
 bool CharsetTranscoder::isInitialized = false;
 CharsetNameCodepageMap CharsetTranscoder::charsetCodepageMap;
 
-void CharsetTranscoder::defineCharset(const char *charset, int codepage, const char *description)
+void CharsetTranscoder::defineCharset(const char *charset, int codepage, const char * /*description*/)
 {
 	std::string charsetString = charset;
 	charsetCodepageMap[charsetString] = codepage;
@@ -157,6 +176,37 @@ int CharsetTranscoder::getCodepageForCharset( const char *charset )
 	return CharsetTranscoder::charsetCodepageMap[charsetString];
 }
 
+#ifndef _WIN32
+// Maps a Windows codepage (as used by the charset table above) to the equivalent iconv charset name.
+//
+std::string CharsetTranscoder::getIconvNameForCodepage( int codepage )
+{
+	char codepageName[16];
+
+	switch ( codepage )
+	{
+		case CP_UTF7:	return "UTF-7";
+		case CP_UTF8:	return "UTF-8";
+		case 1200:		return "UTF-16LE";
+		case 20866:		return "KOI8-R";
+		case 50225:		return "ISO-2022-KR";
+		case 28592:		return "ISO-8859-2";
+		case 28593:		return "ISO-8859-3";
+		case 28594:		return "ISO-8859-4";
+		case 28595:		return "ISO-8859-5";
+		case 28596:		return "ISO-8859-6";
+		case 28597:		return "ISO-8859-7";
+		case 28599:		return "ISO-8859-9";
+		case 28603:		return "ISO-8859-13";
+		case 28605:		return "ISO-8859-15";
+	}
+
+	// The remaining codepages (125x, 874, 932, 936, 949, 950, 852, 866) are all known to iconv as "CPnnn".
+	snprintf( codepageName, sizeof(codepageName), "CP%d", codepage );
+	return codepageName;
+}
+#endif
+
 bool CharsetTranscoder::isSupportedEncoding( const char *charset )
 {
 	if (!isInitialized)
@@ -167,6 +217,153 @@ bool CharsetTranscoder::isSupportedEncoding( const char *charset )
 	return ( 0 != CharsetTranscoder::getCodepageForCharset( charset ) );
 }
 
+// Determines if ASCII bytes stand for the same characters, and nothing else, in the given codepage. This is
+// not the case for UTF-16, nor for the stateful codepages, where ASCII bytes can be part of an escape sequence
+// or of an encoded character.
+//
+bool CharsetTranscoder::isAsciiCompatibleCodepage( int codepage )
+{
+	switch ( codepage )
+	{
+		case 1200:
+		case CP_UTF7:
+		case 50225:
+			return false;
+	}
+	return ( 0 != codepage );
+}
+
+/// Gets the number of bytes at the start of the given text that are 7-bit ASCII.
+/// Scans at memory bandwidth with vector instructions where the target has them.
+size_t CharsetTranscoder::getAsciiLength( const char *bytes, size_t length )
+{
+	const unsigned char *text = (const unsigned char *)bytes;
+	size_t index = 0;
+
+#if defined(CHARSET_SCAN_AVX2)
+	for ( ; index + 64 <= length; index += 64 )
+	{
+		__m256i first = _mm256_loadu_si256( (const __m256i *)( text + index ) );
+		__m256i second = _mm256_loadu_si256( (const __m256i *)( text + index + 32 ) );
+		if ( 0 != _mm256_movemask_epi8( _mm256_or_si256( first, second ) ) )
+		{
+			break;
+		}
+	}
+#elif defined(CHARSET_SCAN_SSE2)
+	for ( ; index + 64 <= length; index += 64 )
+	{
+		__m128i combined = _mm_or_si128(
+				_mm_or_si128( _mm_loadu_si128( (const __m128i *)( text + index ) ), _mm_loadu_si128( (const __m128i *)( text + index + 16 ) ) ),
+				_mm_or_si128( _mm_loadu_si128( (const __m128i *)( text + index + 32 ) ), _mm_loadu_si128( (const __m128i *)( text + index + 48 ) ) ) );
+		if ( 0 != _mm_movemask_epi8( combined ) )
+		{
+			break;
+		}
+	}
+#elif defined(CHARSET_SCAN_NEON)
+	for ( ; index + 64 <= length; index += 64 )
+	{
+		uint8x16_t combined = vorrq_u8(
+				vorrq_u8( vld1q_u8( text + index ), vld1q_u8( text + index + 16 ) ),
+				vorrq_u8( vld1q_u8( text + index + 32 ), vld1q_u8( text + index + 48 ) ) );
+		if ( vmaxvq_u8( combined ) >= 0x80 )
+		{
+			break;
+		}
+	}
+#endif
+
+	// Narrow down to the first non-ASCII byte (or finish a short input) 8 bytes at a time.
+	for ( ; index + 8 <= length; index += 8 )
+	{
+		unsigned long long word;
+		memcpy( &word, text + index, sizeof(word) );
+		if ( 0 != ( word & 0x8080808080808080ULL ) )
+		{
+			break;
+		}
+	}
+	while ( ( index < length ) && ( text[index] < 0x80 ) )
+	{
+		index++;
+	}
+	return index;
+}
+
+/// Determines if the given text is well-formed UTF-8: no overlong forms, surrogates or code points past U+10FFFF,
+/// and no truncated sequence at the end. Runs of ASCII are skipped with getAsciiLength().
+bool CharsetTranscoder::isValidUtf8( const char *bytes, size_t length )
+{
+	const unsigned char *text = (const unsigned char *)bytes;
+	size_t index = 0;
+
+	while ( index < length )
+	{
+		index += getAsciiLength( bytes + index, length - index );
+		if ( index >= length )
+		{
+			break;
+		}
+
+		// Decode one multi-byte sequence, checking the range of the byte after the lead byte per RFC 3629.
+		unsigned char lead = text[index];
+		size_t sequenceLength;
+		unsigned char secondMin = 0x80;
+		unsigned char secondMax = 0xBF;
+		if ( ( lead >= 0xC2 ) && ( lead <= 0xDF ) )
+		{
+			sequenceLength = 2;
+		}
+		else if ( ( lead >= 0xE0 ) && ( lead <= 0xEF ) )
+		{
+			sequenceLength = 3;
+			if ( 0xE0 == lead )
+			{
+				secondMin = 0xA0;
+			}
+			else if ( 0xED == lead )
+			{
+				secondMax = 0x9F;
+			}
+		}
+		else if ( ( lead >= 0xF0 ) && ( lead <= 0xF4 ) )
+		{
+			sequenceLength = 4;
+			if ( 0xF0 == lead )
+			{
+				secondMin = 0x90;
+			}
+			else if ( 0xF4 == lead )
+			{
+				secondMax = 0x8F;
+			}
+		}
+		else
+		{
+			return false;
+		}
+
+		if ( length - index < sequenceLength )
+		{
+			return false;
+		}
+		if ( ( text[index + 1] < secondMin ) || ( text[index + 1] > secondMax ) )
+		{
+			return false;
+		}
+		for ( size_t trailIndex = 2; trailIndex < sequenceLength; trailIndex++ )
+		{
+			if ( ( text[index + trailIndex] & 0xC0 ) != 0x80 )
+			{
+				return false;
+			}
+		}
+		index += sequenceLength;
+	}
+	return true;
+}
+
 bool CharsetTranscoder::transcode( std::string *text, const char *srcCharset, const char *dstCharset )
 {
 	if (!isInitialized)
@@ -179,40 +376,460 @@ bool CharsetTranscoder::transcode( std::string *text, const char *srcCharset, co
 		return false;
 	}
 
+	// Pure ASCII text (most text declared as Latin-1 or ASCII) is the same in both charsets, so leave it as is.
+	//
+	if ( isAsciiCompatibleCodepage( getCodepageForCharset( srcCharset ) ) &&
+		 isAsciiCompatibleCodepage( getCodepageForCharset( dstCharset ) ) &&
+		 ( getAsciiLength( text->data(), text->size() ) == text->size() ) )
+	{
+		debug("Text is ASCII, no need to transcode from %s to %s", srcCharset, dstCharset);
+		return true;
+	}
+
+	// Convert in one pass of the streaming transcoder, so the only other full size copy is the result.
+	//
 	bool bRet = false;
 
+	CharsetStreamTranscoder transcoder;
+	if ( transcoder.open( srcCharset, dstCharset ) )
+	{
+		std::string dstText;
+		dstText.reserve( text->size() );
+		if ( transcoder.write( text->data(), text->size(), &dstText ) && transcoder.finish( &dstText ) )
+		{
+			debug("Successfully transcoded from %s to %s", srcCharset, dstCharset);
+			text->swap( dstText );
+			bRet = true;
+		}
+	}
+
+	return bRet;
+}
+
+// --------------------------------------------------------------------------------------
+// CharsetStreamTranscoder
+// --------------------------------------------------------------------------------------
+
+CharsetStreamTranscoder::CharsetStreamTranscoder( )
+{
+	fSrcCodepage = 0;
+	fDstCodepage = 0;
+	fIsAsciiPassthrough = false;
+	fCarryLength = 0;
+#ifdef _WIN32
+	fSrcMaxCharSize = 1;
+	fIsBufferingInput = false;
+#else
+	fConverter = (iconv_t)-1;
+#endif
+}
+
+CharsetStreamTranscoder::~CharsetStreamTranscoder( )
+{
+	close();
+}
+
+/// Starts a new conversion, ending any conversion in progress.
+/// @return Returns true if both charsets are supported. Returns false if not, leaving the transcoder closed.
+bool CharsetStreamTranscoder::open( const char *srcCharset, const char *dstCharset )
+{
+	close();
+
 	int cpSrc = CharsetTranscoder::getCodepageForCharset( srcCharset );
 	int cpDst = CharsetTranscoder::getCodepageForCharset( dstCharset );
+	if ( ( 0 == cpSrc ) || ( 0 == cpDst ) )
+	{
+		return false;
+	}
+
+#ifdef _WIN32
+	// The codepage functions have no UTF-16 codepage, since UTF-16 is what they convert to and from.
+	// Every other codepage is handed to them, so it must be installed.
+	//
+	if ( ( 1200 != cpDst ) && !IsValidCodePage( cpDst ) )
+	{
+		return false;
+	}
+	if ( 1200 == cpSrc )
+	{
+		fSrcMaxCharSize = 4;
+	}
+	else
+	{
+		CPINFO cpInfo;
+		if ( !GetCPInfo( cpSrc, &cpInfo ) )
+		{
+			return false;
+		}
+		fSrcMaxCharSize = cpInfo.MaxCharSize;
+
+		// Character boundaries can only be found without decoding for single and double byte codepages and
+		// UTF-8. Stateful codepages such as UTF-7 and ISO-2022 (and anything else) are converted in one go.
+		fIsBufferingInput = ( CP_UTF8 != cpSrc ) && ( fSrcMaxCharSize > 2 );
+	}
+#else
+	fConverter = iconv_open( CharsetTranscoder::getIconvNameForCodepage( cpDst ).c_str(), CharsetTranscoder::getIconvNameForCodepage( cpSrc ).c_str() );
+	if ( (iconv_t)-1 == fConverter )
+	{
+		return false;
+	}
+#endif
+
+	fSrcCodepage = cpSrc;
+	fDstCodepage = cpDst;
+	fIsAsciiPassthrough = CharsetTranscoder::isAsciiCompatibleCodepage( cpSrc ) && CharsetTranscoder::isAsciiCompatibleCodepage( cpDst );
+#ifdef _WIN32
+	fIsAsciiPassthrough = fIsAsciiPassthrough && !fIsBufferingInput;
+#endif
+	return true;
+}
+
+/// Determines if a conversion has been started by open() and not ended by close().
+bool CharsetStreamTranscoder::isOpen( )
+{
+	return ( 0 != fSrcCodepage );
+}
+
+/// Converts the next chunk of input and appends the result to the given string. Any partial character at the
+/// end of the chunk is held back until the next write() or finish().
+/// @return Returns true if the chunk was converted. Returns false if the transcoder is not open or the
+///         conversion failed, in which case the output is incomplete.
+bool CharsetStreamTranscoder::write( const char *bytes, size_t length, std::string *output )
+{
+	if ( !isOpen() || ( NULL == output ) )
+	{
+		return false;
+	}
+
+	// Copy leading ASCII straight to the output, which for most text is all of it.
+	//
+	if ( fIsAsciiPassthrough && ( 0 == fCarryLength ) )
+	{
+		size_t asciiLength = CharsetTranscoder::getAsciiLength( bytes, length );
+		output->append( bytes, asciiLength );
+		bytes += asciiLength;
+		length -= asciiLength;
+	}
+
+#ifdef _WIN32
+	if ( fIsBufferingInput )
+	{
+		fBufferedInput.append( bytes, length );
+		return true;
+	}
 
-	if ( ( 0 != cpSrc ) && ( 0 != cpDst ) )
+	// Convert the input one slice at a time, prefixed with whatever was carried over from the last call.
+	//
+	char slice[CHARSET_STREAM_SLICE_SIZE];
+	while ( length > 0 )
 	{
-		// We got two valid codepages, let's see if we can convert from one to the other...
-		//
-		int wideBufferLen = MultiByteToWideChar(cpSrc, 0, text->c_str(), text->size(), NULL, 0);
-		if ( 0 != wideBufferLen )
+		size_t sliceLength = fCarryLength;
+		memcpy( slice, fCarry, fCarryLength );
+
+		size_t copyLength = sizeof(slice) - sliceLength;
+		if ( copyLength > length )
+		{
+			copyLength = length;
+		}
+		memcpy( slice + sliceLength, bytes, copyLength );
+		sliceLength += copyLength;
+		bytes += copyLength;
+		length -= copyLength;
+
+		size_t completeLength = getCompleteLength( slice, sliceLength );
+		fCarryLength = sliceLength - completeLength;
+		if ( fCarryLength > sizeof(fCarry) )
 		{
-			WCHAR * wchars = new WCHAR[wideBufferLen + 1];
+			// Not a partial character after all, just invalid input. Let the codepage functions deal with it.
+			completeLength = sliceLength;
+			fCarryLength = 0;
+		}
+		memcpy( fCarry, slice + completeLength, fCarryLength );
 
-			if ( 0 != MultiByteToWideChar(cpSrc, 0, text->c_str(), text->size(), wchars, wideBufferLen) )
+		if ( !convert( slice, completeLength, output ) )
+		{
+			return false;
+		}
+	}
+	return true;
+#else
+	// First complete the character carried over from the last call with the bytes it is missing.
+	//
+	if ( fCarryLength > 0 )
+	{
+		size_t carriedLength = fCarryLength;
+		size_t takeLength = sizeof(fCarry) - carriedLength;
+		if ( takeLength > length )
+		{
+			takeLength = length;
+		}
+		memcpy( fCarry + carriedLength, bytes, takeLength );
+
+		char *carry = fCarry;
+		size_t carryLeft = carriedLength + takeLength;
+		convert( &carry, &carryLeft, output );
+
+		size_t consumedLength = carriedLength + takeLength - carryLeft;
+		if ( consumedLength >= carriedLength )
+		{
+			// The carried character is complete, carry on from the first input byte not consumed with it.
+			bytes += consumedLength - carriedLength;
+			length -= consumedLength - carriedLength;
+			fCarryLength = 0;
+		}
+		else if ( takeLength == length )
+		{
+			// Still not complete, so there's nothing more to convert yet.
+			memmove( fCarry, carry, carryLeft );
+			fCarryLength = carryLeft;
+			return true;
+		}
+		else
+		{
+			// Longer than any character can be, so it is invalid.
+			appendReplacement( output );
+			fCarryLength = 0;
+		}
+	}
+
+	char *inBuf = (char *)bytes;
+	size_t inBytesLeft = length;
+	convert( &inBuf, &inBytesLeft, output );
+	if ( inBytesLeft > sizeof(fCarry) )
+	{
+		appendReplacement( output );
+		inBytesLeft = 0;
+	}
+	memcpy( fCarry, inBuf, inBytesLeft );
+	fCarryLength = inBytesLeft;
+	return true;
+#endif
+}
+
+/// Converts any input held back by write() and appends the result to the given string. A partial character
+/// left at the end of the input is replaced. The transcoder stays open, but is reset for new input.
+/// @return Returns true if the conversion succeeded. Returns false if the transcoder is not open or the
+///         conversion failed.
+bool CharsetStreamTranscoder::finish( std::string *output )
+{
+	if ( !isOpen() || ( NULL == output ) )
+	{
+		return false;
+	}
+
+	bool bRet = true;
+
+#ifdef _WIN32
+	if ( fIsBufferingInput )
+	{
+		bRet = fBufferedInput.empty() || convert( fBufferedInput.data(), fBufferedInput.size(), output );
+		fBufferedInput.clear();
+	}
+	else if ( fCarryLength > 0 )
+	{
+		bRet = convert( fCarry, fCarryLength, output );
+	}
+#else
+	if ( fCarryLength > 0 )
+	{
+		appendReplacement( output );
+	}
+
+	// Have stateful charsets return to their initial shift state.
+	char outScratch[CHARSET_STREAM_MAX_CARRY * 4];
+	char *outBuf = outScratch;
+	size_t outBytesLeft = sizeof(outScratch);
+	iconv( fConverter, NULL, NULL, &outBuf, &outBytesLeft );
+	output->append( outScratch, sizeof(outScratch) - outBytesLeft );
+	iconv( fConverter, NULL, NULL, NULL, NULL );
+#endif
+
+	fCarryLength = 0;
+	return bRet;
+}
+
+/// Ends the current conversion, dropping any input held back by write().
+void CharsetStreamTranscoder::close( )
+{
+#ifdef _WIN32
+	fIsBufferingInput = false;
+	fBufferedInput.clear();
+#else
+	if ( (iconv_t)-1 != fConverter )
+	{
+		iconv_close( fConverter );
+		fConverter = (iconv_t)-1;
+	}
+#endif
+	fSrcCodepage = 0;
+	fDstCodepage = 0;
+	fIsAsciiPassthrough = false;
+	fCarryLength = 0;
+}
+
+/// Appends the destination charset's replacement for input that could not be converted.
+void CharsetStreamTranscoder::appendReplacement( std::string *output )
+{
+	if ( CP_UTF8 == fDstCodepage )
+	{
+		output->append( "\xEF\xBF\xBD" );
+	}
+	else
+	{
+		output->append( "?" );
+	}
+}
+
+#ifdef _WIN32
+/// Gets the length of the longest prefix of the given bytes that ends on a source character boundary.
+size_t CharsetStreamTranscoder::getCompleteLength( const char *bytes, size_t length )
+{
+	if ( CP_UTF8 == fSrcCodepage )
+	{
+		// Find the lead byte of the last sequence, and see if all of its continuation bytes are there.
+		size_t index = length;
+		while ( ( index > 0 ) && ( length - index < 4 ) && ( ( (unsigned char)bytes[index - 1] & 0xC0 ) == 0x80 ) )
+		{
+			index--;
+		}
+		if ( index > 0 )
+		{
+			unsigned char lead = (unsigned char)bytes[index - 1];
+			size_t sequenceLength = ( lead >= 0xF0 ) ? 4 : ( lead >= 0xE0 ) ? 3 : ( lead >= 0xC0 ) ? 2 : 1;
+			if ( length - ( index - 1 ) < sequenceLength )
+			{
+				return index - 1;
+			}
+		}
+		return length;
+	}
+
+	if ( 1200 == fSrcCodepage )
+	{
+		// Whole UTF-16 code units, not ending on the first half of a surrogate pair.
+		length &= ~(size_t)1;
+		if ( length >= 2 )
+		{
+			WCHAR last = (WCHAR)( (unsigned char)bytes[length - 2] | ( (unsigned char)bytes[length - 1] << 8 ) );
+			if ( ( last >= 0xD800 ) && ( last <= 0xDBFF ) )
+			{
+				length -= 2;
+			}
+		}
+		return length;
+	}
+
+	if ( fSrcMaxCharSize <= 1 )
+	{
+		return length;
+	}
+
+	// Double byte codepage: lead bytes can also be trail bytes, so walk the characters from the start.
+	size_t index = 0;
+	while ( index < length )
+	{
+		index += IsDBCSLeadByteEx( fSrcCodepage, (BYTE)bytes[index] ) ? 2 : 1;
+	}
+	return ( index > length ) ? length - 1 : length;
+}
+
+/// Converts the given bytes (which end on a character boundary) and appends the result to the given string,
+/// going through UTF-16 one slice at a time.
+bool CharsetStreamTranscoder::convert( const char *bytes, size_t length, std::string *output )
+{
+	WCHAR wideSlice[CHARSET_STREAM_SLICE_SIZE];
+	WCHAR *wchars = wideSlice;
+	WCHAR *allocatedWchars = NULL;
+	int wideLength = 0;
+
+	if ( 0 == length )
+	{
+		return true;
+	}
+
+	if ( 1200 == fSrcCodepage )
+	{
+		wideLength = (int)( length / sizeof(WCHAR) );
+		if ( wideLength > CHARSET_STREAM_SLICE_SIZE )
+		{
+			allocatedWchars = new WCHAR[wideLength];
+			wchars = allocatedWchars;
+		}
+		memcpy( wchars, bytes, wideLength * sizeof(WCHAR) );
+	}
+	else
+	{
+		// Every source byte yields at most one UTF-16 code unit, so a slice always fits. Only input collected
+		// for a stateful codepage needs a larger buffer.
+		wideLength = (int)length;
+		if ( wideLength > CHARSET_STREAM_SLICE_SIZE )
+		{
+			allocatedWchars = new WCHAR[wideLength];
+			wchars = allocatedWchars;
+		}
+		wideLength = MultiByteToWideChar( fSrcCodepage, 0, bytes, (int)length, wchars, wideLength );
+	}
+
+	bool bRet = ( wideLength > 0 );
+	if ( bRet )
+	{
+		if ( 1200 == fDstCodepage )
+		{
+			output->append( (const char *)wchars, wideLength * sizeof(WCHAR) );
+		}
+		else
+		{
+			// Convert straight into the end of the output string.
+			int mbLength = WideCharToMultiByte( fDstCodepage, 0, wchars, wideLength, NULL, 0, NULL, NULL );
+			bRet = ( mbLength > 0 );
+			if ( bRet )
 			{
-				// Ensure result is null terminated
-				wchars[wideBufferLen] = 0;
-
-				int mbBufferLen = WideCharToMultiByte( cpDst, 0, wchars, wideBufferLen, NULL, 0, NULL, NULL );
-				if ( 0 != mbBufferLen )
-				{
-					std::string dstText( mbBufferLen, 0 );
-					if ( 0 != WideCharToMultiByte( cpDst, 0, wchars, wideBufferLen, &dstText[0], mbBufferLen, NULL, NULL ) )
-					{
-						debug("Successfully transcoded from %s to %s", srcCharset, dstCharset);
-						text->assign(dstText);
-						bRet = true;
-					}
-				}
+				size_t outputLength = output->size();
+				output->resize( outputLength + mbLength );
+				WideCharToMultiByte( fDstCodepage, 0, wchars, wideLength, &(*output)[outputLength], mbLength, NULL, NULL );
 			}
-			delete [] wchars;
 		}
 	}
 
+	delete [] allocatedWchars;
 	return bRet;
 }
+#else
+/// Converts as much of the given input as possible and appends the result to the given string, through a fixed
+/// size scratch buffer. Invalid input is replaced. Stops early only at a partial character at the end of the input,
+/// leaving "bytes" and "length" pointing at it.
+void CharsetStreamTranscoder::convert( char **bytes, size_t *length, std::string *output )
+{
+	char outScratch[CHARSET_STREAM_SLICE_SIZE];
+
+	while ( *length > 0 )
+	{
+		char *outBuf = outScratch;
+		size_t outBytesLeft = sizeof(outScratch);
+		size_t result = iconv( fConverter, bytes, length, &outBuf, &outBytesLeft );
+		output->append( outScratch, sizeof(outScratch) - outBytesLeft );
+
+		if ( (size_t)-1 != result )
+		{
+			continue;
+		}
+		if ( EILSEQ == errno )
+		{
+			appendReplacement( output );
+			(*bytes)++;
+			(*length)--;
+		}
+		else if ( EINVAL == errno )
+		{
+			break;
+		}
+		else if ( E2BIG != errno )
+		{
+			// Something iconv can't recover from, drop the rest.
+			appendReplacement( output );
+			*bytes += *length;
+			*length = 0;
+		}
+	}
+}
+#endif
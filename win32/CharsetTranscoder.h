@@ -10,11 +10,19 @@
 #ifndef _CharsetTranscoder_H_
 #define _CharsetTranscoder_H_
 
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN             // Exclude rarely-used stuff from Windows headers
 #include "windows.h"
+#else
+#include "LinuxNetworkCompat.h"
+#endif
 #include <map>
 #include <string>
 
+#ifndef _WIN32
+#include <iconv.h>
+#endif
+
 typedef std::map<std::string, int>	CharsetNameCodepageMap;
 
 class CharsetTranscoder
@@ -24,6 +32,9 @@ public:
 	static bool isSupportedEncoding( const char *charset );
 	static bool transcode( std::string *text, const char *srcCharset, const char *dstCharset );
 
+	static size_t getAsciiLength( const char *bytes, size_t length );
+	static bool isValidUtf8( const char *bytes, size_t length );
+
 private:
 
 	static bool isInitialized;
@@ -31,8 +42,68 @@ private:
 
 	static void initialize( );
 	static int getCodepageForCharset( const char *charset );
+#ifndef _WIN32
+	static std::string getIconvNameForCodepage( int codepage );
+#endif
 	static void defineCharset(const char *charset, int codepage, const char *description);
+	static bool isAsciiCompatibleCodepage( int codepage );
+
+	friend class CharsetStreamTranscoder;
+};
+
+/// Number of input bytes converted per step by a CharsetStreamTranscoder, which sizes its fixed scratch buffers.
+#define CHARSET_STREAM_SLICE_SIZE 4096
+
+/// Longest partial character that a CharsetStreamTranscoder carries over from one chunk of input to the next.
+#define CHARSET_STREAM_MAX_CARRY 8
+
+/// Converts text from one charset to another as it arrives in chunks, appending the result to an output string.
+///
+/// Characters split across chunks are carried over to the next write() in a small fixed buffer, and conversion
+/// goes through fixed size scratch buffers, so there is never a second full size copy of the text. The only
+/// exception are stateful charsets on Windows (UTF-7, ISO-2022), whose input is collected and converted on finish().
+/// Invalid input is replaced rather than failing the conversion, just like the Windows codepage functions do.
+class CharsetStreamTranscoder
+{
+public:
+
+	CharsetStreamTranscoder( );
+	~CharsetStreamTranscoder( );
+
+	bool open( const char *srcCharset, const char *dstCharset );
+	bool isOpen( );
+	bool write( const char *bytes, size_t length, std::string *output );
+	bool finish( std::string *output );
+	void close( );
+
+private:
+
+	int fSrcCodepage;
+	int fDstCodepage;
+
+	/// Set if ASCII text reads the same in both charsets, so runs of ASCII input can be copied to the output as is.
+	bool fIsAsciiPassthrough;
+
+	/// Trailing bytes of the last write() that did not form a complete character yet.
+	char fCarry[CHARSET_STREAM_MAX_CARRY];
+	size_t fCarryLength;
+
+#ifdef _WIN32
+	/// Largest number of bytes per character in the source codepage.
+	UINT fSrcMaxCharSize;
+
+	/// Set for stateful source codepages, whose input is collected in "fBufferedInput" until finish().
+	bool fIsBufferingInput;
+	std::string fBufferedInput;
+
+	size_t getCompleteLength( const char *bytes, size_t length );
+	bool convert( const char *bytes, size_t length, std::string *output );
+#else
+	iconv_t fConverter;
 
+	void convert( char **bytes, size_t *length, std::string *output );
+#endif
+	void appendReplacement( std::string *output );
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,141 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "CoronaLog.h"
+#include "CoalescedRequest.h"
+
+
+#pragma region Constructors and Destructors
+/// Creates a request coalesced onto the given request operation.
+/// @param requestParams The request, which this object takes ownership of.
+/// @param requestOperation The operation of the identical request in flight.
+CoalescedRequest::CoalescedRequest( NetworkRequestParameters *requestParams, const std::shared_ptr<NetworkRequestOperation>& requestOperation )
+:	fRequestOperation( requestOperation )
+{
+	fRequestParams = requestParams;
+	fRequestCanceller = NULL;
+}
+
+CoalescedRequest::~CoalescedRequest( )
+{
+	if ( NULL != fRequestParams )
+	{
+		delete fRequestParams;
+	}
+}
+
+#pragma endregion
+
+
+#pragma region Public Functions
+/// Creates the request's canceller, which holds this object, and which is handed to Lua as its requestId.
+RequestCanceller* CoalescedRequest::Start( const std::shared_ptr<CoalescedRequest>& thiz )
+{
+	fRequestCanceller = new RequestCanceller( thiz );
+	fRequestCanceller->AddRef();
+	return fRequestCanceller;
+}
+
+/// Determines if the request was cancelled, or has ended.
+bool CoalescedRequest::IsCancelled( )
+{
+	return ( NULL == fRequestCanceller ) || fRequestCanceller->isCancelled();
+}
+
+/// Dispatches the current phase of the operation's request state to this request's listener.
+void CoalescedRequest::Notify( NetworkRequestState *requestState )
+{
+	if ( NULL == fRequestCanceller )
+	{
+		return;
+	}
+	LuaCallback* luaCallback = fRequestParams->getLuaCallback();
+	if ( NULL != luaCallback )
+	{
+		luaCallback->callWithNetworkRequestState( requestState, fRequestCanceller );
+	}
+}
+
+/// Releases the request once the operation has ended, after its "ended" event (if any) was dispatched.
+void CoalescedRequest::End( )
+{
+	if ( NULL == fRequestCanceller )
+	{
+		return;
+	}
+	LuaCallback* luaCallback = fRequestParams->getLuaCallback();
+	if ( NULL != luaCallback )
+	{
+		luaCallback->unregister();
+	}
+
+	// The canceller holds this object, so our reference must go now. Lua may still hold the canceller, which
+	// must not reach the operation anymore, as it may be reused by another request.
+	fRequestOperation.reset();
+	fRequestCanceller->Release();
+	fRequestCanceller = NULL;
+	delete fRequestParams;
+	fRequestParams = NULL;
+}
+
+/// Called by the request's canceller. Only lets the operation know, which is aborted if nothing else wants it.
+void CoalescedRequest::RequestAbort( )
+{
+	std::shared_ptr<NetworkRequestOperation> requestOperation = fRequestOperation.lock();
+	if ( requestOperation )
+	{
+		requestOperation->RequestCancel();
+	}
+}
+
+/// Determines if a request may be coalesced onto an identical one, i.e. if it is idempotent, has no body, and
+/// has its response delivered in memory (rather than to a file of its own). The requests of a segmented download
+/// are not, as their events go to the download.
+bool CoalescedRequest::isRequestCoalescable( NetworkRequestParameters *requestParams )
+{
+	UTF8String method = requestParams->getRequestMethod();
+	if ( ( 0 != _strcmpi( "GET", method.c_str() ) ) && ( 0 != _strcmpi( "HEAD", method.c_str() ) ) )
+	{
+		return false;
+	}
+	return ( TYPE_NONE == requestParams->getRequestBody()->bodyType ) && ( NULL == requestParams->getResponseFile() ) &&
+		( NULL == requestParams->getDownloadSegment() );
+}
+
+/// Gets the key that identical requests share: the method, URL, request headers, and the parameters that change
+/// the response or the events delivered for it.
+UTF8String CoalescedRequest::getKey( NetworkRequestParameters *requestParams )
+{
+	UTF8String key = requestParams->getRequestMethod();
+	key += " ";
+	key += requestParams->getRequestUrl();
+	key += "\n";
+	key += (char)( '0' + (int)requestParams->getProgressDirection() );
+	key += requestParams->getHandleRedirects() ? 'r' : '-';
+	key += requestParams->isCompressionEnabled() ? 'z' : '-';
+	key += requestParams->isCacheEnabled() ? 'c' : '-';
+	key += "\n";
+	key += requestParams->getRequestHeaderString();
+	return key;
+}
+
+/// Determines if any of the given requests still wants its events.
+bool CoalescedRequest::hasActiveRequests( const List& requests )
+{
+	for ( List::const_iterator iter = requests.begin(); iter != requests.end(); iter++ )
+	{
+		if ( !(*iter)->IsCancelled() )
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+#pragma endregion
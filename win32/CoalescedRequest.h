@@ -0,0 +1,57 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef _CoalescedRequest_H_
+#define _CoalescedRequest_H_
+
+#include "WindowsNetworkSupport.h"
+
+#include <memory>
+#include <vector>
+
+
+/// A request that was coalesced onto an identical request already in flight (same method, URL and request
+/// headers, and no request body), instead of being given its own request operation.
+///
+/// The operation of the request in flight dispatches each of its events to the listener of every request
+/// coalesced onto it, from its own request state (so the response body is shared rather than copied), but with
+/// each request's own requestId. Cancelling a coalesced request only stops its own events. The operation is
+/// aborted once neither its own request nor any request coalesced onto it is left to receive its response.
+/// Only used on the main thread.
+class CoalescedRequest : public NetworkRequestOperation
+{
+public:
+
+	/// The requests coalesced onto a request operation.
+	typedef std::vector< std::shared_ptr<CoalescedRequest> > List;
+
+	CoalescedRequest( NetworkRequestParameters *requestParams, const std::shared_ptr<NetworkRequestOperation>& requestOperation );
+	virtual ~CoalescedRequest( );
+
+	RequestCanceller* Start( const std::shared_ptr<CoalescedRequest>& thiz );
+	bool IsCancelled( );
+	void Notify( NetworkRequestState *requestState );
+	void End( );
+	virtual void RequestAbort( );
+
+	static bool isRequestCoalescable( NetworkRequestParameters *requestParams );
+	static UTF8String getKey( NetworkRequestParameters *requestParams );
+	static bool hasActiveRequests( const List& requests );
+
+private:
+
+	NetworkRequestParameters* fRequestParams;
+	RequestCanceller* fRequestCanceller;
+
+	/// The operation this request was coalesced onto, told when this request is cancelled. Not held, since the
+	/// operation holds this object until the request ends.
+	std::weak_ptr<NetworkRequestOperation> fRequestOperation;
+};
+
+#endif
@@ -0,0 +1,285 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "ContentDecoder.h"
+
+#include <ctype.h>
+#include <string.h>
+
+
+/// Window bits that have inflate() detect a gzip or zlib header by itself.
+#define CONTENT_DECODER_AUTO_HEADER_WINDOW_BITS ( 15 + 32 )
+
+/// Window bits for a zlib header, and for raw deflate data without one.
+#define CONTENT_DECODER_ZLIB_WINDOW_BITS 15
+#define CONTENT_DECODER_RAW_WINDOW_BITS -15
+
+ContentDecoder::ContentDecoder( )
+{
+	fFormat = kFormatNone;
+	fIsStreamEnded = false;
+	fHasInput = false;
+	fIsAwaitingHeader = false;
+	fHeaderLength = 0;
+	fIsZlibInitialized = false;
+	memset( &fZlibStream, 0, sizeof(fZlibStream) );
+#ifdef NETWORK_HAVE_BROTLI
+	fBrotliDecoder = NULL;
+#endif
+}
+
+ContentDecoder::~ContentDecoder( )
+{
+	close();
+}
+
+/// Determines if a response with the given Content-Encoding header value can be decoded.
+bool ContentDecoder::isSupportedEncoding( const char *contentEncoding )
+{
+	return ( kFormatNone != getFormat( contentEncoding ) );
+}
+
+/// Prepares to decode a response body with the given Content-Encoding header value.
+/// @return Returns false if the content coding is not supported (including "identity"), in which case the
+///         body is to be used as received.
+bool ContentDecoder::open( const char *contentEncoding )
+{
+	close();
+
+	Format format = getFormat( contentEncoding );
+	switch ( format )
+	{
+		case kFormatGzip:
+			if ( !initializeZlib( CONTENT_DECODER_AUTO_HEADER_WINDOW_BITS ) )
+			{
+				return false;
+			}
+			break;
+
+		case kFormatDeflate:
+			// Whether there is a zlib header is only known once the first bytes arrive.
+			fIsAwaitingHeader = true;
+			break;
+
+#ifdef NETWORK_HAVE_BROTLI
+		case kFormatBrotli:
+			fBrotliDecoder = BrotliDecoderCreateInstance( NULL, NULL, NULL );
+			if ( NULL == fBrotliDecoder )
+			{
+				return false;
+			}
+			break;
+#endif
+
+		default:
+			return false;
+	}
+
+	fFormat = format;
+	return true;
+}
+
+bool ContentDecoder::isOpen( )
+{
+	return ( kFormatNone != fFormat );
+}
+
+/// Decodes the next chunk of the response body, appending the result to the given output.
+/// @return Returns false if the body is not validly encoded.
+bool ContentDecoder::write( const char *bytes, size_t length, std::string *output )
+{
+	if ( !isOpen() || ( 0 == length ) )
+	{
+		return true;
+	}
+	fHasInput = true;
+
+	const unsigned char *input = (const unsigned char *)bytes;
+
+#ifdef NETWORK_HAVE_BROTLI
+	if ( kFormatBrotli == fFormat )
+	{
+		return decodeBrotli( input, length, output );
+	}
+#endif
+
+	if ( fIsAwaitingHeader )
+	{
+		while ( ( fHeaderLength < sizeof(fHeader) ) && ( length > 0 ) )
+		{
+			fHeader[fHeaderLength++] = *input++;
+			length--;
+		}
+		if ( fHeaderLength < sizeof(fHeader) )
+		{
+			return true;
+		}
+		fIsAwaitingHeader = false;
+
+		// A zlib header gives the deflate method in the low bits of its first byte, and is a multiple of 31.
+		bool hasZlibHeader = ( 8 == ( fHeader[0] & 0x0f ) ) && ( 0 == ( ( fHeader[0] << 8 ) | fHeader[1] ) % 31 );
+		if ( !initializeZlib( hasZlibHeader ? CONTENT_DECODER_ZLIB_WINDOW_BITS : CONTENT_DECODER_RAW_WINDOW_BITS ) ||
+			 !inflateBytes( fHeader, sizeof(fHeader), output ) )
+		{
+			return false;
+		}
+	}
+
+	return inflateBytes( input, length, output );
+}
+
+/// Ends decoding once the whole response body has been written.
+/// @return Returns true if the body was complete, false if it was cut off before the end of the encoded data.
+bool ContentDecoder::finish( )
+{
+	return !isOpen() || !fHasInput || fIsStreamEnded;
+}
+
+/// Releases the decoder's resources. It can be opened again for another response.
+void ContentDecoder::close( )
+{
+	if ( fIsZlibInitialized )
+	{
+		inflateEnd( &fZlibStream );
+		fIsZlibInitialized = false;
+	}
+#ifdef NETWORK_HAVE_BROTLI
+	if ( NULL != fBrotliDecoder )
+	{
+		BrotliDecoderDestroyInstance( fBrotliDecoder );
+		fBrotliDecoder = NULL;
+	}
+#endif
+	fFormat = kFormatNone;
+	fIsStreamEnded = false;
+	fHasInput = false;
+	fIsAwaitingHeader = false;
+	fHeaderLength = 0;
+}
+
+// Gets the format for a Content-Encoding header value. Only a single coding is supported, since nobody stacks them.
+ContentDecoder::Format ContentDecoder::getFormat( const char *contentEncoding )
+{
+	if ( NULL == contentEncoding )
+	{
+		return kFormatNone;
+	}
+
+	while ( isspace( (unsigned char)*contentEncoding ) )
+	{
+		contentEncoding++;
+	}
+	size_t length = strlen( contentEncoding );
+	while ( ( length > 0 ) && isspace( (unsigned char)contentEncoding[length - 1] ) )
+	{
+		length--;
+	}
+
+	std::string coding( contentEncoding, length );
+	for ( size_t i = 0; i < coding.size(); i++ )
+	{
+		coding[i] = (char)tolower( (unsigned char)coding[i] );
+	}
+
+	if ( ( "gzip" == coding ) || ( "x-gzip" == coding ) )
+	{
+		return kFormatGzip;
+	}
+	if ( "deflate" == coding )
+	{
+		return kFormatDeflate;
+	}
+#ifdef NETWORK_HAVE_BROTLI
+	if ( "br" == coding )
+	{
+		return kFormatBrotli;
+	}
+#endif
+	return kFormatNone;
+}
+
+bool ContentDecoder::initializeZlib( int windowBits )
+{
+	memset( &fZlibStream, 0, sizeof(fZlibStream) );
+	if ( Z_OK != inflateInit2( &fZlibStream, windowBits ) )
+	{
+		return false;
+	}
+	fIsZlibInitialized = true;
+	return true;
+}
+
+// Runs the given bytes through zlib, one scratch buffer of output at a time.
+bool ContentDecoder::inflateBytes( const unsigned char *bytes, size_t length, std::string *output )
+{
+	fZlibStream.next_in = (Bytef *)bytes;
+	fZlibStream.avail_in = (uInt)length;
+
+	bool isOutputFull = false;
+	while ( ( fZlibStream.avail_in > 0 ) || isOutputFull )
+	{
+		if ( fIsStreamEnded )
+		{
+			// Gzip members may follow each other, and are decoded as one body. Anything else after the end of
+			// the stream is ignored.
+			if ( ( kFormatGzip != fFormat ) || ( 0x1f != *fZlibStream.next_in ) || ( Z_OK != inflateReset( &fZlibStream ) ) )
+			{
+				return true;
+			}
+			fIsStreamEnded = false;
+		}
+
+		fZlibStream.next_out = (Bytef *)fScratch;
+		fZlibStream.avail_out = (uInt)sizeof(fScratch);
+		int result = ::inflate( &fZlibStream, Z_NO_FLUSH );
+		output->append( fScratch, sizeof(fScratch) - fZlibStream.avail_out );
+		isOutputFull = ( 0 == fZlibStream.avail_out );
+
+		if ( Z_STREAM_END == result )
+		{
+			fIsStreamEnded = true;
+			isOutputFull = false;
+		}
+		else if ( ( Z_OK != result ) && ( Z_BUF_ERROR != result ) )
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+#ifdef NETWORK_HAVE_BROTLI
+bool ContentDecoder::decodeBrotli( const unsigned char *bytes, size_t length, std::string *output )
+{
+	const uint8_t *nextIn = bytes;
+	size_t availableIn = length;
+	while ( !fIsStreamEnded )
+	{
+		uint8_t *nextOut = (uint8_t *)fScratch;
+		size_t availableOut = sizeof(fScratch);
+		BrotliDecoderResult result = BrotliDecoderDecompressStream(
+			fBrotliDecoder, &availableIn, &nextIn, &availableOut, &nextOut, NULL );
+		output->append( fScratch, sizeof(fScratch) - availableOut );
+
+		if ( BROTLI_DECODER_RESULT_SUCCESS == result )
+		{
+			fIsStreamEnded = true;
+		}
+		else if ( BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT == result )
+		{
+			break;
+		}
+		else if ( BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT != result )
+		{
+			return false;
+		}
+	}
+	return true;
+}
+#endif
@@ -0,0 +1,98 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef _ContentDecoder_H_
+#define _ContentDecoder_H_
+
+#include <stddef.h>
+
+#include <string>
+
+#include <zlib.h>
+
+#ifdef NETWORK_HAVE_BROTLI
+#include <brotli/decode.h>
+#endif
+
+
+/// Number of decoded bytes produced per step by a ContentDecoder, which sizes its fixed scratch buffer.
+#define CONTENT_DECODER_SLICE_SIZE 16384
+
+/// The value of the Accept-Encoding request header sent for params.compression = "auto", listing the content
+/// codings a ContentDecoder can undo.
+#ifdef NETWORK_HAVE_BROTLI
+#define CONTENT_DECODER_ACCEPT_ENCODING "gzip, deflate, br"
+#else
+#define CONTENT_DECODER_ACCEPT_ENCODING "gzip, deflate"
+#endif
+
+/// Undoes the content coding of an HTTP response body (its Content-Encoding header) as the body arrives in chunks,
+/// appending the decoded bytes to an output string.
+///
+/// Supports "gzip" (including concatenated gzip members), "deflate" (zlib wrapped, or raw deflate as sent by some
+/// servers) and, if built with NETWORK_HAVE_BROTLI, "br". Decoding goes through a fixed size scratch buffer, so the
+/// decoder never holds more than one slice of output of its own.
+class ContentDecoder
+{
+public:
+
+	ContentDecoder( );
+	~ContentDecoder( );
+
+	static bool isSupportedEncoding( const char *contentEncoding );
+
+	bool open( const char *contentEncoding );
+	bool isOpen( );
+	bool write( const char *bytes, size_t length, std::string *output );
+	bool finish( );
+	void close( );
+
+private:
+
+	enum Format
+	{
+		kFormatNone,
+		kFormatGzip,
+		kFormatDeflate,
+		kFormatBrotli
+	};
+
+	static Format getFormat( const char *contentEncoding );
+
+	Format fFormat;
+
+	/// Set once the end of the encoded stream has been decoded. Any bytes after it are ignored.
+	bool fIsStreamEnded;
+
+	/// Set once any bytes have been written, since an empty body is complete without an end of stream.
+	bool fHasInput;
+
+	/// Set for "deflate" until the first two bytes have been seen, which tell a zlib header from raw deflate data.
+	/// Until then they are held in "fHeader".
+	bool fIsAwaitingHeader;
+	unsigned char fHeader[2];
+	size_t fHeaderLength;
+
+	bool fIsZlibInitialized;
+	z_stream fZlibStream;
+
+#ifdef NETWORK_HAVE_BROTLI
+	BrotliDecoderState *fBrotliDecoder;
+#endif
+
+	char fScratch[CONTENT_DECODER_SLICE_SIZE];
+
+	bool initializeZlib( int windowBits );
+	bool inflateBytes( const unsigned char *bytes, size_t length, std::string *output );
+#ifdef NETWORK_HAVE_BROTLI
+	bool decodeBrotli( const unsigned char *bytes, size_t length, std::string *output );
+#endif
+};
+
+#endif
@@ -0,0 +1,156 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "ContentEncoder.h"
+
+#include <string.h>
+
+
+/// Window bits that have deflate() write a gzip header and trailer.
+#define CONTENT_ENCODER_GZIP_WINDOW_BITS ( 15 + 16 )
+
+/// Compression level used for request bodies. Level 6 (zlib's default) gets most of the size reduction of level 9
+/// at a fraction of the time.
+#define CONTENT_ENCODER_LEVEL 6
+
+/// Memory level of the compressor (zlib's default).
+#define CONTENT_ENCODER_MEMORY_LEVEL 8
+
+ContentEncoder::ContentEncoder( )
+{
+	fIsOpen = false;
+	fIsChunked = false;
+	memset( &fZlibStream, 0, sizeof(fZlibStream) );
+}
+
+ContentEncoder::~ContentEncoder( )
+{
+	close();
+}
+
+/// Prepares to compress a new request body.
+/// @param isChunked Set to frame the output as the chunks of a "Transfer-Encoding: chunked" body.
+/// @return Returns false if the compressor could not be created.
+bool ContentEncoder::open( bool isChunked )
+{
+	close();
+
+	memset( &fZlibStream, 0, sizeof(fZlibStream) );
+	if ( Z_OK != deflateInit2( &fZlibStream, CONTENT_ENCODER_LEVEL, Z_DEFLATED,
+							   CONTENT_ENCODER_GZIP_WINDOW_BITS, CONTENT_ENCODER_MEMORY_LEVEL, Z_DEFAULT_STRATEGY ) )
+	{
+		return false;
+	}
+	fIsOpen = true;
+	fIsChunked = isChunked;
+	return true;
+}
+
+bool ContentEncoder::isOpen( )
+{
+	return fIsOpen;
+}
+
+/// Compresses the next part of the request body, appending whatever compressed bytes are ready to the given output.
+/// The compressor holds on to input until it has enough of it, so this may append nothing.
+bool ContentEncoder::write( const char *bytes, size_t length, std::string *output )
+{
+	if ( !fIsOpen )
+	{
+		return false;
+	}
+	return ( 0 == length ) || deflateBytes( bytes, length, Z_NO_FLUSH, output );
+}
+
+/// Appends the rest of the compressed body (and the last chunk, if chunked) to the given output.
+/// The encoder has to be opened again before the next body.
+bool ContentEncoder::finish( std::string *output )
+{
+	if ( !fIsOpen )
+	{
+		return false;
+	}
+	bool wasSuccessful = deflateBytes( NULL, 0, Z_FINISH, output );
+	if ( wasSuccessful && fIsChunked )
+	{
+		output->append( "0\r\n\r\n", 5 );
+	}
+	close();
+	return wasSuccessful;
+}
+
+/// Releases the compressor's resources.
+void ContentEncoder::close( )
+{
+	if ( fIsOpen )
+	{
+		deflateEnd( &fZlibStream );
+		fIsOpen = false;
+	}
+}
+
+// Runs the given bytes through zlib one scratch buffer at a time, and appends the output as one chunk.
+bool ContentEncoder::deflateBytes( const char *bytes, size_t length, int flush, std::string *output )
+{
+	// Leave room for the chunk size line, which is only known once the chunk's data is.
+	size_t chunkStart = output->size();
+	if ( fIsChunked )
+	{
+		output->append( 10, ' ' );
+	}
+	size_t dataStart = output->size();
+
+	fZlibStream.next_in = (Bytef *)bytes;
+	fZlibStream.avail_in = (uInt)length;
+	for (;;)
+	{
+		fZlibStream.next_out = (Bytef *)fScratch;
+		fZlibStream.avail_out = (uInt)sizeof(fScratch);
+		int result = ::deflate( &fZlibStream, flush );
+		if ( ( Z_OK != result ) && ( Z_STREAM_END != result ) && ( Z_BUF_ERROR != result ) )
+		{
+			output->resize( chunkStart );
+			return false;
+		}
+		output->append( fScratch, sizeof(fScratch) - fZlibStream.avail_out );
+
+		// Done once all input has been taken and the output did not fill the scratch buffer (so nothing is pending),
+		// or once the end of the stream has been written.
+		if ( ( Z_STREAM_END == result ) || ( ( 0 == fZlibStream.avail_in ) && ( 0 != fZlibStream.avail_out ) && ( Z_FINISH != flush ) ) )
+		{
+			break;
+		}
+	}
+
+	size_t dataLength = output->size() - dataStart;
+	if ( !fIsChunked )
+	{
+		return true;
+	}
+	if ( 0 == dataLength )
+	{
+		output->resize( chunkStart );
+		return true;
+	}
+
+	// Write the size line (hex digits and CRLF) right in front of the data, and close the chunk.
+	static const char kHexDigits[] = "0123456789abcdef";
+	char sizeLine[20];
+	size_t sizeLineStart = sizeof(sizeLine) - 2;
+	sizeLine[sizeLineStart] = '\r';
+	sizeLine[sizeLineStart + 1] = '\n';
+	do
+	{
+		sizeLine[--sizeLineStart] = kHexDigits[dataLength & 0xf];
+		dataLength >>= 4;
+	} while ( dataLength > 0 );
+	output->replace( chunkStart, dataStart - chunkStart, sizeLine + sizeLineStart, sizeof(sizeLine) - sizeLineStart );
+	output->append( "\r\n", 2 );
+	return true;
+}
@@ -0,0 +1,52 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef _ContentEncoder_H_
+#define _ContentEncoder_H_
+
+#include <stddef.h>
+
+#include <string>
+
+#include <zlib.h>
+
+
+/// Number of encoded bytes produced per step by a ContentEncoder, which sizes its fixed scratch buffer.
+#define CONTENT_ENCODER_SLICE_SIZE 16384
+
+/// Gzip compresses an HTTP request body as it is sent, appending the result to an output string.
+///
+/// Since the size of the compressed body is not known until all of it has been compressed, the output can be framed
+/// as chunks of a "Transfer-Encoding: chunked" body, one chunk per write() that produced output, with finish()
+/// appending the last (empty) chunk.
+class ContentEncoder
+{
+public:
+
+	ContentEncoder( );
+	~ContentEncoder( );
+
+	bool open( bool isChunked );
+	bool isOpen( );
+	bool write( const char *bytes, size_t length, std::string *output );
+	bool finish( std::string *output );
+	void close( );
+
+private:
+
+	bool fIsOpen;
+	bool fIsChunked;
+	z_stream fZlibStream;
+
+	char fScratch[CONTENT_ENCODER_SLICE_SIZE];
+
+	bool deflateBytes( const char *bytes, size_t length, int flush, std::string *output );
+};
+
+#endif
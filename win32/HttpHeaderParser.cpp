@@ -0,0 +1,184 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "HttpHeaderParser.h"
+
+#include <ctype.h>
+#include <string.h>
+
+
+static bool isHeaderSpace( char c )
+{
+	return ( ' ' == c ) || ( '\t' == c );
+}
+
+HttpHeaderParser::HttpHeaderParser( const char *headers, size_t length )
+{
+	fHeaders = headers;
+	fLength = ( NULL == headers ) ? 0 : length;
+	fOffset = 0;
+	fIsFirstLine = true;
+	fIsDone = false;
+}
+
+/// Gets the next field of the header block.
+/// @return Returns true if a field was found. Returns false once the end of the header block has been reached.
+bool HttpHeaderParser::next( HttpHeaderField *field )
+{
+	while ( !fIsDone && ( fOffset < fLength ) )
+	{
+		size_t lineStart = fOffset;
+		size_t lineEnd = findLineEnd( lineStart );
+		fOffset = skipLineBreak( lineEnd );
+
+		if ( lineEnd == lineStart )
+		{
+			// The empty line ending the header block (unless nothing has been seen yet).
+			fIsDone = !fIsFirstLine;
+			continue;
+		}
+
+		const char *line = fHeaders + lineStart;
+		size_t lineLength = lineEnd - lineStart;
+		const char *colon = (const char *)memchr( line, ':', lineLength );
+
+		if ( fIsFirstLine )
+		{
+			fIsFirstLine = false;
+			if ( ( NULL == colon ) || ( ( lineLength >= 5 ) && ( 0 == memcmp( line, "HTTP/", 5 ) ) ) )
+			{
+				field->Name.Data = line;
+				field->Name.Length = 0;
+				field->Value.Data = line;
+				field->Value.Length = lineLength;
+				field->IsStatusLine = true;
+				field->IsFolded = false;
+				return true;
+			}
+		}
+
+		// A continuation line with no field before it, or a line that isn't a field at all.
+		if ( isHeaderSpace( *line ) || ( NULL == colon ) )
+		{
+			continue;
+		}
+
+		size_t nameLength = colon - line;
+		while ( ( nameLength > 0 ) && isHeaderSpace( line[nameLength - 1] ) )
+		{
+			nameLength--;
+		}
+		if ( 0 == nameLength )
+		{
+			continue;
+		}
+
+		size_t valueStart = ( colon - fHeaders ) + 1;
+		while ( ( valueStart < lineEnd ) && isHeaderSpace( fHeaders[valueStart] ) )
+		{
+			valueStart++;
+		}
+
+		// Lines starting with whitespace continue the value (obsolete line folding).
+		size_t valueEnd = lineEnd;
+		field->IsFolded = false;
+		while ( ( fOffset < fLength ) && isHeaderSpace( fHeaders[fOffset] ) )
+		{
+			field->IsFolded = true;
+			valueEnd = findLineEnd( fOffset );
+			fOffset = skipLineBreak( valueEnd );
+		}
+		while ( ( valueEnd > valueStart ) && isspace( (unsigned char)fHeaders[valueEnd - 1] ) )
+		{
+			valueEnd--;
+		}
+
+		field->Name.Data = line;
+		field->Name.Length = nameLength;
+		field->Value.Data = fHeaders + valueStart;
+		field->Value.Length = valueEnd - valueStart;
+		field->IsStatusLine = false;
+		return true;
+	}
+	return false;
+}
+
+/// Determines if the given field name is the expected one, ignoring case.
+bool HttpHeaderParser::nameEquals( const StringSlice& name, const char *expectedName )
+{
+	if ( name.Length != strlen( expectedName ) )
+	{
+		return false;
+	}
+	for ( size_t i = 0; i < name.Length; i++ )
+	{
+		if ( tolower( (unsigned char)name.Data[i] ) != tolower( (unsigned char)expectedName[i] ) )
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/// Appends the value of the given field to a string, replacing every line fold by a single space.
+void HttpHeaderParser::appendValue( const HttpHeaderField& field, std::string *output )
+{
+	if ( !field.IsFolded )
+	{
+		output->append( field.Value.Data, field.Value.Length );
+		return;
+	}
+
+	size_t outputStart = output->size();
+	const char *value = field.Value.Data;
+	const char *valueEnd = value + field.Value.Length;
+	while ( value < valueEnd )
+	{
+		if ( ( '\r' == *value ) || ( '\n' == *value ) )
+		{
+			while ( ( output->size() > outputStart ) && isHeaderSpace( (*output)[output->size() - 1] ) )
+			{
+				output->resize( output->size() - 1 );
+			}
+			while ( ( value < valueEnd ) && ( ( '\r' == *value ) || ( '\n' == *value ) || isHeaderSpace( *value ) ) )
+			{
+				value++;
+			}
+			output->push_back( ' ' );
+		}
+		else
+		{
+			output->push_back( *value++ );
+		}
+	}
+}
+
+// Gets the index of the line break (or end of the buffer) ending the line that starts at the given index.
+size_t HttpHeaderParser::findLineEnd( size_t offset ) const
+{
+	while ( ( offset < fLength ) && ( '\r' != fHeaders[offset] ) && ( '\n' != fHeaders[offset] ) )
+	{
+		offset++;
+	}
+	return offset;
+}
+
+// Gets the index after the line break (CRLF or LF) at the given index.
+size_t HttpHeaderParser::skipLineBreak( size_t offset ) const
+{
+	if ( ( offset < fLength ) && ( '\r' == fHeaders[offset] ) )
+	{
+		offset++;
+	}
+	if ( ( offset < fLength ) && ( '\n' == fHeaders[offset] ) )
+	{
+		offset++;
+	}
+	return offset;
+}
@@ -0,0 +1,71 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef _HttpHeaderParser_H_
+#define _HttpHeaderParser_H_
+
+#include <stddef.h>
+
+#include <string>
+
+
+/// Part of a string owned by someone else. Not null terminated.
+struct StringSlice
+{
+	const char* Data;
+	size_t Length;
+};
+
+/// One field of an HTTP header block, as returned by HttpHeaderParser. Both slices point into the parsed buffer.
+struct HttpHeaderField
+{
+	/// The field name, or an empty slice for the status line.
+	StringSlice Name;
+
+	/// The field value without surrounding whitespace, or the whole status line.
+	StringSlice Value;
+
+	/// Set for the status line ("HTTP/1.1 200 OK") of a response.
+	bool IsStatusLine;
+
+	/// Set if the value continues on following lines (obsolete line folding). Such a value still contains the
+	/// line breaks, so it has to be copied with HttpHeaderParser::appendValue() to be used.
+	bool IsFolded;
+};
+
+/// Splits a length-delimited HTTP header block into its fields, without copying or allocating.
+///
+/// Accepts CRLF or bare LF line breaks, folded values, repeated fields and colons in values. The first line is taken
+/// as the status line if it starts with "HTTP/" or has no colon. Parsing stops at the empty line ending the block
+/// or at the end of the buffer, and lines that aren't a valid field are skipped.
+class HttpHeaderParser
+{
+public:
+	HttpHeaderParser( const char *headers, size_t length );
+
+	bool next( HttpHeaderField *field );
+
+	/// Gets the number of bytes parsed so far, including the empty line ending the block once it has been reached.
+	size_t getOffset() const { return fOffset; }
+
+	static bool nameEquals( const StringSlice& name, const char *expectedName );
+	static void appendValue( const HttpHeaderField& field, std::string *output );
+
+private:
+	const char *fHeaders;
+	size_t fLength;
+	size_t fOffset;
+	bool fIsFirstLine;
+	bool fIsDone;
+
+	size_t findLineEnd( size_t offset ) const;
+	size_t skipLineBreak( size_t offset ) const;
+};
+
+#endif
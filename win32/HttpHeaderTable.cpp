@@ -0,0 +1,187 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "HttpHeaderTable.h"
+
+#include <ctype.h>
+#include <string.h>
+
+
+/// Smallest number of buckets in the name index. Typical responses have fewer than 16 header fields.
+#define HTTP_HEADER_TABLE_MIN_BUCKETS 32
+
+HttpHeaderTable::HttpHeaderTable()
+{
+}
+
+/// Removes all header fields, keeping the allocated memory for re-use.
+void HttpHeaderTable::clear()
+{
+	fBuffer.clear();
+	fEntries.clear();
+	fBuckets.clear();
+}
+
+/// Adds the header fields of a raw header block, as received from the server: fields separated by CRLF,
+/// with the status line first. The status line is added under the name HTTP_HEADER_STATUS_LINE_NAME.
+void HttpHeaderTable::parse( const char *headers, size_t length )
+{
+	// Names and values take up at most as many bytes as the block, plus their null terminators.
+	fBuffer.reserve( fBuffer.size() + length + sizeof(HTTP_HEADER_STATUS_LINE_NAME) );
+
+	HttpHeaderParser parser( headers, length );
+	HttpHeaderField field;
+	while ( parser.next( &field ) )
+	{
+		add( field );
+	}
+}
+
+/// Adds a header field after all others. Pointers previously returned by the table may no longer be valid.
+void HttpHeaderTable::add( const char *name, size_t nameLength, const char *value, size_t valueLength )
+{
+	beginEntry( name, nameLength );
+	fBuffer.append( value, valueLength );
+	endEntry();
+}
+
+/// Adds a field returned by an HttpHeaderParser after all others, unfolding its value if needed.
+/// Pointers previously returned by the table may no longer be valid.
+void HttpHeaderTable::add( const HttpHeaderField& field )
+{
+	if ( field.IsStatusLine )
+	{
+		beginEntry( HTTP_HEADER_STATUS_LINE_NAME, sizeof(HTTP_HEADER_STATUS_LINE_NAME) - 1 );
+	}
+	else
+	{
+		beginEntry( field.Name.Data, field.Name.Length );
+	}
+	HttpHeaderParser::appendValue( field, &fBuffer );
+	endEntry();
+}
+
+/// Gets the position of the last header field with the given name (ignoring case), or -1 if there is none.
+int HttpHeaderTable::find( const char *name ) const
+{
+	if ( fBuckets.empty() || ( NULL == name ) )
+	{
+		return -1;
+	}
+
+	size_t nameLength = strlen( name );
+	return fBuckets[findBucket( name, nameLength, hashName( name, nameLength ) )];
+}
+
+/// Gets the position of the header field before the given one with the same name, or -1 if there is none.
+int HttpHeaderTable::findPrevious( int index ) const
+{
+	if ( ( index < 0 ) || ( (size_t)index >= fEntries.size() ) )
+	{
+		return -1;
+	}
+	return fEntries[index].PreviousWithName;
+}
+
+/// Gets the value of the last header field with the given name (ignoring case), or NULL if there is none.
+/// The value is null terminated, and stays valid until the table is changed.
+const char* HttpHeaderTable::getValue( const char *name ) const
+{
+	int index = find( name );
+	return ( index < 0 ) ? NULL : getValue( (size_t)index );
+}
+
+// Adds an entry with the given name, whose value is then to be appended to the buffer before calling endEntry().
+void HttpHeaderTable::beginEntry( const char *name, size_t nameLength )
+{
+	Entry entry;
+	entry.Hash = hashName( name, nameLength );
+	entry.NameOffset = (unsigned int)fBuffer.size();
+	entry.NameLength = (unsigned int)nameLength;
+	fBuffer.append( name, nameLength );
+	fBuffer.push_back( 0 );
+	entry.ValueOffset = (unsigned int)fBuffer.size();
+	entry.ValueLength = 0;
+	entry.PreviousWithName = -1;
+	fEntries.push_back( entry );
+}
+
+// Ends the value of the entry added by beginEntry(), and links the entry into the name index.
+void HttpHeaderTable::endEntry()
+{
+	Entry& entry = fEntries.back();
+	entry.ValueLength = (unsigned int)( fBuffer.size() - entry.ValueOffset );
+	fBuffer.push_back( 0 );
+
+	if ( fEntries.size() * 2 > fBuckets.size() )
+	{
+		// Grow the index and re-insert every entry, oldest first, so each name ends up at its latest entry.
+		size_t bucketCount = fBuckets.empty() ? HTTP_HEADER_TABLE_MIN_BUCKETS : fBuckets.size() * 2;
+		fBuckets.assign( bucketCount, -1 );
+		for ( size_t entryIndex = 0; entryIndex < fEntries.size(); entryIndex++ )
+		{
+			index( (int)entryIndex );
+		}
+	}
+	else
+	{
+		index( (int)fEntries.size() - 1 );
+	}
+}
+
+// Links the given entry into the name index, as the latest entry with its name.
+void HttpHeaderTable::index( int entryIndex )
+{
+	Entry& entry = fEntries[entryIndex];
+	size_t bucket = findBucket( fBuffer.data() + entry.NameOffset, entry.NameLength, entry.Hash );
+	entry.PreviousWithName = fBuckets[bucket];
+	fBuckets[bucket] = entryIndex;
+}
+
+// Gets the bucket of the index holding the given name, or the empty bucket it would go in.
+size_t HttpHeaderTable::findBucket( const char *name, size_t nameLength, unsigned int hash ) const
+{
+	size_t mask = fBuckets.size() - 1;
+	size_t bucket = hash & mask;
+	while ( fBuckets[bucket] >= 0 )
+	{
+		const Entry& entry = fEntries[fBuckets[bucket]];
+		if ( ( entry.Hash == hash ) && ( entry.NameLength == nameLength ) &&
+			 namesEqual( fBuffer.data() + entry.NameOffset, name, nameLength ) )
+		{
+			break;
+		}
+		bucket = ( bucket + 1 ) & mask;
+	}
+	return bucket;
+}
+
+// FNV-1a hash of the lower case name.
+unsigned int HttpHeaderTable::hashName( const char *name, size_t nameLength )
+{
+	unsigned int hash = 2166136261U;
+	for ( size_t i = 0; i < nameLength; i++ )
+	{
+		hash ^= (unsigned int)tolower( (unsigned char)name[i] );
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+bool HttpHeaderTable::namesEqual( const char *name1, const char *name2, size_t nameLength )
+{
+	for ( size_t i = 0; i < nameLength; i++ )
+	{
+		if ( tolower( (unsigned char)name1[i] ) != tolower( (unsigned char)name2[i] ) )
+		{
+			return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,82 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef _HttpHeaderTable_H_
+#define _HttpHeaderTable_H_
+
+#include "HttpHeaderParser.h"
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+
+/// Name given to the status line of a response ("HTTP/1.1 200 OK") in a header table.
+#define HTTP_HEADER_STATUS_LINE_NAME "HTTP-STATUS-LINE"
+
+/// Ordered table of HTTP header fields with case-insensitive lookup by name.
+///
+/// All names and values are stored null terminated in one contiguous buffer, next to a vector of entries holding
+/// their offsets and the hash of the lower case name. A small open addressing index maps each distinct name to its
+/// most recent entry, so looking a header up is O(1) and never allocates. Repeated fields are kept as separate
+/// entries in the order they were added, and each entry links to the previous one with the same name.
+class HttpHeaderTable
+{
+public:
+	HttpHeaderTable();
+
+	void clear();
+	void parse( const char *headers, size_t length );
+	void add( const char *name, size_t nameLength, const char *value, size_t valueLength );
+	void add( const HttpHeaderField& field );
+
+	/// Gets the number of header fields in the table, counting repeated fields separately.
+	size_t size() const { return fEntries.size(); }
+	bool empty() const { return fEntries.empty(); }
+
+	/// Gets the name and value of the header field at the given position (in the order they were added).
+	const char* getName( size_t index ) const { return fBuffer.data() + fEntries[index].NameOffset; }
+	const char* getValue( size_t index ) const { return fBuffer.data() + fEntries[index].ValueOffset; }
+	size_t getValueLength( size_t index ) const { return fEntries[index].ValueLength; }
+
+	int find( const char *name ) const;
+	int findPrevious( int index ) const;
+	const char* getValue( const char *name ) const;
+
+private:
+	struct Entry
+	{
+		unsigned int Hash;
+		unsigned int NameOffset;
+		unsigned int NameLength;
+		unsigned int ValueOffset;
+		unsigned int ValueLength;
+
+		/// Index of the previous entry with the same name, or -1 if this is the first one.
+		int PreviousWithName;
+	};
+
+	std::string fBuffer;
+	std::vector<Entry> fEntries;
+
+	/// Index of the latest entry for each distinct name, or -1 for an unused bucket. Its size is a power of two,
+	/// kept at least twice the number of entries.
+	std::vector<int> fBuckets;
+
+	void beginEntry( const char *name, size_t nameLength );
+	void endEntry();
+	void index( int entryIndex );
+	size_t findBucket( const char *name, size_t nameLength, unsigned int hash ) const;
+
+	static unsigned int hashName( const char *name, size_t nameLength );
+	static bool namesEqual( const char *name1, const char *name2, size_t nameLength );
+};
+
+#endif
@@ -0,0 +1,267 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "CoronaLog.h"
+#include "HttpMemoryResponseCache.h"
+#include "HttpResponseCache.h"
+#include "ContentDecoder.h"
+
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <WinHttp.h>
+#endif
+
+
+#pragma region Delivery
+/// Creates the delivery of a stored response to a request.
+/// @param requestParams The request, which the delivery takes ownership of.
+/// @param entry The response. Its body is shared rather than copied.
+HttpMemoryResponseCache::Delivery::Delivery( NetworkRequestParameters *requestParams, const Entry& entry )
+:	fEntry( entry )
+{
+	fRequestParams = requestParams;
+	fRequestState = NULL;
+	fWasAbortRequested = false;
+}
+
+/// Destroys the delivery. Its request is dropped without notifying the listener if it was never delivered.
+HttpMemoryResponseCache::Delivery::~Delivery( )
+{
+	if ( NULL != fRequestState )
+	{
+		delete fRequestState;
+	}
+	if ( NULL != fRequestParams )
+	{
+		delete fRequestParams;
+	}
+}
+
+/// Sets up the request's state, like a request operation being executed.
+/// @return Returns the canceller to hand to Lua for the request.
+RequestCanceller* HttpMemoryResponseCache::Delivery::Start( const std::shared_ptr<Delivery>& thiz )
+{
+	fRequestState = new NetworkRequestState( thiz, fRequestParams->getRequestUrl(), fRequestParams->isDebug() );
+	return fRequestState->getRequestCanceller();
+}
+
+/// Delivers the response to the request's listener as an "ended" event (unless the request was cancelled), and
+/// releases the request.
+void HttpMemoryResponseCache::Delivery::Deliver( )
+{
+	if ( ( NULL == fRequestParams ) || ( NULL == fRequestState ) )
+	{
+		return;
+	}
+
+	LuaCallback* luaCallback = fRequestParams->getLuaCallback();
+	if ( NULL != luaCallback )
+	{
+		if ( !fWasAbortRequested )
+		{
+			long long bodySize = (long long)fEntry.Body->size();
+			fRequestState->setStatus( HTTP_STATUS_OK );
+			fRequestState->setResponseHeaders( fEntry.Headers.data(), fEntry.Headers.size() );
+			fRequestState->setBytesEstimated( bodySize );
+			fRequestState->setBytesTransferred( bodySize );
+			fRequestState->setCacheResult( true, false );
+
+			Body* body = fRequestState->getResponseBody();
+			if ( fEntry.IsText )
+			{
+				body->bodyType = TYPE_STRING;
+				body->bodyString = new UTF8String( *fEntry.Body );
+			}
+			else
+			{
+				body->bodyType = TYPE_BYTES;
+				body->bodyBytes = new ByteVector( fEntry.Body->begin(), fEntry.Body->end() );
+			}
+
+			fRequestState->setPhase( "ended" );
+			luaCallback->callWithNetworkRequestState( fRequestState );
+		}
+
+		luaCallback->unregister();
+	}
+
+	// The state holds the canceller, which holds this object, so it must go now. Lua may still hold the canceller.
+	delete fRequestState;
+	fRequestState = NULL;
+	delete fRequestParams;
+	fRequestParams = NULL;
+	fEntry.Body.reset();
+}
+
+void HttpMemoryResponseCache::Delivery::RequestAbort( )
+{
+	fWasAbortRequested = true;
+}
+
+#pragma endregion
+
+
+#pragma region Cache
+HttpMemoryResponseCache::HttpMemoryResponseCache( )
+{
+	fTotalBytes = 0;
+	fMaxBytes = HTTP_MEMORY_RESPONSE_CACHE_DEFAULT_MAX_BYTES;
+}
+
+HttpMemoryResponseCache::~HttpMemoryResponseCache( )
+{
+}
+
+/// Sets the size of the cache, evicting the least recently used responses that no longer fit. Zero disables it.
+void HttpMemoryResponseCache::setMaxBytes( size_t maxBytes )
+{
+	fMaxBytes = maxBytes;
+	evict();
+}
+
+size_t HttpMemoryResponseCache::getMaxBytes( )
+{
+	return fMaxBytes;
+}
+
+void HttpMemoryResponseCache::clear( )
+{
+	fEntries.clear();
+	fEntriesByKey.clear();
+	fTotalBytes = 0;
+}
+
+/// Determines if a request may be answered from the cache, and its response stored in it. On top of what the disk
+/// cache requires, the response must be delivered in memory rather than to a file.
+bool HttpMemoryResponseCache::isRequestCacheable( NetworkRequestParameters *requestParams )
+{
+	return ( NULL == requestParams->getResponseFile() ) && HttpResponseCache::isRequestCacheable( requestParams );
+}
+
+/// Looks for a fresh response to the given request, and marks it as the most recently used one.
+/// @param entry Set to the stored response, if there is one.
+/// @return Returns false if there is no fresh response that matches the request, or if the request asked for the
+///         response to be revalidated.
+bool HttpMemoryResponseCache::find( NetworkRequestParameters *requestParams, Entry *entry )
+{
+	if ( fEntries.empty() || !isRequestCacheable( requestParams ) || HttpResponseCache::isRevalidationRequested( requestParams ) )
+	{
+		return false;
+	}
+	EntryMap::iterator iter = fEntriesByKey.find( getKey( requestParams ) );
+	if ( fEntriesByKey.end() == iter )
+	{
+		return false;
+	}
+	if ( time( NULL ) >= iter->second->ExpiresTime )
+	{
+		remove( iter );
+		return false;
+	}
+	if ( !iter->second->VaryHeaders.empty() )
+	{
+		HttpHeaderTable storedHeaders;
+		storedHeaders.parse( iter->second->Headers.data(), iter->second->Headers.size() );
+		if ( HttpResponseCache::getVaryHeaders( storedHeaders, requestParams ) != iter->second->VaryHeaders )
+		{
+			return false;
+		}
+	}
+
+	fEntries.splice( fEntries.end(), fEntries, iter->second );
+	*entry = *iter->second;
+	return true;
+}
+
+/// Stores the response just delivered for the given request, replacing any response stored for it.
+/// @param requestState The request's state, with its response headers and its body as delivered to Lua.
+/// @param expiresTime When the response stops being fresh.
+/// @return Returns false if the response is not worth storing (already stale, or too large).
+bool HttpMemoryResponseCache::store( NetworkRequestParameters *requestParams, NetworkRequestState *requestState, time_t expiresTime )
+{
+	Body* body = requestState->getResponseBody();
+	if ( ( time( NULL ) >= expiresTime ) || ( ( TYPE_STRING != body->bodyType ) && ( TYPE_BYTES != body->bodyType ) ) )
+	{
+		return false;
+	}
+
+	std::shared_ptr<UTF8String> bodyBytes = std::make_shared<UTF8String>();
+	if ( TYPE_STRING == body->bodyType )
+	{
+		*bodyBytes = *body->bodyString;
+	}
+	else if ( !body->bodyBytes->empty() )
+	{
+		bodyBytes->assign( (const char*)&(*body->bodyBytes)[0], body->bodyBytes->size() );
+	}
+	if ( bodyBytes->size() > HTTP_MEMORY_RESPONSE_CACHE_MAX_ENTRY_BYTES )
+	{
+		return false;
+	}
+
+	// The body was decoded as it arrived if the response had a Content-Encoding that we undo.
+	const HttpHeaderTable& responseHeaders = requestState->getResponseHeaders();
+	bool isBodyDecoded = requestParams->isCompressionEnabled() &&
+						 ContentDecoder::isSupportedEncoding( responseHeaders.getValue( "Content-Encoding" ) );
+
+	char contentLength[32];
+	sprintf_s( contentLength, sizeof(contentLength), "%u", (unsigned int)bodyBytes->size() );
+
+	Entry entry;
+	entry.Key = getKey( requestParams );
+	entry.Headers = HttpResponseCache::getStoredHeaders( responseHeaders, isBodyDecoded );
+	entry.Headers += "Content-Length: ";
+	entry.Headers += contentLength;
+	entry.Headers += "\r\n\r\n";
+	entry.VaryHeaders = HttpResponseCache::getVaryHeaders( responseHeaders, requestParams );
+	entry.IsText = ( TYPE_STRING == body->bodyType );
+	entry.ExpiresTime = expiresTime;
+	entry.Size = entry.Key.size() + entry.Headers.size() + entry.VaryHeaders.size() + bodyBytes->size();
+	entry.Body = bodyBytes;
+	if ( entry.Size > fMaxBytes )
+	{
+		return false;
+	}
+
+	EntryMap::iterator iter = fEntriesByKey.find( entry.Key );
+	if ( fEntriesByKey.end() != iter )
+	{
+		remove( iter );
+	}
+	fEntriesByKey[entry.Key] = fEntries.insert( fEntries.end(), entry );
+	fTotalBytes += entry.Size;
+
+	evict();
+	return true;
+}
+
+void HttpMemoryResponseCache::remove( EntryMap::iterator iter )
+{
+	fTotalBytes -= iter->second->Size;
+	fEntries.erase( iter->second );
+	fEntriesByKey.erase( iter );
+}
+
+// Removes the least recently used entries until the rest fit the cache's size.
+void HttpMemoryResponseCache::evict( )
+{
+	while ( ( fTotalBytes > fMaxBytes ) && !fEntries.empty() )
+	{
+		remove( fEntriesByKey.find( fEntries.front().Key ) );
+	}
+}
+
+UTF8String HttpMemoryResponseCache::getKey( NetworkRequestParameters *requestParams )
+{
+	return requestParams->getRequestMethod() + " " + requestParams->getRequestUrl();
+}
+
+#pragma endregion
@@ -0,0 +1,112 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef _HttpMemoryResponseCache_H_
+#define _HttpMemoryResponseCache_H_
+
+#include "WindowsNetworkSupport.h"
+
+#include <time.h>
+
+#include <list>
+#include <map>
+#include <memory>
+#include <vector>
+
+
+/// Default size of the memory cache, counting the keys, headers and bodies of its responses.
+#define HTTP_MEMORY_RESPONSE_CACHE_DEFAULT_MAX_BYTES (8 * 1024 * 1024)
+
+/// Largest response body kept in the memory cache. Larger responses are left to the disk cache.
+#define HTTP_MEMORY_RESPONSE_CACHE_MAX_ENTRY_BYTES (256 * 1024)
+
+/// In-memory cache of small GET responses for requests made with params.cache = true, in front of the disk cache.
+///
+/// It keeps the responses that are still fresh as they were delivered to Lua (i.e. with their text body already
+/// converted to UTF-8), so that the request manager can answer a request for one on its next update, without
+/// creating a request operation or doing any I/O. Responses that went stale are dropped rather than revalidated,
+/// which is left to the request operation and the disk cache. Only used on the main thread.
+class HttpMemoryResponseCache
+{
+public:
+
+	/// A stored response.
+	struct Entry
+	{
+		/// The request method and URL ("GET <url>").
+		UTF8String Key;
+
+		/// The response headers as delivered (status line first, CRLF separated, double CRLF at the end), except
+		/// for the headers describing how the body was sent, with a Content-Length for the stored body.
+		UTF8String Headers;
+
+		/// The request headers named by the response's Vary header, as "name: value" lines.
+		UTF8String VaryHeaders;
+
+		/// The body as delivered, shared with the deliveries of the response that are still pending.
+		std::shared_ptr<const UTF8String> Body;
+		bool IsText;
+
+		/// When the response stops being fresh, and the number of bytes counted against the cache's size.
+		time_t ExpiresTime;
+		size_t Size;
+	};
+
+	/// A request answered from the cache, which takes the place of its request operation until the response is
+	/// delivered to the request's listener on the request manager's next update.
+	class Delivery : public NetworkRequestOperation
+	{
+	public:
+		Delivery( NetworkRequestParameters *requestParams, const Entry& entry );
+		virtual ~Delivery( );
+
+		RequestCanceller* Start( const std::shared_ptr<Delivery>& thiz );
+		void Deliver( );
+		virtual void RequestAbort( );
+
+	private:
+		NetworkRequestParameters* fRequestParams;
+		NetworkRequestState* fRequestState;
+		Entry fEntry;
+		bool fWasAbortRequested;
+	};
+
+	/// Deliveries waiting for the request manager's next update.
+	typedef std::vector< std::shared_ptr<Delivery> > DeliveryList;
+
+	HttpMemoryResponseCache( );
+	~HttpMemoryResponseCache( );
+
+	void setMaxBytes( size_t maxBytes );
+	size_t getMaxBytes( );
+	void clear( );
+
+	static bool isRequestCacheable( NetworkRequestParameters *requestParams );
+
+	bool find( NetworkRequestParameters *requestParams, Entry *entry );
+	bool store( NetworkRequestParameters *requestParams, NetworkRequestState *requestState, time_t expiresTime );
+
+private:
+
+	typedef std::list<Entry> EntryList;
+	typedef std::map<UTF8String, EntryList::iterator> EntryMap;
+
+	/// Entries from least to most recently used, and the same entries by key.
+	EntryList fEntries;
+	EntryMap fEntriesByKey;
+	size_t fTotalBytes;
+	size_t fMaxBytes;
+
+	void remove( EntryMap::iterator iter );
+	void evict( );
+
+	static UTF8String getKey( NetworkRequestParameters *requestParams );
+};
+
+#endif
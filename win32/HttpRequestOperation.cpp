@@ -0,0 +1,895 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "CoronaLog.h"
+#include "CoronaLua.h"
+#include "HttpRequestOperation.h"
+#include "CharsetTranscoder.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <WinHttp.h>
+#define HTTP_REQUEST_PATH_SEPARATOR '\\'
+#else
+#include <errno.h>
+#define HTTP_REQUEST_PATH_SEPARATOR '/'
+#endif
+
+
+#pragma region Constructors and Destructors
+/// Creates the main thread side of a request operation.
+/// @param responseCache Disk cache used by requests made with params.cache. Must outlive this object.
+/// @param memoryCache Memory cache used by requests made with params.cache. Must outlive this object.
+/// @param coalescingMap The manager's map of operations that requests can be coalesced onto. Must outlive this object.
+HttpRequestOperation::HttpRequestOperation( HttpResponseCache *responseCache, HttpMemoryResponseCache *memoryCache, CoalescingMap *coalescingMap )
+{
+	fRequestParams = NULL;
+	fRequestState = NULL;
+	fResponseCache = responseCache;
+	fMemoryCache = memoryCache;
+	fCoalescingMap = coalescingMap;
+	fDownloadSegment = NULL;
+	fIsSniffingResponseCharset = false;
+	fIsExecuting = false;
+	ResetCacheState();
+}
+
+HttpRequestOperation::~HttpRequestOperation()
+{
+	StopCoalescing();
+}
+
+#pragma endregion
+
+
+#pragma region Public Functions
+/// Determines if this object is in the middle of an HTTP request operation.
+/// @return Returns true if currently executing an HTTP request operation. Returns false if not.
+bool HttpRequestOperation::IsExecuting()
+{
+	return fIsExecuting;
+}
+
+/// Called when this request, or a request coalesced onto it, was cancelled from Lua. The operation is only
+/// aborted once neither this request's listener nor any coalesced request's listener wants the response.
+void HttpRequestOperation::RequestCancel()
+{
+	if (!IsExecuting())
+	{
+		return;
+	}
+	if (!fRequestState->getRequestCanceller()->isCancelled() || CoalescedRequest::hasActiveRequests(fCoalescedRequests))
+	{
+		debug("Request cancelled, still in flight for other listeners");
+		return;
+	}
+	RequestAbort();
+}
+
+/// Coalesces the given request onto this one if it is identical and this one's response is still to come.
+/// @param requestParams The request, which this object takes ownership of if it is coalesced.
+/// @param key The request's key, from CoalescedRequest::getKey().
+/// @param thiz Shared pointer to this object.
+/// @return Returns the canceller to hand to Lua for the request, or NULL if it was not coalesced.
+RequestCanceller* HttpRequestOperation::CoalesceRequest( NetworkRequestParameters *requestParams, const UTF8String& key, const std::shared_ptr<NetworkRequestOperation>& thiz )
+{
+	if (!IsExecuting() || fCoalescingKey.empty() || (key != fCoalescingKey))
+	{
+		return NULL;
+	}
+
+	debug("Coalescing request onto identical request in flight");
+	std::shared_ptr<CoalescedRequest> coalescedRequest = std::make_shared<CoalescedRequest>(requestParams, thiz);
+	fCoalescedRequests.push_back(coalescedRequest);
+	return coalescedRequest->Start(coalescedRequest);
+}
+
+#pragma endregion
+
+
+#pragma region Request Functions
+/// Takes on the given request, creating its state. To be called by the engine's ExecuteRequest().
+/// @param requestParams The request, which this object takes ownership of.
+/// @param thiz Shared pointer to this object.
+/// @param requestCanceller The canceller already handed to Lua for the request, if it was queued, or NULL to create one.
+void HttpRequestOperation::StartRequest( NetworkRequestParameters *requestParams, const std::shared_ptr<HttpRequestOperation>& thiz, RequestCanceller *requestCanceller )
+{
+	fRequestParams = requestParams;
+	if (NULL != requestCanceller)
+	{
+		fRequestState = new NetworkRequestState( requestCanceller, requestParams->getRequestUrl(), requestParams->isDebug() );
+	}
+	else
+	{
+		fRequestState = new NetworkRequestState( thiz, requestParams->getRequestUrl(), requestParams->isDebug() );
+	}
+	if (CoalescedRequest::isRequestCoalescable(requestParams))
+	{
+		// An identical request that started first (e.g. from the scheduler's queue) keeps taking on the others.
+		fCoalescingKey = CoalescedRequest::getKey(requestParams);
+		std::weak_ptr<HttpRequestOperation>& entry = (*fCoalescingMap)[fCoalescingKey];
+		if (entry.expired())
+		{
+			entry = thiz;
+		}
+	}
+}
+
+/// Stops identical requests from being coalesced onto this one, once its response has ended or it was aborted.
+void HttpRequestOperation::StopCoalescing()
+{
+	if (fCoalescingKey.empty())
+	{
+		return;
+	}
+	CoalescingMap::iterator iter = fCoalescingMap->find(fCoalescingKey);
+	if (iter != fCoalescingMap->end())
+	{
+		HttpRequestOperation* operation = iter->second.lock().get();
+		if ((operation == this) || (NULL == operation))
+		{
+			fCoalescingMap->erase(iter);
+		}
+	}
+	fCoalescingKey.clear();
+}
+
+/// If the response body is directed to a file, picks the temp file that the engine will download it to.
+/// A resumable download always goes to the same partial file instead, which may hold an earlier attempt's bytes,
+/// and a range of a segmented download goes into the download's file ("fDownloadSegment").
+void HttpRequestOperation::SelectDownloadFile()
+{
+	UTF8String& downloadFilePath = GetDownloadFilePath();
+	downloadFilePath.clear();
+	fDownloadSegment = NULL;
+
+	CoronaFileSpec *responseFile = fRequestParams->getResponseFile();
+	DownloadSegment *downloadSegment = fRequestParams->getDownloadSegment();
+	if (fResumableDownload.open(fRequestParams))
+	{
+		downloadFilePath = fResumableDownload.getPartialFilePath();
+		debug("Partial file path: %s", downloadFilePath.c_str());
+	}
+	else if ((NULL != downloadSegment) && downloadSegment->isRange())
+	{
+		fDownloadSegment = downloadSegment;
+		downloadFilePath = fDownloadSegment->getFilePath();
+		debug("Segment of file path: %s", downloadFilePath.c_str());
+	}
+	else if (NULL != responseFile)
+	{
+		UTF8String pathDir;
+		UTF8String fullPath = responseFile->getFullPath();
+		const size_t lastIndex = fullPath.rfind(HTTP_REQUEST_PATH_SEPARATOR);
+		if (std::string::npos != lastIndex)
+		{
+			pathDir = fullPath.substr(0, lastIndex+1);
+		}
+		downloadFilePath = pathForTemporaryFileWithPrefix("download", pathDir);
+		debug("Temp file path: %s", downloadFilePath.c_str());
+	}
+}
+
+/// Looks for a stored response to the request. A stale one is revalidated, unless the request already has
+/// conditions of its own.
+/// @return Returns true if a fresh response was found, which is served without touching the network, so the
+///         request ends right away (without an error). Returns false if the request is to be sent.
+bool HttpRequestOperation::FindCachedResponse()
+{
+	if (HttpResponseCache::isRequestCacheable(fRequestParams) &&
+		(fResponseCache->isOpen() || fResponseCache->open(fRequestParams->getCacheDirectory())) &&
+		fResponseCache->find(fRequestParams, &fCacheEntry))
+	{
+		if (fResponseCache->isFresh(fCacheEntry, fRequestParams))
+		{
+			debug("Serving fresh response from cache");
+			fIsCacheHit = true;
+			return true;
+		}
+		fIsRevalidatingCacheEntry =
+			(NULL == fRequestParams->getRequestHeaderValue("If-None-Match")) &&
+			(NULL == fRequestParams->getRequestHeaderValue("If-Modified-Since"));
+	}
+	return false;
+}
+
+#pragma endregion
+
+
+#pragma region Processing Functions
+/// If the caller specified Upload progress, sends the began event (before uploading starts).
+/// To be called on the request's first processing pass.
+void HttpRequestOperation::NotifyUploadBegan( long long bytesTotal )
+{
+	if (Upload == fRequestParams->getProgressDirection())
+	{
+		fRequestState->setPhase("began");
+		fRequestState->setBytesEstimated(bytesTotal);
+		NotifyListeners();
+	}
+}
+
+/// If the caller specified Upload progress, notifies them that more bytes have been uploaded.
+/// @param bytesSent Request body bytes sent so far.
+/// @param bytesTotal Size of the request body, or -1 if not known.
+/// @param encodedBytesSent Bytes actually sent when the body is compressed, or -1 if it is not.
+void HttpRequestOperation::NotifyUploadProgress( long long bytesSent, long long bytesTotal, long long encodedBytesSent )
+{
+	if (Upload == fRequestParams->getProgressDirection())
+	{
+		debug("Request body written %lld of %lld bytes", bytesSent, bytesTotal);
+		fRequestState->setPhase("progress");
+		fRequestState->setBytesTransferred(bytesSent);
+		if (encodedBytesSent >= 0)
+		{
+			fRequestState->setBytesEncoded(encodedBytesSent);
+		}
+		NotifyListeners();
+	}
+}
+
+/// Applies the response status and headers, and sets up the response body to collect what follows, which is
+/// either written to the download file by the engine or handed to ApplyReceivedBytes().
+void HttpRequestOperation::ApplyResponseHeaders( int statusCode, const char *headers, size_t headersLength )
+{
+	fRequestState->setStatus( statusCode );
+	fRequestState->setResponseHeaders( headers, headersLength );
+
+	// A 304 to a revalidation means the stored response is served once the request ends. Any other response
+	// replaces it, if it can be stored.
+	if (fIsRevalidatingCacheEntry && (HTTP_STATUS_NOT_MODIFIED == statusCode))
+	{
+		fWasCacheEntryRevalidated = true;
+	}
+	else
+	{
+		fIsRevalidatingCacheEntry = false;
+		fIsCachingResponse = HttpResponseCache::isRequestCacheable(fRequestParams) &&
+			HttpResponseCache::isResponseStorable(statusCode, fRequestState->getResponseHeaders());
+	}
+
+	// Size the in-memory body for the whole response up front, so it is received into a single buffer.
+	long long contentLength = fRequestState->getResponseContentLength();
+	size_t contentAllocation = getResponseBodyReserve( contentLength );
+
+	Body* body = fRequestState->getResponseBody();
+
+	// A resumable download also goes to the response file if the response continues its partial file.
+	bool isResumedDownload = fResumableDownload.setResponse( statusCode, fRequestState->getResponseHeaders() );
+
+	CoronaFileSpec *responseFile = fRequestParams->getResponseFile();
+	if ( NULL != fDownloadSegment )
+	{
+		// The engine writes a range of a segmented download into the download's file, which only becomes a
+		// response file once the download has all of its ranges. Nothing is kept in memory.
+		//
+		debug("Response body goes to the segmented download's file");
+	}
+	else if ( ( NULL != responseFile ) && ( ( HTTP_STATUS_OK == statusCode ) || isResumedDownload ) )
+	{
+		// Set up the response body...
+		//
+		// The engine has created the temp file and writes the body to it as it arrives.
+		//
+		body->bodyType = TYPE_FILE;
+		body->bodyFile = new CoronaFileSpec( responseFile );
+	}
+	else
+	{
+		// Now that we have the response headers, we can determine if the response body will be text
+		// or binary, and set it up accordingly so that it can collect response packets appropriately.
+		//
+		char *contentType = NULL;
+		char *contentEncoding = NULL;
+
+		const char *contentTypeHeader = fRequestState->findResponseHeaderValue("Content-Type");
+		if ((NULL != contentTypeHeader) && (0 != *contentTypeHeader))
+		{
+			contentType = getContentType( contentTypeHeader );
+			contentEncoding = getContentTypeEncoding( contentTypeHeader );
+		}
+		if ( ( NULL != contentEncoding ) || ( ( NULL != contentType ) && isContentTypeText( contentType ) ) )
+		{
+			// If the Content-Type has a charset, or if it is "texty", then let's treat it as text
+			debug("treating content as text");
+			body->bodyType = TYPE_STRING;
+			body->bodyString = new UTF8String( );
+			body->bodyString->reserve( contentAllocation );
+
+			// If the charset is given and is not utf-8, transcode the body as it arrives.
+			if ( ( NULL != contentEncoding ) && ( 0 != _strcmpi( "utf-8", contentEncoding ) ) &&
+				fResponseTranscoder.open( contentEncoding, "utf-8" ) )
+			{
+				debug("Transcoding response body from %s to utf-8 as it arrives", contentEncoding);
+			}
+			// Otherwise HTML and XML may name their charset in the content, which is looked for as soon as
+			// enough of the body has arrived.
+			else if ( ( NULL == contentEncoding ) && ( NULL != contentType ) &&
+					  ( isContentTypeXML( contentType ) || isContentTypeHTML( contentType ) ) )
+			{
+				fIsSniffingResponseCharset = true;
+			}
+		}
+		else
+		{
+			debug("treating content as binary");
+			body->bodyType = TYPE_BYTES;
+			body->bodyBytes = new ByteVector( );
+			body->bodyBytes->reserve( contentAllocation );
+		}
+
+		if ( NULL != contentType )
+		{
+			free(contentType);
+		}
+		if ( NULL != contentEncoding )
+		{
+			free(contentEncoding);
+		}
+	}
+
+	// A compressed response body is decoded as it arrives, and both byte counts are reported.
+	if (fRequestParams->isCompressionEnabled())
+	{
+		fRequestState->setBytesDecoded(0);
+	}
+
+	if (Upload != fRequestParams->getProgressDirection())
+	{
+		// If caller specified Download or no progress, we will populate the estimated bytes with the
+		// response content length. A resumed download counts the partial file's bytes as transferred.
+		//
+		if ( isResumedDownload )
+		{
+			fRequestState->setBytesTransferred( fResumableDownload.getOffset() );
+			if ( contentLength >= 0 )
+			{
+				contentLength += fResumableDownload.getOffset();
+			}
+		}
+		fRequestState->setBytesEstimated( contentLength );
+	}
+
+	if (Download == fRequestParams->getProgressDirection())
+	{
+		// If caller specified Download progress, send began progress (now that we may know the
+		// response size).
+		//
+		fRequestState->setPhase("began");
+		NotifyListeners();
+	}
+}
+
+/// Reports the progress of response body bytes the engine has written to the download file.
+/// @param writtenByteCount Bytes received for the body, as sent by the server.
+/// @param decodedByteCount Bytes written to the file, once decoded.
+void HttpRequestOperation::ApplyWrittenBytes( long long writtenByteCount, long long decodedByteCount )
+{
+	debug("Wrote %lld bytes", writtenByteCount);
+	if (Upload != fRequestParams->getProgressDirection())
+	{
+		fRequestState->incrementBytesTransferred((int)writtenByteCount);
+		if (fRequestParams->isCompressionEnabled())
+		{
+			fRequestState->incrementBytesDecoded(decodedByteCount);
+		}
+	}
+
+	if (Download == fRequestParams->getProgressDirection())
+	{
+		// If caller specified Download progress, notify them that more bytes have been downloaded...
+		//
+		debug("Response data written: %lld bytes", writtenByteCount);
+		fRequestState->setPhase("progress");
+		NotifyListeners();
+	}
+}
+
+/// Appends response body bytes received (and decoded) by the engine to the in-memory response body, transcoding
+/// text to UTF-8 as it goes, and reports the progress.
+/// A response body directed to a file is written to the download file by the engine instead (see ApplyWrittenBytes()).
+/// @param data The received bytes, once decoded.
+/// @param length Number of bytes in "data".
+/// @param transferredByteCount Bytes received for them, as sent by the server.
+/// @return Returns false if text could not be transcoded, in which case the request has to fail, since what was
+///         converted so far can't be followed by the raw bytes.
+bool HttpRequestOperation::ApplyReceivedBytes( const char *data, size_t length, long long transferredByteCount )
+{
+	bool wasSuccessful = true;
+
+	debug("Got %u bytes", (unsigned int)length);
+	Body* body = fRequestState->getResponseBody();
+	switch (body->bodyType)
+	{
+		case TYPE_STRING:
+			if (fIsCachingResponse)
+			{
+				if (fCacheResponseBytes.size() + length <= HTTP_RESPONSE_CACHE_MAX_ENTRY_BYTES)
+				{
+					fCacheResponseBytes.append(data, length);
+				}
+				else
+				{
+					debug("Response too large to be cached");
+					fIsCachingResponse = false;
+					UTF8String().swap(fCacheResponseBytes);
+				}
+			}
+			if (!fResponseTranscoder.isOpen())
+			{
+				body->bodyString->append(data, length);
+			}
+			else if (!fResponseTranscoder.write(data, length, body->bodyString))
+			{
+				CORONA_LOG("Error transcoding response body");
+				fResponseTranscoder.close();
+				wasSuccessful = false;
+			}
+			if ( fIsSniffingResponseCharset && ( body->bodyString->size() >= NETWORK_CHARSET_PRESCAN_LENGTH ) )
+			{
+				SniffResponseCharset();
+			}
+			break;
+
+		case TYPE_BYTES:
+			body->bodyBytes->insert(
+				body->bodyBytes->end(),
+				(unsigned char *)data,
+				(unsigned char *)data + length
+				);
+			break;
+
+		default:
+			break;
+	}
+
+	if (Upload != fRequestParams->getProgressDirection())
+	{
+		fRequestState->incrementBytesTransferred((int)transferredByteCount);
+		if (fRequestParams->isCompressionEnabled())
+		{
+			fRequestState->incrementBytesDecoded((long long)length);
+		}
+	}
+
+	if (Download == fRequestParams->getProgressDirection())
+	{
+		// If caller specified Download progress, notify them that more bytes have been downloaded...
+		//
+		debug("Response data received: %u bytes", (unsigned int)length);
+		fRequestState->setPhase("progress");
+		NotifyListeners();
+	}
+	return wasSuccessful;
+}
+
+/// Reports the result of a request whose operation has ended: serves the stored response if the cache has the
+/// answer, finishes the response body (moving a download to the response file, or converting text to UTF-8),
+/// fills the caches, and sends the final event to this request's listener and those coalesced onto it.
+/// To be called once per request, once the engine has stopped delivering the response.
+/// @param errorResult The error the operation ended with.
+/// @param wasAbortRequested Set if the request was aborted, in which case no final event is sent.
+/// @param statusCode The response status received, if any.
+/// @return Returns the error the request ended with, which is "errorResult" unless the stored response could not be read.
+WinHttpRequestError HttpRequestOperation::EndResponse( WinHttpRequestError errorResult, bool wasAbortRequested, int statusCode )
+{
+	LuaCallback* luaCallback = fRequestParams->getLuaCallback();
+
+	debug("Request operation has ended, processing...");
+
+	// A response served from the cache replaces whatever was received (nothing, or a 304).
+	bool isServingCachedResponse = (fIsCacheHit || fWasCacheEntryRevalidated) &&
+		(kWinHttpRequestErrorNone == errorResult) && !wasAbortRequested;
+	if (isServingCachedResponse && !ReadCachedResponse())
+	{
+		errorResult = kWinHttpRequestErrorInternal;
+	}
+
+	// Propagate the async session's error state or status code to the result state object.
+	if ( ( kWinHttpRequestErrorNone != errorResult ) || wasAbortRequested )
+	{
+		fRequestState->setError(GetMessageFromRequestError(errorResult));
+
+		// The download temp file is deleted by ReleaseRequest(), once the engine is done with the request,
+		// since it may still be writing to it.
+	}
+	else
+	{
+		// Success!
+		//
+		if (!isServingCachedResponse)
+		{
+			fRequestState->setStatus( statusCode );
+		}
+
+		// Body download complete, do any required post-processing...
+		//
+		Body* body = fRequestState->getResponseBody();
+		switch (body->bodyType)
+		{
+			case TYPE_FILE:
+			{
+				// The engine closes the download file before reporting success.
+				UTF8String& downloadFilePath = GetDownloadFilePath();
+				if (downloadFilePath.size() > 0)
+				{
+					// Rename temp file to final file (with overwrite)
+					if (HttpResponseCache::renameFile( downloadFilePath, body->bodyFile->getFullPath() ))
+					{
+						debug("File successfully renamed");
+						downloadFilePath.clear();
+						fResumableDownload.complete();
+					}
+					else
+					{
+						if (HttpResponseCache::removeFile( downloadFilePath ))
+						{
+							CORONA_LOG("Failed to rename temp download file to final download file");
+						}
+						else
+						{
+							CORONA_LOG("Failed to rename temp download file to final download file; failed to clean temp download");
+						}
+					}
+				}
+				else
+				{
+					CORONA_LOG("Download to file complete, but no temp file");
+				}
+			}
+			break;
+
+			case TYPE_STRING:
+			{
+				// Decode text string response content based on charset.  Default encoding is
+				// assumed to be utf-8, so if no charset is specified, or if it is specified
+				// and equal to utf-8, we take no action.
+				//
+				const char *contentType = fRequestState->findResponseHeaderValue("Content-Type");
+				Body *responseBody = fRequestState->getResponseBody();
+				char *contentEncoding = getContentTypeEncoding( contentType );
+				if ( NULL != contentEncoding )
+				{
+					debug("Charset from protocol: %s", contentEncoding);
+					fRequestState->setDebugValue("charset", contentEncoding);
+					fRequestState->setDebugValue("charsetSource", "protocol");
+				}
+				else
+				{
+					if ( fIsSniffingResponseCharset )
+					{
+						SniffResponseCharset();
+					}
+					if ( !fSniffedResponseCharset.empty() )
+					{
+						contentEncoding = _strdup( fSniffedResponseCharset.c_str() );
+					}
+					if ( NULL != contentEncoding )
+					{
+						debug("Charset from content: %s", contentEncoding);
+						fRequestState->setDebugValue("charset", contentEncoding);
+						fRequestState->setDebugValue("charsetSource", "content");
+					}
+					else
+					{
+						debug("Charset implicit (text default): utf-8");
+						fRequestState->setDebugValue("charset", "utf-8");
+						fRequestState->setDebugValue("charsetSource", "implicit");
+
+						// Let whoever is debugging know when the text isn't actually utf-8.
+						if ( fRequestState->isDebug() )
+						{
+							if ( CharsetTranscoder::isValidUtf8( responseBody->bodyString->data(), responseBody->bodyString->size() ) )
+							{
+								fRequestState->setDebugValue("charsetValid", "true");
+							}
+							else
+							{
+								fRequestState->setDebugValue("charsetValid", "false");
+							}
+						}
+					}
+				}
+
+				if ( NULL != contentEncoding )
+				{
+					debug("Got response content encoding of: %s", contentEncoding);
+
+					if ( fResponseTranscoder.isOpen() )
+					{
+						// Transcoded as it arrived, only the end of the body is left.
+						//
+						if (!fResponseTranscoder.finish(responseBody->bodyString))
+						{
+							debug("Transcode failed");
+						}
+					}
+					else if ( 0 != _strcmpi( "utf-8", contentEncoding ) )
+					{
+						// Found content encoding other than utf-8
+						//
+						debug("Transcoding response body from %s to utf-8", contentEncoding);
+						if (!CharsetTranscoder::transcode(responseBody->bodyString, contentEncoding, "utf-8"))
+						{
+							debug("Transcode failed");
+						}
+					}
+					free(contentEncoding);
+				}
+			}
+			break;
+
+			default:
+				break;
+		}
+
+		if (fIsCachingResponse)
+		{
+			StoreCachedResponse();
+		}
+
+		// Keep small fresh responses in memory as delivered, so the next request for one needs no operation.
+		if ((isServingCachedResponse || fIsCachingResponse) && HttpMemoryResponseCache::isRequestCacheable(fRequestParams))
+		{
+			time_t now = time(NULL);
+			time_t expiresTime = isServingCachedResponse ? fCacheEntry.ExpiresTime :
+				now + HttpResponseCache::getFreshnessLifetime(fRequestState->getResponseHeaders(), now);
+			fMemoryCache->store(fRequestParams, fRequestState, expiresTime);
+		}
+	}
+
+	if (HttpResponseCache::isRequestCacheable(fRequestParams))
+	{
+		fRequestState->setCacheResult(isServingCachedResponse, fWasCacheEntryRevalidated && isServingCachedResponse);
+	}
+
+	// Send the final callback notification (unless the request was aborted), to this request's listener and to
+	// those of the requests coalesced onto it, which are then released.
+	//
+	StopCoalescing();
+	if (!wasAbortRequested) // kWinHttpRequestErrorAborted
+	{
+		fRequestState->setPhase("ended");
+		NotifyListeners();
+	}
+	if (NULL != luaCallback)
+	{
+		luaCallback->unregister();
+	}
+	EndCoalescedRequests();
+
+	// Lua has its own copy of the response body now.
+	fRequestState->releaseResponseBody();
+	fResponseTranscoder.close();
+	fIsSniffingResponseCharset = false;
+	fSniffedResponseCharset.clear();
+	ResetCacheState();
+
+	debug("Request operaton processing complete");
+	return errorResult;
+}
+
+/// Releases the request once the engine is done with it, keeping or removing what was downloaded to file.
+/// The engine resets its own state and clears "fIsExecuting" afterwards.
+/// @param hasOpenedDownloadFile Set if the engine got as far as opening the download file.
+/// @param interruptedLength Bytes written to a resumable download's partial file if the download was interrupted,
+///                          or -1 if it completed or nothing is to be kept.
+void HttpRequestOperation::ReleaseRequest( bool hasOpenedDownloadFile, long long interruptedLength )
+{
+	debug("Releasing request operation resources");
+	UTF8String& downloadFilePath = GetDownloadFilePath();
+	if (fResumableDownload.isOpen())
+	{
+		// The partial file is kept for the next attempt, or removed along with its sidecar.
+		fResumableDownload.end(hasOpenedDownloadFile, interruptedLength);
+		downloadFilePath.clear();
+	}
+	if (NULL != fDownloadSegment)
+	{
+		// The segmented download's file is the download's to keep or remove.
+		downloadFilePath.clear();
+		fDownloadSegment = NULL;
+	}
+	if (downloadFilePath.size() > 0)
+	{
+		// Delete temp file, if the download got as far as creating it...
+		if ( HttpResponseCache::removeFile( downloadFilePath ) )
+		{
+			debug("Successfully deleted temp file");
+		}
+		else
+		{
+#ifdef _WIN32
+			DWORD errorCode = ::GetLastError();
+			bool wasFileFound = ( ERROR_FILE_NOT_FOUND != errorCode ) && ( ERROR_PATH_NOT_FOUND != errorCode );
+#else
+			bool wasFileFound = ( ENOENT != errno );
+#endif
+			if ( wasFileFound )
+			{
+				CORONA_LOG("Error deleting temp file");
+			}
+		}
+		downloadFilePath.clear();
+	}
+	delete fRequestParams;
+	fRequestParams = NULL;
+	delete fRequestState;
+	fRequestState = NULL;
+}
+
+/// Looks for a charset named in the start of the text response body received so far. If one is found that is not
+/// utf-8, the body received so far is transcoded and the rest will be transcoded as it arrives.
+void HttpRequestOperation::SniffResponseCharset()
+{
+	fIsSniffingResponseCharset = false;
+
+	Body *responseBody = fRequestState->getResponseBody();
+	const char *contentType = fRequestState->findResponseHeaderValue("Content-Type");
+	char *contentEncoding = getEncodingFromContent( contentType, responseBody->bodyString->data(), responseBody->bodyString->size() );
+	if ( NULL == contentEncoding )
+	{
+		return;
+	}
+
+	fSniffedResponseCharset = contentEncoding;
+	if ( ( 0 != _strcmpi( "utf-8", contentEncoding ) ) && fResponseTranscoder.open( contentEncoding, "utf-8" ) )
+	{
+		debug("Transcoding response body from %s to utf-8 as it arrives", contentEncoding);
+
+		UTF8String receivedText;
+		receivedText.swap( *responseBody->bodyString );
+		responseBody->bodyString->reserve( receivedText.capacity() );
+		if ( !fResponseTranscoder.write( receivedText.data(), receivedText.size(), responseBody->bodyString ) )
+		{
+			responseBody->bodyString->swap( receivedText );
+			fResponseTranscoder.close();
+		}
+	}
+	free(contentEncoding);
+}
+
+/// Sets up the response state with the stored response found when the request was executed, after updating it
+/// with the headers of the 304 revalidating it, if any. A text body is handled like a received one from here on.
+/// @return Returns false if the stored response could not be read.
+bool HttpRequestOperation::ReadCachedResponse()
+{
+	if (fWasCacheEntryRevalidated && !fResponseCache->refresh(&fCacheEntry, fRequestState->getResponseHeaders()))
+	{
+		debug("Failed to update revalidated response in cache");
+	}
+
+	// Whatever was set up for the body of the 304 does not apply to the stored body.
+	fResponseTranscoder.close();
+	fIsSniffingResponseCharset = false;
+
+	if (!fResponseCache->readResponse(fCacheEntry, fRequestState, fRequestParams->getResponseFile(), GetDownloadFilePath()))
+	{
+		CORONA_LOG("Error reading response from cache");
+		return false;
+	}
+	if (TYPE_STRING == fRequestState->getResponseBody()->bodyType)
+	{
+		fIsSniffingResponseCharset = true;
+	}
+	return true;
+}
+
+/// Stores the response that was just received in the cache.
+void HttpRequestOperation::StoreCachedResponse()
+{
+	const HttpHeaderTable& responseHeaders = fRequestState->getResponseHeaders();
+	Body* body = fRequestState->getResponseBody();
+	bool wasStored = false;
+	switch (body->bodyType)
+	{
+		case TYPE_FILE:
+			// Only once the download was moved to the response file.
+			if (GetDownloadFilePath().empty())
+			{
+				wasStored = fResponseCache->storeFile(fRequestParams, responseHeaders, body->bodyFile->getFullPath());
+			}
+			break;
+
+		case TYPE_STRING:
+			wasStored = fResponseCache->store(fRequestParams, responseHeaders, fCacheResponseBytes.data(), fCacheResponseBytes.size());
+			break;
+
+		case TYPE_BYTES:
+			wasStored = fResponseCache->store(fRequestParams, responseHeaders,
+				body->bodyBytes->empty() ? "" : (const char*)&(*body->bodyBytes)[0], body->bodyBytes->size());
+			break;
+
+		default:
+			break;
+	}
+	debug("Response %s in cache", wasStored ? "stored" : "not stored");
+}
+
+/// Forgets the response cache state of the last request.
+void HttpRequestOperation::ResetCacheState()
+{
+	fIsCacheHit = false;
+	fIsRevalidatingCacheEntry = false;
+	fWasCacheEntryRevalidated = false;
+	fIsCachingResponse = false;
+	UTF8String().swap(fCacheResponseBytes);
+}
+
+/// Dispatches the current phase of the request state to this request's listener (or to the segmented download it
+/// was made for), and to the listeners of the requests coalesced onto it. Listeners may coalesce more requests onto
+/// this one, which get the event too.
+void HttpRequestOperation::NotifyListeners()
+{
+	LuaCallback* luaCallback = fRequestParams->getLuaCallback();
+	if (NULL != luaCallback)
+	{
+		luaCallback->callWithNetworkRequestState( fRequestState );
+	}
+	DownloadSegment* downloadSegment = fRequestParams->getDownloadSegment();
+	if (NULL != downloadSegment)
+	{
+		downloadSegment->notify( fRequestState );
+	}
+	for (size_t index = 0; index < fCoalescedRequests.size(); index++)
+	{
+		std::shared_ptr<CoalescedRequest> coalescedRequest = fCoalescedRequests[index];
+		coalescedRequest->Notify(fRequestState);
+	}
+}
+
+/// Releases the requests coalesced onto this one, once the operation has ended.
+void HttpRequestOperation::EndCoalescedRequests()
+{
+	CoalescedRequest::List coalescedRequests;
+	coalescedRequests.swap(fCoalescedRequests);
+	for (CoalescedRequest::List::iterator iter = coalescedRequests.begin(); iter != coalescedRequests.end(); iter++)
+	{
+		(*iter)->End();
+	}
+}
+
+// Provides a human-readable error message from a request operation error code.
+// N.B. - The caller is responsible for cleaning the memory of the returned UTF8String.
+UTF8String* HttpRequestOperation::GetMessageFromRequestError( WinHttpRequestError errorCode )
+{
+	UTF8String* errorMessage = NULL;
+
+	switch (errorCode)
+	{
+		case kWinHttpRequestErrorTimedOut:
+			errorMessage = new UTF8String("Timed out");
+			break;
+		case kWinHttpRequestErrorInvalidUrl:
+			errorMessage = new UTF8String("Invalid URL");
+			break;
+		case kWinHttpRequestErrorAborted:
+			errorMessage = new UTF8String("Connection aborted");
+			break;
+		case kWinHttpRequestErrorConnectionFailure:
+			errorMessage = new UTF8String("Connection failure");
+			break;
+		case kWinHttpRequestErrorCertificateRequired:
+			errorMessage = new UTF8String("Certificate required");
+			break;
+		case kWinHttpRequestErrorLoginFailure:
+			errorMessage = new UTF8String("Login failure");
+			break;
+		default:
+			errorMessage = new UTF8String("Unknown error");
+			break;
+	}
+
+	return errorMessage;
+}
+
+#pragma endregion
@@ -0,0 +1,125 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef _HttpRequestOperation_H_
+#define _HttpRequestOperation_H_
+
+#include "WinHttpRequestError.h"
+
+#include "CharsetTranscoder.h"
+#include "CoalescedRequest.h"
+#include "HttpMemoryResponseCache.h"
+#include "HttpResponseCache.h"
+#include "ResumableDownload.h"
+#include "SegmentedDownload.h"
+
+#include "WindowsNetworkSupport.h"
+
+#include <map>
+#include <memory>
+
+
+/// Main thread side of a request operation, shared by the request engines (WinHttpRequestOperation on Windows,
+/// EpollRequestOperation on Linux).
+///
+/// An engine moves the request over the network on a thread of its own, and hands what it got to the main thread on
+/// each processing pass. The functions here turn that into the request's state and listener events: the response
+/// body set up from the headers, received text transcoded to UTF-8 (or its charset looked for in the content), the
+/// response cache and memory cache filled or served from, and the download file of a resumed or segmented download
+/// kept or finished. The engine owns the download file's path, given by GetDownloadFilePath().
+///
+/// Only to be used from the main thread.
+class HttpRequestOperation : public NetworkRequestOperation
+{
+public:
+	/// The operations that identical requests can be coalesced onto, by their request's key (see
+	/// CoalescedRequest::getKey()). Kept by the request manager. An operation is in it from the start of its
+	/// request until the response has ended or the request was aborted.
+	typedef std::map< UTF8String, std::weak_ptr<HttpRequestOperation> > CoalescingMap;
+
+	HttpRequestOperation( HttpResponseCache *responseCache, HttpMemoryResponseCache *memoryCache, CoalescingMap *coalescingMap );
+	virtual ~HttpRequestOperation();
+
+	bool IsExecuting();
+	virtual void RequestCancel();
+	RequestCanceller* CoalesceRequest( NetworkRequestParameters *requestParams, const UTF8String& key, const std::shared_ptr<NetworkRequestOperation>& thiz );
+
+protected:
+	NetworkRequestParameters* fRequestParams;
+	NetworkRequestState* fRequestState;
+
+	/// The manager's response caches, used by requests made with params.cache. Responses are stored in the memory
+	/// cache as they are delivered, but only the manager looks for them there.
+	HttpResponseCache* fResponseCache;
+	HttpMemoryResponseCache* fMemoryCache;
+
+	/// The stored response to the request, if the cache had one. It is served as is if it was fresh
+	/// ("fIsCacheHit"), or revalidated by the request and served if the server answers 304 (Not Modified).
+	HttpResponseCache::Entry fCacheEntry;
+	bool fIsCacheHit;
+	bool fIsRevalidatingCacheEntry;
+	bool fWasCacheEntryRevalidated;
+
+	/// Set if the response is to be stored in the cache once it has been received. A text response body is stored
+	/// as received, before any charset is transcoded, so it is collected in "fCacheResponseBytes" as it arrives.
+	bool fIsCachingResponse;
+	UTF8String fCacheResponseBytes;
+
+	/// The partial file of a download made with params.resume, which the engine downloads to in place of a temp
+	/// file, and which is kept if the download is interrupted.
+	ResumableDownload fResumableDownload;
+
+	/// The range of a segmented download that the request is for, if any. The engine writes the range into the
+	/// download's file, which it neither creates nor removes.
+	DownloadSegment* fDownloadSegment;
+
+	/// Converts a text response body to UTF-8 as it arrives, if the response gave a charset other than UTF-8.
+	CharsetStreamTranscoder fResponseTranscoder;
+
+	/// Set while waiting for enough of an HTML or XML response body (whose Content-Type gives no charset) to look
+	/// for a charset named in the content. Once looked for, "fSniffedResponseCharset" holds the charset found, if any.
+	bool fIsSniffingResponseCharset;
+	UTF8String fSniffedResponseCharset;
+
+	/// Set true if this object is in the middle of an HTTP request operation.
+	bool fIsExecuting;
+
+	/// Identical requests coalesced onto this one while it is in flight, and the key they are matched by
+	/// (see CoalescedRequest). The key is empty if the request can't be shared, or once its response has ended.
+	/// The manager finds this operation by its key in "fCoalescingMap".
+	UTF8String fCoalescingKey;
+	CoalescedRequest::List fCoalescedRequests;
+	CoalescingMap* fCoalescingMap;
+
+	/// Gets the path of the file the response body is downloaded to, or an empty string if the response body is
+	/// not directed to a file. Cleared once the download has been moved to the response file.
+	virtual UTF8String& GetDownloadFilePath() = 0;
+
+	void StartRequest( NetworkRequestParameters *requestParams, const std::shared_ptr<HttpRequestOperation>& thiz, RequestCanceller *requestCanceller );
+	void StopCoalescing();
+	void SelectDownloadFile();
+	bool FindCachedResponse();
+	void NotifyUploadBegan( long long bytesTotal );
+	void NotifyUploadProgress( long long bytesSent, long long bytesTotal, long long encodedBytesSent );
+	void ApplyResponseHeaders( int statusCode, const char *headers, size_t headersLength );
+	void ApplyWrittenBytes( long long writtenByteCount, long long decodedByteCount );
+	bool ApplyReceivedBytes( const char *data, size_t length, long long transferredByteCount );
+	WinHttpRequestError EndResponse( WinHttpRequestError errorResult, bool wasAbortRequested, int statusCode );
+	void ReleaseRequest( bool hasOpenedDownloadFile, long long interruptedLength );
+	void SniffResponseCharset();
+	bool ReadCachedResponse();
+	void StoreCachedResponse();
+	void ResetCacheState();
+	void NotifyListeners();
+	void EndCoalescedRequests();
+
+	static UTF8String* GetMessageFromRequestError( WinHttpRequestError error );
+};
+
+#endif
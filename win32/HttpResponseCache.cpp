@@ -0,0 +1,931 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "CoronaLog.h"
+#include "HttpResponseCache.h"
+#include "ContentDecoder.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <WinHttp.h>
+#define HTTP_RESPONSE_CACHE_PATH_SEPARATOR '\\'
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define HTTP_RESPONSE_CACHE_PATH_SEPARATOR '/'
+#endif
+
+
+/// Name of the index file in the cache directory, and the first line identifying its format.
+#define HTTP_RESPONSE_CACHE_INDEX_FILE_NAME "index"
+#define HTTP_RESPONSE_CACHE_INDEX_VERSION "HttpResponseCache 1"
+
+HttpResponseCache::HttpResponseCache( )
+{
+	fIsOpen = false;
+	fTotalBytes = 0;
+	fIsIndexDirty = false;
+	fNextFileNumber = 1;
+}
+
+HttpResponseCache::~HttpResponseCache( )
+{
+	close();
+}
+
+/// Opens the cache in the given directory (created if needed), loading the entries stored there before.
+/// @return Returns false if the directory could not be created.
+bool HttpResponseCache::open( const UTF8String& directory )
+{
+	close();
+
+	if ( !createDirectory( directory ) )
+	{
+		CORONA_LOG("Error creating response cache directory %s", directory.c_str());
+		return false;
+	}
+	fDirectory = directory;
+	if ( fDirectory.empty() || ( HTTP_RESPONSE_CACHE_PATH_SEPARATOR != fDirectory[fDirectory.size() - 1] ) )
+	{
+		fDirectory += HTTP_RESPONSE_CACHE_PATH_SEPARATOR;
+	}
+	if ( !load() )
+	{
+		debug("Starting with an empty response cache");
+	}
+	fIsOpen = true;
+	return true;
+}
+
+bool HttpResponseCache::isOpen( )
+{
+	return fIsOpen;
+}
+
+/// Writes the order the entries were used in to the index (if it changed) and forgets them.
+void HttpResponseCache::close( )
+{
+	if ( fIsOpen && fIsIndexDirty )
+	{
+		save();
+	}
+	fEntries.clear();
+	fEntriesByKey.clear();
+	fTotalBytes = 0;
+	fIsIndexDirty = false;
+	fIsOpen = false;
+}
+
+/// Determines if a request may be answered from the cache, and its response stored in it. Only GET requests made
+/// with params.cache = true are, unless they ask for part of the resource or ask not to be stored.
+bool HttpResponseCache::isRequestCacheable( NetworkRequestParameters *requestParams )
+{
+	if ( !requestParams->isCacheEnabled() || ( 0 != _strcmpi( "GET", requestParams->getRequestMethod().c_str() ) ) )
+	{
+		return false;
+	}
+	if ( NULL != requestParams->getRequestHeaderValue( "Range" ) )
+	{
+		return false;
+	}
+	UTF8String *cacheControl = requestParams->getRequestHeaderValue( "Cache-Control" );
+	return ( NULL == cacheControl ) || !findDirective( cacheControl->c_str(), "no-store", NULL );
+}
+
+/// Determines if a response may be stored, and is worth storing (i.e. it will be fresh for a while, or it can be
+/// revalidated once it is not).
+bool HttpResponseCache::isResponseStorable( int status, const HttpHeaderTable& responseHeaders )
+{
+	if ( HTTP_STATUS_OK != status )
+	{
+		return false;
+	}
+	const char *cacheControl = responseHeaders.getValue( "Cache-Control" );
+	if ( ( NULL != cacheControl ) && findDirective( cacheControl, "no-store", NULL ) )
+	{
+		return false;
+	}
+	const char *vary = responseHeaders.getValue( "Vary" );
+	if ( ( NULL != vary ) && ( NULL != strchr( vary, '*' ) ) )
+	{
+		return false;
+	}
+	return ( NULL != responseHeaders.getValue( "ETag" ) ) || ( NULL != responseHeaders.getValue( "Last-Modified" ) ) ||
+		   ( getFreshnessLifetime( responseHeaders, time( NULL ) ) > 0 );
+}
+
+/// Looks for a stored response to the given request, and marks it as the most recently used one.
+/// @param entry Set to a copy of the stored response, if there is one.
+/// @return Returns false if there is no stored response that matches the request.
+bool HttpResponseCache::find( NetworkRequestParameters *requestParams, Entry *entry )
+{
+	if ( !fIsOpen )
+	{
+		return false;
+	}
+	EntryMap::iterator iter = fEntriesByKey.find( requestParams->getRequestUrl() );
+	if ( fEntriesByKey.end() == iter )
+	{
+		return false;
+	}
+
+	// The body file may have been removed along with the rest of the app's caches.
+	FILE *bodyFile = openFile( getPath( iter->second->FileName ), "rb" );
+	if ( NULL == bodyFile )
+	{
+		remove( iter );
+		save();
+		return false;
+	}
+	fclose( bodyFile );
+
+	// The requests the response varies on have to match too. A response to a different one will be replaced by
+	// this request's response.
+	HttpHeaderTable storedHeaders;
+	storedHeaders.parse( iter->second->Headers.data(), iter->second->Headers.size() );
+	if ( getVaryHeaders( storedHeaders, requestParams ) != iter->second->VaryHeaders )
+	{
+		return false;
+	}
+
+	fEntries.splice( fEntries.end(), fEntries, iter->second );
+	fIsIndexDirty = true;
+	*entry = *iter->second;
+	return true;
+}
+
+/// Determines if a stored response can be used without revalidating it. It can't if the request asked for it to be
+/// revalidated ("Cache-Control: no-cache" or "max-age=0").
+bool HttpResponseCache::isFresh( const Entry& entry, NetworkRequestParameters *requestParams )
+{
+	return !isRevalidationRequested( requestParams ) && ( time( NULL ) < entry.ExpiresTime );
+}
+
+/// Determines if the request asks for any stored response to be revalidated rather than used as is.
+bool HttpResponseCache::isRevalidationRequested( NetworkRequestParameters *requestParams )
+{
+	UTF8String *cacheControl = requestParams->getRequestHeaderValue( "Cache-Control" );
+	long long maxAge = 0;
+	if ( ( NULL != cacheControl ) &&
+		 ( findDirective( cacheControl->c_str(), "no-cache", NULL ) ||
+		   ( findDirective( cacheControl->c_str(), "max-age", &maxAge ) && ( maxAge <= 0 ) ) ) )
+	{
+		return true;
+	}
+	UTF8String *pragma = requestParams->getRequestHeaderValue( "Pragma" );
+	return ( NULL != pragma ) && findDirective( pragma->c_str(), "no-cache", NULL );
+}
+
+/// Gets the request headers (CRLF terminated lines) asking the server to only send the response if it differs from
+/// the stored one.
+UTF8String HttpResponseCache::getConditionalHeaders( const Entry& entry )
+{
+	HttpHeaderTable storedHeaders;
+	storedHeaders.parse( entry.Headers.data(), entry.Headers.size() );
+
+	UTF8String conditionalHeaders;
+	const char *eTag = storedHeaders.getValue( "ETag" );
+	if ( NULL != eTag )
+	{
+		conditionalHeaders += "If-None-Match: ";
+		conditionalHeaders += eTag;
+		conditionalHeaders += "\r\n";
+	}
+	const char *lastModified = storedHeaders.getValue( "Last-Modified" );
+	if ( NULL != lastModified )
+	{
+		conditionalHeaders += "If-Modified-Since: ";
+		conditionalHeaders += lastModified;
+		conditionalHeaders += "\r\n";
+	}
+	return conditionalHeaders;
+}
+
+/// Stores the response to the given request with a body received in memory, replacing any response stored for it.
+/// @return Returns false if the response is too large to be stored, or could not be written.
+bool HttpResponseCache::store( NetworkRequestParameters *requestParams, const HttpHeaderTable& responseHeaders, const char *body, size_t bodyLength )
+{
+	if ( !fIsOpen || ( bodyLength > HTTP_RESPONSE_CACHE_MAX_ENTRY_BYTES ) )
+	{
+		return false;
+	}
+
+	UTF8String tempPath = createTempPath();
+	FILE *file = openFile( tempPath, "wb" );
+	if ( NULL == file )
+	{
+		return false;
+	}
+	bool wasWritten = ( fwrite( body, 1, bodyLength, file ) == bodyLength );
+	wasWritten = ( 0 == fclose( file ) ) && wasWritten;
+	if ( !wasWritten )
+	{
+		removeFile( tempPath );
+		return false;
+	}
+
+	Entry entry;
+	entry.BodySize = (long long)bodyLength;
+	return add( entry, responseHeaders, requestParams, tempPath );
+}
+
+/// Stores the response to the given request with a body downloaded to a file, replacing any response stored for it.
+/// The file is copied, so it stays the caller's.
+/// @return Returns false if the response is too large to be stored, or could not be copied.
+bool HttpResponseCache::storeFile( NetworkRequestParameters *requestParams, const HttpHeaderTable& responseHeaders, const UTF8String& bodyPath )
+{
+	if ( !fIsOpen )
+	{
+		return false;
+	}
+
+	UTF8String tempPath = createTempPath();
+	Entry entry;
+	if ( !copyFile( bodyPath, tempPath, &entry.BodySize ) )
+	{
+		removeFile( tempPath );
+		return false;
+	}
+	return add( entry, responseHeaders, requestParams, tempPath );
+}
+
+/// Updates a stored response with the headers of a 304 (Not Modified) response revalidating it, which makes it
+/// fresh again.
+/// @param entry The stored response, as found by find(). Updated along with the one in the cache.
+bool HttpResponseCache::refresh( Entry *entry, const HttpHeaderTable& notModifiedHeaders )
+{
+	// Headers in the 304 replace the stored ones with the same name, except for those describing the (absent) body.
+	HttpHeaderTable storedHeaders;
+	storedHeaders.parse( entry->Headers.data(), entry->Headers.size() );
+	UTF8String headers;
+	for ( size_t index = 0; index < storedHeaders.size(); index++ )
+	{
+		const char *name = storedHeaders.getName( index );
+		bool isStatusLine = ( 0 == strcmp( HTTP_HEADER_STATUS_LINE_NAME, name ) );
+		if ( !isStatusLine && ( NULL != notModifiedHeaders.getValue( name ) ) &&
+			 ( 0 != _strcmpi( "Content-Length", name ) ) && ( 0 != _strcmpi( "Content-Encoding", name ) ) )
+		{
+			continue;
+		}
+		if ( !isStatusLine )
+		{
+			headers += name;
+			headers += ": ";
+		}
+		headers.append( storedHeaders.getValue( index ), storedHeaders.getValueLength( index ) );
+		headers += "\r\n";
+	}
+	headers += getStoredHeaders( notModifiedHeaders, true );
+
+	time_t now = time( NULL );
+	HttpHeaderTable refreshedHeaders;
+	refreshedHeaders.parse( headers.data(), headers.size() );
+	entry->Headers = headers;
+	entry->StoredTime = now;
+	entry->ExpiresTime = now + getFreshnessLifetime( refreshedHeaders, now );
+
+	EntryMap::iterator iter = fEntriesByKey.find( entry->Key );
+	if ( ( fEntriesByKey.end() == iter ) || ( iter->second->FileName != entry->FileName ) )
+	{
+		return false;
+	}
+	*iter->second = *entry;
+	return save();
+}
+
+/// Sets up the request state with a stored response, as if it had just been received.
+/// @param responseFile The file the response body is to be downloaded to, or NULL to have it in memory.
+/// @param downloadFilePath Where the body is copied to if it is downloaded, to be moved to the response file once the
+///                         request ends like any other download.
+/// @return Returns false if the stored body could not be read or copied.
+bool HttpResponseCache::readResponse( const Entry& entry, NetworkRequestState *requestState, CoronaFileSpec *responseFile, const UTF8String& downloadFilePath )
+{
+	char contentLength[32];
+	sprintf_s( contentLength, sizeof(contentLength), "%lld", entry.BodySize );
+	UTF8String headers = entry.Headers;
+	headers += "Content-Length: ";
+	headers += contentLength;
+	headers += "\r\n\r\n";
+
+	requestState->releaseResponseBody();
+	requestState->setStatus( HTTP_STATUS_OK );
+	requestState->setResponseHeaders( headers.data(), headers.size() );
+	requestState->setBytesEstimated( entry.BodySize );
+	requestState->setBytesTransferred( entry.BodySize );
+
+	Body *body = requestState->getResponseBody();
+	UTF8String bodyPath = getPath( entry.FileName );
+	if ( NULL != responseFile )
+	{
+		long long length = 0;
+		if ( !copyFile( bodyPath, downloadFilePath, &length ) )
+		{
+			removeFile( downloadFilePath );
+			return false;
+		}
+		body->bodyType = TYPE_FILE;
+		body->bodyFile = new CoronaFileSpec( responseFile );
+		return true;
+	}
+
+	UTF8String bodyBytes;
+	FILE *file = openFile( bodyPath, "rb" );
+	if ( NULL == file )
+	{
+		return false;
+	}
+	bodyBytes.resize( (size_t)entry.BodySize );
+	size_t bytesRead = bodyBytes.empty() ? 0 : fread( &bodyBytes[0], 1, bodyBytes.size(), file );
+	fclose( file );
+	if ( bytesRead != bodyBytes.size() )
+	{
+		return false;
+	}
+
+	// Text or binary, the same way as a received response.
+	char *contentType = NULL;
+	char *contentEncoding = NULL;
+	const char *contentTypeHeader = requestState->findResponseHeaderValue( "Content-Type" );
+	if ( ( NULL != contentTypeHeader ) && ( 0 != *contentTypeHeader ) )
+	{
+		contentType = getContentType( contentTypeHeader );
+		contentEncoding = getContentTypeEncoding( contentTypeHeader );
+	}
+	if ( ( NULL != contentEncoding ) || ( ( NULL != contentType ) && isContentTypeText( contentType ) ) )
+	{
+		body->bodyType = TYPE_STRING;
+		body->bodyString = new UTF8String( );
+		body->bodyString->swap( bodyBytes );
+	}
+	else
+	{
+		body->bodyType = TYPE_BYTES;
+		body->bodyBytes = new ByteVector( bodyBytes.begin(), bodyBytes.end() );
+	}
+	if ( NULL != contentType )
+	{
+		free( contentType );
+	}
+	if ( NULL != contentEncoding )
+	{
+		free( contentEncoding );
+	}
+	return true;
+}
+
+/// Parses an HTTP date (RFC 1123, RFC 850 or asctime() format).
+/// @return Returns the date as a time_t, or -1 if it is not a valid date.
+time_t HttpResponseCache::parseHttpDate( const char *date )
+{
+	static const char *kMonths[] = { "jan", "feb", "mar", "apr", "may", "jun", "jul", "aug", "sep", "oct", "nov", "dec" };
+
+	if ( NULL == date )
+	{
+		return -1;
+	}
+
+	// The formats only differ in the order of the fields and their separators, so each token is recognized by
+	// itself. Day names and the time zone (always GMT) are skipped.
+	int day = -1, month = -1, year = -1, hour = -1, minute = -1, second = -1;
+	const char *text = date;
+	while ( 0 != *text )
+	{
+		if ( ( ' ' == *text ) || ( ',' == *text ) || ( '-' == *text ) )
+		{
+			text++;
+			continue;
+		}
+
+		const char *tokenStart = text;
+		while ( ( 0 != *text ) && ( ' ' != *text ) && ( ',' != *text ) && ( '-' != *text ) )
+		{
+			text++;
+		}
+		size_t tokenLength = text - tokenStart;
+
+		if ( isdigit( (unsigned char)*tokenStart ) )
+		{
+			if ( NULL != memchr( tokenStart, ':', tokenLength ) )
+			{
+				if ( 3 != sscanf( tokenStart, "%d:%d:%d", &hour, &minute, &second ) )
+				{
+					return -1;
+				}
+			}
+			else if ( ( day < 0 ) && ( tokenLength <= 2 ) )
+			{
+				day = atoi( tokenStart );
+			}
+			else
+			{
+				year = atoi( tokenStart );
+				if ( tokenLength <= 2 )
+				{
+					year += ( year < 70 ) ? 2000 : 1900;
+				}
+			}
+		}
+		else if ( tokenLength >= 3 )
+		{
+			for ( int index = 0; index < 12; index++ )
+			{
+				if ( 0 == _strnicmp( tokenStart, kMonths[index], 3 ) )
+				{
+					month = index;
+					break;
+				}
+			}
+		}
+	}
+	if ( ( day < 1 ) || ( day > 31 ) || ( month < 0 ) || ( year < 1970 ) ||
+		 ( hour < 0 ) || ( hour > 23 ) || ( minute < 0 ) || ( minute > 59 ) || ( second < 0 ) || ( second > 60 ) )
+	{
+		return -1;
+	}
+
+	// Days since 1970-01-01 in the proleptic Gregorian calendar, counting years from March so that leap days come
+	// last.
+	int shiftedYear = ( month < 2 ) ? year - 1 : year;
+	int era = shiftedYear / 400;
+	int yearOfEra = shiftedYear - era * 400;
+	int dayOfYear = ( 153 * ( ( month + 10 ) % 12 ) + 2 ) / 5 + day - 1;
+	int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+	long long days = (long long)era * 146097 + dayOfEra - 719468;
+	return (time_t)( days * 86400 + hour * 3600 + minute * 60 + second );
+}
+
+// Adds an entry for the response to the given request, whose body has been written to the given temp file.
+bool HttpResponseCache::add( Entry& entry, const HttpHeaderTable& responseHeaders, NetworkRequestParameters *requestParams, const UTF8String& tempPath )
+{
+	char fileName[32];
+	sprintf_s( fileName, sizeof(fileName), "%lu.body", fNextFileNumber++ );
+	entry.FileName = fileName;
+	if ( !renameFile( tempPath, getPath( entry.FileName ) ) )
+	{
+		removeFile( tempPath );
+		return false;
+	}
+
+	// The body was decoded as it arrived if the response had a Content-Encoding that we undo.
+	bool isBodyDecoded = requestParams->isCompressionEnabled() &&
+						 ContentDecoder::isSupportedEncoding( responseHeaders.getValue( "Content-Encoding" ) );
+
+	time_t now = time( NULL );
+	entry.Key = requestParams->getRequestUrl();
+	entry.Headers = getStoredHeaders( responseHeaders, isBodyDecoded );
+	entry.VaryHeaders = getVaryHeaders( responseHeaders, requestParams );
+	entry.StoredTime = now;
+	entry.ExpiresTime = now + getFreshnessLifetime( responseHeaders, now );
+
+	EntryMap::iterator iter = fEntriesByKey.find( entry.Key );
+	if ( fEntriesByKey.end() != iter )
+	{
+		remove( iter );
+	}
+	fEntriesByKey[entry.Key] = fEntries.insert( fEntries.end(), entry );
+	fTotalBytes += entry.BodySize;
+
+	evict();
+	return save();
+}
+
+// Removes an entry and its body file.
+void HttpResponseCache::remove( EntryMap::iterator iter )
+{
+	EntryList::iterator entry = iter->second;
+	removeFile( getPath( entry->FileName ) );
+	fTotalBytes -= entry->BodySize;
+	fEntriesByKey.erase( iter );
+	fEntries.erase( entry );
+	fIsIndexDirty = true;
+}
+
+// Removes the least recently used entries until the bodies fit the cache's size.
+void HttpResponseCache::evict( )
+{
+	while ( ( fTotalBytes > HTTP_RESPONSE_CACHE_MAX_BYTES ) && !fEntries.empty() )
+	{
+		debug("Evicting %s from the response cache", fEntries.front().Key.c_str());
+		remove( fEntriesByKey.find( fEntries.front().Key ) );
+	}
+}
+
+// Reads the index file. Each entry is a line of numbers (its times, body size and the lengths of its strings),
+// followed by the strings themselves and a line break.
+bool HttpResponseCache::load( )
+{
+	FILE *file = openFile( getPath( HTTP_RESPONSE_CACHE_INDEX_FILE_NAME ), "rb" );
+	if ( NULL == file )
+	{
+		return false;
+	}
+	UTF8String index;
+	char buffer[4096];
+	size_t bytesRead;
+	while ( ( bytesRead = fread( buffer, 1, sizeof(buffer), file ) ) > 0 )
+	{
+		index.append( buffer, bytesRead );
+	}
+	fclose( file );
+
+	size_t versionLength = strlen( HTTP_RESPONSE_CACHE_INDEX_VERSION );
+	if ( 0 != index.compare( 0, versionLength, HTTP_RESPONSE_CACHE_INDEX_VERSION ) )
+	{
+		return false;
+	}
+	const char *text = index.c_str() + versionLength;
+	const char *end = index.c_str() + index.size();
+	char *next = NULL;
+	fNextFileNumber = strtoul( text, &next, 10 );
+	text = next;
+
+	while ( text < end )
+	{
+		Entry entry;
+		long long lengths[4];
+		entry.StoredTime = (time_t)_strtoi64( text, &next, 10 );
+		entry.ExpiresTime = (time_t)_strtoi64( next, &next, 10 );
+		entry.BodySize = _strtoi64( next, &next, 10 );
+		for ( int index = 0; index < 4; index++ )
+		{
+			lengths[index] = _strtoi64( next, &next, 10 );
+		}
+		if ( ( next >= end ) || ( '\n' != *next ) )
+		{
+			break;
+		}
+		text = next + 1;
+		if ( ( lengths[0] < 0 ) || ( lengths[1] < 0 ) || ( lengths[2] < 0 ) || ( lengths[3] < 0 ) ||
+			 ( lengths[0] + lengths[1] + lengths[2] + lengths[3] >= end - text ) )
+		{
+			break;
+		}
+		entry.Key.assign( text, (size_t)lengths[0] );
+		text += lengths[0];
+		entry.Headers.assign( text, (size_t)lengths[1] );
+		text += lengths[1];
+		entry.VaryHeaders.assign( text, (size_t)lengths[2] );
+		text += lengths[2];
+		entry.FileName.assign( text, (size_t)lengths[3] );
+		text += lengths[3] + 1;
+
+		if ( fEntriesByKey.end() == fEntriesByKey.find( entry.Key ) )
+		{
+			fEntriesByKey[entry.Key] = fEntries.insert( fEntries.end(), entry );
+			fTotalBytes += entry.BodySize;
+		}
+	}
+	fIsIndexDirty = false;
+	return true;
+}
+
+// Writes the index file, replacing the previous one only once the new one has been written in full.
+bool HttpResponseCache::save( )
+{
+	UTF8String index = HTTP_RESPONSE_CACHE_INDEX_VERSION;
+	char line[160];
+	sprintf_s( line, sizeof(line), " %lu\n", fNextFileNumber );
+	index += line;
+	for ( EntryList::iterator iter = fEntries.begin(); iter != fEntries.end(); iter++ )
+	{
+		sprintf_s( line, sizeof(line), "%lld %lld %lld %u %u %u %u\n",
+				   (long long)iter->StoredTime, (long long)iter->ExpiresTime, iter->BodySize,
+				   (unsigned int)iter->Key.size(), (unsigned int)iter->Headers.size(),
+				   (unsigned int)iter->VaryHeaders.size(), (unsigned int)iter->FileName.size() );
+		index += line;
+		index += iter->Key;
+		index += iter->Headers;
+		index += iter->VaryHeaders;
+		index += iter->FileName;
+		index += "\n";
+	}
+
+	UTF8String tempPath = createTempPath();
+	FILE *file = openFile( tempPath, "wb" );
+	if ( NULL == file )
+	{
+		return false;
+	}
+	bool wasWritten = ( fwrite( index.data(), 1, index.size(), file ) == index.size() );
+	wasWritten = ( 0 == fclose( file ) ) && wasWritten;
+	if ( !wasWritten || !renameFile( tempPath, getPath( HTTP_RESPONSE_CACHE_INDEX_FILE_NAME ) ) )
+	{
+		CORONA_LOG("Error writing response cache index");
+		removeFile( tempPath );
+		return false;
+	}
+	fIsIndexDirty = false;
+	return true;
+}
+
+UTF8String HttpResponseCache::getPath( const UTF8String& fileName )
+{
+	return fDirectory + fileName;
+}
+
+// Gets the path of a new file in the cache directory, which is renamed once it has been written.
+UTF8String HttpResponseCache::createTempPath( )
+{
+	char fileName[32];
+	sprintf_s( fileName, sizeof(fileName), "%lu.tmp", fNextFileNumber++ );
+	return getPath( fileName );
+}
+
+/// Gets how long a response is fresh for from its headers (max-age, Expires, or a tenth of the time since it was
+/// last modified), less the time it already spent in other caches (Age).
+time_t HttpResponseCache::getFreshnessLifetime( const HttpHeaderTable& responseHeaders, time_t now )
+{
+	const char *cacheControl = responseHeaders.getValue( "Cache-Control" );
+	if ( ( NULL != cacheControl ) &&
+		 ( findDirective( cacheControl, "no-cache", NULL ) || findDirective( cacheControl, "no-store", NULL ) ) )
+	{
+		return 0;
+	}
+
+	time_t date = parseHttpDate( responseHeaders.getValue( "Date" ) );
+	if ( date < 0 )
+	{
+		date = now;
+	}
+
+	long long lifetime = 0;
+	long long maxAge = 0;
+	const char *expires = responseHeaders.getValue( "Expires" );
+	const char *lastModified = responseHeaders.getValue( "Last-Modified" );
+	if ( ( NULL != cacheControl ) && findDirective( cacheControl, "max-age", &maxAge ) )
+	{
+		lifetime = maxAge;
+	}
+	else if ( NULL != expires )
+	{
+		// An invalid date (such as "0") means the response has already expired.
+		time_t expiresTime = parseHttpDate( expires );
+		lifetime = ( expiresTime < 0 ) ? 0 : (long long)( expiresTime - date );
+	}
+	else if ( NULL != lastModified )
+	{
+		time_t lastModifiedTime = parseHttpDate( lastModified );
+		if ( ( lastModifiedTime >= 0 ) && ( lastModifiedTime < date ) )
+		{
+			lifetime = (long long)( date - lastModifiedTime ) / 10;
+			if ( lifetime > HTTP_RESPONSE_CACHE_MAX_HEURISTIC_SECONDS )
+			{
+				lifetime = HTTP_RESPONSE_CACHE_MAX_HEURISTIC_SECONDS;
+			}
+		}
+	}
+
+	const char *age = responseHeaders.getValue( "Age" );
+	if ( NULL != age )
+	{
+		lifetime -= _strtoi64( age, NULL, 10 );
+	}
+	return ( lifetime > 0 ) ? (time_t)lifetime : 0;
+}
+
+// Looks for a directive in a comma separated Cache-Control (or Pragma) value, ignoring case.
+// @param value Set to the directive's numeric argument ("max-age=60"), if not NULL.
+bool HttpResponseCache::findDirective( const char *cacheControl, const char *directive, long long *value )
+{
+	size_t directiveLength = strlen( directive );
+	const char *text = cacheControl;
+	while ( 0 != *text )
+	{
+		while ( ( ' ' == *text ) || ( '\t' == *text ) || ( ',' == *text ) )
+		{
+			text++;
+		}
+		const char *tokenStart = text;
+		while ( ( 0 != *text ) && ( ',' != *text ) && ( '=' != *text ) && ( ' ' != *text ) && ( '\t' != *text ) )
+		{
+			text++;
+		}
+		bool isMatch = ( (size_t)( text - tokenStart ) == directiveLength ) && ( 0 == _strnicmp( tokenStart, directive, directiveLength ) );
+
+		// Skip the argument, which may be quoted (and contain commas).
+		while ( ( ' ' == *text ) || ( '\t' == *text ) )
+		{
+			text++;
+		}
+		const char *argument = NULL;
+		if ( '=' == *text )
+		{
+			text++;
+			argument = text;
+			if ( '"' == *text )
+			{
+				argument++;
+				text = strchr( text + 1, '"' );
+				text = ( NULL == text ) ? cacheControl + strlen( cacheControl ) : text + 1;
+			}
+			while ( ( 0 != *text ) && ( ',' != *text ) )
+			{
+				text++;
+			}
+		}
+		while ( ( 0 != *text ) && ( ',' != *text ) )
+		{
+			text++;
+		}
+
+		if ( isMatch )
+		{
+			if ( NULL != value )
+			{
+				*value = ( NULL != argument ) ? _strtoi64( argument, NULL, 10 ) : 0;
+			}
+			return true;
+		}
+	}
+	return false;
+}
+
+/// Gets the request's values of the headers named in the response's Vary header, as "name: value" lines.
+UTF8String HttpResponseCache::getVaryHeaders( const HttpHeaderTable& responseHeaders, NetworkRequestParameters *requestParams )
+{
+	UTF8String varyHeaders;
+	const char *vary = responseHeaders.getValue( "Vary" );
+	if ( NULL == vary )
+	{
+		return varyHeaders;
+	}
+	while ( 0 != *vary )
+	{
+		while ( ( ' ' == *vary ) || ( '\t' == *vary ) || ( ',' == *vary ) )
+		{
+			vary++;
+		}
+		const char *nameStart = vary;
+		while ( ( 0 != *vary ) && ( ',' != *vary ) && ( ' ' != *vary ) && ( '\t' != *vary ) )
+		{
+			vary++;
+		}
+		if ( vary == nameStart )
+		{
+			continue;
+		}
+		UTF8String name( nameStart, vary - nameStart );
+		UTF8String *value = requestParams->getRequestHeaderValue( name.c_str() );
+		varyHeaders += name;
+		varyHeaders += ": ";
+		if ( NULL != value )
+		{
+			varyHeaders += *value;
+		}
+		varyHeaders += "\n";
+	}
+	return varyHeaders;
+}
+
+/// Serializes the response headers to be stored (CRLF terminated lines), leaving out the ones describing how the
+/// body was sent.
+UTF8String HttpResponseCache::getStoredHeaders( const HttpHeaderTable& responseHeaders, bool isBodyDecoded )
+{
+	UTF8String headers;
+	for ( size_t index = 0; index < responseHeaders.size(); index++ )
+	{
+		const char *name = responseHeaders.getName( index );
+		if ( ( 0 == _strcmpi( "Content-Length", name ) ) || ( 0 == _strcmpi( "Transfer-Encoding", name ) ) ||
+			 ( 0 == _strcmpi( "Connection", name ) ) || ( 0 == _strcmpi( "Keep-Alive", name ) ) ||
+			 ( isBodyDecoded && ( 0 == _strcmpi( "Content-Encoding", name ) ) ) )
+		{
+			continue;
+		}
+		if ( 0 != strcmp( HTTP_HEADER_STATUS_LINE_NAME, name ) )
+		{
+			headers += name;
+			headers += ": ";
+		}
+		headers.append( responseHeaders.getValue( index ), responseHeaders.getValueLength( index ) );
+		headers += "\r\n";
+	}
+	return headers;
+}
+
+#ifdef _WIN32
+// Converts a UTF-8 path to the UTF-16 one taken by the Win32 file functions.
+static std::wstring getWidePath( const UTF8String& path )
+{
+	std::wstring widePath;
+	int wideLength = MultiByteToWideChar( CP_UTF8, 0, path.c_str(), (int)path.size(), NULL, 0 );
+	if ( wideLength > 0 )
+	{
+		widePath.resize( wideLength );
+		MultiByteToWideChar( CP_UTF8, 0, path.c_str(), (int)path.size(), &widePath[0], wideLength );
+	}
+	return widePath;
+}
+#endif
+
+FILE* HttpResponseCache::openFile( const UTF8String& path, const char *mode )
+{
+#ifdef _WIN32
+	FILE *file = NULL;
+	std::wstring wideMode( mode, mode + strlen( mode ) );
+	::_wfopen_s( &file, getWidePath( path ).c_str(), wideMode.c_str() );
+	return file;
+#else
+	return ::fopen( path.c_str(), mode );
+#endif
+}
+
+/// Creates a file of the given length (replacing any file at the path), reserving its disk space without writing to
+/// it, so that it can be written in any order.
+bool HttpResponseCache::createFile( const UTF8String& path, long long length )
+{
+#ifdef _WIN32
+	HANDLE fileHandle = ::CreateFileW( getWidePath( path ).c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+	if ( INVALID_HANDLE_VALUE == fileHandle )
+	{
+		return false;
+	}
+	LARGE_INTEGER endOfFile;
+	endOfFile.QuadPart = length;
+	bool wasCreated = ( FALSE != ::SetFilePointerEx( fileHandle, endOfFile, NULL, FILE_BEGIN ) ) && ( FALSE != ::SetEndOfFile( fileHandle ) );
+	wasCreated = ( FALSE != ::CloseHandle( fileHandle ) ) && wasCreated;
+#else
+	int file = ::open( path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 );
+	if ( file < 0 )
+	{
+		return false;
+	}
+	// Not every file system can reserve the space, in which case the file is only given its length.
+	bool wasCreated = ( length <= 0 ) || ( 0 == ::fallocate( file, 0, 0, (off_t)length ) ) || ( 0 == ::ftruncate( file, (off_t)length ) );
+	wasCreated = ( 0 == ::close( file ) ) && wasCreated;
+#endif
+	if ( !wasCreated )
+	{
+		removeFile( path );
+	}
+	return wasCreated;
+}
+
+bool HttpResponseCache::removeFile( const UTF8String& path )
+{
+#ifdef _WIN32
+	return ( FALSE != ::DeleteFileW( getWidePath( path ).c_str() ) );
+#else
+	return ( 0 == ::unlink( path.c_str() ) );
+#endif
+}
+
+// Renames a file, replacing the target file if it exists.
+bool HttpResponseCache::renameFile( const UTF8String& sourcePath, const UTF8String& targetPath )
+{
+#ifdef _WIN32
+	return ( FALSE != ::MoveFileExW( getWidePath( sourcePath ).c_str(), getWidePath( targetPath ).c_str(), MOVEFILE_REPLACE_EXISTING ) );
+#else
+	return ( 0 == ::rename( sourcePath.c_str(), targetPath.c_str() ) );
+#endif
+}
+
+// Copies a file of up to HTTP_RESPONSE_CACHE_MAX_ENTRY_BYTES bytes, setting "length" to its size.
+bool HttpResponseCache::copyFile( const UTF8String& sourcePath, const UTF8String& targetPath, long long *length )
+{
+	FILE *sourceFile = openFile( sourcePath, "rb" );
+	if ( NULL == sourceFile )
+	{
+		return false;
+	}
+	FILE *targetFile = openFile( targetPath, "wb" );
+	if ( NULL == targetFile )
+	{
+		fclose( sourceFile );
+		return false;
+	}
+
+	char buffer[16384];
+	size_t bytesRead;
+	bool wasCopied = true;
+	*length = 0;
+	while ( wasCopied && ( ( bytesRead = fread( buffer, 1, sizeof(buffer), sourceFile ) ) > 0 ) )
+	{
+		*length += bytesRead;
+		wasCopied = ( *length <= HTTP_RESPONSE_CACHE_MAX_ENTRY_BYTES ) && ( fwrite( buffer, 1, bytesRead, targetFile ) == bytesRead );
+	}
+	wasCopied = !ferror( sourceFile ) && wasCopied;
+	fclose( sourceFile );
+	wasCopied = ( 0 == fclose( targetFile ) ) && wasCopied;
+	return wasCopied;
+}
+
+bool HttpResponseCache::createDirectory( const UTF8String& path )
+{
+#ifdef _WIN32
+	return ( FALSE != ::CreateDirectoryW( getWidePath( path ).c_str(), NULL ) ) || ( ERROR_ALREADY_EXISTS == ::GetLastError() );
+#else
+	return ( 0 == ::mkdir( path.c_str(), 0755 ) ) || ( EEXIST == errno );
+#endif
+}
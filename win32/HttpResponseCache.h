@@ -0,0 +1,134 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef _HttpResponseCache_H_
+#define _HttpResponseCache_H_
+
+#include "WindowsNetworkSupport.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#include <list>
+#include <map>
+#include <string>
+
+
+/// Name of the directory (in the app's caches directory) holding the disk cache used by params.cache.
+#define HTTP_RESPONSE_CACHE_DIRECTORY_NAME "network-cache"
+
+/// Total size of the response bodies kept by the disk cache. The least recently used responses are evicted to
+/// stay under it, and a response larger than a quarter of it is never stored.
+#define HTTP_RESPONSE_CACHE_MAX_BYTES (32 * 1024 * 1024)
+#define HTTP_RESPONSE_CACHE_MAX_ENTRY_BYTES (HTTP_RESPONSE_CACHE_MAX_BYTES / 4)
+
+/// Longest a response without explicit freshness (no max-age or Expires) is considered fresh, based on how long
+/// ago it was last modified.
+#define HTTP_RESPONSE_CACHE_MAX_HEURISTIC_SECONDS (24 * 60 * 60)
+
+/// On-disk cache of GET responses for requests made with params.cache = true.
+///
+/// Only 200 responses that allow it (no "Cache-Control: no-store", no "Vary: *") and that are either fresh for
+/// some time or have a validator (ETag or Last-Modified) are stored. A fresh response is served without touching
+/// the network, while a stale one is revalidated with If-None-Match/If-Modified-Since and served on a 304.
+///
+/// Each response body is kept in its own file, next to an index file holding the keys, response headers and
+/// freshness of all entries in least recently used order. Bodies are stored as they were delivered, i.e. after
+/// any Content-Encoding was undone, but before any charset was transcoded. Only used on the main thread.
+class HttpResponseCache
+{
+public:
+
+	/// A stored response.
+	struct Entry
+	{
+		/// The request URL.
+		UTF8String Key;
+
+		/// The response headers as received (status line first, CRLF separated), except for the headers describing
+		/// how the body was sent (Content-Length, Content-Encoding, Transfer-Encoding, Connection).
+		UTF8String Headers;
+
+		/// The request headers named by the response's Vary header, as "name: value" lines. A request only matches
+		/// the entry if it has the same values.
+		UTF8String VaryHeaders;
+
+		/// Name of the body file in the cache directory, and its size.
+		UTF8String FileName;
+		long long BodySize;
+
+		/// When the response was received, and when it stops being fresh.
+		time_t StoredTime;
+		time_t ExpiresTime;
+	};
+
+	HttpResponseCache( );
+	~HttpResponseCache( );
+
+	bool open( const UTF8String& directory );
+	bool isOpen( );
+	void close( );
+
+	static bool isRequestCacheable( NetworkRequestParameters *requestParams );
+	static bool isResponseStorable( int status, const HttpHeaderTable& responseHeaders );
+
+	bool find( NetworkRequestParameters *requestParams, Entry *entry );
+	bool isFresh( const Entry& entry, NetworkRequestParameters *requestParams );
+	static UTF8String getConditionalHeaders( const Entry& entry );
+
+	bool store( NetworkRequestParameters *requestParams, const HttpHeaderTable& responseHeaders, const char *body, size_t bodyLength );
+	bool storeFile( NetworkRequestParameters *requestParams, const HttpHeaderTable& responseHeaders, const UTF8String& bodyPath );
+	bool refresh( Entry *entry, const HttpHeaderTable& notModifiedHeaders );
+	bool readResponse( const Entry& entry, NetworkRequestState *requestState, CoronaFileSpec *responseFile, const UTF8String& downloadFilePath );
+
+	static bool isRevalidationRequested( NetworkRequestParameters *requestParams );
+	static time_t getFreshnessLifetime( const HttpHeaderTable& responseHeaders, time_t now );
+	static UTF8String getVaryHeaders( const HttpHeaderTable& responseHeaders, NetworkRequestParameters *requestParams );
+	static UTF8String getStoredHeaders( const HttpHeaderTable& responseHeaders, bool isBodyDecoded );
+	static time_t parseHttpDate( const char *date );
+
+	static FILE* openFile( const UTF8String& path, const char *mode );
+	static bool createFile( const UTF8String& path, long long length );
+	static bool removeFile( const UTF8String& path );
+	static bool renameFile( const UTF8String& sourcePath, const UTF8String& targetPath );
+
+private:
+
+	typedef std::list<Entry> EntryList;
+	typedef std::map<UTF8String, EntryList::iterator> EntryMap;
+
+	UTF8String fDirectory;
+	bool fIsOpen;
+
+	/// Entries from least to most recently used, and the same entries by key.
+	EntryList fEntries;
+	EntryMap fEntriesByKey;
+	long long fTotalBytes;
+
+	/// Set when the entries have changed since the index file was written, if only in the order they were used.
+	bool fIsIndexDirty;
+
+	/// Number used to name the next body file, so that a body is never written over one still in use.
+	unsigned long fNextFileNumber;
+
+	bool add( Entry& entry, const HttpHeaderTable& responseHeaders, NetworkRequestParameters *requestParams, const UTF8String& tempPath );
+	void remove( EntryMap::iterator iter );
+	void evict( );
+	bool load( );
+	bool save( );
+	UTF8String getPath( const UTF8String& fileName );
+	UTF8String createTempPath( );
+
+	static bool findDirective( const char *cacheControl, const char *directive, long long *value );
+
+	static bool copyFile( const UTF8String& sourcePath, const UTF8String& targetPath, long long *length );
+	static bool createDirectory( const UTF8String& path );
+};
+
+#endif
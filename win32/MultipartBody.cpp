@@ -0,0 +1,294 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+// Declares rand_s(), which must come before stdlib.h is first included.
+#define _CRT_RAND_S
+
+#include "CoronaLog.h"
+#include "MultipartBody.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/// Number of random characters in a form boundary, after its "CoronaFormBoundary" prefix.
+#define MULTIPART_BOUNDARY_RANDOM_LENGTH 32
+
+
+#pragma region Constructors and Destructors
+MultipartBody::MultipartBody( )
+{
+	// The boundary must not occur in any part, which a long random one makes all but certain.
+	if ( !generateBoundary( &fBoundary ) )
+	{
+		fBoundary.clear();
+	}
+	fSize = 0;
+	fFileIndex = 0;
+	fPieceIndex = 0;
+}
+
+MultipartBody::~MultipartBody( )
+{
+	close();
+	for ( size_t index = 0; index < fPieces.size(); index++ )
+	{
+		delete fPieces[index].Value;
+		delete fPieces[index].File;
+	}
+}
+
+#pragma endregion
+
+
+#pragma region Public Member Functions
+/// Adds a field whose value is the string at the given stack index, which is pinned rather than copied.
+/// @param contentType The field's Content-Type, or empty for none (which means text/plain).
+void MultipartBody::addField( const UTF8String& name, lua_State *luaState, int valueIndex, const UTF8String& contentType )
+{
+	addPartHead( name, UTF8String(), contentType );
+
+	Piece piece;
+	piece.Value = new LuaStringBody( luaState, valueIndex, false );
+	piece.File = NULL;
+	piece.Length = (long long)piece.Value->getSize();
+	if ( piece.Length > 0 )
+	{
+		addPiece( piece );
+	}
+	else
+	{
+		delete piece.Value;
+	}
+}
+
+/// Adds a file part, which the body takes ownership of. The file must still have the given size when it is sent.
+/// @param contentType The part's Content-Type, or empty for application/octet-stream.
+void MultipartBody::addFile( const UTF8String& name, CoronaFileSpec *file, long long fileSize, const UTF8String& contentType )
+{
+	// The part is named after the file, without the directories it is in.
+	UTF8String filename = file->getFilename();
+	size_t separatorIndex = filename.find_last_of( "/\\" );
+	if ( UTF8String::npos != separatorIndex )
+	{
+		filename.erase( 0, separatorIndex + 1 );
+	}
+	addPartHead( name, filename, contentType.empty() ? UTF8String( "application/octet-stream" ) : contentType );
+
+	Piece piece;
+	piece.Value = NULL;
+	piece.File = file;
+	piece.Length = fileSize;
+	if ( piece.Length > 0 )
+	{
+		addPiece( piece );
+	}
+	else
+	{
+		delete piece.File;
+	}
+}
+
+/// Ends the body with its closing boundary, once all parts have been added.
+void MultipartBody::finish( )
+{
+	addText( fPendingText + "--" + fBoundary + "--\r\n" );
+	fPendingText.clear();
+}
+
+/// Determines if the body got a random boundary, without which it can't be sent.
+bool MultipartBody::hasBoundary( ) const
+{
+	return !fBoundary.empty();
+}
+
+/// Gets the Content-Type header value of the body, which names its boundary.
+UTF8String MultipartBody::getContentType( ) const
+{
+	return "multipart/form-data; boundary=" + fBoundary;
+}
+
+long long MultipartBody::getSize( ) const
+{
+	return fSize;
+}
+
+/// Gets the bytes of the body starting at the given offset, straight from the piece that holds them. The slice ends
+/// at the end of the piece (or of the mapped window of its file), so it may be shorter than asked for.
+/// @param offset Offset of the slice in the body.
+/// @param maxLength Largest number of bytes the slice is to have.
+/// @param sliceLength Set to the number of bytes in the slice.
+/// @return Returns the slice, which stays valid until the next call, or NULL past the end of the body or if a file
+///         could not be read (or no longer has the size it had when it was added).
+const char* MultipartBody::getSlice( long long offset, size_t maxLength, size_t *sliceLength )
+{
+	*sliceLength = 0;
+	if ( ( offset < 0 ) || ( offset >= fSize ) || ( 0 == maxLength ) )
+	{
+		return NULL;
+	}
+
+	// Slices are taken in order, so the search starts from the last piece unless the body is being sent again.
+	if ( ( fPieceIndex >= fPieces.size() ) || ( offset < fPieces[fPieceIndex].Offset ) )
+	{
+		fPieceIndex = 0;
+	}
+	while ( offset >= ( fPieces[fPieceIndex].Offset + fPieces[fPieceIndex].Length ) )
+	{
+		fPieceIndex++;
+	}
+	const Piece& piece = fPieces[fPieceIndex];
+	long long pieceOffset = offset - piece.Offset;
+	long long bytesLeft = piece.Length - pieceOffset;
+	size_t length = ( bytesLeft < (long long)maxLength ) ? (size_t)bytesLeft : maxLength;
+
+	if ( NULL != piece.Value )
+	{
+		*sliceLength = length;
+		return piece.Value->getData() + pieceOffset;
+	}
+	if ( NULL == piece.File )
+	{
+		*sliceLength = length;
+		return piece.Text.data() + pieceOffset;
+	}
+
+	if ( !fFileView.isOpen() || ( fFileIndex != fPieceIndex ) )
+	{
+		if ( !fFileView.open( piece.File->getFullPath() ) || ( fFileView.getSize() != piece.Length ) )
+		{
+			CORONA_LOG( "Error reading multipart body file %s", piece.File->getFullPath().c_str() );
+			fFileView.close();
+			return NULL;
+		}
+		fFileIndex = fPieceIndex;
+	}
+	return fFileView.getSlice( pieceOffset, length, sliceLength );
+}
+
+/// Closes the file slices were last taken from, if any.
+void MultipartBody::close( )
+{
+	fFileView.close();
+}
+
+#pragma endregion
+
+
+#pragma region Private Member Functions
+/// Adds the boundary and headers that start a part, after whatever ends the previous one.
+void MultipartBody::addPartHead( const UTF8String& name, const UTF8String& filename, const UTF8String& contentType )
+{
+	UTF8String head = fPendingText;
+	head += "--" + fBoundary + "\r\n";
+	head += "Content-Disposition: form-data; name=\"" + escapeName( name ) + "\"";
+	if ( !filename.empty() )
+	{
+		head += "; filename=\"" + escapeName( filename ) + "\"";
+	}
+	head += "\r\n";
+	if ( !contentType.empty() )
+	{
+		head += "Content-Type: " + contentType + "\r\n";
+	}
+	head += "\r\n";
+	addText( head );
+
+	// The part's data is followed by a line break, which belongs to the next boundary.
+	fPendingText = "\r\n";
+}
+
+void MultipartBody::addPiece( const Piece& piece )
+{
+	fPieces.push_back( piece );
+	fPieces.back().Offset = fSize;
+	fSize += piece.Length;
+}
+
+void MultipartBody::addText( const UTF8String& text )
+{
+	Piece piece;
+	piece.Text = text;
+	piece.Value = NULL;
+	piece.File = NULL;
+	piece.Length = (long long)text.size();
+	addPiece( piece );
+}
+
+/// Generates a boundary from the system's random source. Its characters are letters, digits, "-" and "_", all of
+/// which RFC 2046 allows in a boundary, so it needs no quoting in the Content-Type.
+/// @return Returns false if no random bytes could be had, since a predictable boundary could occur in a part.
+bool MultipartBody::generateBoundary( UTF8String *boundary )
+{
+	static const char kAlphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+	unsigned char randomBytes[MULTIPART_BOUNDARY_RANDOM_LENGTH];
+#ifdef _WIN32
+	for ( size_t index = 0; index < sizeof(randomBytes); index += sizeof(unsigned int) )
+	{
+		unsigned int randomValue;
+		if ( 0 != rand_s( &randomValue ) )
+		{
+			CORONA_LOG( "Unable to generate multipart body boundary" );
+			return false;
+		}
+		memcpy( randomBytes + index, &randomValue, sizeof(randomValue) );
+	}
+#else
+	bool isRandom = false;
+	int randomSource = ::open( "/dev/urandom", O_RDONLY );
+	if ( randomSource >= 0 )
+	{
+		isRandom = ( ::read( randomSource, randomBytes, sizeof(randomBytes) ) == (ssize_t)sizeof(randomBytes) );
+		::close( randomSource );
+	}
+	if ( !isRandom )
+	{
+		CORONA_LOG( "Unable to generate multipart body boundary" );
+		return false;
+	}
+#endif
+
+	// The alphabet has 64 characters, so each takes 6 bits of a random byte.
+	*boundary = "CoronaFormBoundary";
+	for ( size_t index = 0; index < sizeof(randomBytes); index++ )
+	{
+		*boundary += kAlphabet[randomBytes[index] & 0x3F];
+	}
+	return true;
+}
+
+/// Escapes a name or filename for a quoted Content-Disposition parameter, the way browsers do (HTML form
+/// submission): quotes and line breaks are percent-encoded, everything else (such as UTF-8) is sent as is.
+UTF8String MultipartBody::escapeName( const UTF8String& name )
+{
+	UTF8String escapedName;
+	for ( size_t index = 0; index < name.size(); index++ )
+	{
+		switch ( name[index] )
+		{
+			case '"':
+				escapedName += "%22";
+				break;
+			case '\r':
+				escapedName += "%0D";
+				break;
+			case '\n':
+				escapedName += "%0A";
+				break;
+			default:
+				escapedName += name[index];
+				break;
+		}
+	}
+	return escapedName;
+}
+
+#pragma endregion
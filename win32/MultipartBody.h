@@ -0,0 +1,79 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef _MultipartBody_H_
+#define _MultipartBody_H_
+
+#include "WindowsNetworkSupport.h"
+#include "UploadFileView.h"
+
+#include <vector>
+
+
+/// A multipart/form-data request body (params.body = { multipart = { ... } }), made of fields (a name and a Lua
+/// string value) and files (a name and a CoronaFileSpec).
+///
+/// Nothing is built up front: the body is a list of pieces, each of which is either text the body owns (a boundary
+/// and the headers of a part), a field's value (sent straight from its pinned Lua string), or a file (sent straight
+/// from its mapping, see UploadFileView). The size of every piece is known once the parts have been added, so the
+/// request gets a Content-Length and is sent slice by slice like any other body.
+///
+/// Parts are added by the main thread when the parameters are validated. Slices are then taken by the thread
+/// sending the request, which opens each file as it gets to it, and the main thread closes the last one once the
+/// request is complete.
+class MultipartBody
+{
+public:
+	MultipartBody( );
+	~MultipartBody( );
+
+	void addField( const UTF8String& name, lua_State *luaState, int valueIndex, const UTF8String& contentType );
+	void addFile( const UTF8String& name, CoronaFileSpec *file, long long fileSize, const UTF8String& contentType );
+	void finish( );
+
+	bool hasBoundary( ) const;
+	UTF8String getContentType( ) const;
+	long long getSize( ) const;
+	const char* getSlice( long long offset, size_t maxLength, size_t *sliceLength );
+	void close( );
+
+private:
+
+	/// One contiguous run of the body. Exactly one of "Text" (if neither of the others is set), "Value" and "File"
+	/// holds its bytes, which start at "Offset" in the body.
+	struct Piece
+	{
+		UTF8String Text;
+		LuaStringBody* Value;
+		CoronaFileSpec* File;
+		long long Offset;
+		long long Length;
+	};
+
+	UTF8String fBoundary;
+	std::vector<Piece> fPieces;
+	long long fSize;
+
+	/// Text still to be added ahead of the next part, which ends the previous part's data.
+	UTF8String fPendingText;
+
+	/// The file of the piece at "fFileIndex" that is open, if any, and the piece slices were last taken from.
+	UploadFileView fFileView;
+	size_t fFileIndex;
+	size_t fPieceIndex;
+
+	void addPartHead( const UTF8String& name, const UTF8String& filename, const UTF8String& contentType );
+	void addPiece( const Piece& piece );
+	void addText( const UTF8String& text );
+
+	static bool generateBoundary( UTF8String *boundary );
+	static UTF8String escapeName( const UTF8String& name );
+};
+
+#endif
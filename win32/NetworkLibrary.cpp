@@ -58,6 +58,8 @@ class NetworkLibrary : WinHttpRequestManager
 		static int request( lua_State *L );
 		static int cancel( lua_State *L );
 		static int getConnectionStatus( lua_State *L );
+		static int setMemoryCacheSize( lua_State *L );
+		static int setRequestLimits( lua_State *L );
 
 	protected:
 		void onStarted( lua_State *L ); 
@@ -143,6 +145,8 @@ NetworkLibrary::Open( lua_State *L )
 		{ "request_native", request },
 		{ "cancel", cancel },
 		{ "getConnectionStatus", getConnectionStatus },
+		{ "setMemoryCacheSize", setMemoryCacheSize },
+		{ "setRequestLimits", setRequestLimits },
 
 		{ NULL, NULL }
 	};
@@ -268,6 +272,49 @@ NetworkLibrary::getConnectionStatus( lua_State *L )
 	return 1;
 }
 
+// [Lua] network.setMemoryCacheSize( bytes )
+//
+// Sets how many bytes of small responses to requests made with params.cache are kept in memory (8 MB by default).
+// Zero turns the memory cache off.
+int
+NetworkLibrary::setMemoryCacheSize( lua_State *L )
+{
+	Self *library = NetworkLibrary::ToLibrary( L );
+
+	if ( ( LUA_TNUMBER == lua_type( L, 1 ) ) && ( lua_tonumber( L, 1 ) >= 0 ) )
+	{
+		library->GetMemoryCache().setMaxBytes( (size_t)lua_tonumber( L, 1 ) );
+	}
+	else
+	{
+		paramValidationFailure( L, "network.setMemoryCacheSize() expects a number of bytes (got %s)", lua_typename( L, lua_type( L, 1 ) ) );
+	}
+
+	return 0;
+}
+
+// [Lua] network.setRequestLimits( maxRequests, maxRequestsPerHost )
+//
+// Sets how many requests are executed at once, in all (16 by default) and per host (6 by default). The requests
+// over these limits are queued, and started by params.priority as the active ones end.
+int
+NetworkLibrary::setRequestLimits( lua_State *L )
+{
+	Self *library = NetworkLibrary::ToLibrary( L );
+
+	if ( ( LUA_TNUMBER == lua_type( L, 1 ) ) && ( lua_tonumber( L, 1 ) >= 1 ) &&
+		 ( LUA_TNUMBER == lua_type( L, 2 ) ) && ( lua_tonumber( L, 2 ) >= 1 ) )
+	{
+		library->SetRequestLimits( (int)lua_tonumber( L, 1 ), (int)lua_tonumber( L, 2 ) );
+	}
+	else
+	{
+		paramValidationFailure( L, "network.setRequestLimits() expects two numbers of requests, of at least 1 (got %s, %s)", lua_typename( L, lua_type( L, 1 ) ), lua_typename( L, lua_type( L, 2 ) ) );
+	}
+
+	return 0;
+}
+
 // This static method receives "system" event messages from Corona, at which point it determines the instance
 // that registered the listener and dispatches the system events to that instance.
 //
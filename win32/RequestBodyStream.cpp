@@ -0,0 +1,195 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "CoronaLog.h"
+#include "RequestBodyStream.h"
+
+#include <stdio.h>
+
+
+// --------------------------------------------------------------------------------------
+// RequestBodySource
+// --------------------------------------------------------------------------------------
+
+RequestBodySource::~RequestBodySource( )
+{
+}
+
+// --------------------------------------------------------------------------------------
+// LuaRequestBodySource
+// --------------------------------------------------------------------------------------
+
+LuaRequestBodySource::LuaRequestBodySource( lua_State *luaState, int index )
+{
+	// The function is called, and its reference released, on the main thread, even if the request was made from
+	// a coroutine.
+	lua_State *mainState = CoronaLuaGetCoronaThread( luaState );
+	fLuaState = ( NULL != mainState ) ? mainState : luaState;
+
+	fLuaReference = CoronaLuaNewRef( luaState, index );
+}
+
+LuaRequestBodySource::~LuaRequestBodySource( )
+{
+	CoronaLuaDeleteRef( fLuaState, fLuaReference );
+}
+
+bool LuaRequestBodySource::read( std::string *output, bool *isEnded )
+{
+	int top = lua_gettop( fLuaState );
+	CoronaLuaPushRef( fLuaState, fLuaReference );
+	if ( 0 != Corona::Lua::DoCall( fLuaState, 0, 1 ) ) // 0 arguments, 1 return
+	{
+		CORONA_LOG( "Error calling request body function" );
+		lua_settop( fLuaState, top );
+		return false;
+	}
+
+	bool wasSuccessful = true;
+	switch ( lua_type( fLuaState, -1 ) )
+	{
+		case LUA_TSTRING:
+		{
+			size_t length = 0;
+			const char *bytes = lua_tolstring( fLuaState, -1, &length );
+			output->append( bytes, length );
+		}
+		break;
+
+		case LUA_TNIL:
+		case LUA_TNONE:
+			*isEnded = true;
+			break;
+
+		default:
+			CORONA_LOG( "Request body function should return a string, or nil at the end of the body (got %s)", lua_typename( fLuaState, lua_type( fLuaState, -1 ) ) );
+			wasSuccessful = false;
+			break;
+	}
+	lua_settop( fLuaState, top );
+	return wasSuccessful;
+}
+
+// --------------------------------------------------------------------------------------
+// RequestBodyStream
+// --------------------------------------------------------------------------------------
+
+#pragma region Constructors and Destructors
+/// @param source The producer of the body, which the stream takes ownership of.
+RequestBodyStream::RequestBodyStream( RequestBodySource *source )
+{
+	fSource = source;
+	fIsCompressed = false;
+	fIsEnded = false;
+	fBytesRead = 0;
+}
+
+RequestBodyStream::~RequestBodyStream( )
+{
+	delete fSource;
+}
+
+#pragma endregion
+
+
+#pragma region Public Member Functions
+/// Prepares to send the body, just before the request is sent.
+/// @param isCompressed Set to gzip compress the body (params.bodyCompression = "gzip").
+/// @return Returns false if the compressor could not be created.
+bool RequestBodyStream::open( bool isCompressed )
+{
+	fIsCompressed = isCompressed;
+	return !fIsCompressed || fEncoder.open( true );
+}
+
+/// Reads the source for as long as it has bytes ready, and appends the chunks they make to the given output. The
+/// last chunk is appended once the source ends the body. A compressed body may append nothing even if the source
+/// had bytes, since the compressor holds on to them until it has enough.
+/// @param maxLength Number of bytes of output after which the source is not read again for now.
+/// @return Returns false if the source or the compressor failed, which fails the request.
+bool RequestBodyStream::read( std::string *output, size_t maxLength )
+{
+	size_t outputStart = output->size();
+	while ( !fIsEnded && ( ( output->size() - outputStart ) < maxLength ) )
+	{
+		fSourceBytes.clear();
+		bool isSourceEnded = false;
+		if ( !fSource->read( &fSourceBytes, &isSourceEnded ) )
+		{
+			return false;
+		}
+
+		if ( !fSourceBytes.empty() )
+		{
+			fBytesRead += (long long)fSourceBytes.size();
+			if ( fIsCompressed )
+			{
+				if ( !fEncoder.write( fSourceBytes.data(), fSourceBytes.size(), output ) )
+				{
+					CORONA_LOG( "Error compressing request body" );
+					return false;
+				}
+			}
+			else
+			{
+				appendChunk( fSourceBytes.data(), fSourceBytes.size(), output );
+			}
+		}
+
+		if ( isSourceEnded )
+		{
+			if ( fIsCompressed )
+			{
+				if ( !fEncoder.finish( output ) )
+				{
+					CORONA_LOG( "Error compressing request body" );
+					return false;
+				}
+			}
+			else
+			{
+				output->append( "0\r\n\r\n", 5 );
+			}
+			fIsEnded = true;
+		}
+		else if ( fSourceBytes.empty() )
+		{
+			// Nothing ready yet
+			break;
+		}
+	}
+	return true;
+}
+
+/// Determines if the whole body (and its last chunk) has been read.
+bool RequestBodyStream::isEnded( ) const
+{
+	return fIsEnded;
+}
+
+long long RequestBodyStream::getBytesRead( ) const
+{
+	return fBytesRead;
+}
+
+#pragma endregion
+
+
+#pragma region Private Member Functions
+// Appends the given bytes as one chunk: their size in hex digits, CRLF, the bytes and CRLF.
+void RequestBodyStream::appendChunk( const char *bytes, size_t length, std::string *output )
+{
+	char sizeLine[24];
+	int sizeLineLength = sprintf_s( sizeLine, _countof(sizeLine), "%llx\r\n", (unsigned long long)length );
+	output->append( sizeLine, (size_t)sizeLineLength );
+	output->append( bytes, length );
+	output->append( "\r\n", 2 );
+}
+
+#pragma endregion
@@ -0,0 +1,86 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef _RequestBodyStream_H_
+#define _RequestBodyStream_H_
+
+#include "WindowsNetworkSupport.h"
+#include "ContentEncoder.h"
+
+#include <string>
+
+
+/// Producer of a request body whose length is not known up front. Native code can stream a body by implementing
+/// read(), while a Lua function given as the body (params.body = function) is pulled by LuaRequestBodySource.
+///
+/// Only ever read by the main thread, so a producer is free to call into Lua.
+class RequestBodySource
+{
+public:
+	virtual ~RequestBodySource( );
+
+	/// Appends the next bytes of the body to the given output, if any are ready. Appending nothing (without ending
+	/// the body) means that none are ready yet, and the source is read again on a later pass.
+	/// @param isEnded Set once the body has no more bytes.
+	/// @return Returns false if the body could not be produced, which fails the request.
+	virtual bool read( std::string *output, bool *isEnded ) = 0;
+};
+
+/// Request body produced by a Lua function, which is called with no arguments each time more of the body is
+/// wanted. It returns the next part of the body as a string, an empty string if it has nothing yet, or nil once
+/// the body is complete. The function is pinned with a reference in the Lua registry until the request parameters
+/// are destroyed on the main thread.
+class LuaRequestBodySource : public RequestBodySource
+{
+public:
+	LuaRequestBodySource( lua_State *luaState, int index );
+	virtual ~LuaRequestBodySource( );
+
+	virtual bool read( std::string *output, bool *isEnded );
+
+private:
+
+	lua_State* fLuaState;
+	CoronaLuaRef fLuaReference;
+};
+
+/// A request body read from a RequestBodySource as it is sent, which the request sends with
+/// "Transfer-Encoding: chunked". The stream turns what the source produces into the chunks of the body, compressed
+/// with gzip if the body is (params.bodyCompression = "gzip"), and ends it with the last (empty) chunk.
+///
+/// Read by the main thread while the request is in flight, which hands the chunks to the thread sending the request.
+/// A stream can only be sent once.
+class RequestBodyStream
+{
+public:
+	RequestBodyStream( RequestBodySource *source );
+	~RequestBodyStream( );
+
+	bool open( bool isCompressed );
+	bool read( std::string *output, size_t maxLength );
+	bool isEnded( ) const;
+	long long getBytesRead( ) const;
+
+private:
+
+	RequestBodySource* fSource;
+	ContentEncoder fEncoder;
+	bool fIsCompressed;
+	bool fIsEnded;
+
+	/// Number of body bytes taken from the source so far (before compression and chunk framing).
+	long long fBytesRead;
+
+	/// What the source produced on its last read, which keeps its capacity from one read to the next.
+	std::string fSourceBytes;
+
+	static void appendChunk( const char *bytes, size_t length, std::string *output );
+};
+
+#endif
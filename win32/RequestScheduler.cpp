@@ -0,0 +1,311 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "CoronaLog.h"
+#include "RequestScheduler.h"
+
+#include <ctype.h>
+
+
+#pragma region QueuedRequest
+/// Creates a queued request.
+/// @param requestParams The request, which this object takes ownership of until it is started.
+/// @param hostKey The request's host, from RequestScheduler::getHostKey().
+RequestScheduler::QueuedRequest::QueuedRequest( RequestScheduler *scheduler, NetworkRequestParameters *requestParams, const UTF8String& hostKey )
+:	fHostKey( hostKey )
+{
+	fScheduler = scheduler;
+	fRequestParams = requestParams;
+	fRequestCanceller = NULL;
+}
+
+RequestScheduler::QueuedRequest::~QueuedRequest( )
+{
+	if ( NULL != fRequestParams )
+	{
+		delete fRequestParams;
+	}
+}
+
+/// Creates the request's canceller, which holds this object, and which is handed to Lua as its requestId. This
+/// object holds the canceller in turn until the request is started or dropped.
+RequestCanceller* RequestScheduler::QueuedRequest::Start( const std::shared_ptr<QueuedRequest>& thiz )
+{
+	fRequestCanceller = new RequestCanceller( thiz );
+	fRequestCanceller->AddRef();
+	return fRequestCanceller;
+}
+
+const UTF8String& RequestScheduler::QueuedRequest::GetHostKey( )
+{
+	return fHostKey;
+}
+
+RequestCanceller* RequestScheduler::QueuedRequest::GetRequestCanceller( )
+{
+	return fRequestCanceller;
+}
+
+/// Hands the request over to the operation executing it, which the canceller is forwarded to from now on.
+/// @return Returns the request's parameters, which the caller takes ownership of.
+NetworkRequestParameters* RequestScheduler::QueuedRequest::TakeRequestParams( const std::shared_ptr<NetworkRequestOperation>& requestOperation )
+{
+	NetworkRequestParameters* requestParams = fRequestParams;
+	fRequestParams = NULL;
+	fRequestOperation = requestOperation;
+	return requestParams;
+}
+
+/// Lets go of the canceller once the request's state holds it.
+void RequestScheduler::QueuedRequest::Started( )
+{
+	RequestCanceller* requestCanceller = fRequestCanceller;
+	fRequestCanceller = NULL;
+	requestCanceller->Release();
+}
+
+/// Releases a request that is not going to be started, without notifying its listener.
+void RequestScheduler::QueuedRequest::Drop( )
+{
+	if ( NULL != fRequestParams )
+	{
+		LuaCallback* luaCallback = fRequestParams->getLuaCallback();
+		if ( NULL != luaCallback )
+		{
+			luaCallback->unregister();
+		}
+		delete fRequestParams;
+		fRequestParams = NULL;
+	}
+
+	// The canceller may be the last holder of this object.
+	RequestCanceller* requestCanceller = fRequestCanceller;
+	fRequestCanceller = NULL;
+	if ( NULL != requestCanceller )
+	{
+		requestCanceller->Release();
+	}
+}
+
+void RequestScheduler::QueuedRequest::RequestAbort( )
+{
+	if ( fRequestOperation )
+	{
+		fRequestOperation->RequestAbort();
+	}
+	else if ( NULL != fRequestParams )
+	{
+		fScheduler->remove( this );
+	}
+}
+
+void RequestScheduler::QueuedRequest::RequestCancel( )
+{
+	if ( fRequestOperation )
+	{
+		fRequestOperation->RequestCancel();
+	}
+	else if ( NULL != fRequestParams )
+	{
+		fScheduler->remove( this );
+	}
+}
+
+#pragma endregion
+
+
+#pragma region Scheduler
+RequestScheduler::RequestScheduler( )
+{
+	fQueuedCount = 0;
+	fMaxActiveRequests = REQUEST_SCHEDULER_DEFAULT_MAX_ACTIVE_REQUESTS;
+	fMaxActiveRequestsPerHost = REQUEST_SCHEDULER_DEFAULT_MAX_ACTIVE_REQUESTS_PER_HOST;
+}
+
+RequestScheduler::~RequestScheduler( )
+{
+	dropAll();
+}
+
+/// Sets how many requests may be executed at once, in all and per host. Lowering a limit does not stop the
+/// requests already executing. Raising one lets queued requests start on the request manager's next update.
+void RequestScheduler::setLimits( int maxActiveRequests, int maxActiveRequestsPerHost )
+{
+	fMaxActiveRequests = ( maxActiveRequests > 0 ) ? maxActiveRequests : 1;
+	fMaxActiveRequestsPerHost = ( maxActiveRequestsPerHost > 0 ) ? maxActiveRequestsPerHost : 1;
+}
+
+int RequestScheduler::getMaxActiveRequests( )
+{
+	return fMaxActiveRequests;
+}
+
+int RequestScheduler::getMaxActiveRequestsPerHost( )
+{
+	return fMaxActiveRequestsPerHost;
+}
+
+/// Determines if the given request can be executed right away. Queued requests go first, so this is only
+/// meaningful if there are none (see hasQueuedRequests()).
+bool RequestScheduler::canStart( NetworkRequestParameters *requestParams )
+{
+	return canStart( getHostKey( requestParams->getRequestUrl() ) );
+}
+
+bool RequestScheduler::hasQueuedRequests( )
+{
+	return ( fQueuedCount > 0 );
+}
+
+int RequestScheduler::getQueuedCount( )
+{
+	return fQueuedCount;
+}
+
+/// Queues the given request at the end of its priority class.
+/// @return Returns the canceller to hand to Lua for the request.
+RequestCanceller* RequestScheduler::enqueue( NetworkRequestParameters *requestParams )
+{
+	RequestPriority priority = requestParams->getPriority();
+	std::shared_ptr<QueuedRequest> queuedRequest =
+		std::make_shared<QueuedRequest>( this, requestParams, getHostKey( requestParams->getRequestUrl() ) );
+
+	debug("Queueing request (%d active, %d queued)", (int)fActiveRequests.size(), fQueuedCount);
+	fQueues[priority].push_back( queuedRequest );
+	fQueuedCount++;
+	return queuedRequest->Start( queuedRequest );
+}
+
+/// Takes the next request to start off the queues: the first one of the highest priority class whose host is
+/// not at its limit, provided the overall limit is not reached either.
+/// @return Returns the request to start, or NULL if none can start now.
+std::shared_ptr<RequestScheduler::QueuedRequest> RequestScheduler::dequeue( )
+{
+	if ( ( 0 == fQueuedCount ) || ( (int)fActiveRequests.size() >= fMaxActiveRequests ) )
+	{
+		return std::shared_ptr<QueuedRequest>();
+	}
+
+	for ( int priority = 0; priority < PriorityCount; priority++ )
+	{
+		Queue& queue = fQueues[priority];
+		for ( Queue::iterator iter = queue.begin(); iter != queue.end(); iter++ )
+		{
+			if ( canStart( (*iter)->GetHostKey() ) )
+			{
+				std::shared_ptr<QueuedRequest> queuedRequest = *iter;
+				queue.erase( iter );
+				fQueuedCount--;
+				return queuedRequest;
+			}
+		}
+	}
+	return std::shared_ptr<QueuedRequest>();
+}
+
+/// Drops all queued requests, without notifying their listeners.
+void RequestScheduler::dropAll( )
+{
+	for ( int priority = 0; priority < PriorityCount; priority++ )
+	{
+		Queue queue;
+		queue.swap( fQueues[priority] );
+		for ( Queue::iterator iter = queue.begin(); iter != queue.end(); iter++ )
+		{
+			(*iter)->Drop();
+		}
+	}
+	fQueuedCount = 0;
+}
+
+/// Counts the given request operation as active for its request's host, until requestEnded().
+void RequestScheduler::requestStarted( const void *requestOperation, NetworkRequestParameters *requestParams )
+{
+	UTF8String hostKey = getHostKey( requestParams->getRequestUrl() );
+	fActiveRequests[requestOperation] = hostKey;
+	fActiveCountsByHost[hostKey]++;
+}
+
+/// Stops counting the given request operation as active. Does nothing if it was not.
+void RequestScheduler::requestEnded( const void *requestOperation )
+{
+	ActiveRequestMap::iterator iter = fActiveRequests.find( requestOperation );
+	if ( fActiveRequests.end() == iter )
+	{
+		return;
+	}
+	HostCountMap::iterator countIter = fActiveCountsByHost.find( iter->second );
+	if ( ( fActiveCountsByHost.end() != countIter ) && ( --countIter->second <= 0 ) )
+	{
+		fActiveCountsByHost.erase( countIter );
+	}
+	fActiveRequests.erase( iter );
+}
+
+/// Gets the part of the given URL that identifies the server: its scheme, host and port, in lower case.
+UTF8String RequestScheduler::getHostKey( const UTF8String& url )
+{
+	size_t authorityStart = url.find( "://" );
+	if ( UTF8String::npos == authorityStart )
+	{
+		return url;
+	}
+	authorityStart += 3;
+	size_t authorityEnd = url.find_first_of( "/?#", authorityStart );
+	if ( UTF8String::npos == authorityEnd )
+	{
+		authorityEnd = url.size();
+	}
+
+	// Credentials don't make for a different server.
+	size_t userInfoEnd = url.rfind( '@', authorityEnd );
+	if ( ( UTF8String::npos != userInfoEnd ) && ( userInfoEnd >= authorityStart ) )
+	{
+		authorityStart = userInfoEnd + 1;
+	}
+
+	UTF8String hostKey = url.substr( 0, url.find( "://" ) + 3 ) + url.substr( authorityStart, authorityEnd - authorityStart );
+	for ( size_t index = 0; index < hostKey.size(); index++ )
+	{
+		hostKey[index] = (char)tolower( (unsigned char)hostKey[index] );
+	}
+	return hostKey;
+}
+
+bool RequestScheduler::canStart( const UTF8String& hostKey )
+{
+	if ( (int)fActiveRequests.size() >= fMaxActiveRequests )
+	{
+		return false;
+	}
+	HostCountMap::iterator iter = fActiveCountsByHost.find( hostKey );
+	return ( fActiveCountsByHost.end() == iter ) || ( iter->second < fMaxActiveRequestsPerHost );
+}
+
+// Takes a cancelled request off its queue and drops it.
+void RequestScheduler::remove( QueuedRequest *queuedRequest )
+{
+	for ( int priority = 0; priority < PriorityCount; priority++ )
+	{
+		Queue& queue = fQueues[priority];
+		for ( Queue::iterator iter = queue.begin(); iter != queue.end(); iter++ )
+		{
+			if ( iter->get() == queuedRequest )
+			{
+				std::shared_ptr<QueuedRequest> removedRequest = *iter;
+				queue.erase( iter );
+				fQueuedCount--;
+				removedRequest->Drop();
+				return;
+			}
+		}
+	}
+}
+
+#pragma endregion
@@ -0,0 +1,104 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef _RequestScheduler_H_
+#define _RequestScheduler_H_
+
+#include "WindowsNetworkSupport.h"
+
+#include <deque>
+#include <map>
+#include <memory>
+
+
+/// Default limits on how many requests are executed at once, in all and per host (scheme, host and port).
+#define REQUEST_SCHEDULER_DEFAULT_MAX_ACTIVE_REQUESTS 16
+#define REQUEST_SCHEDULER_DEFAULT_MAX_ACTIVE_REQUESTS_PER_HOST 6
+
+/// Decides when the request manager executes each request, so that a burst of requests doesn't compete equally
+/// with the few that matter.
+///
+/// A request is executed right away if that stays within the limits on active requests (in all and for its
+/// host), and queued otherwise. Queued requests are started as active requests end, in the order of their
+/// params.priority class, and first come first served within a class. A request for a host at its limit does not
+/// hold up the requests for other hosts behind it. A request that has started is never preempted.
+///
+/// A queued request only holds its parameters and its canceller (handed to Lua as its requestId), without any
+/// request operation, connection or buffer. Only used on the main thread.
+class RequestScheduler
+{
+public:
+
+	/// A request waiting for its turn, which stands in for its request operation until it is started.
+	class QueuedRequest : public NetworkRequestOperation
+	{
+	public:
+		QueuedRequest( RequestScheduler *scheduler, NetworkRequestParameters *requestParams, const UTF8String& hostKey );
+		virtual ~QueuedRequest( );
+
+		RequestCanceller* Start( const std::shared_ptr<QueuedRequest>& thiz );
+		const UTF8String& GetHostKey( );
+		RequestCanceller* GetRequestCanceller( );
+		NetworkRequestParameters* TakeRequestParams( const std::shared_ptr<NetworkRequestOperation>& requestOperation );
+		void Started( );
+		void Drop( );
+		virtual void RequestAbort( );
+		virtual void RequestCancel( );
+
+	private:
+		RequestScheduler* fScheduler;
+		NetworkRequestParameters* fRequestParams;
+		RequestCanceller* fRequestCanceller;
+		UTF8String fHostKey;
+
+		/// The operation executing the request once it was started, which the canceller is forwarded to.
+		std::shared_ptr<NetworkRequestOperation> fRequestOperation;
+	};
+
+	RequestScheduler( );
+	~RequestScheduler( );
+
+	void setLimits( int maxActiveRequests, int maxActiveRequestsPerHost );
+	int getMaxActiveRequests( );
+	int getMaxActiveRequestsPerHost( );
+
+	bool canStart( NetworkRequestParameters *requestParams );
+	bool hasQueuedRequests( );
+	int getQueuedCount( );
+	RequestCanceller* enqueue( NetworkRequestParameters *requestParams );
+	std::shared_ptr<QueuedRequest> dequeue( );
+	void dropAll( );
+
+	void requestStarted( const void *requestOperation, NetworkRequestParameters *requestParams );
+	void requestEnded( const void *requestOperation );
+
+	static UTF8String getHostKey( const UTF8String& url );
+
+private:
+
+	typedef std::deque< std::shared_ptr<QueuedRequest> > Queue;
+	typedef std::map<UTF8String, int> HostCountMap;
+	typedef std::map<const void*, UTF8String> ActiveRequestMap;
+
+	/// The queued requests of each priority class, in the order they were sent.
+	Queue fQueues[PriorityCount];
+	int fQueuedCount;
+
+	/// The host of each active request, and the number of active requests per host.
+	ActiveRequestMap fActiveRequests;
+	HostCountMap fActiveCountsByHost;
+
+	int fMaxActiveRequests;
+	int fMaxActiveRequestsPerHost;
+
+	bool canStart( const UTF8String& hostKey );
+	void remove( QueuedRequest *queuedRequest );
+};
+
+#endif
@@ -0,0 +1,254 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef _RequestSlotTable_H_
+#define _RequestSlotTable_H_
+
+#include <stddef.h>
+
+#include <deque>
+#include <memory>
+
+
+/// Slab of request operation slots used by the request managers.
+///
+/// Slots are never freed while the table exists, so pointers to them stay valid. Every slot is linked
+/// into exactly one of two intrusive lists: the active list (slots whose operation is executing) or the
+/// idle list (slots available for the next request). Acquiring, releasing and counting slots are all O(1),
+/// and the manager's processing pass only has to walk the active list. Active slots whose operation needs
+/// passes of its own while no events come for it are also linked into the waiting list.
+///
+/// Only to be used from the main thread.
+template<class TOperation>
+class RequestSlotTable
+{
+public:
+	/// One entry in the table.
+	struct Slot
+	{
+		/// The operation occupying this slot. Idle slots keep their last operation around so it can be re-used.
+		std::shared_ptr<TOperation> Operation;
+
+		Slot* Previous;
+		Slot* Next;
+		bool IsActive;
+
+		/// Links of the waiting list, valid while "IsWaiting" is set.
+		Slot* WaitingPrevious;
+		Slot* WaitingNext;
+		bool IsWaiting;
+	};
+
+	RequestSlotTable()
+	{
+		fActiveList.Head = fActiveList.Tail = NULL;
+		fActiveList.Count = 0;
+		fIdleList.Head = fIdleList.Tail = NULL;
+		fIdleList.Count = 0;
+		fWaitingList.Head = fWaitingList.Tail = NULL;
+		fWaitingList.Count = 0;
+	}
+
+	/// Takes an idle slot (allocating a new one if none are idle) and appends it to the active list.
+	/// @return Returns the slot, whose "Operation" may be NULL or hold an operation from an earlier request.
+	Slot* AcquireSlot()
+	{
+		Slot* slot = fIdleList.Head;
+		if (slot)
+		{
+			Unlink(fIdleList, slot);
+		}
+		else
+		{
+			fSlots.push_back(Slot());
+			slot = &fSlots.back();
+		}
+		slot->IsActive = true;
+		Append(fActiveList, slot);
+		return slot;
+	}
+
+	/// Moves an active slot to the front of the idle list, making it the next one to be acquired. It leaves the
+	/// waiting list.
+	void ReleaseSlot( Slot* slot )
+	{
+		if ((NULL == slot) || !slot->IsActive)
+		{
+			return;
+		}
+		SetSlotWaiting(slot, false);
+		Unlink(fActiveList, slot);
+		slot->IsActive = false;
+		Prepend(fIdleList, slot);
+	}
+
+	/// Appends an active slot to the waiting list, or removes it from it. Does nothing if it already is (or is not)
+	/// on the list.
+	void SetSlotWaiting( Slot* slot, bool isWaiting )
+	{
+		if ((NULL == slot) || (slot->IsWaiting == isWaiting) || (isWaiting && !slot->IsActive))
+		{
+			return;
+		}
+		if (isWaiting)
+		{
+			slot->WaitingPrevious = fWaitingList.Tail;
+			slot->WaitingNext = NULL;
+			if (fWaitingList.Tail)
+			{
+				fWaitingList.Tail->WaitingNext = slot;
+			}
+			else
+			{
+				fWaitingList.Head = slot;
+			}
+			fWaitingList.Tail = slot;
+			fWaitingList.Count++;
+		}
+		else
+		{
+			if (slot->WaitingPrevious)
+			{
+				slot->WaitingPrevious->WaitingNext = slot->WaitingNext;
+			}
+			else
+			{
+				fWaitingList.Head = slot->WaitingNext;
+			}
+			if (slot->WaitingNext)
+			{
+				slot->WaitingNext->WaitingPrevious = slot->WaitingPrevious;
+			}
+			else
+			{
+				fWaitingList.Tail = slot->WaitingPrevious;
+			}
+			slot->WaitingPrevious = NULL;
+			slot->WaitingNext = NULL;
+			fWaitingList.Count--;
+		}
+		slot->IsWaiting = isWaiting;
+	}
+
+	/// Gets the first slot of the active list, in acquisition order. Follow "Next" to walk the list.
+	Slot* GetFirstActiveSlot()
+	{
+		return fActiveList.Head;
+	}
+
+	/// Gets the number of slots in the active list.
+	int GetActiveCount()
+	{
+		return fActiveList.Count;
+	}
+
+	/// Gets the first slot of the waiting list, in the order they started waiting. Follow "WaitingNext" to walk
+	/// the list.
+	Slot* GetFirstWaitingSlot()
+	{
+		return fWaitingList.Head;
+	}
+
+	/// Gets the number of slots in the waiting list.
+	int GetWaitingCount()
+	{
+		return fWaitingList.Count;
+	}
+
+	/// Gets the total number of slots ever allocated (active and idle).
+	int GetSlotCount()
+	{
+		return (int)fSlots.size();
+	}
+
+	/// Releases all operations and slots.
+	void Clear()
+	{
+		fSlots.clear();
+		fActiveList.Head = fActiveList.Tail = NULL;
+		fActiveList.Count = 0;
+		fIdleList.Head = fIdleList.Tail = NULL;
+		fIdleList.Count = 0;
+		fWaitingList.Head = fWaitingList.Tail = NULL;
+		fWaitingList.Count = 0;
+	}
+
+private:
+	/// Head, tail and length of one intrusive slot list.
+	struct SlotList
+	{
+		Slot* Head;
+		Slot* Tail;
+		int Count;
+	};
+
+	/// Backing storage. A deque never moves its elements when growing at the back.
+	std::deque<Slot> fSlots;
+
+	SlotList fActiveList;
+	SlotList fIdleList;
+	SlotList fWaitingList;
+
+	static void Append( SlotList& list, Slot* slot )
+	{
+		slot->Previous = list.Tail;
+		slot->Next = NULL;
+		if (list.Tail)
+		{
+			list.Tail->Next = slot;
+		}
+		else
+		{
+			list.Head = slot;
+		}
+		list.Tail = slot;
+		list.Count++;
+	}
+
+	static void Prepend( SlotList& list, Slot* slot )
+	{
+		slot->Previous = NULL;
+		slot->Next = list.Head;
+		if (list.Head)
+		{
+			list.Head->Previous = slot;
+		}
+		else
+		{
+			list.Tail = slot;
+		}
+		list.Head = slot;
+		list.Count++;
+	}
+
+	static void Unlink( SlotList& list, Slot* slot )
+	{
+		if (slot->Previous)
+		{
+			slot->Previous->Next = slot->Next;
+		}
+		else
+		{
+			list.Head = slot->Next;
+		}
+		if (slot->Next)
+		{
+			slot->Next->Previous = slot->Previous;
+		}
+		else
+		{
+			list.Tail = slot->Previous;
+		}
+		slot->Previous = NULL;
+		slot->Next = NULL;
+		list.Count--;
+	}
+};
+
+#endif
@@ -0,0 +1,291 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "CoronaLog.h"
+#include "ResumableDownload.h"
+#include "HttpResponseCache.h"
+
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <WinHttp.h>
+#endif
+
+/// Status of a response to a Range request that asked for bytes past the end of the body.
+#define RESUMABLE_DOWNLOAD_STATUS_RANGE_NOT_SATISFIABLE 416
+
+/// Largest sidecar file read, which is far more than a URL, a validator and a length take.
+#define RESUMABLE_DOWNLOAD_MAX_INFO_BYTES (64 * 1024)
+
+
+#pragma region Constructors and Destructors
+ResumableDownload::ResumableDownload( )
+{
+	fIsOpen = false;
+	fOffset = 0;
+}
+
+ResumableDownload::~ResumableDownload( )
+{
+}
+
+#pragma endregion
+
+
+#pragma region Public Functions
+/// Sets up the download of the given request, if it was made with params.resume = true, and looks for a partial
+/// file left by an earlier attempt. A request with a Range header of its own is not resumed.
+/// @return Returns true if the request is a resumable download.
+bool ResumableDownload::open( NetworkRequestParameters *requestParams )
+{
+	close();
+	CoronaFileSpec *responseFile = requestParams->getResponseFile();
+	if ( !requestParams->isResumeEnabled() || ( NULL == responseFile ) || ( NULL != requestParams->getRequestHeaderValue( "Range" ) ) )
+	{
+		return false;
+	}
+
+	fUrl = requestParams->getRequestUrl();
+	fPartialFilePath = responseFile->getFullPath() + RESUMABLE_DOWNLOAD_PARTIAL_FILE_SUFFIX;
+	fInfoFilePath = responseFile->getFullPath() + RESUMABLE_DOWNLOAD_INFO_FILE_SUFFIX;
+	fIsOpen = true;
+	load();
+	return true;
+}
+
+bool ResumableDownload::isOpen( ) const
+{
+	return fIsOpen;
+}
+
+/// Forgets the download, leaving its files as they are.
+void ResumableDownload::close( )
+{
+	fIsOpen = false;
+	fUrl.clear();
+	fPartialFilePath.clear();
+	fInfoFilePath.clear();
+	fValidator.clear();
+	fOffset = 0;
+	fResponseValidator.clear();
+}
+
+/// Gets the path the download is written to, in place of a temp file.
+const UTF8String& ResumableDownload::getPartialFilePath( ) const
+{
+	return fPartialFilePath;
+}
+
+/// Gets the number of bytes of the partial file that the download resumes after, or 0 if it starts over.
+long long ResumableDownload::getOffset( ) const
+{
+	return fOffset;
+}
+
+/// Gets the request headers asking for the rest of the partial file ("Name: value" lines, each ending in CRLF),
+/// or an empty string if there is nothing to resume from.
+UTF8String ResumableDownload::getRangeHeaders( ) const
+{
+	UTF8String headers;
+	if ( fOffset > 0 )
+	{
+		char range[64];
+		sprintf_s( range, sizeof(range), "Range: bytes=%lld-\r\n", fOffset );
+		headers = range;
+		headers += "If-Range: ";
+		headers += fValidator;
+		headers += "\r\n";
+	}
+	return headers;
+}
+
+/// Determines if the given response is the rest of the partial file: a 206 whose range starts where the partial
+/// file ends, of a body with the same validator, sent as is.
+bool ResumableDownload::isResumedResponse( int status, const HttpHeaderTable& responseHeaders ) const
+{
+	if ( ( HTTP_STATUS_PARTIAL_CONTENT != status ) || ( fOffset <= 0 ) )
+	{
+		return false;
+	}
+
+	const char *contentRange = responseHeaders.getValue( "Content-Range" );
+	if ( ( NULL == contentRange ) || ( 0 != _strnicmp( contentRange, "bytes ", 6 ) ) ||
+		 ( _strtoi64( contentRange + 6, NULL, 10 ) != fOffset ) )
+	{
+		return false;
+	}
+
+	const char *contentEncoding = responseHeaders.getValue( "Content-Encoding" );
+	if ( ( NULL != contentEncoding ) && ( 0 != *contentEncoding ) && ( 0 != _strcmpi( "identity", contentEncoding ) ) )
+	{
+		return false;
+	}
+
+	// Entity tags are quoted, dates are not.
+	const char *validator = responseHeaders.getValue( ( '"' == fValidator[0] ) ? "ETag" : "Last-Modified" );
+	return ( NULL != validator ) && ( fValidator == validator );
+}
+
+/// Takes note of the response to the request once its headers have arrived, and of whether it can be resumed from
+/// if it is interrupted. A 206 that is not the rest of the partial file, or a 416 (the partial file is longer than
+/// the body), means the partial file is of no use anymore, so it is removed.
+/// @return Returns true if the response is the rest of the partial file (see isResumedResponse()).
+bool ResumableDownload::setResponse( int status, const HttpHeaderTable& responseHeaders )
+{
+	fResponseValidator.clear();
+	if ( !fIsOpen )
+	{
+		return false;
+	}
+
+	bool isResumed = isResumedResponse( status, responseHeaders );
+	if ( isResumed || ( HTTP_STATUS_OK == status ) )
+	{
+		fResponseValidator = getValidator( responseHeaders );
+	}
+	else if ( ( HTTP_STATUS_PARTIAL_CONTENT == status ) || ( RESUMABLE_DOWNLOAD_STATUS_RANGE_NOT_SATISFIABLE == status ) )
+	{
+		debug("Partial download does not match the response, removing it");
+		discard();
+	}
+	return isResumed;
+}
+
+/// Removes the sidecar once the partial file has been moved to the response file, and closes the download.
+void ResumableDownload::complete( )
+{
+	if ( fIsOpen )
+	{
+		HttpResponseCache::removeFile( fInfoFilePath );
+		close();
+	}
+}
+
+/// Keeps or removes the partial file once the request is complete (and no other thread uses it), and closes the
+/// download. Does nothing to the files if the request never got as far as writing to the partial file.
+/// @param hasWrittenFile Set if the request opened the partial file.
+/// @param interruptedLength The number of bytes in the partial file if the download was interrupted, or -1 if the
+///                          download ended otherwise.
+void ResumableDownload::end( bool hasWrittenFile, long long interruptedLength )
+{
+	if ( !fIsOpen )
+	{
+		return;
+	}
+	if ( hasWrittenFile )
+	{
+		if ( ( interruptedLength > 0 ) && !fResponseValidator.empty() && save( interruptedLength ) )
+		{
+			debug("Kept %lld bytes of the download to resume it later", interruptedLength);
+		}
+		else
+		{
+			discard();
+		}
+	}
+	close();
+}
+
+/// Gets the validator of the given response that an If-Range request header can give back: its ETag if it is
+/// strong (weak tags can't be used with ranges), or else its Last-Modified date. Gets an empty string if the
+/// response has neither, is compressed (a range of the decoded body can't be asked for), or may not be asked
+/// for ranges.
+UTF8String ResumableDownload::getValidator( const HttpHeaderTable& responseHeaders )
+{
+	const char *contentEncoding = responseHeaders.getValue( "Content-Encoding" );
+	const char *acceptRanges = responseHeaders.getValue( "Accept-Ranges" );
+	if ( ( ( NULL != contentEncoding ) && ( 0 != *contentEncoding ) && ( 0 != _strcmpi( "identity", contentEncoding ) ) ) ||
+		 ( ( NULL != acceptRanges ) && ( 0 == _strcmpi( "none", acceptRanges ) ) ) )
+	{
+		return UTF8String();
+	}
+
+	const char *entityTag = responseHeaders.getValue( "ETag" );
+	if ( ( NULL != entityTag ) && ( '"' == entityTag[0] ) )
+	{
+		return UTF8String( entityTag );
+	}
+	const char *lastModified = responseHeaders.getValue( "Last-Modified" );
+	if ( ( NULL != lastModified ) && ( 0 != *lastModified ) )
+	{
+		return UTF8String( lastModified );
+	}
+	return UTF8String();
+}
+
+#pragma endregion
+
+
+#pragma region Private Functions
+// Reads the sidecar left by an earlier attempt, which is only used if it is for the same URL and the partial file
+// still holds at least the bytes it counts. Bytes past them are dropped when the partial file is opened.
+void ResumableDownload::load( )
+{
+	FILE *file = HttpResponseCache::openFile( fInfoFilePath, "rb" );
+	if ( NULL == file )
+	{
+		return;
+	}
+	char buffer[4096];
+	UTF8String info;
+	size_t bytesRead;
+	while ( ( ( bytesRead = fread( buffer, 1, sizeof(buffer), file ) ) > 0 ) && ( info.size() < RESUMABLE_DOWNLOAD_MAX_INFO_BYTES ) )
+	{
+		info.append( buffer, bytesRead );
+	}
+	fclose( file );
+
+	// One line each for the URL, the validator and the length.
+	size_t urlEnd = info.find( '\n' );
+	size_t validatorEnd = ( UTF8String::npos != urlEnd ) ? info.find( '\n', urlEnd + 1 ) : UTF8String::npos;
+	if ( ( UTF8String::npos == validatorEnd ) || ( 0 != info.compare( 0, urlEnd, fUrl ) ) || ( validatorEnd == urlEnd + 1 ) )
+	{
+		debug("Ignoring partial download of another request");
+		return;
+	}
+	long long length = _strtoi64( info.c_str() + validatorEnd + 1, NULL, 10 );
+
+	struct _stat64 buf;
+	if ( ( length <= 0 ) || ( _stati64( fPartialFilePath.c_str(), &buf ) != 0 ) || ( buf.st_size < length ) )
+	{
+		debug("Ignoring partial download that is missing bytes");
+		return;
+	}
+
+	fValidator = info.substr( urlEnd + 1, validatorEnd - urlEnd - 1 );
+	fOffset = length;
+	debug("Resuming download after %lld bytes", fOffset);
+}
+
+// Writes the sidecar for the partial file.
+bool ResumableDownload::save( long long length )
+{
+	FILE *file = HttpResponseCache::openFile( fInfoFilePath, "wb" );
+	if ( NULL == file )
+	{
+		return false;
+	}
+	bool wasWritten = ( fprintf( file, "%s\n%s\n%lld\n", fUrl.c_str(), fResponseValidator.c_str(), length ) > 0 );
+	wasWritten = ( 0 == fclose( file ) ) && wasWritten;
+	if ( !wasWritten )
+	{
+		HttpResponseCache::removeFile( fInfoFilePath );
+	}
+	return wasWritten;
+}
+
+// Removes the partial file and its sidecar. What the request was sent with stays as is, as the thread writing the
+// download file may still look at it.
+void ResumableDownload::discard( )
+{
+	HttpResponseCache::removeFile( fPartialFilePath );
+	HttpResponseCache::removeFile( fInfoFilePath );
+}
+
+#pragma endregion
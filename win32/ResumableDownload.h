@@ -0,0 +1,80 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef _ResumableDownload_H_
+#define _ResumableDownload_H_
+
+#include "WindowsNetworkSupport.h"
+
+
+/// Suffixes appended to the response file's path to name the partial file a resumable download is written to, and
+/// the sidecar file describing what the partial file holds.
+#define RESUMABLE_DOWNLOAD_PARTIAL_FILE_SUFFIX ".partial"
+#define RESUMABLE_DOWNLOAD_INFO_FILE_SUFFIX ".resume"
+
+/// The partial file of a download made with params.resume = true, which survives a failed or cancelled attempt so
+/// that the next attempt picks up where it stopped.
+///
+/// Unlike other downloads, which go to a new temp file every time, a resumable download always goes to the response
+/// file's path plus ".partial". If an attempt is interrupted after some of the body was written, the partial file is
+/// kept along with a sidecar file holding the request URL, the response's validator (a strong ETag, or else its
+/// Last-Modified date) and the number of bytes written.
+///
+/// The next attempt for the same URL asks for the rest of the body with "Range" and "If-Range" request headers. A
+/// 206 (Partial Content) response starting at the end of the partial file, with the same validator and no
+/// Content-Encoding, is appended to it. Otherwise the server sends the whole body (a 200), which replaces the
+/// partial file. Once the download completes, the partial file becomes the response file and the sidecar is
+/// removed. A response that can't be resumed from (no validator, compressed, or "Accept-Ranges: none") is not
+/// kept if interrupted.
+///
+/// Used by the main thread, except for isResumedResponse() and getOffset(), which the thread writing the download
+/// file calls while the request is in flight.
+class ResumableDownload
+{
+public:
+	ResumableDownload( );
+	~ResumableDownload( );
+
+	bool open( NetworkRequestParameters *requestParams );
+	bool isOpen( ) const;
+	void close( );
+
+	const UTF8String& getPartialFilePath( ) const;
+	long long getOffset( ) const;
+	UTF8String getRangeHeaders( ) const;
+
+	bool isResumedResponse( int status, const HttpHeaderTable& responseHeaders ) const;
+	bool setResponse( int status, const HttpHeaderTable& responseHeaders );
+
+	void complete( );
+	void end( bool hasWrittenFile, long long interruptedLength );
+
+	static UTF8String getValidator( const HttpHeaderTable& responseHeaders );
+
+private:
+
+	UTF8String fUrl;
+	UTF8String fPartialFilePath;
+	UTF8String fInfoFilePath;
+	bool fIsOpen;
+
+	/// The validator and length of what the partial file held when the request was sent, or an empty validator and
+	/// no length if there was nothing to resume from. Not changed while the request is in flight.
+	UTF8String fValidator;
+	long long fOffset;
+
+	/// The validator of the response being written to the partial file, or empty if it can't be resumed from.
+	UTF8String fResponseValidator;
+
+	void load( );
+	bool save( long long length );
+	void discard( );
+};
+
+#endif
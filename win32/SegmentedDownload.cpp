@@ -0,0 +1,577 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "CoronaLog.h"
+#include "SegmentedDownload.h"
+#include "HttpResponseCache.h"
+#include "ResumableDownload.h"
+
+#ifdef _WIN32
+#include <WinHttp.h>
+#endif
+
+
+#pragma region DownloadSegment
+/// Creates the probe or the whole request of a segmented download.
+DownloadSegment::DownloadSegment( Kind kind )
+{
+	fKind = kind;
+	fStart = 0;
+	fLength = -1;
+	fLuaCallback = NULL;
+	fRequestCanceller = NULL;
+	fHasEnded = false;
+	fIsError = false;
+	fStatus = -1;
+	fBytesTransferred = 0;
+}
+
+/// Creates a range of a segmented download.
+/// @param filePath The download's file, which the range is written into.
+/// @param start The offset of the range in the body, and in the file.
+/// @param length The number of bytes in the range.
+/// @param validator The body's strong ETag or Last-Modified date, which the range's response must have too.
+DownloadSegment::DownloadSegment( const UTF8String& filePath, long long start, long long length, const UTF8String& validator )
+:	fFilePath( filePath ),
+	fValidator( validator )
+{
+	fKind = kKindRange;
+	fStart = start;
+	fLength = length;
+	fLuaCallback = NULL;
+	fRequestCanceller = NULL;
+	fHasEnded = false;
+	fIsError = false;
+	fStatus = -1;
+	fBytesTransferred = 0;
+}
+
+DownloadSegment::~DownloadSegment( )
+{
+}
+
+DownloadSegment::Kind DownloadSegment::getKind( ) const
+{
+	return fKind;
+}
+
+/// Determines if the segment is a range of the body, which its request writes into the download's file.
+bool DownloadSegment::isRange( ) const
+{
+	return ( kKindRange == fKind );
+}
+
+const UTF8String& DownloadSegment::getFilePath( ) const
+{
+	return fFilePath;
+}
+
+long long DownloadSegment::getStart( ) const
+{
+	return fStart;
+}
+
+long long DownloadSegment::getLength( ) const
+{
+	return fLength;
+}
+
+/// Gets the request headers asking for the range ("Name: value" lines, each ending in CRLF), or an empty string if
+/// the segment is not a range.
+UTF8String DownloadSegment::getRangeHeaders( ) const
+{
+	UTF8String headers;
+	if ( isRange() )
+	{
+		char range[80];
+		sprintf_s( range, sizeof(range), "Range: bytes=%lld-%lld\r\n", fStart, fStart + fLength - 1 );
+		headers = range;
+		headers += "If-Range: ";
+		headers += fValidator;
+		headers += "\r\n";
+	}
+	return headers;
+}
+
+/// Determines if the given response is the range: a 206 for exactly its bytes, of a body with the same validator,
+/// sent as is. Anything else (such as a 200 with the whole body, if it changed) must not go into the file.
+bool DownloadSegment::isSegmentResponse( int status, const HttpHeaderTable& responseHeaders ) const
+{
+	if ( ( HTTP_STATUS_PARTIAL_CONTENT != status ) || !isRange() )
+	{
+		return false;
+	}
+
+	const char *contentRange = responseHeaders.getValue( "Content-Range" );
+	char *rangeEnd = NULL;
+	if ( ( NULL == contentRange ) || ( 0 != _strnicmp( contentRange, "bytes ", 6 ) ) ||
+		 ( _strtoi64( contentRange + 6, &rangeEnd, 10 ) != fStart ) || ( '-' != *rangeEnd ) ||
+		 ( _strtoi64( rangeEnd + 1, NULL, 10 ) != fStart + fLength - 1 ) )
+	{
+		return false;
+	}
+
+	const char *contentEncoding = responseHeaders.getValue( "Content-Encoding" );
+	if ( ( NULL != contentEncoding ) && ( 0 != *contentEncoding ) && ( 0 != _strcmpi( "identity", contentEncoding ) ) )
+	{
+		return false;
+	}
+
+	// Entity tags are quoted, dates are not.
+	const char *validator = responseHeaders.getValue( ( '"' == fValidator[0] ) ? "ETag" : "Last-Modified" );
+	return ( NULL != validator ) && ( fValidator == validator );
+}
+
+/// Has the events of a whole request dispatched to the segmented download's listener, as the events of the
+/// download (with its requestId).
+void DownloadSegment::relayTo( LuaCallback *luaCallback, RequestCanceller *requestCanceller )
+{
+	fLuaCallback = luaCallback;
+	fRequestCanceller = requestCanceller;
+}
+
+/// Called by the request's operation with each of its events, in place of a Lua listener.
+void DownloadSegment::notify( NetworkRequestState *requestState )
+{
+	if ( 0 == strcmp( "ended", requestState->getPhase() ) )
+	{
+		fHasEnded = true;
+		fIsError = requestState->isError();
+		Body *body = requestState->getResponseBody();
+		if ( fIsError && ( TYPE_STRING == body->bodyType ) && ( NULL != body->bodyString ) )
+		{
+			fErrorMessage = *body->bodyString;
+		}
+	}
+
+	// The status and headers are the same in every event once the response has arrived.
+	const HttpHeaderTable& responseHeaders = requestState->getResponseHeaders();
+	fStatus = requestState->getStatus();
+	if ( ( kKindProbe == fKind ) && fResponseHeaders.empty() && !responseHeaders.empty() )
+	{
+		for ( size_t index = 0; index < responseHeaders.size(); index++ )
+		{
+			const char *name = responseHeaders.getName( index );
+			if ( 0 != strcmp( HTTP_HEADER_STATUS_LINE_NAME, name ) )
+			{
+				fResponseHeaders += name;
+				fResponseHeaders += ": ";
+			}
+			fResponseHeaders.append( responseHeaders.getValue( index ), responseHeaders.getValueLength( index ) );
+			fResponseHeaders += "\r\n";
+		}
+	}
+	fBytesTransferred = requestState->getBytesTransferred();
+
+	if ( NULL != fLuaCallback )
+	{
+		fLuaCallback->callWithNetworkRequestState( requestState, fRequestCanceller );
+	}
+}
+
+/// Determines if the request's "ended" event was dispatched, which an aborted request never has.
+bool DownloadSegment::hasEnded( ) const
+{
+	return fHasEnded;
+}
+
+/// Determines if a range's request ended with all of its bytes written to the file.
+bool DownloadSegment::isComplete( ) const
+{
+	return fHasEnded && !fIsError && ( HTTP_STATUS_PARTIAL_CONTENT == fStatus ) && ( fBytesTransferred == fLength );
+}
+
+bool DownloadSegment::isError( ) const
+{
+	return fIsError;
+}
+
+/// Gets the status of the request's response, or -1 if none has arrived.
+int DownloadSegment::getStatus( ) const
+{
+	return fStatus;
+}
+
+/// Gets the probe's response headers (CRLF terminated lines, starting with the status line).
+const UTF8String& DownloadSegment::getResponseHeaders( ) const
+{
+	return fResponseHeaders;
+}
+
+const UTF8String& DownloadSegment::getErrorMessage( ) const
+{
+	return fErrorMessage;
+}
+
+long long DownloadSegment::getBytesTransferred( ) const
+{
+	return fBytesTransferred;
+}
+
+#pragma endregion
+
+
+#pragma region SegmentedDownload
+/// Creates a segmented download.
+/// @param requestParams The request, which this object takes ownership of.
+SegmentedDownload::SegmentedDownload( NetworkRequestParameters *requestParams )
+{
+	fRequestParams = requestParams;
+	fRequestState = NULL;
+	fStage = kStageProbing;
+	fIsExecuting = false;
+	fWasAbortRequested = false;
+	fHasRangeFailed = false;
+	fTakenRequestCount = 0;
+	fReportedBytes = 0;
+}
+
+SegmentedDownload::~SegmentedDownload( )
+{
+	ReleaseRequests();
+	if ( NULL != fRequestParams )
+	{
+		delete fRequestParams;
+	}
+	if ( NULL != fRequestState )
+	{
+		delete fRequestState;
+	}
+}
+
+/// Starts the download with its probe, or with the whole request if it asks for a range of its own. The probe is
+/// sent by the manager, along with the other requests taken from TakeRequestParams().
+/// @return Returns the download's canceller, which is handed to Lua as its requestId.
+RequestCanceller* SegmentedDownload::Start( const std::shared_ptr<SegmentedDownload>& thiz )
+{
+	fRequestState = new NetworkRequestState( thiz, fRequestParams->getRequestUrl(), fRequestParams->isDebug() );
+	fIsExecuting = true;
+	if ( NULL != fRequestParams->getRequestHeaderValue( "Range" ) )
+	{
+		StartWhole();
+	}
+	else
+	{
+		fStage = kStageProbing;
+		fSegments.push_back( std::make_shared<DownloadSegment>( DownloadSegment::kKindProbe ) );
+	}
+	return fRequestState->getRequestCanceller();
+}
+
+/// Gets the parameters of the next request to send for the download, if any. The manager sends it like any other
+/// request, and hands its canceller to RequestSent().
+/// @return Returns parameters that the caller takes ownership of, or NULL if there are no more requests to send.
+NetworkRequestParameters* SegmentedDownload::TakeRequestParams( )
+{
+	if ( !fIsExecuting || fWasAbortRequested || fHasRangeFailed || ( fTakenRequestCount >= fSegments.size() ) )
+	{
+		return NULL;
+	}
+	return new NetworkRequestParameters( fRequestParams, fSegments[fTakenRequestCount++] );
+}
+
+/// Takes note of the canceller of the request just sent for the download, which is held until the stage ends.
+void SegmentedDownload::RequestSent( RequestCanceller *requestCanceller )
+{
+	requestCanceller->AddRef();
+	fRequestCancellers.push_back( requestCanceller );
+}
+
+/// Moves the download on once its requests have processed their events. Called by the manager on every update,
+/// after its request operations.
+void SegmentedDownload::ProcessExecution( )
+{
+	if ( !fIsExecuting )
+	{
+		return;
+	}
+
+	// Nothing is reported once aborted. The temp file is only removed once no request is writing to it.
+	if ( fWasAbortRequested )
+	{
+		if ( AreRequestsReleased() )
+		{
+			End( false );
+		}
+		return;
+	}
+
+	switch ( fStage )
+	{
+		case kStageProbing:
+			if ( AreRequestsReleased() )
+			{
+				std::shared_ptr<DownloadSegment> probe = fSegments[0];
+				ReleaseRequests();
+				StartRanges( *probe );
+			}
+			break;
+
+		case kStageDownloading:
+			ProcessRanges();
+			break;
+
+		case kStageRelaying:
+			// The whole request's events, including its "ended" one, were relayed to the listener as they came.
+			if ( AreRequestsReleased() )
+			{
+				End( false );
+			}
+			break;
+	}
+}
+
+bool SegmentedDownload::IsExecuting( )
+{
+	return fIsExecuting;
+}
+
+/// Called by the download's canceller. Cancels the download's requests, and ends it without notifying its listener
+/// once they have let go of the temp file.
+void SegmentedDownload::RequestAbort( )
+{
+	if ( fIsExecuting && !fWasAbortRequested )
+	{
+		fWasAbortRequested = true;
+		CancelRequests();
+	}
+}
+
+/// Determines if the given request is split over several connections, i.e. if it was made with params.segments
+/// greater than 1.
+bool SegmentedDownload::isRequestSegmentable( NetworkRequestParameters *requestParams )
+{
+	return ( requestParams->getSegmentCount() > 1 ) && ( NULL == requestParams->getDownloadSegment() );
+}
+
+#pragma endregion
+
+
+#pragma region Private Functions
+// Splits the body into ranges if the probe's response allows it, and creates the temp file they are written to.
+// Otherwise makes the whole request.
+void SegmentedDownload::StartRanges( const DownloadSegment& probe )
+{
+	HttpHeaderTable responseHeaders;
+	responseHeaders.parse( probe.getResponseHeaders().data(), probe.getResponseHeaders().size() );
+	const char *acceptRanges = responseHeaders.getValue( "Accept-Ranges" );
+	const char *contentLength = responseHeaders.getValue( "Content-Length" );
+	long long length = ( NULL != contentLength ) ? _strtoi64( contentLength, NULL, 10 ) : -1;
+	UTF8String validator = ResumableDownload::getValidator( responseHeaders );
+
+	long long segmentCount = fRequestParams->getSegmentCount();
+	if ( length > 0 )
+	{
+		segmentCount = ( length / SEGMENTED_DOWNLOAD_MIN_SEGMENT_BYTES < segmentCount ) ? length / SEGMENTED_DOWNLOAD_MIN_SEGMENT_BYTES : segmentCount;
+	}
+	if ( probe.isError() || ( HTTP_STATUS_OK != probe.getStatus() ) || ( NULL == acceptRanges ) ||
+		 ( 0 != _strcmpi( "bytes", acceptRanges ) ) || validator.empty() || ( segmentCount < 2 ) )
+	{
+		debug("Response can't be split into segments, downloading it whole");
+		StartWhole();
+		return;
+	}
+
+	// The temp file goes next to the response file, so that it can be renamed to it.
+	UTF8String pathDir;
+	UTF8String fullPath = fRequestParams->getResponseFile()->getFullPath();
+	const size_t lastIndex = fullPath.find_last_of( "/\\" );
+	if ( UTF8String::npos != lastIndex )
+	{
+		pathDir = fullPath.substr( 0, lastIndex + 1 );
+	}
+	fTempFilePath = pathForTemporaryFileWithPrefix( "download", pathDir );
+	if ( !HttpResponseCache::createFile( fTempFilePath, length ) )
+	{
+		debug("Unable to create temp file for segmented download, downloading it whole");
+		fTempFilePath.clear();
+		StartWhole();
+		return;
+	}
+
+	debug("Downloading %lld bytes in %lld segments", length, segmentCount);
+	long long segmentLength = length / segmentCount;
+	for ( long long index = 0; index < segmentCount; index++ )
+	{
+		long long start = index * segmentLength;
+		fSegments.push_back( std::make_shared<DownloadSegment>(
+			fTempFilePath, start, ( index == segmentCount - 1 ) ? length - start : segmentLength, validator ) );
+	}
+	fStage = kStageDownloading;
+
+	// The listener sees the probe's response as the download's, whose body is the sum of the ranges.
+	fRequestState->setStatus( probe.getStatus() );
+	fRequestState->setResponseHeaders( probe.getResponseHeaders().data(), probe.getResponseHeaders().size() );
+	if ( Upload != fRequestParams->getProgressDirection() )
+	{
+		fRequestState->setBytesEstimated( length );
+	}
+	if ( Download == fRequestParams->getProgressDirection() )
+	{
+		fRequestState->setPhase( "began" );
+		NotifyListener();
+	}
+}
+
+// Makes the request as it was sent, relaying its events to the listener.
+void SegmentedDownload::StartWhole( )
+{
+	fStage = kStageRelaying;
+	std::shared_ptr<DownloadSegment> segment = std::make_shared<DownloadSegment>( DownloadSegment::kKindWhole );
+	segment->relayTo( fRequestParams->getLuaCallback(), fRequestState->getRequestCanceller() );
+	fSegments.push_back( segment );
+}
+
+// Reports the progress of the ranges, and ends the download once they have all ended. The first range that fails
+// has the others cancelled, as the download can't complete without it.
+void SegmentedDownload::ProcessRanges( )
+{
+	long long bytesTransferred = 0;
+	bool areRangesReleased = true;
+	for ( size_t index = 0; index < fSegments.size(); index++ )
+	{
+		bytesTransferred += fSegments[index]->getBytesTransferred();
+		if ( !IsSegmentReleased( index ) )
+		{
+			areRangesReleased = false;
+		}
+		else if ( !fHasRangeFailed && !fSegments[index]->isComplete() )
+		{
+			debug("Segment %d of download failed, cancelling the others", (int)index);
+			fHasRangeFailed = true;
+			fFailureMessage = fSegments[index]->getErrorMessage();
+			CancelRequests();
+		}
+	}
+
+	if ( !areRangesReleased )
+	{
+		if ( !fHasRangeFailed && ( bytesTransferred != fReportedBytes ) )
+		{
+			fReportedBytes = bytesTransferred;
+			if ( Upload != fRequestParams->getProgressDirection() )
+			{
+				fRequestState->setBytesTransferred( bytesTransferred );
+			}
+			if ( Download == fRequestParams->getProgressDirection() )
+			{
+				fRequestState->setPhase( "progress" );
+				NotifyListener();
+			}
+		}
+		return;
+	}
+
+	if ( !fHasRangeFailed && HttpResponseCache::renameFile( fTempFilePath, fRequestParams->getResponseFile()->getFullPath() ) )
+	{
+		debug("File successfully renamed");
+		fTempFilePath.clear();
+		if ( Upload != fRequestParams->getProgressDirection() )
+		{
+			fRequestState->setBytesTransferred( bytesTransferred );
+		}
+		Body *body = fRequestState->getResponseBody();
+		body->bodyType = TYPE_FILE;
+		body->bodyFile = new CoronaFileSpec( fRequestParams->getResponseFile() );
+	}
+	else
+	{
+		if ( !fHasRangeFailed )
+		{
+			CORONA_LOG("Failed to rename temp download file to final download file");
+		}
+		fRequestState->setError( new UTF8String( fFailureMessage.empty() ? "Unknown error" : fFailureMessage ) );
+	}
+	End( true );
+}
+
+// Cancels the requests sent for the current stage. Those still queued by the manager are dropped.
+void SegmentedDownload::CancelRequests( )
+{
+	for ( std::vector<RequestCanceller*>::iterator iter = fRequestCancellers.begin(); iter != fRequestCancellers.end(); iter++ )
+	{
+		(*iter)->cancel();
+	}
+}
+
+// Determines if every request of the current stage has been released by its operation, which is done with it (and
+// with the temp file) by then.
+bool SegmentedDownload::AreRequestsReleased( )
+{
+	for ( size_t index = 0; index < fSegments.size(); index++ )
+	{
+		if ( !IsSegmentReleased( index ) )
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Lets go of the requests of the current stage.
+void SegmentedDownload::ReleaseRequests( )
+{
+	for ( std::vector<RequestCanceller*>::iterator iter = fRequestCancellers.begin(); iter != fRequestCancellers.end(); iter++ )
+	{
+		(*iter)->Release();
+	}
+	fRequestCancellers.clear();
+	fSegments.clear();
+	fTakenRequestCount = 0;
+}
+
+// Ends the download, dispatching its "ended" event if asked to, and removes the temp file unless it became the
+// response file.
+void SegmentedDownload::End( bool isNotifying )
+{
+	if ( isNotifying )
+	{
+		fRequestState->setPhase( "ended" );
+		NotifyListener();
+	}
+	LuaCallback* luaCallback = fRequestParams->getLuaCallback();
+	if ( NULL != luaCallback )
+	{
+		luaCallback->unregister();
+	}
+	if ( !fTempFilePath.empty() )
+	{
+		HttpResponseCache::removeFile( fTempFilePath );
+		fTempFilePath.clear();
+	}
+	ReleaseRequests();
+	fIsExecuting = false;
+
+	// The state holds the canceller, which holds this object. Lua may still hold the canceller, which has nothing
+	// left to cancel.
+	NetworkRequestState* requestState = fRequestState;
+	fRequestState = NULL;
+	delete fRequestParams;
+	fRequestParams = NULL;
+	delete requestState;
+}
+
+// Dispatches the download's state to its listener.
+void SegmentedDownload::NotifyListener( )
+{
+	LuaCallback* luaCallback = fRequestParams->getLuaCallback();
+	if ( NULL != luaCallback )
+	{
+		luaCallback->callWithNetworkRequestState( fRequestState );
+	}
+}
+
+// Determines if the request of the given segment is done with it: it was never handed to the manager, or the
+// parameters it was made with (the only other holder of the segment) have been deleted.
+bool SegmentedDownload::IsSegmentReleased( size_t index )
+{
+	return ( index >= fTakenRequestCount ) || ( 1 == fSegments[index].use_count() );
+}
+
+#pragma endregion
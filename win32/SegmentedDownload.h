@@ -0,0 +1,166 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef _SegmentedDownload_H_
+#define _SegmentedDownload_H_
+
+#include "WindowsNetworkSupport.h"
+
+#include <memory>
+#include <vector>
+
+
+/// Fewest bytes a segment of a segmented download is given. A smaller body is split into fewer segments, or is not
+/// split at all, since a connection of its own would not pay for itself.
+#define SEGMENTED_DOWNLOAD_MIN_SEGMENT_BYTES (1024 * 1024)
+
+/// One of the requests a SegmentedDownload makes, which is executed by a request operation like any other request,
+/// but whose events go to the segmented download instead of a Lua listener.
+///
+/// A segment is either the probe (a HEAD request telling if and how the body can be split), a range of the body
+/// (a GET for "Range: bytes=start-end", written at its own offset into the download's shared file), or the whole
+/// request (made as it was sent, if it can't be split, whose events are relayed to its listener as they are).
+///
+/// Used by the main thread, except for the getters of what the request was made with and isSegmentResponse(),
+/// which the thread writing the download file calls while the request is in flight.
+class DownloadSegment
+{
+public:
+
+	/// What the request of a segment asks for.
+	enum Kind
+	{
+		kKindProbe,
+		kKindRange,
+		kKindWhole
+	};
+
+	DownloadSegment( Kind kind );
+	DownloadSegment( const UTF8String& filePath, long long start, long long length, const UTF8String& validator );
+	~DownloadSegment( );
+
+	Kind getKind( ) const;
+	bool isRange( ) const;
+	const UTF8String& getFilePath( ) const;
+	long long getStart( ) const;
+	long long getLength( ) const;
+	UTF8String getRangeHeaders( ) const;
+	bool isSegmentResponse( int status, const HttpHeaderTable& responseHeaders ) const;
+
+	void relayTo( LuaCallback *luaCallback, RequestCanceller *requestCanceller );
+	void notify( NetworkRequestState *requestState );
+
+	bool hasEnded( ) const;
+	bool isComplete( ) const;
+	bool isError( ) const;
+	int getStatus( ) const;
+	const UTF8String& getResponseHeaders( ) const;
+	const UTF8String& getErrorMessage( ) const;
+	long long getBytesTransferred( ) const;
+
+private:
+
+	Kind fKind;
+
+	/// The file, range and validator of a range segment, which the request was made with.
+	UTF8String fFilePath;
+	long long fStart;
+	long long fLength;
+	UTF8String fValidator;
+
+	/// The listener and canceller of the segmented download, which a whole request's events are relayed to.
+	LuaCallback* fLuaCallback;
+	RequestCanceller* fRequestCanceller;
+
+	/// What the request's events have told so far. The response headers are only kept for the probe.
+	bool fHasEnded;
+	bool fIsError;
+	int fStatus;
+	UTF8String fResponseHeaders;
+	UTF8String fErrorMessage;
+	long long fBytesTransferred;
+};
+
+/// A download made with params.segments = N, which fetches the body over up to N connections at once.
+///
+/// The request is first probed with a HEAD request. If the response is a 200 that accepts byte ranges, has a
+/// Content-Length and a validator (a strong ETag or a Last-Modified date), and is not compressed, a temp file of the
+/// body's size is created next to the response file, and the body is split into equal ranges. Each range is asked
+/// for by a GET request of its own ("Range: bytes=start-end", with "If-Range" holding the validator, so that a body
+/// that changed in between is never stitched together), which writes it at its offset into the temp file. Once all
+/// ranges are in, the temp file is renamed to the response file, as with any other download.
+///
+/// The download's listener sees a single request: a "began" event with the probe's status and headers, "progress"
+/// events counting the bytes of all ranges, and one "ended" event. If a range fails, the others are cancelled, the
+/// temp file is removed, and the download ends with that range's error. A request that can't be split (or whose
+/// temp file can't be created) is made as it was sent, and its events are relayed to the listener as they are.
+///
+/// The segment requests are sent by the request manager, through its scheduler, so they count against the limits
+/// on active requests like any others. Only used on the main thread.
+class SegmentedDownload : public NetworkRequestOperation
+{
+public:
+
+	/// The segmented downloads of a request manager.
+	typedef std::vector< std::shared_ptr<SegmentedDownload> > List;
+
+	SegmentedDownload( NetworkRequestParameters *requestParams );
+	virtual ~SegmentedDownload( );
+
+	RequestCanceller* Start( const std::shared_ptr<SegmentedDownload>& thiz );
+	NetworkRequestParameters* TakeRequestParams( );
+	void RequestSent( RequestCanceller *requestCanceller );
+	void ProcessExecution( );
+	bool IsExecuting( );
+	virtual void RequestAbort( );
+
+	static bool isRequestSegmentable( NetworkRequestParameters *requestParams );
+
+private:
+
+	/// What the download is waiting for: the probe, the ranges, or the whole request.
+	enum Stage
+	{
+		kStageProbing,
+		kStageDownloading,
+		kStageRelaying
+	};
+
+	NetworkRequestParameters* fRequestParams;
+	NetworkRequestState* fRequestState;
+	Stage fStage;
+	bool fIsExecuting;
+	bool fWasAbortRequested;
+
+	/// Set once a range has failed, along with the error the download ends with.
+	bool fHasRangeFailed;
+	UTF8String fFailureMessage;
+
+	/// The segments of the current stage, and the cancellers of those whose requests were sent. Requests are made
+	/// for the segments in order, so the first "fTakenRequestCount" segments have been handed to the manager.
+	std::vector< std::shared_ptr<DownloadSegment> > fSegments;
+	std::vector<RequestCanceller*> fRequestCancellers;
+	size_t fTakenRequestCount;
+
+	/// The temp file the ranges are written to, and the number of body bytes the listener was last told about.
+	UTF8String fTempFilePath;
+	long long fReportedBytes;
+
+	void StartRanges( const DownloadSegment& probe );
+	void StartWhole( );
+	void ProcessRanges( );
+	void CancelRequests( );
+	bool AreRequestsReleased( );
+	void ReleaseRequests( );
+	void End( bool isNotifying );
+	void NotifyListener( );
+	bool IsSegmentReleased( size_t index );
+};
+
+#endif
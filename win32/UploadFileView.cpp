@@ -0,0 +1,227 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "CoronaLog.h"
+#include "UploadFileView.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+#pragma region Constructors and Destructors
+UploadFileView::UploadFileView( )
+{
+#ifdef _WIN32
+	fFileHandle = INVALID_HANDLE_VALUE;
+	fMappingHandle = NULL;
+#else
+	fFile = -1;
+#endif
+	fIsOpen = false;
+	fSize = 0;
+	fView = NULL;
+	fViewOffset = 0;
+	fViewLength = 0;
+}
+
+UploadFileView::~UploadFileView( )
+{
+	close();
+}
+
+#pragma endregion
+
+
+#pragma region Public Member Functions
+/// Opens the file at the given path for reading. Nothing is mapped until the first slice is asked for.
+/// @return Returns false if the file could not be opened.
+bool UploadFileView::open( const UTF8String& path )
+{
+	close();
+
+#ifdef _WIN32
+	std::wstring widePath;
+	int wideLength = MultiByteToWideChar( CP_UTF8, 0, path.c_str(), (int)path.size(), NULL, 0 );
+	if ( wideLength > 0 )
+	{
+		widePath.resize( wideLength );
+		MultiByteToWideChar( CP_UTF8, 0, path.c_str(), (int)path.size(), &widePath[0], wideLength );
+	}
+
+	// Others may read the file while it is sent, but not change it. An empty file can't be mapped, and has no
+	// slices to map anyway.
+	fFileHandle = ::CreateFileW(
+		widePath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+	LARGE_INTEGER fileSize;
+	if ( ( INVALID_HANDLE_VALUE == fFileHandle ) || !::GetFileSizeEx( fFileHandle, &fileSize ) )
+	{
+		close();
+		return false;
+	}
+	fSize = fileSize.QuadPart;
+	if ( fSize > 0 )
+	{
+		fMappingHandle = ::CreateFileMappingW( fFileHandle, NULL, PAGE_READONLY, 0, 0, NULL );
+		if ( NULL == fMappingHandle )
+		{
+			close();
+			return false;
+		}
+	}
+#else
+	fFile = ::open( path.c_str(), O_RDONLY | O_CLOEXEC );
+	struct stat fileStatus;
+	if ( ( fFile < 0 ) || ( 0 != ::fstat( fFile, &fileStatus ) ) )
+	{
+		close();
+		return false;
+	}
+	fSize = (long long)fileStatus.st_size;
+#endif
+
+	fIsOpen = true;
+	return true;
+}
+
+bool UploadFileView::isOpen( ) const
+{
+	return fIsOpen;
+}
+
+void UploadFileView::close( )
+{
+	unmapView();
+#ifdef _WIN32
+	if ( NULL != fMappingHandle )
+	{
+		::CloseHandle( fMappingHandle );
+		fMappingHandle = NULL;
+	}
+	if ( INVALID_HANDLE_VALUE != fFileHandle )
+	{
+		::CloseHandle( fFileHandle );
+		fFileHandle = INVALID_HANDLE_VALUE;
+	}
+#else
+	if ( fFile >= 0 )
+	{
+		::close( fFile );
+		fFile = -1;
+	}
+#endif
+	fIsOpen = false;
+	fSize = 0;
+}
+
+/// Gets the size the file had when it was opened.
+long long UploadFileView::getSize( ) const
+{
+	return fSize;
+}
+
+/// Gets the bytes of the file starting at the given offset, mapping the window that holds them if needed. The slice
+/// ends at the end of the window, so it may be shorter than asked for even if the file is not.
+/// @param offset Offset of the slice in the file.
+/// @param maxLength Largest number of bytes the slice is to have.
+/// @param sliceLength Set to the number of bytes in the slice.
+/// @return Returns the slice, which stays valid until the next call, or NULL past the end of the file or if the file
+///         could not be mapped.
+const char* UploadFileView::getSlice( long long offset, size_t maxLength, size_t *sliceLength )
+{
+	*sliceLength = 0;
+	if ( !fIsOpen || ( offset < 0 ) || ( offset >= fSize ) || ( 0 == maxLength ) )
+	{
+		return NULL;
+	}
+	if ( ( NULL == fView ) || ( offset < fViewOffset ) || ( offset >= ( fViewOffset + (long long)fViewLength ) ) )
+	{
+		if ( !mapView( offset ) )
+		{
+			return NULL;
+		}
+	}
+
+	size_t bytesLeft = (size_t)( ( fViewOffset + (long long)fViewLength ) - offset );
+	*sliceLength = ( bytesLeft < maxLength ) ? bytesLeft : maxLength;
+	return fView + ( offset - fViewOffset );
+}
+
+#pragma endregion
+
+
+#pragma region Private Member Functions
+/// Maps the window of the file holding the given offset, in place of the one mapped before.
+bool UploadFileView::mapView( long long offset )
+{
+	unmapView();
+
+	long long viewOffset = offset - ( offset % UPLOAD_FILE_VIEW_BYTES );
+	long long viewLength = fSize - viewOffset;
+	if ( viewLength > UPLOAD_FILE_VIEW_BYTES )
+	{
+		viewLength = UPLOAD_FILE_VIEW_BYTES;
+	}
+
+#ifdef _WIN32
+	void *view = ::MapViewOfFile(
+		fMappingHandle, FILE_MAP_READ, (DWORD)( viewOffset >> 32 ), (DWORD)( viewOffset & 0xFFFFFFFF ), (SIZE_T)viewLength );
+	if ( NULL == view )
+	{
+		CORONA_LOG( "Error mapping request body file - error: %u", ::GetLastError() );
+		return false;
+	}
+#else
+	// Touching a mapped page past the end of a file raises SIGBUS, so a file that was cut short since it was opened
+	// is not mapped again. Unlike Windows, nothing keeps it from being changed while it is sent.
+	struct stat fileStatus;
+	if ( ( 0 != ::fstat( fFile, &fileStatus ) ) || ( (long long)fileStatus.st_size < ( viewOffset + viewLength ) ) )
+	{
+		CORONA_LOG( "Request body file changed while it was being sent" );
+		return false;
+	}
+	void *view = ::mmap( NULL, (size_t)viewLength, PROT_READ, MAP_PRIVATE, fFile, (off_t)viewOffset );
+	if ( MAP_FAILED == view )
+	{
+		CORONA_LOG( "Error mapping request body file - error: %d", errno );
+		return false;
+	}
+	::madvise( view, (size_t)viewLength, MADV_SEQUENTIAL );
+#endif
+
+	fView = (char*)view;
+	fViewOffset = viewOffset;
+	fViewLength = (size_t)viewLength;
+	return true;
+}
+
+void UploadFileView::unmapView( )
+{
+	if ( NULL == fView )
+	{
+		return;
+	}
+#ifdef _WIN32
+	::UnmapViewOfFile( fView );
+#else
+	::munmap( fView, fViewLength );
+#endif
+	fView = NULL;
+	fViewOffset = 0;
+	fViewLength = 0;
+}
+
+#pragma endregion
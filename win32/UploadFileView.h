@@ -0,0 +1,61 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef _UploadFileView_H_
+#define _UploadFileView_H_
+
+#include "WindowsNetworkSupport.h"
+
+
+/// Bytes of the file mapped into memory at a time. A multiple of the allocation granularity (64 KB on Windows) and of
+/// the page size, so that every window starts at an offset the system can map from.
+#define UPLOAD_FILE_VIEW_BYTES (16 * 1024 * 1024)
+
+/// Read-only view of a request body file (network.upload, or a params.body file), which the request is sent
+/// straight from, without reading the file into buffers of its own.
+///
+/// The file is mapped into memory one window of UPLOAD_FILE_VIEW_BYTES at a time, so that a file of any size (over
+/// 4 GB, even in a 32-bit process) takes the same address space. A slice stays mapped until the next call to
+/// getSlice() or close(), which is what lets a write be handed the slice as is and complete later.
+///
+/// Only used by the thread sending the request, once the main thread has opened it.
+class UploadFileView
+{
+public:
+	UploadFileView( );
+	~UploadFileView( );
+
+	bool open( const UTF8String& path );
+	bool isOpen( ) const;
+	void close( );
+
+	long long getSize( ) const;
+	const char* getSlice( long long offset, size_t maxLength, size_t *sliceLength );
+
+private:
+
+#ifdef _WIN32
+	HANDLE fFileHandle;
+	HANDLE fMappingHandle;
+#else
+	int fFile;
+#endif
+	bool fIsOpen;
+	long long fSize;
+
+	/// The window of the file mapped in, if any, and where it starts in the file.
+	char* fView;
+	long long fViewOffset;
+	size_t fViewLength;
+
+	bool mapView( long long offset );
+	void unmapView( );
+};
+
+#endif
@@ -15,18 +15,145 @@
 #include <WinHttp.h>
 
 #include "WindowsNetworkSupport.h"
+#include "ContentDecoder.h"
+#include "ContentEncoder.h"
+#include "UploadFileView.h"
 
 #define SESSION_TX_BUFFER_SIZE 65536
-#define SESSION_RX_BUFFER_SIZE 65536 // Original 8192 was recommended by Microsoft's WinHttp documentation, has 4.4Mbps download speed at maximum.
+
+class DownloadSegment;
+class ResumableDownload;
+class WinHttpEventQueue;
+class WinHttpRequestOperation;
 
 /// Stores information needed by a threaded HTTP request.
-/// Provides fields to be monitored by the main thread to control the async operation.
+///
+/// The WinHttp callback thread never writes fields read by the main thread. Instead it reports progress by
+/// posting WinHttpRequestEvent objects to "EventQueue", which the main thread applies to its own fields.
+/// Fields are grouped below by which thread owns them.
 struct WinHttpAsyncRequestSessionData
 {
-	/// The handle returned by the WinHttpOpen() function.
-	HINTERNET SessionHandle;
+	// Set by the main thread before the request is sent, and read-only while it is in flight.
+
+	/// The operation owning this session, which handles the events posted for it.
+	WinHttpRequestOperation* Owner;
+
+	/// Queue that the callback thread posts this session's events to.
+	WinHttpEventQueue* EventQueue;
+
+	/// Manual-reset event that is set while WinHttp holds no request handle bound to this session. The main thread
+	/// resets it when it binds a new request handle, and the callback thread sets it on the handle's HANDLE_CLOSING,
+	/// after which WinHttp no longer calls back with this session. Created and closed by the owning operation, which
+	/// waits on it before it is destroyed.
+	HANDLE RequestHandleClosedEvent;
+
+	/// Incremented by the main thread for every request executed with this session. Events are stamped
+	/// with it so that events posted for an earlier request can be recognized and dropped.
+	DWORD RequestId;
+
+	Body* RequestBody;
+
+	long long RequestBodyBytesTotal; // Total number of request body bytes to be sent
+
+	/// Set if the request body is gzip compressed as it is sent (params.bodyCompression = "gzip"), in which case
+	/// it is sent chunked since its compressed size is not known up front.
+	bool IsEncodingRequestBody;
+
+	/// Set if the request body is streamed (params.body = function), which is sent chunked. The main thread reads it
+	/// and writes its chunks (compressed by its stream if "IsEncodingRequestBody" is set), each once the callback
+	/// thread has completed the last write and handed it the turn with "IsRequestBodyStreamStarved".
+	bool IsStreamingRequestBody;
+
+	/// Path of the temp file that the response body is downloaded to, or empty if the response body is not
+	/// directed to a file. The callback thread only creates the file if the response status is 200 (OK), or opens
+	/// it if the response is a 206 (Partial Content) resuming a partial download.
+	UTF8String DownloadFilePath;
+
+	/// The partial file that "DownloadFilePath" names if the download is resumable (params.resume), which the
+	/// callback thread asks whether the response continues it. NULL for other requests.
+	const ResumableDownload* Resume;
+
+	/// The range of a segmented download that the request is for, if any, which the callback thread asks whether
+	/// the response is the range. The range is written into the download's file ("DownloadFilePath"), which the
+	/// request neither creates, trims nor removes. NULL for other requests.
+	const DownloadSegment* Segment;
+
+	/// Set if the response body is to be decoded according to its Content-Encoding (params.compression = "auto").
+	/// The callback thread decodes what it writes to the download file, and the main thread everything else.
+	bool IsDecodingResponse;
+
+	/// Ring of "ReceiveBufferCount" buffers of "ReceiveBufferSize" bytes each, that response data is read into.
+	/// The callback thread keeps reading into the next free buffer while the main thread consumes filled ones,
+	/// so reading only stalls when every buffer is waiting for the main thread.
+	char* ReceiveBuffers;
+	LONG ReceiveBufferCount;
+	DWORD ReceiveBufferSize;
+
+
+	// Shared by both threads, and only accessed with the Interlocked functions.
+
+	/// Number of buffers filled by the callback thread and not yet consumed by the main thread. Whichever thread
+	/// changes it away from "ReceiveBufferCount" (the callback thread by filling a buffer, the main thread by
+	/// consuming the last one of a full ring) issues the next WinHttpReadData() call.
+	volatile LONG FilledReceiveBufferCount;
+
+	/// Index of the buffer the next (or pending) WinHttpReadData() call reads into. Written by the thread
+	/// that issues the read.
+	volatile LONG ReceiveWriteIndex;
+
+	/// Set by the callback thread once a streamed request body's last write has completed (or the request has been
+	/// sent), and cleared by the main thread when it writes the next chunks. "UploadBuffer", "RequestBodyBytesRead"
+	/// and "IsRequestBodyStreamEnded" belong to the main thread while it is set.
+	volatile LONG IsRequestBodyStreamStarved;
+
+
+	// Owned by the WinHttp callback thread while the request is in flight.
+
+	/// The file containing the request body to upload (if any), which slices are written from as they are mapped.
+	/// Opened by the main thread before the request is sent.
+	UploadFileView UploadFile;
+
+	long long RequestBodyBytesCurrent; // Number of request body bytes sent by the sending thread
+
+	/// Holds the slice of the request body being written, which WinHttp needs until the write completes.
+	/// Compressed slices are built in "UploadBuffer", while others are written from the body (or its file) as is.
+	std::string UploadBuffer;
+
+	/// Compresses the request body if "IsEncodingRequestBody" is set. Opened by the main thread before the request
+	/// is sent, and closed once the last of the body has been compressed. "RequestBodyBytesRead" is the number of
+	/// uncompressed bytes it has been given so far, while "RequestBodyBytesCurrent" counts compressed bytes.
+	ContentEncoder UploadEncoder;
+	long long RequestBodyBytesRead;
 
-	/// The handle returned by the WinHttpConnect() function.
+	/// Set by the main thread when it writes the last chunk of a streamed request body.
+	bool IsRequestBodyStreamEnded;
+
+	/// Handle to the open download temp file, or INVALID_HANDLE_VALUE. The callback thread writes response data
+	/// to it straight from the receive buffer, so the main thread never waits on the disk. Closed by the callback
+	/// thread once all data has been written, otherwise by the main thread once the request is complete.
+	HANDLE DownloadFileHandle;
+
+	/// Set once the callback thread has opened the download file, and the offset the next body bytes are written
+	/// at, which is where a resumed download starts. Read by the main thread once the request is complete.
+	bool HasOpenedDownloadFile;
+	long long DownloadFileOffset;
+
+	/// Decodes a compressed response body before it is written to the download file, into "DownloadDecodeBuffer"
+	/// (which keeps its capacity from one read to the next). Opened along with the download file.
+	ContentDecoder DownloadDecoder;
+	std::string DownloadDecodeBuffer;
+
+	/// Set once the callback thread has posted the ended event, after which it issues no more WinHttp calls.
+	bool HasPostedEnd;
+
+	/// Set when WinHttp reports that it is connecting to the server for this request. Passed on to the
+	/// main thread with the headers event.
+	bool HasOpenedConnection;
+
+
+	// Owned by the main thread.
+
+	/// The connection handle leased from the WinHttpConnectionPool for this request.
 	HINTERNET ConnectionHandle;
 
 	/// The handle returned by the WinHttpOpenRequest() function.
@@ -38,38 +165,42 @@ struct WinHttpAsyncRequestSessionData
 
 	bool IsFirstProcessingPassForRequest;
 
-	Body* RequestBody;
-
-	/// File stream to an open file containing the request body to upload (if any)
-	FILE* UploadFileStream;
-
-	DWORD RequestBodyBytesCurrent;   // Number of request body bytes sent by the sending thread
-	DWORD RequestBodyBytesProcessed; // Number of request body bytes processed by the monitoring thread 
-	DWORD RequestBodyBytesTotal;     // Total number of request body bytes to be sent
+	long long RequestBodyBytesSent;      // Number of request body bytes reported sent by the latest upload progress event
+	long long RequestBodyBytesProcessed; // Number of request body bytes processed by the monitoring thread 
+	long long RequestBodyEncodedBytesSent; // Number of compressed request body bytes reported sent, if compressing it
 
 	// UTFString to collect response headers, and flag indicating that headers
 	// have been received and may be read.
 	UTF8String ResponseHeaders;
 	bool ResponseHeadersReady;
 
-	/// Buffer used by the thread to copy response data to.
-	/// The main thread is expected to copy these bytes to its own buffer.
-	char ReceiveBuffer[SESSION_RX_BUFFER_SIZE];
+	/// Index of the next filled buffer for the main thread to consume.
+	LONG ReceiveReadIndex;
 
-	/// The number of bytes received and copied into "ReceiveBuffer".
+	/// The number of bytes received and copied into the buffer at "ReceiveReadIndex".
 	/// To be used by the main thread to copy the received bytes to its own buffer.
 	/// The main thread is expected to set this field to zero after copying the received bytes.
 	int ReceivedByteCount;
 
+	/// The number of bytes the callback thread has written to the download file that have not yet been
+	/// reported as progress. The main thread is expected to set this field to zero after reporting them.
+	DWORD WrittenByteCount;
+
+	/// The number of decoded bytes behind "WrittenByteCount", which only differs from it for compressed responses.
+	DWORD DecodedWrittenByteCount;
+
 	/// The HTTP status code that was received in the HTTP response's header.
 	/// Set to -1 if a response has not been received.
 	int ReceivedStatusCode;
 
-	/// Set true to have the async operation aborted. This flag is monitored by the threaded
-	/// HTTP request operation and will abort when it is able to.
+	/// Set true if WinHttp had to open a new socket for this request, rather than reusing a
+	/// kept-alive connection from the shared session.
+	bool IsNewConnection;
+
+	/// Set true to have the async operation aborted.
 	bool WasAbortRequested;
 
-	/// Set true by the threaded operation when the request operation has ended.
+	/// Set true when the request operation has ended.
 	bool HasAsyncOperationEnded;
 
 	/// Set to true by the processing thread to indicate that HasAsyncOperationEnded has been
@@ -88,12 +219,37 @@ struct WinHttpAsyncRequestSessionData
 		RequestComplete = false;
 		IsFirstProcessingPassForRequest = true;
 		RequestBodyBytesCurrent = 0;
+		RequestBodyBytesSent = 0;
 		RequestBodyBytesProcessed = 0;
 		RequestBodyBytesTotal = 0;
-		ResponseHeaders.empty();
+		IsEncodingRequestBody = false;
+		IsStreamingRequestBody = false;
+		IsRequestBodyStreamStarved = 0;
+		IsRequestBodyStreamEnded = false;
+		UploadBuffer.clear();
+		UploadEncoder.close();
+		RequestBodyBytesRead = 0;
+		RequestBodyEncodedBytesSent = 0;
+		HasPostedEnd = false;
+		HasOpenedConnection = false;
+		FilledReceiveBufferCount = 0;
+		ReceiveWriteIndex = 0;
+		ReceiveReadIndex = 0;
+		DownloadFilePath.clear();
+		Resume = NULL;
+		Segment = NULL;
+		HasOpenedDownloadFile = false;
+		DownloadFileOffset = 0;
+		IsDecodingResponse = false;
+		DownloadDecoder.close();
+		DownloadDecodeBuffer.clear();
+		ResponseHeaders.clear();
 		ResponseHeadersReady = false;
 		ReceivedByteCount = 0;
+		WrittenByteCount = 0;
+		DecodedWrittenByteCount = 0;
 		ReceivedStatusCode = -1;
+		IsNewConnection = false;
 		WasAbortRequested = false;
 		HasAsyncOperationEnded = false;
 		EndOfOperationProcessed = false;
@@ -103,15 +259,47 @@ struct WinHttpAsyncRequestSessionData
 	/// Creates a new session object for an asynchronous HTTP request operation.
 	WinHttpAsyncRequestSessionData()
 	{
-		SessionHandle = NULL;
+		Owner = NULL;
+		EventQueue = NULL;
+		RequestId = 0;
+
 		ConnectionHandle = NULL;
 		RequestHandle = NULL;
 
 		RequestBody = NULL;
-		UploadFileStream = NULL;
+		DownloadFileHandle = INVALID_HANDLE_VALUE;
+
+		ReceiveBuffers = NULL;
+		ReceiveBufferCount = 0;
+		ReceiveBufferSize = 0;
 
 		Reset();
 	}
+
+	/// Destroys the session object and its receive buffers.
+	~WinHttpAsyncRequestSessionData()
+	{
+		delete [] ReceiveBuffers;
+	}
+
+	/// Sets up the receive buffer ring for a new request, re-using the current buffers if they are large enough.
+	/// Never call this function if it is currently being used by an active async operation.
+	void AllocateReceiveBuffers(LONG count, DWORD size)
+	{
+		if ((NULL == ReceiveBuffers) || ((size_t)count * size > (size_t)ReceiveBufferCount * ReceiveBufferSize))
+		{
+			delete [] ReceiveBuffers;
+			ReceiveBuffers = new char[(size_t)count * size];
+		}
+		ReceiveBufferCount = count;
+		ReceiveBufferSize = size;
+	}
+
+	/// Gets the buffer with the given index in the receive buffer ring.
+	char* GetReceiveBuffer(LONG index)
+	{
+		return ReceiveBuffers + (size_t)index * ReceiveBufferSize;
+	}
 };
 
 #endif
@@ -0,0 +1,286 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md 
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "CoronaLog.h"
+#include "WinHttpConnectionPool.h"
+#include "WindowsNetworkSupport.h"
+#include "WinTimer.h"
+
+
+#pragma region Constructors and Destructors
+/// Creates a new, empty pool. The WinHttp session is opened on first use.
+WinHttpConnectionPool::WinHttpConnectionPool()
+{
+	fSessionHandle = NULL;
+	fMaxIdleConnections = WINHTTP_POOL_MAX_IDLE_CONNECTIONS;
+	fMaxIdleConnectionsPerHost = WINHTTP_POOL_MAX_IDLE_CONNECTIONS_PER_HOST;
+	fIdleTimeoutInMilliseconds = WINHTTP_POOL_IDLE_TIMEOUT_MS;
+	fMaxConnectionsPerHost = WINHTTP_POOL_MAX_CONNECTIONS_PER_HOST;
+	fHitCount = 0;
+	fMissCount = 0;
+}
+
+/// Closes all pooled connection handles and the WinHttp session.
+/// All request operations using this pool must have completed before it is destroyed.
+WinHttpConnectionPool::~WinHttpConnectionPool()
+{
+	CloseIdleConnections();
+
+	LeasedConnectionMap::iterator iter;
+	for (iter = fLeasedConnections.begin(); iter != fLeasedConnections.end(); iter++)
+	{
+		::WinHttpCloseHandle(iter->first);
+	}
+	fLeasedConnections.clear();
+
+	if (fSessionHandle)
+	{
+		::WinHttpSetStatusCallback(fSessionHandle, NULL, WINHTTP_CALLBACK_FLAG_ALL_NOTIFICATIONS, NULL);
+		::WinHttpCloseHandle(fSessionHandle);
+		fSessionHandle = NULL;
+	}
+}
+
+#pragma endregion
+
+
+#pragma region Public Functions
+/// Gets the shared WinHttp session, opening it (and installing the given status callback) if not done already.
+/// @param statusCallback Callback to receive the notifications of all requests opened in this session.
+/// @return Returns the session handle, or NULL if it could not be opened.
+HINTERNET WinHttpConnectionPool::GetSessionHandle( WINHTTP_STATUS_CALLBACK statusCallback )
+{
+	if (NULL == fSessionHandle)
+	{
+		fSessionHandle = ::WinHttpOpen(
+			NULL,
+			WINHTTP_ACCESS_TYPE_DEFAULT_PROXY,
+			WINHTTP_NO_PROXY_NAME,
+			WINHTTP_NO_PROXY_BYPASS,
+			WINHTTP_FLAG_ASYNC
+			);
+		if (fSessionHandle)
+		{
+			::WinHttpSetStatusCallback(
+				fSessionHandle,
+				statusCallback,
+				WINHTTP_CALLBACK_FLAG_ALL_NOTIFICATIONS,
+				NULL
+				);
+			ApplyConnectionLimits();
+		}
+		else
+		{
+			CORONA_LOG("Unable to open WinHttp session (%u)", ::GetLastError());
+		}
+	}
+	return fSessionHandle;
+}
+
+/// Leases a connection handle for the given origin, reusing an idle one if available.
+/// The handle must be given back with ReleaseConnection() once the request on it has been closed.
+/// @return Returns a connection handle, or NULL on failure (with the WinHttp error in GetLastError()).
+HINTERNET WinHttpConnectionPool::AcquireConnection( const std::wstring& hostName, INTERNET_PORT port, bool isHttps )
+{
+	std::wstring originKey = GetOriginKey(hostName, port, isHttps);
+
+	IdleConnectionList::iterator iter;
+	for (iter = fIdleConnections.begin(); iter != fIdleConnections.end(); iter++)
+	{
+		if (iter->OriginKey == originKey)
+		{
+			HINTERNET connectionHandle = iter->ConnectionHandle;
+			fIdleConnections.erase(iter);
+			fLeasedConnections[connectionHandle] = originKey;
+			return connectionHandle;
+		}
+	}
+
+	if (NULL == fSessionHandle)
+	{
+		::SetLastError(ERROR_WINHTTP_INCORRECT_HANDLE_STATE);
+		return NULL;
+	}
+
+	// Configure the connection to the server. This does not actually establish a socket connection.
+	HINTERNET connectionHandle = ::WinHttpConnect(fSessionHandle, hostName.c_str(), port, 0);
+	if (connectionHandle)
+	{
+		fLeasedConnections[connectionHandle] = originKey;
+	}
+	return connectionHandle;
+}
+
+/// Returns a connection handle obtained from AcquireConnection() to the idle list, trimming the
+/// idle list back to its limits.
+void WinHttpConnectionPool::ReleaseConnection( HINTERNET connectionHandle )
+{
+	if (NULL == connectionHandle)
+	{
+		return;
+	}
+
+	LeasedConnectionMap::iterator leasedIter = fLeasedConnections.find(connectionHandle);
+	if (leasedIter == fLeasedConnections.end())
+	{
+		::WinHttpCloseHandle(connectionHandle);
+		return;
+	}
+
+	IdleConnection idleConnection;
+	idleConnection.OriginKey = leasedIter->second;
+	idleConnection.ConnectionHandle = connectionHandle;
+	idleConnection.IdleSinceTicks = ::GetTickCount();
+	fLeasedConnections.erase(leasedIter);
+	fIdleConnections.push_front(idleConnection);
+
+	// Enforce the per-origin limit, dropping that origin's least recently used handles.
+	int originCount = 0;
+	IdleConnectionList::iterator iter = fIdleConnections.begin();
+	while (iter != fIdleConnections.end())
+	{
+		if ((iter->OriginKey == idleConnection.OriginKey) && (++originCount > fMaxIdleConnectionsPerHost))
+		{
+			::WinHttpCloseHandle(iter->ConnectionHandle);
+			iter = fIdleConnections.erase(iter);
+		}
+		else
+		{
+			iter++;
+		}
+	}
+
+	// Enforce the overall limit, dropping the least recently used handles.
+	while ((int)fIdleConnections.size() > fMaxIdleConnections)
+	{
+		::WinHttpCloseHandle(fIdleConnections.back().ConnectionHandle);
+		fIdleConnections.pop_back();
+	}
+}
+
+/// Closes idle connection handles that have not been used within the idle timeout.
+/// Expected to be called at regular intervals.
+void WinHttpConnectionPool::PruneIdleConnections()
+{
+	DWORD currentTicks = ::GetTickCount();
+	while (!fIdleConnections.empty() &&
+		   (WinTimer::GetTickDelta(currentTicks, fIdleConnections.back().IdleSinceTicks) > (long)fIdleTimeoutInMilliseconds))
+	{
+		debug("Closing idle connection handle");
+		::WinHttpCloseHandle(fIdleConnections.back().ConnectionHandle);
+		fIdleConnections.pop_back();
+	}
+}
+
+/// Closes all idle connection handles.
+void WinHttpConnectionPool::CloseIdleConnections()
+{
+	IdleConnectionList::iterator iter;
+	for (iter = fIdleConnections.begin(); iter != fIdleConnections.end(); iter++)
+	{
+		::WinHttpCloseHandle(iter->ConnectionHandle);
+	}
+	fIdleConnections.clear();
+}
+
+/// Determines if any connection handles are idle, waiting to be leased again or closed by PruneIdleConnections().
+bool WinHttpConnectionPool::HasIdleConnections()
+{
+	return !fIdleConnections.empty();
+}
+
+/// Gets the time after which an idle connection handle is closed.
+DWORD WinHttpConnectionPool::GetIdleTimeout()
+{
+	return fIdleTimeoutInMilliseconds;
+}
+
+/// Records whether a request was served over a connection WinHttp already had open.
+void WinHttpConnectionPool::RecordRequest( bool wasConnectionReused )
+{
+	if (wasConnectionReused)
+	{
+		fHitCount++;
+	}
+	else
+	{
+		fMissCount++;
+	}
+	debug("Connection pool: %lu hits, %lu misses", fHitCount, fMissCount);
+}
+
+/// Gets the number of requests that reused an open connection.
+unsigned long WinHttpConnectionPool::GetHitCount()
+{
+	return fHitCount;
+}
+
+/// Gets the number of requests that had to open a new connection.
+unsigned long WinHttpConnectionPool::GetMissCount()
+{
+	return fMissCount;
+}
+
+void WinHttpConnectionPool::SetMaxIdleConnections( int count )
+{
+	fMaxIdleConnections = count;
+}
+
+void WinHttpConnectionPool::SetMaxIdleConnectionsPerHost( int count )
+{
+	fMaxIdleConnectionsPerHost = count;
+}
+
+void WinHttpConnectionPool::SetIdleTimeout( DWORD milliseconds )
+{
+	fIdleTimeoutInMilliseconds = milliseconds;
+}
+
+void WinHttpConnectionPool::SetMaxConnectionsPerHost( DWORD count )
+{
+	fMaxConnectionsPerHost = count;
+	ApplyConnectionLimits();
+}
+
+#pragma endregion
+
+
+#pragma region Private Functions
+/// Builds the key identifying an origin (scheme, host and port).
+std::wstring WinHttpConnectionPool::GetOriginKey( const std::wstring& hostName, INTERNET_PORT port, bool isHttps )
+{
+	wchar_t portText[16];
+	_snwprintf_s(portText, _countof(portText), _TRUNCATE, L":%u", (unsigned int)port);
+
+	std::wstring originKey = isHttps ? L"https://" : L"http://";
+	originKey += hostName;
+	originKey += portText;
+	return originKey;
+}
+
+/// Applies the per-server connection limit to the session, if it is open.
+void WinHttpConnectionPool::ApplyConnectionLimits()
+{
+	if (NULL == fSessionHandle)
+	{
+		return;
+	}
+
+	DWORD maxConnections = fMaxConnectionsPerHost;
+	if (!::WinHttpSetOption(fSessionHandle, WINHTTP_OPTION_MAX_CONNS_PER_SERVER, &maxConnections, sizeof(maxConnections)))
+	{
+		debug("Failed to set WINHTTP_OPTION_MAX_CONNS_PER_SERVER (%u)", ::GetLastError());
+	}
+	if (!::WinHttpSetOption(fSessionHandle, WINHTTP_OPTION_MAX_CONNS_PER_1_0_SERVER, &maxConnections, sizeof(maxConnections)))
+	{
+		debug("Failed to set WINHTTP_OPTION_MAX_CONNS_PER_1_0_SERVER (%u)", ::GetLastError());
+	}
+}
+
+#pragma endregion
@@ -0,0 +1,109 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md 
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef _WinHttpConnectionPool_H_
+#define _WinHttpConnectionPool_H_
+
+#include <windows.h>
+#include <WinHttp.h>
+
+#include <list>
+#include <map>
+#include <string>
+
+/// Maximum number of idle connection handles kept by the pool across all origins.
+#ifndef WINHTTP_POOL_MAX_IDLE_CONNECTIONS
+#define WINHTTP_POOL_MAX_IDLE_CONNECTIONS 32
+#endif
+
+/// Maximum number of idle connection handles kept by the pool for a single origin.
+#ifndef WINHTTP_POOL_MAX_IDLE_CONNECTIONS_PER_HOST
+#define WINHTTP_POOL_MAX_IDLE_CONNECTIONS_PER_HOST 4
+#endif
+
+/// Idle connection handles unused for longer than this are closed.
+#ifndef WINHTTP_POOL_IDLE_TIMEOUT_MS
+#define WINHTTP_POOL_IDLE_TIMEOUT_MS 60000
+#endif
+
+/// Maximum number of simultaneous sockets WinHttp opens to a single server. Requests beyond
+/// this limit are queued by WinHttp until a connection frees up.
+#ifndef WINHTTP_POOL_MAX_CONNECTIONS_PER_HOST
+#define WINHTTP_POOL_MAX_CONNECTIONS_PER_HOST 16
+#endif
+
+
+/// Owns the WinHttp session shared by all request operations of a WinHttpRequestManager, along with
+/// the connection handles (one per scheme/host/port origin) that requests are opened on.
+///
+/// Because every request runs in the same session, WinHttp keeps the sockets it opens alive between
+/// requests and hands them to the next request for the same server, saving the TCP (and TLS) handshake.
+/// Connection handles are leased to one request at a time and returned to an idle list afterwards,
+/// bounded by total idle count, idle count per origin, and idle time.
+///
+/// Only to be used from the main thread.
+class WinHttpConnectionPool
+{
+public:
+	WinHttpConnectionPool();
+	virtual ~WinHttpConnectionPool();
+
+	HINTERNET GetSessionHandle( WINHTTP_STATUS_CALLBACK statusCallback );
+	HINTERNET AcquireConnection( const std::wstring& hostName, INTERNET_PORT port, bool isHttps );
+	void ReleaseConnection( HINTERNET connectionHandle );
+	void PruneIdleConnections();
+	void CloseIdleConnections();
+	bool HasIdleConnections();
+	DWORD GetIdleTimeout();
+
+	void RecordRequest( bool wasConnectionReused );
+	unsigned long GetHitCount();
+	unsigned long GetMissCount();
+
+	void SetMaxIdleConnections( int count );
+	void SetMaxIdleConnectionsPerHost( int count );
+	void SetIdleTimeout( DWORD milliseconds );
+	void SetMaxConnectionsPerHost( DWORD count );
+
+private:
+	/// A connection handle waiting to be leased again.
+	struct IdleConnection
+	{
+		std::wstring OriginKey;
+		HINTERNET ConnectionHandle;
+		DWORD IdleSinceTicks;
+	};
+
+	/// Typedef for the idle list, most recently released first.
+	typedef std::list<IdleConnection> IdleConnectionList;
+
+	/// Typedef for the origin of every connection handle currently leased to a request.
+	typedef std::map<HINTERNET, std::wstring> LeasedConnectionMap;
+
+	/// The handle returned by the WinHttpOpen() function.
+	HINTERNET fSessionHandle;
+
+	IdleConnectionList fIdleConnections;
+	LeasedConnectionMap fLeasedConnections;
+
+	int fMaxIdleConnections;
+	int fMaxIdleConnectionsPerHost;
+	DWORD fIdleTimeoutInMilliseconds;
+	DWORD fMaxConnectionsPerHost;
+
+	/// Requests that were served over a connection WinHttp already had open (hits), or that
+	/// needed a new connection (misses).
+	unsigned long fHitCount;
+	unsigned long fMissCount;
+
+	static std::wstring GetOriginKey( const std::wstring& hostName, INTERNET_PORT port, bool isHttps );
+	void ApplyConnectionLimits();
+};
+
+#endif
@@ -0,0 +1,82 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "WinHttpEventQueue.h"
+#include "WinTimer.h"
+
+
+#pragma region Constructors and Destructors
+/// Creates a new, empty event queue.
+/// @param wakeTarget Timer to wake whenever an event is posted to an empty queue. Can be NULL.
+WinHttpEventQueue::WinHttpEventQueue( WinTimer *wakeTarget )
+{
+	fHead = NULL;
+	fWakeTarget = wakeTarget;
+}
+
+/// Deletes any events that were never popped.
+WinHttpEventQueue::~WinHttpEventQueue()
+{
+	WinHttpRequestEvent* event = PopAll();
+	while (event)
+	{
+		WinHttpRequestEvent* nextEvent = event->Next;
+		delete event;
+		event = nextEvent;
+	}
+}
+
+#pragma endregion
+
+
+#pragma region Public Functions
+/// Adds an event to the queue. Can be called from any thread.
+/// @param event The event to post. The queue takes ownership of it.
+void WinHttpEventQueue::Post( WinHttpRequestEvent *event )
+{
+	WinHttpRequestEvent* head;
+	do
+	{
+		head = fHead;
+		event->Next = head;
+	} while (::InterlockedCompareExchangePointer((PVOID volatile*)&fHead, event, head) != head);
+
+	// Only the first event posted after the main thread drained the queue needs to wake it.
+	if ((NULL == head) && fWakeTarget)
+	{
+		fWakeTarget->Wake();
+	}
+}
+
+/// Removes all events from the queue. Only to be called from the main thread.
+/// @return Returns the removed events in the order they were posted, linked by their "Next" fields.
+///         The caller owns the events and must delete them. Returns NULL if the queue is empty.
+WinHttpRequestEvent* WinHttpEventQueue::PopAll()
+{
+	WinHttpRequestEvent* event = (WinHttpRequestEvent*)::InterlockedExchangePointer((PVOID volatile*)&fHead, NULL);
+
+	// Reverse the newest-first chain into posting order.
+	WinHttpRequestEvent* firstEvent = NULL;
+	while (event)
+	{
+		WinHttpRequestEvent* nextEvent = event->Next;
+		event->Next = firstEvent;
+		firstEvent = event;
+		event = nextEvent;
+	}
+	return firstEvent;
+}
+
+/// Determines if there are any events waiting to be popped.
+bool WinHttpEventQueue::IsEmpty()
+{
+	return (NULL == ::InterlockedCompareExchangePointer((PVOID volatile*)&fHead, NULL, NULL));
+}
+
+#pragma endregion
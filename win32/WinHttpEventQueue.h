@@ -0,0 +1,115 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of the Corona game engine.
+// For overview and more information on licensing please refer to README.md
+// Home page: https://github.com/coronalabs/corona
+// Contact: support@coronalabs.com
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef _WinHttpEventQueue_H_
+#define _WinHttpEventQueue_H_
+
+#include <windows.h>
+
+#include "WinHttpRequestError.h"
+
+#include "WindowsNetworkSupport.h"
+
+struct WinHttpAsyncRequestSessionData;
+class WinTimer;
+
+
+/// Types of events posted by the WinHttp callback thread for the main thread to process.
+typedef enum
+{
+	/// The response status code and headers have been received.
+	kWinHttpRequestEventHeaders,
+
+	/// "Value" bytes of response body have been copied into the session's receive buffer.
+	kWinHttpRequestEventData,
+
+	/// "Value" bytes of response body have been written to the session's download file.
+	kWinHttpRequestEventDataWritten,
+
+	/// "Value" is the total number of request body bytes sent so far.
+	kWinHttpRequestEventUploadProgress,
+
+	/// The request operation has ended, with the error given by "Error".
+	kWinHttpRequestEventEnded,
+
+	/// WinHttp has closed the request handle and will not use the session data again.
+	kWinHttpRequestEventHandleClosed
+
+} WinHttpRequestEventType;
+
+/// One event for the main thread, allocated by the posting thread and deleted by the main thread.
+struct WinHttpRequestEvent
+{
+	WinHttpRequestEventType Type;
+
+	/// The session of the request this event belongs to.
+	WinHttpAsyncRequestSessionData* Session;
+
+	/// The session's "RequestId" at the time the event was posted. Used to drop events posted for a
+	/// request that has since completed.
+	DWORD RequestId;
+
+	/// Byte count for data, data written and upload progress events, status code for header events. Upload progress
+	/// is counted over the whole request body, which may be over 4 GB.
+	long long Value;
+
+	/// Number of bytes written to the download file for data written events, which differs from the number of bytes
+	/// received ("Value") when the response body is decoded. For upload progress events, the number of request body
+	/// bytes sent, which differs from the number of bytes written ("Value") when the request body is compressed.
+	long long DecodedValue;
+
+	/// Error for ended events.
+	WinHttpRequestError Error;
+
+	/// Raw response headers for header events.
+	UTF8String Headers;
+
+	/// Set for header events if WinHttp opened a new socket for the request.
+	bool IsNewConnection;
+
+	/// Next event in the queue.
+	WinHttpRequestEvent* Next;
+
+	WinHttpRequestEvent()
+	:	Type( kWinHttpRequestEventEnded ),
+		Session( NULL ),
+		RequestId( 0 ),
+		Value( 0 ),
+		DecodedValue( 0 ),
+		Error( kWinHttpRequestErrorNone ),
+		IsNewConnection( false ),
+		Next( NULL )
+	{
+	}
+};
+
+
+/// Lock-free multiple producer, single consumer queue of WinHttpRequestEvent objects.
+///
+/// Any thread may Post() events. Only the main thread may call PopAll(). When an event is posted to an
+/// empty queue, the given WinTimer is woken so that the main thread drains the queue on its next message,
+/// meaning the main thread does no work while there are no events.
+class WinHttpEventQueue
+{
+public:
+	WinHttpEventQueue( WinTimer *wakeTarget );
+	virtual ~WinHttpEventQueue();
+
+	void Post( WinHttpRequestEvent *event );
+	WinHttpRequestEvent* PopAll();
+	bool IsEmpty();
+
+private:
+	/// Most recently posted event. Events are linked newest to oldest until popped.
+	WinHttpRequestEvent* volatile fHead;
+
+	WinTimer* fWakeTarget;
+};
+
+#endif
@@ -16,13 +16,22 @@
 #pragma region Constructors and Destructors
 /// Creates a new manager object for handling concurrent async HTTP requests.
 WinHttpRequestManager::WinHttpRequestManager()
+:	fEventQueue( this )
 {
 	fIsProcessingRequests = false;
+
+	// OnTimer() is invoked whenever an event is posted to the queue. The only periodic work is closing idle
+	// connections and polling streamed request bodies, which UpdateTimerInterval() schedules while there are any.
+	SetInterval(INFINITE);
 }
 
 /// Destructor. Destroys this object and aborts any active HTTP requests.
 WinHttpRequestManager::~WinHttpRequestManager()
 {
+	Stop();
+	AbortAllRequests();
+	ProcessRequestsUntil(5000);
+	fRequestSlots.Clear();
 }
 
 #pragma endregion
@@ -32,57 +41,61 @@ WinHttpRequestManager::~WinHttpRequestManager()
 
 RequestCanceller* WinHttpRequestManager::SendNetworkRequest( NetworkRequestParameters *requestParams )
 {
-	WinHttpRequestOperationList::iterator iter;
-	std::shared_ptr<WinHttpRequestOperation> requestPointer;
+	// A download split over several connections is driven by an object of its own, which makes the requests for it.
+	if (SegmentedDownload::isRequestSegmentable(requestParams))
+	{
+		std::shared_ptr<SegmentedDownload> download = std::make_shared<SegmentedDownload>(requestParams);
+		fSegmentedDownloads.push_back(download);
+		RequestCanceller* requestCanceller = download->Start(download);
+		SendSegmentedDownloadRequests(download);
+		return requestCanceller;
+	}
 
-	// Check if this object's list contains any inactive request objects that we can re-use.
-	// Each request object is at least 8 KB (due to its receive buffer). So, try to be memory efficient.
-	for (iter = fRequests.begin(); iter != fRequests.end(); iter++)
+	// A request for a small response that is in memory and still fresh needs neither an operation nor any I/O.
+	// It is answered on the next update, as the listener is never called from within network.request().
+	HttpMemoryResponseCache::Entry cacheEntry;
+	if (fMemoryCache.find(requestParams, &cacheEntry))
 	{
-		if ((*iter)->IsExecuting() == false)
-		{
-			*iter = std::make_shared<WinHttpRequestOperation>();
-			requestPointer = *iter;
-			break;
-		}
+		debug("Serving fresh response from memory cache");
+		std::shared_ptr<HttpMemoryResponseCache::Delivery> delivery = std::make_shared<HttpMemoryResponseCache::Delivery>(requestParams, cacheEntry);
+		fPendingDeliveries.push_back(delivery);
+		Wake();
+		return delivery->Start(delivery);
 	}
 
-	// If there are no request objects that we can re-use, then create a new one and add it to the list.
-	if (NULL == requestPointer)
+	// An identical request in flight answers this one too. Its events are dispatched to this request's listener
+	// with this request's own requestId.
+	if (CoalescedRequest::isRequestCoalescable(requestParams))
 	{
-		fRequests.push_back(std::make_shared<WinHttpRequestOperation>());
-		requestPointer = fRequests.back();
+		HttpRequestOperation::CoalescingMap::iterator iter = fCoalescingMap.find(CoalescedRequest::getKey(requestParams));
+		if (iter != fCoalescingMap.end())
+		{
+			std::shared_ptr<HttpRequestOperation> operation = iter->second.lock();
+			RequestCanceller* requestCanceller = operation ? operation->CoalesceRequest(requestParams, iter->first, operation) : NULL;
+			if (NULL != requestCanceller)
+			{
+				return requestCanceller;
+			}
+		}
 	}
 
-	// Execute HTTP request.
-	return requestPointer->ExecuteRequest( requestParams, requestPointer );
+	return ScheduleRequest(requestParams);
 }
 
 /// Gets the number of concurrent HTTP requests that are currently being executed by this object.
 /// @return The number of HTTP requests being exected. Returns zero if there are no active requests.
 int WinHttpRequestManager::ActiveRequestCount()
 {
-	WinHttpRequestOperationList::iterator iter;
-	int count = 0;
-
-	for (iter = fRequests.begin(); iter != fRequests.end(); iter++)
-	{
-		if ((*iter)->IsExecuting())
-		{
-			count++;
-		}
-	}
-	return count;
+	return fRequestSlots.GetActiveCount() + fScheduler.getQueuedCount() + (int)fPendingDeliveries.size() +
+		(int)fSegmentedDownloads.size();
 }
 
-/// Polls all active HTTP requests to see if they have completed their work.
-/// This function is expected to be called at regular intervals). It polls every asynchronous
-/// HTTP request, synchs their data to the main thread, checks if request operation have completed,
-/// and invokes LuaResource listeners if assigned.
+/// Processes the events posted by WinHttp since the last call. Each event is applied to its request,
+/// which synchs its data to the main thread, checks if the request operation has completed, and invokes
+/// LuaResource listeners if assigned. Requests without events are not touched.
 void WinHttpRequestManager::ProcessRequests()
 {
-	WinHttpRequestOperationList::iterator iter;
-	int index;
+	WinHttpRequestEvent* event;
 
 	// Do not continue if this function is in the middle of processing requests.
 	// This can happen if a processed request has ended whose Lua listener calls this function again.
@@ -94,52 +107,50 @@ void WinHttpRequestManager::ProcessRequests()
 	// Flag that we're processing requests.
 	fIsProcessingRequests = true;
 
-	// Copy requests to be processed to a temporary list. This is to prevent a race condition where
-	// a processed requests that finishes, invokes a Lua listener, and which then attempts to send
-	// another HTTP request won't break the STL list's iterator.
-	for (iter = fRequests.begin(), index = 0; iter != fRequests.end(); iter++, index++)
-	{
-		if (index < (int)fTemporaryRequestList.size())
-		{
-			WinHttpRequestOperationList::iterator tempIter;
-			int tempIndex;
-			for (tempIter = fTemporaryRequestList.begin(), tempIndex = 0;
-				 tempIter != fTemporaryRequestList.end(); tempIter++, tempIndex++)
-			{
-				if (tempIndex == index)
-				{
-					*tempIter = *iter;
-					break;
-				}
-			}
-		}
-		else
-		{
-			fTemporaryRequestList.push_back(*iter);
-		}
-	}
-	while (fTemporaryRequestList.size() > fRequests.size())
+	// Take all pending events at once. Events posted while we process these (including by requests
+	// sent from Lua listeners) wake the timer again and are handled on the next call.
+	event = fEventQueue.PopAll();
+	while (event)
 	{
-		fTemporaryRequestList.pop_back();
+		WinHttpRequestEvent* nextEvent = event->Next;
+		WinHttpRequestOperation* operation = event->Session->Owner;
+
+		operation->HandleEvent(*event);
+		UpdateRequestSlot(operation);
+
+		delete event;
+		event = nextEvent;
 	}
 
-	// Process all requests that were copied into the temporary list. This makes it race condition proof.
-	for (iter = fTemporaryRequestList.begin(); iter != fTemporaryRequestList.end(); iter++)
+	// Streamed request bodies whose source had nothing ready get no events until their next chunks are written,
+	// so they are given a pass of their own to read their source again.
+	ProcessWaitingRequestBodies();
+
+	// Start the queued requests that fit in the room left by the requests that ended.
+	StartQueuedRequests();
+
+	// Move the segmented downloads on, now that their requests have processed their events.
+	ProcessSegmentedDownloads();
+
+	// Deliver the responses found in the memory cache since the last call. Requests answered from it by the
+	// listeners called here are delivered by the next call.
+	if (!fPendingDeliveries.empty())
 	{
-		if (*iter != NULL)
+		HttpMemoryResponseCache::DeliveryList deliveries;
+		deliveries.swap(fPendingDeliveries);
+		for (HttpMemoryResponseCache::DeliveryList::iterator iter = deliveries.begin(); iter != deliveries.end(); iter++)
 		{
-			(*iter)->ProcessExecution();
+			(*iter)->Deliver();
 		}
 	}
 
 	// Finished processing requests. Clearing this flag allows this function to be called again.
 	fIsProcessingRequests = false;
+
+	UpdateTimerInterval();
 }
 
-/// Blocking call which polls all active HTTP requests to see if they have completed their work.
-/// This function is expected to be called at regular intervals). It polls every asynchronous
-/// HTTP request, synchs their data to the main thread, checks if request operation have completed,
-/// and invokes LuaResource listeners if assigned.
+/// Blocking call which processes request events until all active HTTP requests have completed their work.
 /// @param timeoutInMilliseconds The maximum amount of time to process all active HTTP requests.
 void WinHttpRequestManager::ProcessRequestsUntil(int timeoutInMilliseconds)
 {
@@ -147,6 +158,10 @@ void WinHttpRequestManager::ProcessRequestsUntil(int timeoutInMilliseconds)
 	do
 	{
 		ProcessRequests();
+		if ((ActiveRequestCount() > 0) && fEventQueue.IsEmpty())
+		{
+			::Sleep(1);
+		}
 	} while (((endTime - (int)::GetTickCount()) > 0) && (ActiveRequestCount() > 0));
 }
 
@@ -155,9 +170,20 @@ void WinHttpRequestManager::ProcessRequestsUntil(int timeoutInMilliseconds)
 /// call the ProcessRequests() function repeatedly to process the abort.
 void WinHttpRequestManager::AbortAllRequests()
 {
-	WinHttpRequestOperationList::iterator iter;
+	WinHttpRequestOperationSlotTable::Slot* slot;
+
+	// Queued requests are dropped first, so that none starts as the active ones end.
+	fScheduler.dropAll();
+	for (SegmentedDownload::List::iterator iter = fSegmentedDownloads.begin(); iter != fSegmentedDownloads.end(); iter++)
+	{
+		(*iter)->RequestAbort();
+	}
 
-	for (iter = fRequests.begin(); iter != fRequests.end(); iter++)
+	for (slot = fRequestSlots.GetFirstActiveSlot(); slot != NULL; slot = slot->Next)
+	{
+		slot->Operation->RequestAbort();
+	}
+	for (HttpMemoryResponseCache::DeliveryList::iterator iter = fPendingDeliveries.begin(); iter != fPendingDeliveries.end(); iter++)
 	{
 		(*iter)->RequestAbort();
 	}
@@ -166,6 +192,172 @@ void WinHttpRequestManager::AbortAllRequests()
 void WinHttpRequestManager::OnTimer()
 {
 	ProcessRequests();
+	fConnectionPool.PruneIdleConnections();
+	UpdateTimerInterval();
+}
+
+/// Gets the pool providing the shared WinHttp session and connection handles, along with
+/// its connection reuse hit/miss counters.
+WinHttpConnectionPool& WinHttpRequestManager::GetConnectionPool()
+{
+	return fConnectionPool;
+}
+
+/// Gets the cache of small responses that are answered without a request operation, whose size can be changed.
+HttpMemoryResponseCache& WinHttpRequestManager::GetMemoryCache()
+{
+	return fMemoryCache;
+}
+
+/// Sets how many requests may be executed at once, in all and per host. Queued requests that now fit are started.
+void WinHttpRequestManager::SetRequestLimits(int maxActiveRequests, int maxActiveRequestsPerHost)
+{
+	fScheduler.setLimits(maxActiveRequests, maxActiveRequestsPerHost);
+	StartQueuedRequests();
+}
+
+#pragma endregion
+
+
+#pragma region Private Functions
+/// Gets an operation to execute a request on: the most recently idled one, or a new one.
+std::shared_ptr<WinHttpRequestOperation> WinHttpRequestManager::AcquireRequestOperation()
+{
+	// Take the most recently idled slot (or a new one) and move it to the active list.
+	WinHttpRequestOperationSlotTable::Slot* slot = fRequestSlots.AcquireSlot();
+
+	// Re-use the slot's operation object unless something else still references it, such as a RequestCanceller
+	// held by Lua for an earlier request. That reference must not be able to cancel the new request.
+	if ((NULL == slot->Operation) || (slot->Operation.use_count() > 1))
+	{
+		if (slot->Operation)
+		{
+			slot->Operation->SetSlot(NULL);
+		}
+		slot->Operation = std::make_shared<WinHttpRequestOperation>(&fConnectionPool, &fEventQueue, &fResponseCache, &fMemoryCache, &fCoalescingMap);
+		slot->Operation->SetSlot(slot);
+	}
+	return slot->Operation;
+}
+
+/// Executes the given request, or queues it if the scheduler's limits on active requests are reached.
+/// @return Returns the request's canceller.
+RequestCanceller* WinHttpRequestManager::ScheduleRequest( NetworkRequestParameters *requestParams )
+{
+	// Requests wait in the scheduler's queues while the limits on active requests are reached, and behind any
+	// requests already waiting, which go first.
+	if (fScheduler.hasQueuedRequests() || !fScheduler.canStart(requestParams))
+	{
+		RequestCanceller* requestCanceller = fScheduler.enqueue(requestParams);
+		StartQueuedRequests();
+		return requestCanceller;
+	}
+
+	// Execute HTTP request.
+	std::shared_ptr<WinHttpRequestOperation> requestPointer = AcquireRequestOperation();
+	fScheduler.requestStarted(requestPointer.get(), requestParams);
+	return requestPointer->ExecuteRequest( requestParams, requestPointer );
+}
+
+/// Starts the queued requests that the scheduler's limits let through, in order.
+void WinHttpRequestManager::StartQueuedRequests()
+{
+	std::shared_ptr<RequestScheduler::QueuedRequest> queuedRequest;
+	while ((queuedRequest = fScheduler.dequeue()) != NULL)
+	{
+		std::shared_ptr<WinHttpRequestOperation> requestPointer = AcquireRequestOperation();
+		NetworkRequestParameters* requestParams = queuedRequest->TakeRequestParams(requestPointer);
+		fScheduler.requestStarted(requestPointer.get(), requestParams);
+		requestPointer->ExecuteRequest( requestParams, requestPointer, queuedRequest->GetRequestCanceller() );
+		queuedRequest->Started();
+	}
+}
+
+/// Sends the requests the given segmented download has to make, through the scheduler like any others.
+void WinHttpRequestManager::SendSegmentedDownloadRequests( const std::shared_ptr<SegmentedDownload>& download )
+{
+	NetworkRequestParameters* requestParams;
+	while ((requestParams = download->TakeRequestParams()) != NULL)
+	{
+		download->RequestSent( ScheduleRequest(requestParams) );
+	}
+}
+
+/// Releases the slot of an operation that has just been processed if its request has ended. Otherwise puts it on
+/// the slot table's waiting list if its streamed body is waiting on its source (see
+/// WinHttpRequestOperation::IsWaitingForRequestBody()), or takes it off.
+void WinHttpRequestManager::UpdateRequestSlot( WinHttpRequestOperation* operation )
+{
+	if (!operation->IsExecuting())
+	{
+		fScheduler.requestEnded(operation);
+		fRequestSlots.ReleaseSlot(operation->GetSlot());
+	}
+	else
+	{
+		fRequestSlots.SetSlotWaiting(operation->GetSlot(), operation->IsWaitingForRequestBody());
+	}
+}
+
+/// Processes the requests on the slot table's waiting list, whose streamed body writes its next chunks if its
+/// source has any ready now. Other requests are not touched.
+void WinHttpRequestManager::ProcessWaitingRequestBodies()
+{
+	WinHttpRequestOperationSlotTable::Slot* slot = fRequestSlots.GetFirstWaitingSlot();
+	while (slot)
+	{
+		WinHttpRequestOperationSlotTable::Slot* nextSlot = slot->WaitingNext;
+		std::shared_ptr<WinHttpRequestOperation> operation = slot->Operation;
+		if (operation->IsWaitingForRequestBody())
+		{
+			operation->ProcessExecution();
+		}
+		UpdateRequestSlot(operation.get());
+		slot = nextSlot;
+	}
+}
+
+/// Has OnTimer() invoked at the pool's idle timeout for as long as there are requests or idle connections, so that
+/// idle connections are closed even once no more events come. With neither, it is only invoked by events. While a
+/// streamed request body waits on its source, it is invoked every WINHTTP_REQUEST_BODY_POLL_INTERVAL_MS instead.
+void WinHttpRequestManager::UpdateTimerInterval()
+{
+	if (fRequestSlots.GetWaitingCount() > 0)
+	{
+		SetInterval(WINHTTP_REQUEST_BODY_POLL_INTERVAL_MS);
+	}
+	else if ((ActiveRequestCount() > 0) || fConnectionPool.HasIdleConnections())
+	{
+		SetInterval(fConnectionPool.GetIdleTimeout());
+	}
+	else
+	{
+		SetInterval(INFINITE);
+	}
+}
+
+/// Processes the segmented downloads, sending the requests they make and releasing those that have ended. A
+/// download started by a listener called here is first processed by the next call.
+void WinHttpRequestManager::ProcessSegmentedDownloads()
+{
+	size_t count = fSegmentedDownloads.size();
+	for (size_t index = 0; index < count; index++)
+	{
+		std::shared_ptr<SegmentedDownload> download = fSegmentedDownloads[index];
+		download->ProcessExecution();
+		SendSegmentedDownloadRequests(download);
+	}
+	for (SegmentedDownload::List::iterator iter = fSegmentedDownloads.begin(); iter != fSegmentedDownloads.end(); )
+	{
+		if ((*iter)->IsExecuting())
+		{
+			iter++;
+		}
+		else
+		{
+			iter = fSegmentedDownloads.erase(iter);
+		}
+	}
 }
 
 #pragma endregion
@@ -14,16 +14,29 @@
 
 #include "WinTimer.h"
 
+#include "WinHttpConnectionPool.h"
+#include "WinHttpEventQueue.h"
 #include "WinHttpRequestOperation.h"
+#include "HttpMemoryResponseCache.h"
+#include "RequestScheduler.h"
+#include "SegmentedDownload.h"
 
+#include "RequestSlotTable.h"
 #include "WindowsNetworkSupport.h"
 
-#include <list>
 #include <memory>
 
+/// How often a streamed request body (params.body = function) whose source had nothing ready is read again.
+#ifndef WINHTTP_REQUEST_BODY_POLL_INTERVAL_MS
+#define WINHTTP_REQUEST_BODY_POLL_INTERVAL_MS 10
+#endif
+
 
 /// Class supporting concurrent asynchronous HTTP requests.
 /// Can set up a LuaResource listener to notify a Lua script the result of this operation.
+///
+/// Requests are processed on the main thread only when WinHttp has posted events for them, or while their streamed
+/// body waits on its source. Otherwise the timer only runs to close idle connections.
 class WinHttpRequestManager : public WinTimer
 {
 public:
@@ -37,20 +50,54 @@ public:
 	void ProcessRequestsUntil(int timeoutInMilliseconds);
 	void AbortAllRequests();
 	void OnTimer( );
+	WinHttpConnectionPool& GetConnectionPool();
+	HttpMemoryResponseCache& GetMemoryCache();
+	void SetRequestLimits(int maxActiveRequests, int maxActiveRequestsPerHost);
 
 private:
-	/// Typedef for a WinHttpRequestOperation STL list.
-	typedef std::list< std::shared_ptr<WinHttpRequestOperation> > WinHttpRequestOperationList;
+	/// Typedef for the table of request operation slots.
+	typedef RequestSlotTable<WinHttpRequestOperation> WinHttpRequestOperationSlotTable;
+
+	/// Shared WinHttp session and per-origin connection handles used by all requests.
+	/// Declared before the request slots so that it is destroyed after every request operation.
+	WinHttpConnectionPool fConnectionPool;
+
+	/// Events posted by the WinHttp callback thread for this manager's requests. Posting to an empty
+	/// queue wakes this timer, which is otherwise idle.
+	WinHttpEventQueue fEventQueue;
+
+	/// Disk cache of responses to requests made with params.cache, opened by the first such request.
+	HttpResponseCache fResponseCache;
 
-	/// Collection of HTTP request operations.
-	WinHttpRequestOperationList fRequests;
+	/// Small fresh responses to requests made with params.cache, which are answered without a request operation.
+	/// The requests answered since the last update are delivered by the next one.
+	HttpMemoryResponseCache fMemoryCache;
+	HttpMemoryResponseCache::DeliveryList fPendingDeliveries;
 
-	/// Collection used to temporarily store all requests to be processed by the ProcessRequests() function.
-	/// This member variable is to only be used by the ProcessRequests() function.
-	WinHttpRequestOperationList fTemporaryRequestList;
+	/// Decides when each request is executed, queueing those over the limits on active requests.
+	RequestScheduler fScheduler;
+
+	/// Downloads split over several connections, which make their requests through the scheduler.
+	SegmentedDownload::List fSegmentedDownloads;
+
+	/// The operations in flight that identical requests are coalesced onto, by request key. Declared before the
+	/// request slots, since the operations leave it when they are destroyed.
+	HttpRequestOperation::CoalescingMap fCoalescingMap;
+
+	/// Slots holding this manager's HTTP request operations, split into active and idle lists.
+	WinHttpRequestOperationSlotTable fRequestSlots;
 
 	/// Set true if in the middle of processing requests.
 	bool fIsProcessingRequests;
+
+	std::shared_ptr<WinHttpRequestOperation> AcquireRequestOperation();
+	RequestCanceller* ScheduleRequest( NetworkRequestParameters *requestParams );
+	void StartQueuedRequests();
+	void SendSegmentedDownloadRequests( const std::shared_ptr<SegmentedDownload>& download );
+	void ProcessSegmentedDownloads();
+	void UpdateRequestSlot( WinHttpRequestOperation* operation );
+	void ProcessWaitingRequestBodies();
+	void UpdateTimerInterval();
 };
 
 #endif
@@ -12,39 +12,50 @@
 #include "WinHttpRequestOperation.h"
 #include "WindowsNetworkSupport.h"
 #include "CharsetTranscoder.h"
+#include "MultipartBody.h"
+#include "RequestBodyStream.h"
 #include <Shlobj.h>
 
 
 #pragma region Constructors and Destructors
 /// Creates a new HTTP request operation object.
-WinHttpRequestOperation::WinHttpRequestOperation()
+/// @param connectionPool Pool providing the shared WinHttp session and connection handles. Must outlive this object.
+/// @param eventQueue Queue that this operation's WinHttp events are posted to. Must outlive this object.
+/// @param responseCache Disk cache used by requests made with params.cache. Must outlive this object.
+/// @param memoryCache Memory cache used by requests made with params.cache. Must outlive this object.
+/// @param coalescingMap The manager's map of operations that requests can be coalesced onto. Must outlive this object.
+WinHttpRequestOperation::WinHttpRequestOperation(WinHttpConnectionPool *connectionPool, WinHttpEventQueue *eventQueue, HttpResponseCache *responseCache, HttpMemoryResponseCache *memoryCache, CoalescingMap *coalescingMap)
+:	HttpRequestOperation( responseCache, memoryCache, coalescingMap )
 {
-	fDownloadFileStream = NULL;
-	fIsExecuting = false;
+	fConnectionPool = connectionPool;
+	fSlot = NULL;
+	fAsyncSession.Owner = this;
+	fAsyncSession.EventQueue = eventQueue;
+	fAsyncSession.RequestHandleClosedEvent = ::CreateEventW(NULL, TRUE, TRUE, NULL);
 	fAsyncSession.Reset();
 }
 
 /// Destroys the HTTP request operation object. If this object is currently executing a request
-/// operation, then this destructor will block while attempting to abort that operation.
+/// operation, then it is aborted, and this destructor blocks until WinHttp has released its request handle,
+/// since the callback thread may use this object's session data until then. The owning manager normally
+/// processes its events until that happens, so that this doesn't block.
 WinHttpRequestOperation::~WinHttpRequestOperation()
 {
-	// If currently executing a request, then abort it. Block for up to 5 seconds until abort completes.
-	// We need to do this to cleanup after the threaded WinHttp operation.
 	if (IsExecuting())
 	{
+		// Nothing will process events for this object anymore, so don't let the abort post any.
+		fAsyncSession.EventQueue = NULL;
 		RequestAbort();
-		ProcessExecutionUntil(5000);
 	}
 
-	// Close the WinHttp session (if ever established) and remove the callback.
-	// Only do this if we're not executing an async operation, otherwise we'll crash.
-	// Hopefully, the above abort will stop a pending async operation.
-	if (!IsExecuting() && fAsyncSession.SessionHandle)
+	// WinHttp always sends HANDLE_CLOSING once the request handle is closed, which the abort above has done.
+	if (fAsyncSession.RequestHandleClosedEvent)
 	{
-		::WinHttpSetStatusCallback(fAsyncSession.SessionHandle, NULL, WINHTTP_CALLBACK_FLAG_ALL_NOTIFICATIONS, NULL);
-		::WinHttpCloseHandle(fAsyncSession.SessionHandle);
-		fAsyncSession.SessionHandle = 0;
+		::WaitForSingleObject(fAsyncSession.RequestHandleClosedEvent, INFINITE);
+		::CloseHandle(fAsyncSession.RequestHandleClosedEvent);
 	}
+
+	// The WinHttp session is shared and owned by the connection pool, which closes it.
 }
 
 #pragma endregion
@@ -65,6 +76,25 @@ bool WinHttpRequestOperation::Execute()
 
 	// Initialize variables for a new HTTP request.
 	fIsExecuting = true;
+	fAsyncSession.RequestId++;
+	fAsyncSession.AllocateReceiveBuffers(fRequestParams->getReceiveBufferCount(), (DWORD)fRequestParams->getReceiveBufferSize());
+
+	// Pick the file the WinHttp thread downloads the response body to, if any. The thread writes a resumed
+	// download's partial file, or a segmented download's file, at the offset the response starts at.
+	SelectDownloadFile();
+	if (fResumableDownload.isOpen())
+	{
+		fAsyncSession.Resume = &fResumableDownload;
+	}
+	fAsyncSession.Segment = fDownloadSegment;
+	fAsyncSession.IsDecodingResponse = fRequestParams->isCompressionEnabled();
+
+	// A fresh stored response needs nothing from WinHttp, so the request ends right away (without an error).
+	if (FindCachedResponse())
+	{
+		fAsyncSession.HasAsyncOperationEnded = true;
+		return false;
+	}
 
 	// Get method...
 	const WCHAR* wideMethod = getWCHARs(fRequestParams->getRequestMethod());
@@ -107,28 +137,9 @@ bool WinHttpRequestOperation::Execute()
 
 	delete [] wideUrl;
 
-	// Create the WinHttp session handle if not done already.
-	// This session handle gets re-used on every call to Execute(). It is closed by the destructor.
-	if (0 == fAsyncSession.SessionHandle)
-	{
-		fAsyncSession.SessionHandle = ::WinHttpOpen(
-			NULL, 
-			WINHTTP_ACCESS_TYPE_DEFAULT_PROXY,
-			WINHTTP_NO_PROXY_NAME,
-			WINHTTP_NO_PROXY_BYPASS, 
-			WINHTTP_FLAG_ASYNC
-			);
-		if (fAsyncSession.SessionHandle)
-		{
-			::WinHttpSetStatusCallback(
-				fAsyncSession.SessionHandle,
-				WinHttpRequestOperation::OnAsyncWinHttpStatusChanged,
-				WINHTTP_CALLBACK_FLAG_ALL_NOTIFICATIONS, 
-				NULL
-				);
-		}
-	}
-	if (0 == fAsyncSession.SessionHandle)
+	// Fetch the WinHttp session shared by all requests. Sharing it lets WinHttp keep sockets alive between
+	// requests and reuse them for the next request to the same server.
+	if (NULL == fConnectionPool->GetSessionHandle(WinHttpRequestOperation::OnAsyncWinHttpStatusChanged))
 	{
 		// Unable to create a WinHttp session. Flag it as an internal error and give up.
 		fAsyncSession.ErrorResult = kWinHttpRequestErrorInternal;
@@ -136,20 +147,9 @@ bool WinHttpRequestOperation::Execute()
 		return false;
 	}
 
-	int timeoutMs = fRequestParams->getTimeout() * 1000;
-	if (!WinHttpSetTimeouts( fAsyncSession.SessionHandle, timeoutMs, timeoutMs, timeoutMs, timeoutMs ))
-	{
-		CORONA_LOG("Error setting WinHttp timeouts to %u ms", timeoutMs);
-	}
-
-	// Configure the connection to the server (provided by the URL).
+	// Lease a connection to the server (provided by the URL) from the pool.
 	// This does not actually establish a socket connection.
-	fAsyncSession.ConnectionHandle = ::WinHttpConnect(
-		fAsyncSession.SessionHandle,
-		hostName.c_str(),
-		port, 
-		0
-		);
+	fAsyncSession.ConnectionHandle = fConnectionPool->AcquireConnection(hostName, port, isHttps);
 	if (NULL == fAsyncSession.ConnectionHandle)
 	{
 		fAsyncSession.ErrorResult = GetRequestErrorFromWinHttpError(::GetLastError());
@@ -174,6 +174,30 @@ bool WinHttpRequestOperation::Execute()
 		return false;
 	}
 
+	// Associate the session data with the request handle now, rather than only via WinHttpSendRequest(), so that
+	// closing the handle always produces a HANDLE_CLOSING notification we can see, even if sending fails. Without
+	// it, nothing would tell us when WinHttp is done with the session, so the request can't go on.
+	::ResetEvent(fAsyncSession.RequestHandleClosedEvent);
+	DWORD_PTR contextValue = (DWORD_PTR)&fAsyncSession;
+	if (!::WinHttpSetOption(fAsyncSession.RequestHandle, WINHTTP_OPTION_CONTEXT_VALUE, &contextValue, sizeof(contextValue)))
+	{
+		DWORD errorCode = ::GetLastError();
+		debug("Failed to set WINHTTP_OPTION_CONTEXT_VALUE (%u)", errorCode);
+		fAsyncSession.ErrorResult = GetRequestErrorFromWinHttpError(errorCode);
+		fAsyncSession.HasAsyncOperationEnded = true;
+		::WinHttpCloseHandle(fAsyncSession.RequestHandle);
+		fAsyncSession.RequestHandle = 0;
+		::SetEvent(fAsyncSession.RequestHandleClosedEvent);
+		return false;
+	}
+
+	// Timeouts are set per request, since the session is shared with other requests.
+	int timeoutMs = fRequestParams->getTimeout() * 1000;
+	if (!WinHttpSetTimeouts( fAsyncSession.RequestHandle, timeoutMs, timeoutMs, timeoutMs, timeoutMs ))
+	{
+		CORONA_LOG("Error setting WinHttp timeouts to %u ms", timeoutMs);
+	}
+
 	if (! fRequestParams->getHandleRedirects())
 	{
 		DWORD redirectPolicy = WINHTTP_OPTION_REDIRECT_POLICY_NEVER;
@@ -206,70 +230,31 @@ bool WinHttpRequestOperation::Execute()
 	//
 	fAsyncSession.RequestBody = fRequestParams->getRequestBody();
 
-	// See if we have a "Content-Type" header.
+	// When we have a text string request body, we need to apply the charset encoding specified in the
+	// Content-Type header to it if not utf-8, which is the only time a body from a Lua string is copied.
 	//
 	// Note: We check for the presence of a Content-Type request header on param validation whenever a request body
-	// is specified, so we don't need worry about adding a default Content-Type header.
+	// is specified, so we don't need worry about adding a default Content-Type header. A text body's Content-Type
+	// always has a charset by now, as the params add "charset=UTF-8" if it had none.
 	//
-	UTF8String *contentTypeValue = fRequestParams->getRequestHeaderValue("Content-Type");
-	if (NULL != contentTypeValue)
+	if (!fRequestParams->transcodeRequestBody())
 	{
-		if ( TYPE_STRING == fAsyncSession.RequestBody->bodyType )
-		{
-			// When we have a text string request body, we need to analyze and charset encoding
-			// specified in the Content-Type header, and if not utf-8, we need to apply said encoding
-			// to the text string.
-			//
-			char *contentEncoding = getContentTypeEncoding( contentTypeValue->c_str() );
-			if ( NULL != contentEncoding )
-			{
-				debug("Got request content encoding of: %s", contentEncoding);
-
-				if ( 0 != _strcmpi( "utf-8", contentEncoding ) )
-				{
-					// Found content encoding other than utf-8
-					//
-					debug("Transcoding request body from utf-8 to %s", contentEncoding);
-					if (!CharsetTranscoder::transcode(fAsyncSession.RequestBody->bodyString, "utf-8", contentEncoding))
-					{
-						debug("Transcode failed");
-					}
-				}
-				free(contentEncoding);
-			}
-			else
-			{
-				// No charset provided, adding explicit UTF-8
-				contentTypeValue->append("; charset=UTF-8");
-			}
-		}
+		fAsyncSession.ErrorResult = kWinHttpRequestErrorInternal;
+		fAsyncSession.HasAsyncOperationEnded = true;
+		return false;
 	}
 
-	// Prepare the request headers for the request call.
+	// The request headers were serialized (and converted to UTF-16) once, when the params were validated.
 	//
-	std::wstring headers;
+	const std::wstring& headers = fRequestParams->getWideRequestHeaderString();
 
-	const WCHAR* wideHeaders = getWCHARs(fRequestParams->getRequestHeaderString());
-	if (NULL != wideHeaders)
-	{
-		headers = std::wstring(wideHeaders);
-		delete [] wideHeaders;
-	}
-
-	// If the body is from a file, we need to open it here...
+	// If the body is from a file, we need to open it here. The WinHttp thread writes it straight from the file's
+	// mapping, a window at a time.
 	//
 	if ( TYPE_FILE == fAsyncSession.RequestBody->bodyType )
 	{
-		wchar_t *utf16FullPath = NULL;
-		try
-		{
-			CoronaFileSpec* fileSpec = fAsyncSession.RequestBody->bodyFile;
-			utf16FullPath = CreateUtf16StringFrom(fileSpec->getFullPath().c_str());
-			::_wfopen_s(&fAsyncSession.UploadFileStream, utf16FullPath, L"rb+");
-		}
-		catch (...) { }
-		DestroyUtf16String(utf16FullPath);
-		if (NULL == fAsyncSession.UploadFileStream)
+		CoronaFileSpec* fileSpec = fAsyncSession.RequestBody->bodyFile;
+		if (!fAsyncSession.UploadFile.open(fileSpec->getFullPath()))
 		{
 			CORONA_LOG("Error opening request body file");
 			fAsyncSession.ErrorResult = kWinHttpRequestErrorInternal;
@@ -278,24 +263,97 @@ bool WinHttpRequestOperation::Execute()
 		}
 	}
 
-	// This will fail for files > 4Gb (which requires WinHttp 5.1 anyway).
-	fAsyncSession.RequestBodyBytesTotal = (DWORD)fRequestParams->getRequestBodySize();
+	fAsyncSession.RequestBodyBytesTotal = fRequestParams->getRequestBodySize();
 
-	debug("Request body size: %u", fAsyncSession.RequestBodyBytesTotal);
+	debug("Request body size: %lld", fAsyncSession.RequestBodyBytesTotal);
+
+	// A streamed body's length is not known. The main thread reads it as it is sent, and writes its chunks.
+	//
+	fAsyncSession.IsStreamingRequestBody = (TYPE_STREAM == fAsyncSession.RequestBody->bodyType);
+	if (fAsyncSession.IsStreamingRequestBody &&
+		!fAsyncSession.RequestBody->bodyStream->open(fRequestParams->isBodyCompressionEnabled()))
+	{
+		CORONA_LOG("Error creating request body compressor");
+		fAsyncSession.ErrorResult = kWinHttpRequestErrorInternal;
+		fAsyncSession.HasAsyncOperationEnded = true;
+		return false;
+	}
 
 	// As long as dwTotalLength is provided in the WinHttpSendRequest call below, the
 	// Content-Length header will automatically be added (if not already present) - per 
-	// the API documentation.
+	// the API documentation. A body over 4 GB does not fit it, so its Content-Length is
+	// added here instead, and WinHttp is told to take the length from it.
+	//
+	// A compressed body's length is not known until all of it has been compressed, so it is sent chunked instead,
+	// with the callback thread writing the chunk framing along with the compressed data. So is a streamed body,
+	// whose chunks (compressed or not) come from its stream.
+	DWORD totalLength = (DWORD)fAsyncSession.RequestBodyBytesTotal;
+	const std::wstring* sendHeaders = &headers;
+	std::wstring extendedHeaders;
+	if ((fAsyncSession.RequestBodyBytesTotal > MAXDWORD) && !fRequestParams->isBodyCompressionEnabled())
+	{
+		wchar_t contentLengthHeader[64];
+		swprintf_s(contentLengthHeader, L"Content-Length: %lld\r\n", fAsyncSession.RequestBodyBytesTotal);
+		extendedHeaders = headers;
+		extendedHeaders.append(contentLengthHeader);
+		sendHeaders = &extendedHeaders;
+		totalLength = WINHTTP_IGNORE_REQUEST_TOTAL_LENGTH;
+	}
+	if (fIsRevalidatingCacheEntry)
+	{
+		const WCHAR* wideConditionalHeaders = getWCHARs(HttpResponseCache::getConditionalHeaders(fCacheEntry));
+		if (sendHeaders != &extendedHeaders)
+		{
+			extendedHeaders = headers;
+		}
+		extendedHeaders.append(wideConditionalHeaders);
+		sendHeaders = &extendedHeaders;
+		delete [] wideConditionalHeaders;
+	}
+	UTF8String rangeHeaders = fResumableDownload.getRangeHeaders();
+	if (NULL != fAsyncSession.Segment)
+	{
+		rangeHeaders += fAsyncSession.Segment->getRangeHeaders();
+	}
+	if (!rangeHeaders.empty())
+	{
+		const WCHAR* wideRangeHeaders = getWCHARs(rangeHeaders);
+		if (sendHeaders != &extendedHeaders)
+		{
+			extendedHeaders = headers;
+			sendHeaders = &extendedHeaders;
+		}
+		extendedHeaders.append(wideRangeHeaders);
+		delete [] wideRangeHeaders;
+	}
+	if (fRequestParams->isBodyCompressionEnabled() || fAsyncSession.IsStreamingRequestBody)
+	{
+		if (!fAsyncSession.IsStreamingRequestBody && !fAsyncSession.UploadEncoder.open(true))
+		{
+			CORONA_LOG("Error creating request body compressor");
+			fAsyncSession.ErrorResult = kWinHttpRequestErrorInternal;
+			fAsyncSession.HasAsyncOperationEnded = true;
+			return false;
+		}
+		fAsyncSession.IsEncodingRequestBody = fRequestParams->isBodyCompressionEnabled();
+		if (sendHeaders != &extendedHeaders)
+		{
+			extendedHeaders = headers;
+			sendHeaders = &extendedHeaders;
+		}
+		extendedHeaders.append(L"Transfer-Encoding: chunked\r\n");
+		totalLength = WINHTTP_IGNORE_REQUEST_TOTAL_LENGTH;
+	}
 
 	// Start the asynchronous request. This is a non-blocking call.
 	//
 	BOOL wasSuccessful = ::WinHttpSendRequest(
 		fAsyncSession.RequestHandle,
-		headers.c_str(), 
+		sendHeaders->c_str(), 
 		-1,
 		WINHTTP_NO_REQUEST_DATA,
 		0,
-		fAsyncSession.RequestBodyBytesTotal,
+		totalLength,
 		(DWORD_PTR)&fAsyncSession
 		);
 	if (!wasSuccessful)
@@ -308,13 +366,28 @@ bool WinHttpRequestOperation::Execute()
 	return true;
 }
 
-RequestCanceller* WinHttpRequestOperation::ExecuteRequest( NetworkRequestParameters *requestParams, const std::shared_ptr<WinHttpRequestOperation>& thiz)
+/// Executes the given request.
+/// @param requestParams The request, which this object takes ownership of.
+/// @param thiz Shared pointer to this object.
+/// @param requestCanceller The canceller already handed to Lua for the request, if it was queued. Otherwise one
+///                         is created for it.
+/// @return Returns the request's canceller.
+RequestCanceller* WinHttpRequestOperation::ExecuteRequest( NetworkRequestParameters *requestParams, const std::shared_ptr<WinHttpRequestOperation>& thiz, RequestCanceller *requestCanceller )
 {
-	fRequestParams = requestParams;
-	fRequestState = new NetworkRequestState( thiz, requestParams->getRequestUrl(), requestParams->isDebug() );
+	StartRequest( requestParams, thiz, requestCanceller );
 
 	debug("Executing request");
-	Execute(); // No need to check for errors, as they will be handled and dispatched asynchronously.
+	if (!Execute())
+	{
+		// Errors (and responses served from the cache) are dispatched asynchronously like any other
+		// result, but WinHttp will not post anything for this request, so post the ended event ourselves.
+		// If no request handle was opened, there will be no HANDLE_CLOSING notification to wait for either.
+		if (NULL == fAsyncSession.RequestHandle)
+		{
+			fAsyncSession.RequestComplete = true;
+		}
+		PostEvent(&fAsyncSession, kWinHttpRequestEventEnded, 0, fAsyncSession.ErrorResult);
+	}
 
 	return fRequestState->getRequestCanceller();
 }
@@ -330,160 +403,42 @@ void WinHttpRequestOperation::ProcessExecution()
 		return;
 	}
 
-	LuaCallback* luaCallback = fRequestParams->getLuaCallback();
-
 	if (fAsyncSession.IsFirstProcessingPassForRequest)
 	{
 		fAsyncSession.IsFirstProcessingPassForRequest = false;
-
-		if (Upload == fRequestParams->getProgressDirection())
-		{
-			// If caller specified Upload progress, send it now (before uploading starts).
-			//
-			fRequestState->setPhase("began");
-			fRequestState->setBytesEstimated(fAsyncSession.RequestBodyBytesTotal);
-			if (NULL != luaCallback)
-			{
-				luaCallback->callWithNetworkRequestState( fRequestState );
-			}
-		}
+		NotifyUploadBegan(fAsyncSession.RequestBodyBytesTotal);
 	}
 
-	// We're going to copy the current request body count since it could change (be overwritten
-	// by the WinHttp thread) while we're playing with it.
-	DWORD currentBytes = fAsyncSession.RequestBodyBytesCurrent;
+	PumpRequestBodyStream();
+
+	// Request body bytes sent, as of the latest upload progress event.
+	long long currentBytes = fAsyncSession.RequestBodyBytesSent;
 	if (currentBytes != fAsyncSession.RequestBodyBytesProcessed)
 	{
 		// New bytes have been uploaded...
 		//
 		fAsyncSession.RequestBodyBytesProcessed = currentBytes;
-
-		if (Upload == fRequestParams->getProgressDirection())
-		{
-			// If caller specified Upload progress, notify them that more bytes have been uploaded...
-			//
-			debug("Request body written %u of %u bytes", fAsyncSession.RequestBodyBytesProcessed, fAsyncSession.RequestBodyBytesTotal);
-			fRequestState->setPhase("progress");
-			fRequestState->setBytesTransferred(fAsyncSession.RequestBodyBytesProcessed);
-			if (NULL != luaCallback)
-			{
-				luaCallback->callWithNetworkRequestState( fRequestState );
-			}
-		}
+		NotifyUploadProgress(currentBytes, fAsyncSession.RequestBodyBytesTotal,
+			fAsyncSession.IsEncodingRequestBody ? fAsyncSession.RequestBodyEncodedBytesSent : -1);
 	}
 
 	if (fAsyncSession.ResponseHeadersReady)
 	{
-		fRequestState->setStatus( fAsyncSession.ReceivedStatusCode );
-		fRequestState->setResponseHeaders(fAsyncSession.ResponseHeaders.c_str());
-
-		long contentLength = -1;
-		DWORD defaultContentAllocation = 8192;
-
-		UTF8String contentLengthText = fRequestState->getResponseHeaderValue("Content-Length");
-		if (contentLengthText.size() > 0)
-		{
-			contentLength = atoi(contentLengthText.c_str());
-		}
-
-		Body* body = fRequestState->getResponseBody();
+		// Count whether the response came back over a connection WinHttp kept alive from an earlier request.
+		fConnectionPool->RecordRequest(!fAsyncSession.IsNewConnection);
+		fRequestState->setDebugValue("connectionReused", fAsyncSession.IsNewConnection ? "false" : "true");
 
-		CoronaFileSpec *responseFile = fRequestParams->getResponseFile();
-		if ( ( NULL != responseFile ) && ( HTTP_STATUS_OK == fAsyncSession.ReceivedStatusCode ) )
-		{
-			// Set up the response body...
-			//
-			body->bodyType = TYPE_FILE;
-			body->bodyFile = new CoronaFileSpec( responseFile );
-
-
-			UTF8String pathDir;
-			UTF8String fullPath = responseFile->getFullPath();
-			const size_t lastIndex = fullPath.rfind('\\');
-			if (std::string::npos != lastIndex)
-			{
-				pathDir = fullPath.substr(0, lastIndex+1);
-				wchar_t *utf16DirectoryPath = CreateUtf16StringFrom(pathDir.c_str());
-				::SHCreateDirectoryEx(NULL, utf16DirectoryPath, NULL);
-				DestroyUtf16String(utf16DirectoryPath);
-			}
-			
-			fTempDownloadFilePath = pathForTemporaryFileWithPrefix("download", pathDir);
-			debug("Temp file path: %s", fTempDownloadFilePath.c_str());
-
-			// Create/open the download temp file.
-			wchar_t *utf16FilePath = CreateUtf16StringFrom(fTempDownloadFilePath.c_str());
-			try
-			{
-				fDownloadFileStream = NULL;
-				::_wfopen_s(&fDownloadFileStream, utf16FilePath, L"wb+");
-			}
-			catch (...) { }
-			DestroyUtf16String(utf16FilePath);
-			if ( NULL == fDownloadFileStream )
-			{
-				CORONA_LOG("Error creating temp file for download");
-				fAsyncSession.ErrorResult = kWinHttpRequestErrorInternal;
-				fAsyncSession.HasAsyncOperationEnded = true;
-			}
-		}
-		else
-		{
-			// Now that we have the response headers, we can determine if the response body will be text
-			// or binary, and set it up accordingly so that it can collect response packets appropriately.
-			//
-			char *contentType = NULL;
-			char *contentEncoding = NULL;
-
-			UTF8String contentTypeHeader = fRequestState->getResponseHeaderValue("Content-Type");
-			if (contentTypeHeader.length() > 0)
-			{
-				contentType = getContentType( contentTypeHeader.c_str() );
-				contentEncoding = getContentTypeEncoding( contentTypeHeader.c_str() );
-			}
-			if ( ( NULL != contentEncoding ) || ( ( NULL != contentType ) && isContentTypeText( contentType ) ) )
-			{
-				// If the Content-Type has a charset, or if it is "texty", then let's treat it as text
-				debug("treating content as text");
-				body->bodyType = TYPE_STRING;
-				body->bodyString = new UTF8String( );
-				body->bodyString->reserve( contentLength > 0 ? contentLength : defaultContentAllocation );
-			}
-			else
-			{
-				debug("treating content as binary");
-				body->bodyType = TYPE_BYTES;
-				body->bodyBytes = new ByteVector( );
-				body->bodyBytes->reserve(  contentLength > 0 ? contentLength : defaultContentAllocation  );
-			}
-
-			if ( NULL != contentType )
-			{
-				free(contentType);
-			}
-			if ( NULL != contentEncoding )
-			{
-				free(contentEncoding);
-			}
-		}
-
-		if (Upload != fRequestParams->getProgressDirection())
-		{
-			// If caller specified Download or no progress, we will populate the estimated bytes with the
-			// response content length.
-			//
-			fRequestState->setBytesEstimated( contentLength );
-		}
+		ApplyResponseHeaders(fAsyncSession.ReceivedStatusCode, fAsyncSession.ResponseHeaders.data(), fAsyncSession.ResponseHeaders.size());
 
-		if (Download == fRequestParams->getProgressDirection())
+		// Decode a compressed response body as it arrives, before it is transcoded or looked at. The WinHttp thread
+		// decodes the body itself when it writes it to the download file.
+		//
+		if (fAsyncSession.IsDecodingResponse)
 		{
-			// If caller specified Download progress, send began progress (now that we may know the 
-			// response size).
-			//
-			fRequestState->setPhase("began");
-			if (NULL != luaCallback)
+			const char *contentEncodingHeader = fRequestState->findResponseHeaderValue("Content-Encoding");
+			if ((TYPE_FILE != fRequestState->getResponseBody()->bodyType) && fResponseDecoder.open(contentEncodingHeader))
 			{
-				luaCallback->callWithNetworkRequestState( fRequestState );
+				debug("Decoding %s response body as it arrives", contentEncodingHeader);
 			}
 		}
 
@@ -492,80 +447,63 @@ void WinHttpRequestOperation::ProcessExecution()
 		fAsyncSession.ResponseHeadersReady = false;
 	}
 
-	// If data has been received by the thread, then append it to the result buffer or file.
+	// If the WinHttp thread has written data to the download file, all that is left to do is report the progress.
 	//
-	if (fAsyncSession.ReceivedByteCount > 0)
+	if (fAsyncSession.WrittenByteCount > 0)
 	{
-		debug("Got %u bytes", fAsyncSession.ReceivedByteCount);
-		Body* body = fRequestState->getResponseBody();
-		switch (body->bodyType)
-		{
-			case TYPE_FILE:
-				if (fDownloadFileStream)
-				{
-					size_t bytesWritten = 0;
-					try
-					{
-						bytesWritten = ::fwrite(
-							fAsyncSession.ReceiveBuffer, 
-							sizeof(fAsyncSession.ReceiveBuffer[0]),
-							(size_t)fAsyncSession.ReceivedByteCount, 
-							fDownloadFileStream
-							);
-					}
-					catch (...) { }
-				}
-				else
-				{
-					CORONA_LOG("Downloading file bytes, but no open file stream");
-				}
-				break;
-
-			case TYPE_STRING:
-				body->bodyString->append(fAsyncSession.ReceiveBuffer, fAsyncSession.ReceivedByteCount);
-				break;
-
-			case TYPE_BYTES:
-				body->bodyBytes->insert(
-					body->bodyBytes->end(), 
-					(unsigned char *)fAsyncSession.ReceiveBuffer, 
-					(unsigned char *)fAsyncSession.ReceiveBuffer + fAsyncSession.ReceivedByteCount
-					);
-				break;
-		}
-
-		if (Upload != fRequestParams->getProgressDirection())
-		{
-			fRequestState->incrementBytesTransferred(fAsyncSession.ReceivedByteCount);
-		}
+		ApplyWrittenBytes(fAsyncSession.WrittenByteCount, fAsyncSession.DecodedWrittenByteCount);
+		fAsyncSession.WrittenByteCount = 0;
+		fAsyncSession.DecodedWrittenByteCount = 0;
+	}
 
-		if (Download == fRequestParams->getProgressDirection())
+	// If data has been received by the thread, then have it appended to the result buffer.
+	//
+	if (fAsyncSession.ReceivedByteCount > 0)
+	{
+		// Nothing is delivered once the end was processed (e.g. after an abort), or once the body failed to decode.
+		const char* receiveBuffer = fAsyncSession.GetReceiveBuffer(fAsyncSession.ReceiveReadIndex);
+		size_t receivedLength = (size_t)fAsyncSession.ReceivedByteCount;
+		bool isDelivering = !fAsyncSession.EndOfOperationProcessed;
+		if (isDelivering && fResponseDecoder.isOpen())
 		{
-			// If caller specified Download progress, notify them that more bytes have been downloaded...
-			//
-			debug("Response data received: %u bytes", fAsyncSession.ReceivedByteCount);
-			fRequestState->setPhase("progress");
-			if (NULL != luaCallback)
+			fDecodedResponseBytes.clear();
+			if (!fResponseDecoder.write(receiveBuffer, receivedLength, &fDecodedResponseBytes))
 			{
-				luaCallback->callWithNetworkRequestState( fRequestState );
+				CORONA_LOG("Error decoding compressed response body");
+				fAsyncSession.ErrorResult = kWinHttpRequestErrorInternal;
+				fAsyncSession.HasAsyncOperationEnded = true;
+				isDelivering = false;
 			}
+			receiveBuffer = fDecodedResponseBytes.data();
+			receivedLength = fDecodedResponseBytes.size();
+		}
+		if (isDelivering && !ApplyReceivedBytes(receiveBuffer, receivedLength, fAsyncSession.ReceivedByteCount))
+		{
+			fAsyncSession.ErrorResult = kWinHttpRequestErrorInternal;
+			fAsyncSession.HasAsyncOperationEnded = true;
 		}
 
-		// Signal the WinHttp thread that we're ready for more data
+		// Hand the buffer back to the WinHttp thread. If every buffer was full, the WinHttp thread stopped
+		// reading and it is up to us to resume (unless the operation ended, e.g. from the Lua listener).
 		//
 		fAsyncSession.ReceivedByteCount = 0; 
+		fAsyncSession.ReceiveReadIndex = (fAsyncSession.ReceiveReadIndex + 1) % fAsyncSession.ReceiveBufferCount;
 
-		BOOL wasSuccessful = ::WinHttpReadData(
-			fAsyncSession.RequestHandle,
-			fAsyncSession.ReceiveBuffer,
-			sizeof(fAsyncSession.ReceiveBuffer), 
-			NULL
-			);
-		if (FALSE == wasSuccessful)
+		LONG filledCount = ::InterlockedDecrement(&fAsyncSession.FilledReceiveBufferCount);
+		if ((filledCount == fAsyncSession.ReceiveBufferCount - 1) && !fAsyncSession.HasAsyncOperationEnded)
 		{
-			debug("Failed to post request for more response data");
-			fAsyncSession.ErrorResult = kWinHttpRequestErrorUnknown;
-			fAsyncSession.HasAsyncOperationEnded = true;
+			BOOL wasSuccessful = ::WinHttpReadData(
+				fAsyncSession.RequestHandle,
+				fAsyncSession.GetReceiveBuffer(fAsyncSession.ReceiveWriteIndex),
+				fAsyncSession.ReceiveBufferSize, 
+				NULL
+				);
+			if (FALSE == wasSuccessful)
+			{
+				debug("Failed to post request for more response data");
+				fAsyncSession.ErrorResult = kWinHttpRequestErrorUnknown;
+				fAsyncSession.HasAsyncOperationEnded = true;
+			}
 		}
 	}
 
@@ -574,9 +512,7 @@ void WinHttpRequestOperation::ProcessExecution()
 	{
 		fAsyncSession.EndOfOperationProcessed = true;
 
-		debug("Request operation has ended, processing...");
-
-		// Close the WinHttp request and connection, if not done already by an abort.
+		// Close the WinHttp request and return the connection to the pool, if not done already by an abort.
 		//
 		HINTERNET requestHandle = fAsyncSession.RequestHandle;
 		fAsyncSession.RequestHandle = 0;
@@ -590,217 +526,148 @@ void WinHttpRequestOperation::ProcessExecution()
 		fAsyncSession.ConnectionHandle = 0;
 		if (connectionHandle)
 		{
-			debug("Closing connection handle (end of data)");
-			::WinHttpCloseHandle(connectionHandle);
+			debug("Releasing connection handle (end of data)");
+			fConnectionPool->ReleaseConnection(connectionHandle);
 		}
 
-		// Propagate the async session's error state or status code to the result state object.
-		if ( ( kWinHttpRequestErrorNone != fAsyncSession.ErrorResult ) || fAsyncSession.WasAbortRequested )
+		if ((kWinHttpRequestErrorNone == fAsyncSession.ErrorResult) && !fAsyncSession.WasAbortRequested &&
+			fResponseDecoder.isOpen() && !fResponseDecoder.finish())
 		{
-			fRequestState->setError(GetMessageFromWinHttpError(fAsyncSession.ErrorResult));
+			CORONA_LOG("Compressed response ended before the end of its data");
+			fAsyncSession.ErrorResult = kWinHttpRequestErrorInternal;
+		}
 
+		// Upload and download files are closed (and the download temp file deleted) once WinHttp has
+		// released the request, since the callback thread may still be using them.
+		fAsyncSession.ErrorResult = EndResponse(fAsyncSession.ErrorResult, fAsyncSession.WasAbortRequested, fAsyncSession.ReceivedStatusCode);
+		fResponseDecoder.close();
+	}
 
-			// Close any open files, delete any temp files
-			//
-			if (fAsyncSession.UploadFileStream)
+	if (fAsyncSession.RequestComplete)
+	{
+		// Release resources...
+		//
+		// Uploading from file - close file.
+		fAsyncSession.UploadFile.close();
+		if (fAsyncSession.RequestBody && (TYPE_MULTIPART == fAsyncSession.RequestBody->bodyType))
+		{
+			fAsyncSession.RequestBody->bodyMultipart->close();
+		}
+		long long interruptedLength = -1;
+		if (INVALID_HANDLE_VALUE != fAsyncSession.DownloadFileHandle)
+		{
+			// The download did not complete - close file. A resumable download keeps what was written, without
+			// the space preallocated for the rest. A segmented download's file is left at its full size.
+			if (fResumableDownload.isOpen())
 			{
-				// Uploading from file - close file.
-				try
+				LARGE_INTEGER endOfData;
+				endOfData.QuadPart = fAsyncSession.DownloadFileOffset;
+				if (::SetFilePointerEx(fAsyncSession.DownloadFileHandle, endOfData, NULL, FILE_BEGIN) &&
+					::SetEndOfFile(fAsyncSession.DownloadFileHandle))
 				{
-					::fclose(fAsyncSession.UploadFileStream);
+					interruptedLength = fAsyncSession.DownloadFileOffset;
 				}
-				catch (...) { }
-				fAsyncSession.UploadFileStream = NULL;
 			}
+			::CloseHandle(fAsyncSession.DownloadFileHandle);
+			fAsyncSession.DownloadFileHandle = INVALID_HANDLE_VALUE;
+		}
+		ReleaseRequest(fAsyncSession.HasOpenedDownloadFile, interruptedLength);
+		fAsyncSession.Reset();
+			
+		// Flag that execution has ended (puts this object back into the pool).
+		//
+		fIsExecuting = false;
+	}
+}
 
-			if (fDownloadFileStream)
+/// Gets the temp file (or partial file, or segmented download's file) the WinHttp thread downloads the response
+/// body to. The WinHttp thread only reads it while the request is in flight.
+UTF8String& WinHttpRequestOperation::GetDownloadFilePath()
+{
+	return fAsyncSession.DownloadFilePath;
+}
+
+/// Determines if this object's streamed request body (params.body = function) is waiting on its source for the next
+/// chunks to write. No event comes for the request until they are written, so the manager polls it meanwhile.
+/// @return Returns true if the body's source had nothing ready on the last pass. Returns false if not.
+bool WinHttpRequestOperation::IsWaitingForRequestBody()
+{
+	return fIsExecuting && fAsyncSession.IsStreamingRequestBody && !fAsyncSession.HasAsyncOperationEnded &&
+		(::InterlockedCompareExchange(&fAsyncSession.IsRequestBodyStreamStarved, 0, 0) != 0);
+}
+
+/// Applies an event posted for this object's session to the main thread's copy of the request state,
+/// then processes the request. To be called by the manager for every event it pops from the event queue.
+/// @param event The event to apply. Ignored if it was posted for an earlier request.
+void WinHttpRequestOperation::HandleEvent(const WinHttpRequestEvent& event)
+{
+	if (!IsExecuting() || (event.RequestId != fAsyncSession.RequestId))
+	{
+		debug("Dropping stale request event");
+		return;
+	}
+
+	switch (event.Type)
+	{
+		case kWinHttpRequestEventHeaders:
+			if (!fAsyncSession.HasAsyncOperationEnded)
 			{
-				// Downloading to file - close file.
-				try
-				{
-					::fclose(fDownloadFileStream);
-				}
-				catch (...) { }
-				fDownloadFileStream = NULL;
+				fAsyncSession.ReceivedStatusCode = (int)event.Value;
+				fAsyncSession.ResponseHeaders = event.Headers;
+				fAsyncSession.IsNewConnection = event.IsNewConnection;
+				fAsyncSession.ResponseHeadersReady = true;
 			}
+			break;
 
-			if (fTempDownloadFilePath.size() > 0)
+		case kWinHttpRequestEventData:
+			if (!fAsyncSession.HasAsyncOperationEnded)
 			{
-				// Delete temp file...
-				wchar_t *utf16TempFilePath = CreateUtf16StringFrom(fTempDownloadFilePath.c_str());
-				if ( DeleteFileW( utf16TempFilePath ) )
-				{
-					debug("Successfully deleted temp file");
-					fTempDownloadFilePath.clear();
-				}
-				else
-				{
-					CORONA_LOG("Error deleting temp file");
-				}
-				DestroyUtf16String(utf16TempFilePath);
+				fAsyncSession.ReceivedByteCount = (int)event.Value;
 			}
-		}
-		else
-		{
-			// Success!
-			//
-			fRequestState->setStatus( fAsyncSession.ReceivedStatusCode );
+			break;
 
-			// Body download complete, do any required post-processing...
-			//
-			Body* body = fRequestState->getResponseBody();
-			switch (body->bodyType)
+		case kWinHttpRequestEventDataWritten:
+			if (!fAsyncSession.HasAsyncOperationEnded)
 			{
-				case TYPE_FILE:
-				{
-					if (fDownloadFileStream)
-					{
-						// Downloading to file - close file.
-						try
-						{
-							::fclose(fDownloadFileStream);
-						}
-						catch (...) { }
-						fDownloadFileStream = NULL;
-
-						// Rename temp file to final file (with overwrite)
-						wchar_t *utf16SourceFilePath = CreateUtf16StringFrom(fTempDownloadFilePath.c_str());
-						wchar_t *utf16TargetFilePath = CreateUtf16StringFrom(body->bodyFile->getFullPath().c_str());
-						if (MoveFileExW( utf16SourceFilePath, utf16TargetFilePath, MOVEFILE_REPLACE_EXISTING ))
-						{
-							debug("File successfully renamed");
-							fTempDownloadFilePath.clear();
-						}
-						else
-						{
-							if (DeleteFileW( utf16SourceFilePath ))
-							{
-								CORONA_LOG("Failed to rename temp download file to final download file");
-							}
-							else
-							{
-								CORONA_LOG("Failed to rename temp download file to final download file; failed to clean temp download");
-							}
-						}
-						DestroyUtf16String(utf16SourceFilePath);
-						DestroyUtf16String(utf16TargetFilePath);
-					}
-					else
-					{
-						CORONA_LOG("Download to file complete, but no open file stream");
-					}
-				}
-				break;
-
-				case TYPE_STRING:
-				{
-					// Decode text string response content based on charset.  Default encoding is
-					// assumed to be utf-8, so if no charset is specified, or if it is specified
-					// and equal to utf-8, we take no action.
-					//
-					UTF8String contentType = fRequestState->getResponseHeaderValue("Content-Type");
-					Body *responseBody = fRequestState->getResponseBody();
-					char *contentEncoding = getContentTypeEncoding( contentType.c_str() );
-					if ( NULL != contentEncoding )
-					{
-						debug("Charset from protocol: %s", contentEncoding);
-						fRequestState->setDebugValue("charset", contentEncoding);
-						fRequestState->setDebugValue("charsetSource", "protocol");
-					}
-					else 
-					{
-						contentEncoding = getEncodingFromContent( contentType.c_str(), responseBody->bodyString->c_str() );
-						if ( NULL != contentEncoding )
-						{
-							debug("Charset from content: %s", contentEncoding);
-							fRequestState->setDebugValue("charset", contentEncoding);
-							fRequestState->setDebugValue("charsetSource", "content");
-						}
-						else
-						{
-							debug("Charset implicit (text default): utf-8");
-							fRequestState->setDebugValue("charset", "utf-8");
-							fRequestState->setDebugValue("charsetSource", "implicit");
-						}
-					}
-
-					if ( NULL != contentEncoding )
-					{
-						debug("Got response content encoding of: %s", contentEncoding);
-
-						if ( 0 != _strcmpi( "utf-8", contentEncoding ) )
-						{
-							// Found content encoding other than utf-8
-							//
-							debug("Transcoding response body from %s to utf-8", contentEncoding);
-							if (!CharsetTranscoder::transcode(responseBody->bodyString, contentEncoding, "utf-8"))
-							{
-								debug("Transcode failed");
-							}
-						}
-						free(contentEncoding);
-					}
-				}
-				break;
+				fAsyncSession.WrittenByteCount += (DWORD)event.Value;
+				fAsyncSession.DecodedWrittenByteCount += (DWORD)event.DecodedValue;
 			}
-		}
+			break;
 
-		if (NULL != luaCallback)
-		{
-			// Send the final callback notification (unless the request was cancelled)
-			//
-			if (!fAsyncSession.WasAbortRequested) // kWinHttpRequestErrorAborted
+		case kWinHttpRequestEventUploadProgress:
+			if (!fAsyncSession.HasAsyncOperationEnded)
 			{
-				fRequestState->setPhase("ended");
-				luaCallback->callWithNetworkRequestState( fRequestState );
+				fAsyncSession.RequestBodyBytesSent = event.DecodedValue;
+				fAsyncSession.RequestBodyEncodedBytesSent = event.Value;
 			}
+			break;
 
-			luaCallback->unregister();
-		}
-
-		debug("Request operaton processing complete");
-	}
+		case kWinHttpRequestEventEnded:
+			if (!fAsyncSession.HasAsyncOperationEnded)
+			{
+				fAsyncSession.ErrorResult = event.Error;
+				fAsyncSession.HasAsyncOperationEnded = true;
+			}
+			break;
 
-	if (fAsyncSession.RequestComplete)
-	{
-		// Release resources...
-		//
-		debug("Releasing request operation resources");
-		delete fRequestParams;
-		fRequestParams = NULL;
-		delete fRequestState;
-		fRequestState = NULL;
-		fAsyncSession.Reset();
-			
-		// Flag that execution has ended (puts this object back into the pool).
-		//
-		fIsExecuting = false;
+		case kWinHttpRequestEventHandleClosed:
+			fAsyncSession.RequestComplete = true;
+			break;
 	}
-}
 
-/// Blocking call which processes the currently executed operation until it has ended or
-/// the given timeout has been reached.
-/// @param timeoutInMilliseconds The maximum amount of time to process the currently active operation.
-void WinHttpRequestOperation::ProcessExecutionUntil(int timeoutInMilliseconds)
-{
-	// First, process execution before entering the below loop.
-	// This is because the operation may be ready to end now, making the Sleep() function below unnecessary.
 	ProcessExecution();
+}
 
-	// Process execution until the operation has ended or the given timeout has been reached.
-	int endTime = (int)::GetTickCount() + timeoutInMilliseconds;
-	while (fIsExecuting && ((endTime - (int)::GetTickCount()) > 0))
-	{
-		ProcessExecution();
-		::Sleep(10);
-	}
+/// Gets the manager's slot holding this object, as set by SetSlot().
+WinHttpRequestOperation::Slot* WinHttpRequestOperation::GetSlot()
+{
+	return fSlot;
 }
 
-/// Determines if this object is in the middle of an HTTP request operation.
-/// @return Returns true if currently executing an HTTP request operation. Returns false if not.
-bool WinHttpRequestOperation::IsExecuting()
+/// Records the manager's slot holding this object, so the manager can find it from an event.
+void WinHttpRequestOperation::SetSlot(Slot* slot)
 {
-	return fIsExecuting;
+	fSlot = slot;
 }
 
 /// Request to have the currently active HTTP request operation be aborted.
@@ -813,14 +680,19 @@ void WinHttpRequestOperation::RequestAbort()
 	{
 		return;
 	}
+	StopCoalescing();
 
-	// Flag that the current operation was aborted.
+	// Flag that the current operation was aborted, and have it processed on the next pass.
 	//
+	if (!fAsyncSession.HasAsyncOperationEnded)
+	{
+		PostEvent(&fAsyncSession, kWinHttpRequestEventEnded, 0, kWinHttpRequestErrorAborted);
+	}
 	fAsyncSession.ErrorResult = kWinHttpRequestErrorAborted;
 	fAsyncSession.WasAbortRequested = true;
 	fAsyncSession.HasAsyncOperationEnded = true;
 
-	// Close the WinHttp request and connection.
+	// Close the WinHttp request and return the connection to the pool.
 	//
 	HINTERNET requestHandle = fAsyncSession.RequestHandle;
 	fAsyncSession.RequestHandle = 0;
@@ -834,8 +706,54 @@ void WinHttpRequestOperation::RequestAbort()
 	fAsyncSession.ConnectionHandle = 0;
 	if (connectionHandle)
 	{
-		debug("Closing connection handle (request abort)");
-		::WinHttpCloseHandle(connectionHandle);
+		debug("Releasing connection handle (request abort)");
+		fConnectionPool->ReleaseConnection(connectionHandle);
+	}
+}
+
+/// Writes the next chunks of a streamed request body (params.body = function), if the callback thread has completed
+/// the last write and handed back the turn. The body's source is read here, on the main thread, since it may call
+/// into Lua, and only when there is a write to make, so it is read no faster than it is sent.
+void WinHttpRequestOperation::PumpRequestBodyStream()
+{
+	if (!fAsyncSession.IsStreamingRequestBody || fAsyncSession.HasAsyncOperationEnded ||
+		(0 == ::InterlockedCompareExchange(&fAsyncSession.IsRequestBodyStreamStarved, 0, 0)))
+	{
+		return;
+	}
+
+	RequestBodyStream* bodyStream = fAsyncSession.RequestBody->bodyStream;
+	fAsyncSession.UploadBuffer.clear();
+	if (!bodyStream->read(&fAsyncSession.UploadBuffer, SESSION_TX_BUFFER_SIZE))
+	{
+		CORONA_LOG("Error reading request body");
+		fAsyncSession.ErrorResult = kWinHttpRequestErrorInternal;
+		fAsyncSession.HasAsyncOperationEnded = true;
+		return;
+	}
+	if (fAsyncSession.UploadBuffer.empty())
+	{
+		// The source has nothing ready yet (or the compressor is holding on to what it gave). The turn stays here,
+		// and the manager polls this request until there is something to write (see IsWaitingForRequestBody()).
+		return;
+	}
+
+	// Hand the turn back to the callback thread, which picks up from the write's completion. The data stays put
+	// until then.
+	fAsyncSession.RequestBodyBytesRead = bodyStream->getBytesRead();
+	fAsyncSession.IsRequestBodyStreamEnded = bodyStream->isEnded();
+	::InterlockedExchange(&fAsyncSession.IsRequestBodyStreamStarved, 0);
+	BOOL wasSuccessful = ::WinHttpWriteData(
+		fAsyncSession.RequestHandle,
+		fAsyncSession.UploadBuffer.data(),
+		(DWORD)fAsyncSession.UploadBuffer.size(),
+		NULL
+		);
+	if (!wasSuccessful)
+	{
+		debug("HTTP write failed - error: %u", ::GetLastError());
+		fAsyncSession.ErrorResult = GetRequestErrorFromWinHttpError(::GetLastError());
+		fAsyncSession.HasAsyncOperationEnded = true;
 	}
 }
 
@@ -878,40 +796,6 @@ WinHttpRequestError WinHttpRequestOperation::GetRequestErrorFromWinHttpError(DWO
 	return kWinHttpRequestErrorInternal;
 }
 
-// Provides a human-readable error message from a WinHttpRequestOperation error code.
-// N.B. - The caller is responsible for cleaning the memory of the returned UTF8String.
-UTF8String* WinHttpRequestOperation::GetMessageFromWinHttpError(WinHttpRequestError errorCode)
-{
-	UTF8String* errorMessage = NULL;
-
-	switch (errorCode)
-	{
-		case kWinHttpRequestErrorTimedOut:
-			errorMessage = new UTF8String("Timed out");
-			break;
-		case kWinHttpRequestErrorInvalidUrl:
-			errorMessage = new UTF8String("Invalid URL");
-			break;
-		case kWinHttpRequestErrorAborted:
-			errorMessage = new UTF8String("Connection aborted");
-			break;
-		case kWinHttpRequestErrorConnectionFailure:
-			errorMessage = new UTF8String("Connection failure");
-			break;
-		case kWinHttpRequestErrorCertificateRequired:
-			errorMessage = new UTF8String("Certificate required");
-			break;
-		case kWinHttpRequestErrorLoginFailure:
-			errorMessage = new UTF8String("Login failure");
-			break;
-		default:
-			errorMessage = new UTF8String("Unknown error");
-			break;
-	}
-
-	return errorMessage;
-}
-
 void CALLBACK debugAsyncCallback(
 	HINTERNET hInternet, 
 	DWORD_PTR dwContext, 
@@ -1033,6 +917,7 @@ void WinHttpRequestOperation::OnAsyncWinHttpStatusChanged(
 	DWORD statusCode;
 	DWORD statusCodeSize;
 	BOOL wasSuccessful;
+	long long downloadOffset;
 
 	// Fetch the session object.
 	if (NULL == dwContext)
@@ -1066,16 +951,25 @@ void WinHttpRequestOperation::OnAsyncWinHttpStatusChanged(
 		// So yeah, we're going to do that ;)
 		//
 		// Note that this is the request handle we're processing here (as it is what's assiciated with the context
-		// data).  The connection handle is closed immediately after the request handle, but has no context data.
-		// Since we're not re-using the connection handle and it's not associated with the context data, there is no
-		// need to wait for it to signal that it's closed.
+		// data).  The connection handle is returned to the pool immediately after the request handle is closed, but
+		// has no context data. Since it's not associated with the context data, there is no need to wait for the
+		// request handle to signal that it's closed before reusing the connection handle.
 		//
 		debug("Request handle closing: %u", hInternet);
-		asyncSessionPointer->RequestComplete = true;
+		PostEvent(asyncSessionPointer, kWinHttpRequestEventHandleClosed, 0, kWinHttpRequestErrorNone);
+
+		// The owning operation may be destroyed as soon as this is set, so the session is not touched after it.
+		::SetEvent(asyncSessionPointer->RequestHandleClosedEvent);
+		return;
+	}
+	else if (WINHTTP_CALLBACK_STATUS_CONNECTING_TO_SERVER == dwInternetStatus)
+	{
+		// WinHttp is opening a new socket, meaning it had no idle kept-alive connection to this server.
+		asyncSessionPointer->HasOpenedConnection = true;
 	}
 
-	// Do not continue if the request operation has been flagged as completed.
-	if (asyncSessionPointer->HasAsyncOperationEnded)
+	// Do not continue if we've already told the main thread that the request operation has ended.
+	if (asyncSessionPointer->HasPostedEnd)
 	{
 		return;
 	}
@@ -1094,119 +988,105 @@ void WinHttpRequestOperation::OnAsyncWinHttpStatusChanged(
 				debug("WinHttp thread - uploaded %u request body bytes", bytesWritten);
 				asyncSessionPointer->RequestBodyBytesCurrent += bytesWritten;
 			}
+			{
+				// The main thread writes the next chunks of a streamed body (see PumpRequestBodyStream()). It is
+				// handed the turn before the progress event is posted, so that it finds the turn when handling it.
+				bool isWaitingForRequestBody =
+					asyncSessionPointer->IsStreamingRequestBody && !asyncSessionPointer->IsRequestBodyStreamEnded;
+
+				// Progress is given in bytes of the request body. When it is compressed, the bytes actually sent
+				// are passed on too.
+				WinHttpEventQueue* eventQueue = asyncSessionPointer->EventQueue;
+				WinHttpRequestEvent* progressEvent = NULL;
+				if (eventQueue)
+				{
+					progressEvent = CreateRequestEvent(asyncSessionPointer, kWinHttpRequestEventUploadProgress, asyncSessionPointer->RequestBodyBytesCurrent, kWinHttpRequestErrorNone);
+					if (asyncSessionPointer->IsEncodingRequestBody || asyncSessionPointer->IsStreamingRequestBody)
+					{
+						progressEvent->DecodedValue = asyncSessionPointer->RequestBodyBytesRead;
+					}
+				}
+				if (isWaitingForRequestBody)
+				{
+					::InterlockedExchange(&asyncSessionPointer->IsRequestBodyStreamStarved, 1);
+				}
+				if (progressEvent)
+				{
+					eventQueue->Post(progressEvent);
+				}
+				if (isWaitingForRequestBody)
+				{
+					return;
+				}
+			}
 
-			if (asyncSessionPointer->RequestBodyBytesCurrent < asyncSessionPointer->RequestBodyBytesTotal)
+			// Get the next part of the body to send, if any.
 			{
-				// More bytes to uploade, let's do it!
-				//
-				DWORD bodyLen = 0;
 				LPCVOID bodyPtr = NULL;
-				bool bDeleteBodyPtr = false;
-
-				if (NULL != asyncSessionPointer->RequestBody)
+				DWORD bodyLen = 0;
+				if (asyncSessionPointer->IsStreamingRequestBody)
+				{
+					// Only reached once the main thread has written the last of a streamed body.
+				}
+				else if (asyncSessionPointer->IsEncodingRequestBody)
 				{
-					switch (asyncSessionPointer->RequestBody->bodyType)
+					if (!EncodeRequestBodySlice(asyncSessionPointer))
 					{
-						case TYPE_STRING:
-						{
-							DWORD fullBodyLen = asyncSessionPointer->RequestBody->bodyString->length();
-							const char *fullBodyPtr = asyncSessionPointer->RequestBody->bodyString->c_str();
-							bodyPtr = &fullBodyPtr[asyncSessionPointer->RequestBodyBytesCurrent];
-							bodyLen = min(SESSION_TX_BUFFER_SIZE, fullBodyLen - asyncSessionPointer->RequestBodyBytesCurrent); 
-							debug("Uploading %u chars from text string", bodyLen);
-						}
-						break;
-
-						case TYPE_BYTES:
-						{
-							DWORD fullBodyLen = asyncSessionPointer->RequestBody->bodyBytes->size();
-							unsigned char * fullBodyPtr = &asyncSessionPointer->RequestBody->bodyBytes->at(0);
-							bodyPtr = &fullBodyPtr[asyncSessionPointer->RequestBodyBytesCurrent];
-							bodyLen = min(SESSION_TX_BUFFER_SIZE, fullBodyLen - asyncSessionPointer->RequestBodyBytesCurrent); 
-							debug("Uploading %u bytes from binary string", bodyLen);
-						}
-						break;
-
-						case TYPE_FILE:
-						{
-							size_t bytesRead = 0;
-							size_t bufferSize = SESSION_TX_BUFFER_SIZE;
-							char *buffer = new char[bufferSize];
-
-							try
-							{
-								bytesRead = ::fread(
-									buffer, 
-									sizeof(buffer[0]), 
-									bufferSize/sizeof(buffer[0]), 
-									asyncSessionPointer->UploadFileStream 
-									);
-							}
-							catch (...) { }
-							if ( bytesRead > 0 )
-							{
-								debug("Successfully read %u bytes from request body file, uploading", bytesRead);
-								bodyLen = bytesRead;
-								bodyPtr = buffer;
-								bDeleteBodyPtr = true;
-							}
-							else
-							{
-								CORONA_LOG("Error reading from request body file");
-								delete [] buffer;
-								asyncSessionPointer->ErrorResult = kWinHttpRequestErrorUnknown;
-								asyncSessionPointer->HasAsyncOperationEnded = true;
-								return;
-							}
-						}
-						break;
-					};
+						CORONA_LOG("Error compressing request body");
+						PostEnd(asyncSessionPointer, kWinHttpRequestErrorInternal);
+						return;
+					}
+					bodyPtr = asyncSessionPointer->UploadBuffer.data();
+					bodyLen = (DWORD)asyncSessionPointer->UploadBuffer.size();
 				}
-
-				wasSuccessful = ::WinHttpWriteData(
-					asyncSessionPointer->RequestHandle,
-					bodyPtr,
-					bodyLen,
-					NULL
-					);
-
-				if (bDeleteBodyPtr)
+				else if (asyncSessionPointer->RequestBodyBytesCurrent < asyncSessionPointer->RequestBodyBytesTotal)
 				{
-					delete [] bodyPtr;
+					const char* slice = NULL;
+					if (!ReadRequestBodySlice(asyncSessionPointer, asyncSessionPointer->RequestBodyBytesCurrent, &slice, &bodyLen))
+					{
+						CORONA_LOG("Error reading from request body file");
+						PostEnd(asyncSessionPointer, kWinHttpRequestErrorUnknown);
+						return;
+					}
+					bodyPtr = slice;
 				}
 
-				if (!wasSuccessful)
+				if (bodyLen > 0)
 				{
-					debug("HTTP write failed - error: %u", ::GetLastError());
-					asyncSessionPointer->ErrorResult = GetRequestErrorFromWinHttpError(::GetLastError());
-					asyncSessionPointer->HasAsyncOperationEnded = true;
+					// More bytes to upload, let's do it! The data stays put until the write completes.
+					//
+					wasSuccessful = ::WinHttpWriteData(
+						hInternet,
+						bodyPtr,
+						bodyLen,
+						NULL
+						);
+					if (!wasSuccessful)
+					{
+						debug("HTTP write failed - error: %u", ::GetLastError());
+						PostEnd(asyncSessionPointer, GetRequestErrorFromWinHttpError(::GetLastError()));
+					}
 					return;
 				}
 			}
-			else
-			{
-				// Done uploading body (if any)
-				//
 
+			// Done uploading body (if any)
+			//
+			{
 				// If we were uploading from a file, we're done now, so close it...
 				//
-				if ( NULL != asyncSessionPointer->UploadFileStream )
+				asyncSessionPointer->UploadFile.close();
+				if (asyncSessionPointer->RequestBody && (TYPE_MULTIPART == asyncSessionPointer->RequestBody->bodyType))
 				{
-					try
-					{
-						::fclose( asyncSessionPointer->UploadFileStream );
-					}
-					catch (...) { }
-					asyncSessionPointer->UploadFileStream = NULL;
+					asyncSessionPointer->RequestBody->bodyMultipart->close();
 				}
 
 				// Now lets read the response...
 				//
-				wasSuccessful = ::WinHttpReceiveResponse(asyncSessionPointer->RequestHandle, NULL);
+				wasSuccessful = ::WinHttpReceiveResponse(hInternet, NULL);
 				if (FALSE == wasSuccessful)
 				{
-					asyncSessionPointer->ErrorResult = kWinHttpRequestErrorUnknown;
-					asyncSessionPointer->HasAsyncOperationEnded = true;
+					PostEnd(asyncSessionPointer, kWinHttpRequestErrorUnknown);
 				}
 			}
 			break;
@@ -1219,7 +1099,7 @@ void WinHttpRequestOperation::OnAsyncWinHttpStatusChanged(
 			statusCode = HTTP_STATUS_OK;
 			statusCodeSize = sizeof(DWORD);
 			wasSuccessful = ::WinHttpQueryHeaders(
-				asyncSessionPointer->RequestHandle,
+				hInternet,
 				WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
 				WINHTTP_HEADER_NAME_BY_INDEX,
 				&statusCode, 
@@ -1229,18 +1109,19 @@ void WinHttpRequestOperation::OnAsyncWinHttpStatusChanged(
 			if (FALSE == wasSuccessful)
 			{
 				CORONA_LOG("Failed to get response status");
-				asyncSessionPointer->ErrorResult = kWinHttpRequestErrorUnknown;
-				asyncSessionPointer->HasAsyncOperationEnded = true;
+				PostEnd(asyncSessionPointer, kWinHttpRequestErrorUnknown);
 				break;
 			}
-			asyncSessionPointer->ReceivedStatusCode = statusCode;
 
-			// Read the headers.
+			// Read the headers, and hand them and the status code to the main thread.
 			//
 			{
+				WinHttpRequestEvent* headersEvent = CreateRequestEvent(asyncSessionPointer, kWinHttpRequestEventHeaders, statusCode, kWinHttpRequestErrorNone);
+				headersEvent->IsNewConnection = asyncSessionPointer->HasOpenedConnection;
+
 				DWORD dwSize = 0;
 				WinHttpQueryHeaders( 
-					asyncSessionPointer->RequestHandle, 
+					hInternet, 
 					WINHTTP_QUERY_RAW_HEADERS_CRLF,
 					WINHTTP_HEADER_NAME_BY_INDEX, 
 					NULL,
@@ -1255,39 +1136,89 @@ void WinHttpRequestOperation::OnAsyncWinHttpStatusChanged(
 
 					// Now, use WinHttpQueryHeaders to retrieve the header.
 					wasSuccessful = WinHttpQueryHeaders( 
-						asyncSessionPointer->RequestHandle,
+						hInternet,
 						WINHTTP_QUERY_RAW_HEADERS_CRLF,
 						WINHTTP_HEADER_NAME_BY_INDEX,
 						(LPVOID)lpOutBuffer, 
 						&dwSize,
 						WINHTTP_NO_HEADER_INDEX
 						);
+					if (wasSuccessful)
+					{
+						headersEvent->Headers = utf8_encode( lpOutBuffer, dwSize/sizeof(WCHAR) );
+					}
+					delete [] lpOutBuffer;
+
 					if (FALSE == wasSuccessful)
 					{
 						CORONA_LOG("Failed to get response headers");
-						asyncSessionPointer->ErrorResult = kWinHttpRequestErrorUnknown;
-						asyncSessionPointer->HasAsyncOperationEnded = true;
+						delete headersEvent;
+						PostEnd(asyncSessionPointer, kWinHttpRequestErrorUnknown);
 						break;
 					}
+				}
 
-					asyncSessionPointer->ResponseHeaders = utf8_encode( lpOutBuffer, dwSize/sizeof(WCHAR) );
-					asyncSessionPointer->ResponseHeadersReady = true;
+				// The body goes to the download file if the response is a 200, or a 206 that continues the partial
+				// file of a resumable download (after its bytes). A range of a segmented download only takes the 206
+				// for its bytes.
+				downloadOffset = (HTTP_STATUS_OK == statusCode) ? 0 : -1;
+				if ((HTTP_STATUS_PARTIAL_CONTENT == statusCode) && (NULL != asyncSessionPointer->Resume))
+				{
+					HttpHeaderTable responseHeaders;
+					responseHeaders.parse(headersEvent->Headers.data(), headersEvent->Headers.size());
+					if (asyncSessionPointer->Resume->isResumedResponse(statusCode, responseHeaders))
+					{
+						downloadOffset = asyncSessionPointer->Resume->getOffset();
+					}
+				}
+				else if (NULL != asyncSessionPointer->Segment)
+				{
+					HttpHeaderTable responseHeaders;
+					responseHeaders.parse(headersEvent->Headers.data(), headersEvent->Headers.size());
+					downloadOffset = asyncSessionPointer->Segment->isSegmentResponse(statusCode, responseHeaders) ?
+						asyncSessionPointer->Segment->getStart() : -1;
+				}
 
-					delete [] lpOutBuffer;
+				WinHttpEventQueue* eventQueue = asyncSessionPointer->EventQueue;
+				if (eventQueue)
+				{
+					eventQueue->Post(headersEvent);
+				}
+				else
+				{
+					delete headersEvent;
+				}
+			}
+
+			// Create the download file now that we know the response is going to it. Any other response to a range
+			// of a segmented download (such as the whole body, if it changed) is not read, as the download can't
+			// use it.
+			if ((downloadOffset >= 0) && (asyncSessionPointer->DownloadFilePath.size() > 0))
+			{
+				if (!OpenDownloadFile(asyncSessionPointer, hInternet, downloadOffset))
+				{
+					CORONA_LOG("Error creating temp file for download");
+					PostEnd(asyncSessionPointer, kWinHttpRequestErrorInternal);
+					break;
 				}
 			}
+			if ((NULL != asyncSessionPointer->Segment) && (downloadOffset < 0))
+			{
+				CORONA_LOG("Response does not match the requested segment of the download");
+				PostEnd(asyncSessionPointer, kWinHttpRequestErrorInternal);
+				break;
+			}
 
 			// Fetch response data.
 			wasSuccessful = ::WinHttpReadData(
-				asyncSessionPointer->RequestHandle,
-				asyncSessionPointer->ReceiveBuffer,
-				sizeof(asyncSessionPointer->ReceiveBuffer), 
+				hInternet,
+				asyncSessionPointer->GetReceiveBuffer(asyncSessionPointer->ReceiveWriteIndex),
+				asyncSessionPointer->ReceiveBufferSize, 
 				NULL
 				);
 			if (FALSE == wasSuccessful)
 			{
-				asyncSessionPointer->ErrorResult = kWinHttpRequestErrorUnknown;
-				asyncSessionPointer->HasAsyncOperationEnded = true;
+				PostEnd(asyncSessionPointer, kWinHttpRequestErrorUnknown);
 			}
 			break;
 
@@ -1296,31 +1227,115 @@ void WinHttpRequestOperation::OnAsyncWinHttpStatusChanged(
 			// Check if we have received any new data.
 			if (dwStatusInformationLength > 0)
 			{
-				// Data has been received. Have the data copied to its target.
-				asyncSessionPointer->ReceivedByteCount = (int)dwStatusInformationLength;
-				debug("Processing thread signalled that %i new bytes are available", asyncSessionPointer->ReceivedByteCount);
+				// Data has been received. If it is going to a file, write it out from this thread and read the
+				// next block into the same buffer, so the main thread only has to report the progress.
+				debug("Processing thread signalled that %u new bytes are available", dwStatusInformationLength);
+				if (INVALID_HANDLE_VALUE != asyncSessionPointer->DownloadFileHandle)
+				{
+					const char* writeBuffer = asyncSessionPointer->GetReceiveBuffer(asyncSessionPointer->ReceiveWriteIndex);
+					DWORD writeLength = dwStatusInformationLength;
+					if (asyncSessionPointer->DownloadDecoder.isOpen())
+					{
+						asyncSessionPointer->DownloadDecodeBuffer.clear();
+						if (!asyncSessionPointer->DownloadDecoder.write(writeBuffer, writeLength, &asyncSessionPointer->DownloadDecodeBuffer))
+						{
+							CORONA_LOG("Error decoding compressed response body");
+							PostEnd(asyncSessionPointer, kWinHttpRequestErrorInternal);
+							break;
+						}
+						writeBuffer = asyncSessionPointer->DownloadDecodeBuffer.data();
+						writeLength = (DWORD)asyncSessionPointer->DownloadDecodeBuffer.size();
+					}
+
+					DWORD bytesWritten = 0;
+					wasSuccessful = ::WriteFile(
+						asyncSessionPointer->DownloadFileHandle,
+						writeBuffer,
+						writeLength,
+						&bytesWritten,
+						NULL
+						);
+					if ((FALSE == wasSuccessful) || (bytesWritten != writeLength))
+					{
+						CORONA_LOG("Error writing to temp file for download");
+						PostEnd(asyncSessionPointer, kWinHttpRequestErrorInternal);
+						break;
+					}
+					asyncSessionPointer->DownloadFileOffset += writeLength;
+
+					WinHttpEventQueue* eventQueue = asyncSessionPointer->EventQueue;
+					if (eventQueue)
+					{
+						WinHttpRequestEvent* writtenEvent = CreateRequestEvent(asyncSessionPointer, kWinHttpRequestEventDataWritten, dwStatusInformationLength, kWinHttpRequestErrorNone);
+						writtenEvent->DecodedValue = writeLength;
+						eventQueue->Post(writtenEvent);
+					}
+
+					wasSuccessful = ::WinHttpReadData(
+						hInternet,
+						asyncSessionPointer->GetReceiveBuffer(asyncSessionPointer->ReceiveWriteIndex),
+						asyncSessionPointer->ReceiveBufferSize, 
+						NULL
+						);
+					if (FALSE == wasSuccessful)
+					{
+						PostEnd(asyncSessionPointer, kWinHttpRequestErrorUnknown);
+					}
+					break;
+				}
+
+				// Otherwise have the data copied to its target by the main thread.
+				asyncSessionPointer->ReceiveWriteIndex = (asyncSessionPointer->ReceiveWriteIndex + 1) % asyncSessionPointer->ReceiveBufferCount;
+				LONG filledCount = ::InterlockedIncrement(&asyncSessionPointer->FilledReceiveBufferCount);
+				PostEvent(asyncSessionPointer, kWinHttpRequestEventData, dwStatusInformationLength, kWinHttpRequestErrorNone);
 
-				// Note: The processing thread will read more data after it has processed the pending data.
+				// Keep reading into the next buffer while one is free. Otherwise the main thread
+				// resumes reading once it has consumed a buffer.
+				if (filledCount < asyncSessionPointer->ReceiveBufferCount)
+				{
+					wasSuccessful = ::WinHttpReadData(
+						hInternet,
+						asyncSessionPointer->GetReceiveBuffer(asyncSessionPointer->ReceiveWriteIndex),
+						asyncSessionPointer->ReceiveBufferSize, 
+						NULL
+						);
+					if (FALSE == wasSuccessful)
+					{
+						PostEnd(asyncSessionPointer, kWinHttpRequestErrorUnknown);
+					}
+				}
 			}
 			else
 			{
-				// All response data has been received. Inform main thread that we're done.
+				// All response data has been received. Finish off the download file (if any), so that the main
+				// thread can move it into place, and inform main thread that we're done.
 				debug("Signal the main thread that all response data has been received");
-				asyncSessionPointer->ErrorResult = kWinHttpRequestErrorNone;
-				asyncSessionPointer->HasAsyncOperationEnded = true;
+				if (!CloseDownloadFile(asyncSessionPointer))
+				{
+					CORONA_LOG("Error finishing temp file for download");
+					PostEnd(asyncSessionPointer, kWinHttpRequestErrorInternal);
+					break;
+				}
+				PostEnd(asyncSessionPointer, kWinHttpRequestErrorNone);
 			}
 			break;
 
 		case WINHTTP_CALLBACK_STATUS_REQUEST_ERROR:
 			debug("WINHTTP_CALLBACK_STATUS_REQUEST_ERROR");
-			asyncSessionPointer->ErrorResult = GetRequestErrorFromWinHttpError(::GetLastError());
-			asyncSessionPointer->HasAsyncOperationEnded = true;
+			{
+				// The error is passed in the notification rather than through GetLastError() on this thread.
+				DWORD errorCode = ::GetLastError();
+				if (lpvStatusInformation && (dwStatusInformationLength >= sizeof(WINHTTP_ASYNC_RESULT)))
+				{
+					errorCode = ((WINHTTP_ASYNC_RESULT*)lpvStatusInformation)->dwError;
+				}
+				PostEnd(asyncSessionPointer, GetRequestErrorFromWinHttpError(errorCode));
+			}
 			break;
 
 		case WINHTTP_CALLBACK_STATUS_SECURE_FAILURE:
 			debug("WINHTTP_CALLBACK_STATUS_SECURE_FAILURE");
-			asyncSessionPointer->ErrorResult = kWinHttpRequestErrorCertificateRequired;
-			asyncSessionPointer->HasAsyncOperationEnded = true;
+			PostEnd(asyncSessionPointer, kWinHttpRequestErrorCertificateRequired);
 			break;
 	}
 }
@@ -1329,6 +1344,284 @@ void WinHttpRequestOperation::OnAsyncWinHttpStatusChanged(
 
 
 #pragma region Private Helper Functions
+/// Creates an event for the given session's current request. The caller must post or delete it.
+WinHttpRequestEvent* WinHttpRequestOperation::CreateRequestEvent(
+	WinHttpAsyncRequestSessionData* session, WinHttpRequestEventType type, long long value, WinHttpRequestError error)
+{
+	WinHttpRequestEvent* event = new WinHttpRequestEvent();
+	event->Type = type;
+	event->Session = session;
+	event->RequestId = session->RequestId;
+	event->Value = value;
+	event->DecodedValue = value;
+	event->Error = error;
+	return event;
+}
+
+/// Posts an event for the given session's current request to the session's event queue.
+/// Can be called from any thread. The event is dropped if the session no longer has a queue.
+void WinHttpRequestOperation::PostEvent(
+	WinHttpAsyncRequestSessionData* session, WinHttpRequestEventType type, long long value, WinHttpRequestError error)
+{
+	WinHttpEventQueue* eventQueue = session->EventQueue;
+	if (eventQueue)
+	{
+		eventQueue->Post(CreateRequestEvent(session, type, value, error));
+	}
+}
+
+/// Posts the ended event from the WinHttp callback thread, after which that thread leaves the request alone
+/// until the main thread closes its handle.
+void WinHttpRequestOperation::PostEnd(WinHttpAsyncRequestSessionData* session, WinHttpRequestError error)
+{
+	session->HasPostedEnd = true;
+	PostEvent(session, kWinHttpRequestEventEnded, 0, error);
+}
+
+/// Gets the next slice of the request body (of up to SESSION_TX_BUFFER_SIZE bytes) from the WinHttp callback thread.
+/// A slice of a file body comes straight from the session's "UploadFile" mapping, where it stays until the next call,
+/// and a slice of a multipart body from the piece of it that holds the bytes (see MultipartBody).
+/// @param session The session whose "RequestBody" is being sent.
+/// @param offset The number of body bytes already taken.
+/// @param slice Set to the slice, which is empty once the end of the body is reached.
+/// @param sliceLength Set to the number of bytes in the slice.
+/// @return Returns false if the body file (or a multipart body's file) could not be read.
+bool WinHttpRequestOperation::ReadRequestBodySlice(
+	WinHttpAsyncRequestSessionData* session, long long offset, const char** slice, DWORD* sliceLength)
+{
+	*slice = NULL;
+	*sliceLength = 0;
+	if ((NULL == session->RequestBody) || (offset >= session->RequestBodyBytesTotal))
+	{
+		return true;
+	}
+
+	long long bytesLeft = session->RequestBodyBytesTotal - offset;
+	DWORD length = (bytesLeft < SESSION_TX_BUFFER_SIZE) ? (DWORD)bytesLeft : SESSION_TX_BUFFER_SIZE;
+	switch (session->RequestBody->bodyType)
+	{
+		case TYPE_STRING:
+			*slice = session->RequestBody->bodyString->c_str() + offset;
+			*sliceLength = length;
+			debug("Uploading %u chars from text string", length);
+			break;
+
+		case TYPE_BYTES:
+			*slice = (const char*)&session->RequestBody->bodyBytes->at(0) + offset;
+			*sliceLength = length;
+			debug("Uploading %u bytes from binary string", length);
+			break;
+
+		case TYPE_LUA_STRING:
+			*slice = session->RequestBody->bodyLuaString->getData() + offset;
+			*sliceLength = length;
+			debug("Uploading %u bytes from Lua string", length);
+			break;
+
+		case TYPE_FILE:
+		{
+			size_t mappedLength = 0;
+			*slice = session->UploadFile.getSlice(offset, length, &mappedLength);
+			if (NULL == *slice)
+			{
+				return false;
+			}
+			debug("Uploading %u bytes from request body file", (DWORD)mappedLength);
+			*sliceLength = (DWORD)mappedLength;
+		}
+		break;
+
+		case TYPE_MULTIPART:
+		{
+			size_t pieceLength = 0;
+			*slice = session->RequestBody->bodyMultipart->getSlice(offset, length, &pieceLength);
+			if (NULL == *slice)
+			{
+				return false;
+			}
+			debug("Uploading %u bytes from multipart body", (DWORD)pieceLength);
+			*sliceLength = (DWORD)pieceLength;
+		}
+		break;
+
+		default:
+			// No body, or a streamed one, which is not read in slices.
+			return false;
+	}
+	return true;
+}
+
+/// Fills the session's "UploadBuffer" with the next part of the compressed request body from the WinHttp callback
+/// thread, compressing as many slices of the body as it takes to produce output. The buffer is left empty once the
+/// whole body (and the last chunk) has been sent.
+/// @return Returns false if the body file could not be read or the body could not be compressed.
+bool WinHttpRequestOperation::EncodeRequestBodySlice(WinHttpAsyncRequestSessionData* session)
+{
+	session->UploadBuffer.clear();
+	while (session->UploadBuffer.empty() && session->UploadEncoder.isOpen())
+	{
+		const char* slice = NULL;
+		DWORD sliceLength = 0;
+		if (!ReadRequestBodySlice(session, session->RequestBodyBytesRead, &slice, &sliceLength))
+		{
+			return false;
+		}
+		if (sliceLength > 0)
+		{
+			session->RequestBodyBytesRead += sliceLength;
+			if (!session->UploadEncoder.write(slice, sliceLength, &session->UploadBuffer))
+			{
+				return false;
+			}
+		}
+		else if (!session->UploadEncoder.finish(&session->UploadBuffer))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/// Creates the session's download temp file from the WinHttp callback thread, and preallocates it to the
+/// response's Content-Length (if given) so that the file does not have to be grown while writing to it.
+/// @param session The session whose "DownloadFilePath" is to be created.
+/// @param hInternet The request handle to read the Content-Length header from.
+/// @param offset The number of bytes of the existing file that the response continues, if it resumes a partial
+///               download. Anything past them is dropped. The file is created anew if 0.
+/// @return Returns true if the file was created and its handle stored in "DownloadFileHandle".
+bool WinHttpRequestOperation::OpenDownloadFile(WinHttpAsyncRequestSessionData* session, HINTERNET hInternet, long long offset)
+{
+	UTF8String pathDir;
+	const size_t lastIndex = session->DownloadFilePath.rfind('\\');
+	if (std::string::npos != lastIndex)
+	{
+		pathDir = session->DownloadFilePath.substr(0, lastIndex+1);
+		wchar_t *utf16DirectoryPath = CreateUtf16StringFrom(pathDir.c_str());
+		::SHCreateDirectoryEx(NULL, utf16DirectoryPath, NULL);
+		DestroyUtf16String(utf16DirectoryPath);
+	}
+
+	// The ranges of a segmented download are written into its file at once, each through a handle of its own.
+	bool isSegment = (NULL != session->Segment);
+	wchar_t *utf16FilePath = CreateUtf16StringFrom(session->DownloadFilePath.c_str());
+	HANDLE fileHandle = INVALID_HANDLE_VALUE;
+	if (utf16FilePath)
+	{
+		fileHandle = ::CreateFileW(
+			utf16FilePath, GENERIC_WRITE, isSegment ? FILE_SHARE_WRITE : 0, NULL,
+			((offset > 0) || isSegment) ? OPEN_EXISTING : CREATE_ALWAYS,
+			FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	}
+	DestroyUtf16String(utf16FilePath);
+	if (INVALID_HANDLE_VALUE == fileHandle)
+	{
+		return false;
+	}
+	session->DownloadFileHandle = fileHandle;
+	session->HasOpenedDownloadFile = true;
+	session->DownloadFileOffset = offset;
+
+	// A segmented download's file was created at its full size, which is left as is.
+	LARGE_INTEGER startOfBody;
+	startOfBody.QuadPart = offset;
+	if (isSegment)
+	{
+		return (FALSE != ::SetFilePointerEx(fileHandle, startOfBody, NULL, FILE_BEGIN));
+	}
+	if ((offset > 0) && (!::SetFilePointerEx(fileHandle, startOfBody, NULL, FILE_BEGIN) || !::SetEndOfFile(fileHandle)))
+	{
+		return false;
+	}
+
+	// A compressed body is decoded before it is written, so its Content-Length says nothing about the file's size.
+	if (session->IsDecodingResponse)
+	{
+		WCHAR contentEncodingText[32];
+		DWORD contentEncodingSize = sizeof(contentEncodingText);
+		if (::WinHttpQueryHeaders(
+				hInternet,
+				WINHTTP_QUERY_CONTENT_ENCODING,
+				WINHTTP_HEADER_NAME_BY_INDEX,
+				contentEncodingText,
+				&contentEncodingSize,
+				WINHTTP_NO_HEADER_INDEX))
+		{
+			// Content codings are ASCII tokens.
+			char contentEncoding[32];
+			size_t length = contentEncodingSize / sizeof(WCHAR);
+			for (size_t index = 0; index < length; index++)
+			{
+				contentEncoding[index] = (contentEncodingText[index] < 0x80) ? (char)contentEncodingText[index] : '?';
+			}
+			contentEncoding[length] = 0;
+			if (session->DownloadDecoder.open(contentEncoding))
+			{
+				return true;
+			}
+		}
+	}
+
+	// Reserve the file's full size up front. Not being able to is not fatal, the writes will tell.
+	WCHAR contentLengthText[32];
+	DWORD contentLengthSize = sizeof(contentLengthText);
+	BOOL wasSuccessful = ::WinHttpQueryHeaders(
+		hInternet,
+		WINHTTP_QUERY_CONTENT_LENGTH,
+		WINHTTP_HEADER_NAME_BY_INDEX,
+		contentLengthText,
+		&contentLengthSize,
+		WINHTTP_NO_HEADER_INDEX
+		);
+	if (wasSuccessful)
+	{
+		LARGE_INTEGER endOfFile;
+		endOfFile.QuadPart = (LONGLONG)::_wcstoui64(contentLengthText, NULL, 10);
+		if (endOfFile.QuadPart > 0)
+		{
+			endOfFile.QuadPart += offset;
+			if (!::SetFilePointerEx(fileHandle, endOfFile, NULL, FILE_BEGIN) || !::SetEndOfFile(fileHandle))
+			{
+				debug("Unable to preallocate download file");
+			}
+			::SetFilePointerEx(fileHandle, startOfBody, NULL, FILE_BEGIN);
+		}
+	}
+	return true;
+}
+
+/// Closes the session's download file (if open) from the WinHttp callback thread once all response data
+/// has been written to it, trimming off any preallocated space that the response did not fill.
+/// @return Returns true if the file was closed successfully (and a compressed body was complete), or if there was
+///         no file to close.
+bool WinHttpRequestOperation::CloseDownloadFile(WinHttpAsyncRequestSessionData* session)
+{
+	HANDLE fileHandle = session->DownloadFileHandle;
+	if (INVALID_HANDLE_VALUE == fileHandle)
+	{
+		return true;
+	}
+	session->DownloadFileHandle = INVALID_HANDLE_VALUE;
+
+	// A segmented download's file holds the other ranges past this one.
+	BOOL wasSuccessful = (NULL != session->Segment) ? TRUE : ::SetEndOfFile(fileHandle);
+
+	// A compressed download that was cut off fails, and the file is removed along with the request.
+	if (session->DownloadDecoder.isOpen())
+	{
+		if (!session->DownloadDecoder.finish())
+		{
+			CORONA_LOG("Compressed download ended before the end of its data");
+			wasSuccessful = FALSE;
+		}
+		session->DownloadDecoder.close();
+	}
+	if (!::CloseHandle(fileHandle))
+	{
+		wasSuccessful = FALSE;
+	}
+	return (FALSE != wasSuccessful);
+}
+
 /// Converts the given UTF-8 string to a UTF-16 string and returns it.
 /// @param utf8String The UTF-8 string to be converted. Can be NULL.
 /// @return Returns a new UTF-16 string matching the given UTF-8 string.
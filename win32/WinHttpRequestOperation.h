@@ -15,48 +15,74 @@
 #include <windows.h>
 #include <WinHttp.h>
 #include "WinHttpAsyncRequestSessionData.h"
+#include "WinHttpConnectionPool.h"
+#include "WinHttpEventQueue.h"
 
 #include "WinHttpRequestError.h"
 
+#include "ContentDecoder.h"
+#include "HttpRequestOperation.h"
+
+#include "RequestSlotTable.h"
 #include "WindowsNetworkSupport.h"
 
 
 /// Class used to send an HTTP request to a server and wait for a response asynchronously.
 ///
-class WinHttpRequestOperation
+/// WinHttp runs the request on its own threads and posts events for it, which the manager applies on the main
+/// thread with HandleEvent(). What the events carry is turned into the request's state by HttpRequestOperation.
+class WinHttpRequestOperation : public HttpRequestOperation
 {
 public:
-	WinHttpRequestOperation();
+	/// Typedef for the manager's slot holding an operation.
+	typedef RequestSlotTable<WinHttpRequestOperation>::Slot Slot;
+
+	WinHttpRequestOperation( WinHttpConnectionPool *connectionPool, WinHttpEventQueue *eventQueue, HttpResponseCache *responseCache, HttpMemoryResponseCache *memoryCache, CoalescingMap *coalescingMap );
 	virtual ~WinHttpRequestOperation();
 
-	RequestCanceller* ExecuteRequest( NetworkRequestParameters *requestParams, const std::shared_ptr<WinHttpRequestOperation>& thiz);
-	bool IsExecuting();
+	RequestCanceller* ExecuteRequest( NetworkRequestParameters *requestParams, const std::shared_ptr<WinHttpRequestOperation>& thiz, RequestCanceller *requestCanceller = NULL );
+	bool IsWaitingForRequestBody();
 	void ProcessExecution();
+	void HandleEvent( const WinHttpRequestEvent& event );
 	void RequestAbort();
 
+	Slot* GetSlot();
+	void SetSlot( Slot* slot );
+
 private:
 	/// Stores data needed to perform an asynchronous HTTP request operation.
 	/// This object's fields are changed on another thread.
 	WinHttpAsyncRequestSessionData fAsyncSession;
-	NetworkRequestParameters* fRequestParams;
-	NetworkRequestState* fRequestState;
 
-	/// Temp file path and file stream to open temp file that serves as the destination of the
-	/// response body, if response body is directed to a file.
-	UTF8String fTempDownloadFilePath;
-	FILE* fDownloadFileStream;
+	/// Provides the shared WinHttp session and the connection handles requests are opened on.
+	WinHttpConnectionPool* fConnectionPool;
+
+	/// The manager's slot holding this object.
+	Slot* fSlot;
 
-	/// Set true if this object is in the middle of an HTTP request operation.
-	bool fIsExecuting;
+	/// Decodes a compressed response body received in memory as it arrives (params.compression = "auto"), into
+	/// "fDecodedResponseBytes" which keeps its capacity from one buffer to the next.
+	ContentDecoder fResponseDecoder;
+	std::string fDecodedResponseBytes;
 
 	bool Execute();
-	void ProcessExecutionUntil(int timeoutInMilliseconds);
+	void PumpRequestBodyStream();
+	virtual UTF8String& GetDownloadFilePath();
 
 	static WinHttpRequestError GetRequestErrorFromWinHttpError(DWORD dwError);
-	static UTF8String* WinHttpRequestOperation::GetMessageFromWinHttpError(WinHttpRequestError error);
 	static void CALLBACK OnAsyncWinHttpStatusChanged(
 				HINTERNET hInternet, DWORD_PTR dwContext, DWORD dwInternetStatus,
 				LPVOID lpvStatusInformation, DWORD dwStatusInformationLength);
+	static WinHttpRequestEvent* CreateRequestEvent(
+				WinHttpAsyncRequestSessionData* session, WinHttpRequestEventType type, long long value, WinHttpRequestError error);
+	static void PostEvent(
+				WinHttpAsyncRequestSessionData* session, WinHttpRequestEventType type, long long value, WinHttpRequestError error);
+	static void PostEnd(WinHttpAsyncRequestSessionData* session, WinHttpRequestError error);
+	static bool ReadRequestBodySlice(
+				WinHttpAsyncRequestSessionData* session, long long offset, const char** slice, DWORD* sliceLength);
+	static bool EncodeRequestBodySlice(WinHttpAsyncRequestSessionData* session);
+	static bool OpenDownloadFile(WinHttpAsyncRequestSessionData* session, HINTERNET hInternet, long long offset);
+	static bool CloseDownloadFile(WinHttpAsyncRequestSessionData* session);
 	static wchar_t* CreateUtf16StringFrom(const char* utf8String);
 	static void DestroyUtf16String(wchar_t *utf16String);
 };
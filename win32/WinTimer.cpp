@@ -24,8 +24,10 @@ WinTimer::WinTimer()
 	fWindowHandle = NULL;
 	fThreadHandle = NULL;
 	fStopEvent = NULL;
+	fIntervalChangedEvent = NULL;
 	fIsRunning = 0;
 	fTickPending = 0;
+	fWakePending = 0;
 	fIntervalInMilliseconds = 10;
 	fNextIntervalTimeInTicks = 0;
 }
@@ -109,10 +111,19 @@ void WinTimer::RunTimerThread()
 {
 	while (InterlockedCompareExchange(&fIsRunning, 0, 0) != 0)
 	{
-		if (fStopEvent && (WAIT_OBJECT_0 == ::WaitForSingleObject(fStopEvent, 10)))
+		// With an INFINITE interval this thread just sleeps until stopped (or given an interval), and OnTimer()
+		// is only invoked by calls to Wake().
+		HANDLE waitHandles[2] = { fStopEvent, fIntervalChangedEvent };
+		DWORD waitResult = ::WaitForMultipleObjects(2, waitHandles, FALSE, fIntervalInMilliseconds);
+		if (WAIT_OBJECT_0 == waitResult)
 		{
 			break;
 		}
+		if ((WAIT_OBJECT_0 + 1) == waitResult)
+		{
+			// Wait again with the new interval.
+			continue;
+		}
 
 		if (NULL == fWindowHandle)
 		{
@@ -169,13 +180,16 @@ void WinTimer::Start()
 	}
 
 	InterlockedExchange(&fTickPending, 0);
+	InterlockedExchange(&fWakePending, 0);
 	InterlockedExchange(&fIsRunning, 1);
 	fNextIntervalTimeInTicks = ::GetTickCount() + fIntervalInMilliseconds;
 
 	fStopEvent = ::CreateEventW(NULL, TRUE, FALSE, NULL);
-	if (NULL == fStopEvent)
+	fIntervalChangedEvent = ::CreateEventW(NULL, FALSE, FALSE, NULL);
+	if ((NULL == fStopEvent) || (NULL == fIntervalChangedEvent))
 	{
 		InterlockedExchange(&fIsRunning, 0);
+		CloseEvents();
 		DestroyMessageWindow();
 		return;
 	}
@@ -184,8 +198,7 @@ void WinTimer::Start()
 	if (NULL == fThreadHandle)
 	{
 		InterlockedExchange(&fIsRunning, 0);
-		::CloseHandle(fStopEvent);
-		fStopEvent = NULL;
+		CloseEvents();
 		DestroyMessageWindow();
 	}
 }
@@ -212,18 +225,39 @@ void WinTimer::Stop()
 		fThreadHandle = NULL;
 	}
 
+	CloseEvents();
+	DestroyMessageWindow();
+}
+
+void WinTimer::CloseEvents()
+{
 	if (fStopEvent)
 	{
 		::CloseHandle(fStopEvent);
 		fStopEvent = NULL;
 	}
-
-	DestroyMessageWindow();
+	if (fIntervalChangedEvent)
+	{
+		::CloseHandle(fIntervalChangedEvent);
+		fIntervalChangedEvent = NULL;
+	}
 }
 
+/// Sets how often OnTimer() is invoked, or INFINITE to only have it invoked by Wake(). A running timer starts the
+/// new interval right away.
 void WinTimer::SetInterval(DWORD milliseconds)
 {
+	if (milliseconds == fIntervalInMilliseconds)
+	{
+		return;
+	}
+
 	fIntervalInMilliseconds = milliseconds;
+	fNextIntervalTimeInTicks = ::GetTickCount() + milliseconds;
+	if (fIntervalChangedEvent)
+	{
+		::SetEvent(fIntervalChangedEvent);
+	}
 }
 
 bool WinTimer::IsRunning() const
@@ -233,22 +267,48 @@ bool WinTimer::IsRunning() const
 
 void WinTimer::Evaluate()
 {
+	// Clear the pending flag before calling OnTimer(), so that a Wake() from another thread while
+	// OnTimer() is running posts a new message instead of being lost.
+	InterlockedExchange(&fTickPending, 0);
+
 	if (!IsRunning())
 	{
-		InterlockedExchange(&fTickPending, 0);
 		return;
 	}
 
-	if (CompareTicks(::GetTickCount(), fNextIntervalTimeInTicks) < 0)
+	if (0 != InterlockedExchange(&fWakePending, 0))
+	{
+		OnTimer();
+		return;
+	}
+
+	if ((INFINITE == fIntervalInMilliseconds) || (CompareTicks(::GetTickCount(), fNextIntervalTimeInTicks) < 0))
 	{
-		InterlockedExchange(&fTickPending, 0);
 		return;
 	}
 
 	for (; CompareTicks(::GetTickCount(), fNextIntervalTimeInTicks) > 0; fNextIntervalTimeInTicks += fIntervalInMilliseconds);
 
 	OnTimer();
-	InterlockedExchange(&fTickPending, 0);
+}
+
+/// Has OnTimer() invoked on the main thread as soon as possible, regardless of the interval.
+/// Can be called from any thread.
+void WinTimer::Wake()
+{
+	if (!IsRunning() || (NULL == fWindowHandle))
+	{
+		return;
+	}
+
+	InterlockedExchange(&fWakePending, 1);
+	if (0 == InterlockedCompareExchange(&fTickPending, 1, 0))
+	{
+		if (!::PostMessageW(fWindowHandle, kWinTimerMessageId, 0, 0))
+		{
+			InterlockedExchange(&fTickPending, 0);
+		}
+	}
 }
 
 long WinTimer::GetTickDelta(DWORD x, DWORD y)
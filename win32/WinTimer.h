@@ -26,6 +26,7 @@ class WinTimer
 		virtual void SetInterval( ULONG milliseconds );
 		virtual bool IsRunning() const;
 		virtual void Evaluate();
+		virtual void Wake();
 		virtual void OnTimer() = 0; // Pure virtual, derived class must implement
 
 	public:
@@ -36,6 +37,7 @@ class WinTimer
 		static bool RegisterWindowClass();
 		bool CreateMessageWindow();
 		void DestroyMessageWindow();
+		void CloseEvents();
 		static DWORD WINAPI TimerThreadProc(LPVOID context);
 		void RunTimerThread();
 		static LRESULT CALLBACK MessageWindowProc(HWND windowHandle, UINT messageId, WPARAM wParam, LPARAM lParam);
@@ -44,9 +46,11 @@ class WinTimer
 		HWND		fWindowHandle;
 		HANDLE		fThreadHandle;
 		HANDLE		fStopEvent;
+		HANDLE		fIntervalChangedEvent;
 		volatile LONG fIsRunning;
 		volatile LONG fTickPending;
-		DWORD		fIntervalInMilliseconds;
+		volatile LONG fWakePending;
+		volatile DWORD fIntervalInMilliseconds;
 		DWORD		fNextIntervalTimeInTicks;
 };
 
@@ -13,13 +13,21 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <sys/stat.h>
-#include <Rpc.h>
 #include <math.h>
 
-#include "WinHttpRequestOperation.h"
+#ifdef _WIN32
+#include <Rpc.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #include "CharsetTranscoder.h"
-#include "WinTimer.h"
+#include "ContentDecoder.h"
+#include "HttpResponseCache.h"
+#include "MultipartBody.h"
+#include "RequestBodyStream.h"
+#include "SegmentedDownload.h"
 
 
 
@@ -41,9 +49,27 @@ void debug( char *message, ... )
 	va_end(args);
 
 	return;
+#else
+	(void)message;
 #endif
 }
 
+// Compares two GetTickCount() values, accounting for wraparound.
+// Returns a negative value if x is before y, zero if equal, and a positive value if x is after y.
+int compareTicks( DWORD x, DWORD y )
+{
+	long deltaTime = (long)(int)(x - y);
+	if (deltaTime < 0)
+	{
+		return -1;
+	}
+	else if (0 == deltaTime)
+	{
+		return 0;
+	}
+	return 1;
+}
+
 
 // --------------------------------------------------------------------------------------
 
@@ -104,6 +130,7 @@ UTF8String pathForTemporaryFileWithPrefix(const char *prefix, UTF8String pathDir
 	pathString.append( prefix );
 	pathString.append( "-" );
 
+#ifdef _WIN32
 	UUID uuid;
 	char *uuidStr;
 
@@ -123,6 +150,29 @@ UTF8String pathForTemporaryFileWithPrefix(const char *prefix, UTF8String pathDir
 	{
 		CORONA_LOG("Unable to generate UUID for temp path");
 	}
+#else
+	// No RPC runtime here, so build a UUID-shaped name from the system random source instead.
+	unsigned char uuid[16];
+	bool isRandom = false;
+	int randomSource = open("/dev/urandom", O_RDONLY);
+	if (randomSource >= 0)
+	{
+		isRandom = (read(randomSource, uuid, sizeof(uuid)) == (ssize_t)sizeof(uuid));
+		close(randomSource);
+	}
+	if (isRandom)
+	{
+		char uuidStr[40];
+		snprintf(uuidStr, sizeof(uuidStr), "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+			uuid[0], uuid[1], uuid[2], uuid[3], uuid[4], uuid[5], uuid[6], uuid[7],
+			uuid[8], uuid[9], uuid[10], uuid[11], uuid[12], uuid[13], uuid[14], uuid[15]);
+		pathString.append( uuidStr );
+	}
+	else
+	{
+		CORONA_LOG("Unable to generate UUID for temp path");
+	}
+#endif
 
 	return pathString;
 
@@ -130,6 +180,26 @@ UTF8String pathForTemporaryFileWithPrefix(const char *prefix, UTF8String pathDir
 
 // --------------------------------------------------------------------------------------
 
+/// Gets the number of bytes to reserve for a response body that is collected in memory, so that it is
+/// normally received into a single allocation of its final size.
+/// @param contentLength The response's Content-Length, or -1 if it has none.
+size_t getResponseBodyReserve( long long contentLength )
+{
+	if ( contentLength <= 0 )
+	{
+		return NETWORK_DEFAULT_RESPONSE_BODY_RESERVE;
+	}
+	if ( contentLength > NETWORK_MAX_RESPONSE_BODY_RESERVE )
+	{
+		return NETWORK_MAX_RESPONSE_BODY_RESERVE;
+	}
+	return (size_t)contentLength;
+}
+
+// --------------------------------------------------------------------------------------
+
+#ifdef _WIN32
+
 // Convert a wide Unicode string to a UTF8 string
 UTF8String utf8_encode( const WCHAR * wideString )
 {
@@ -176,30 +246,32 @@ const WCHAR * getWCHARs( UTF8String string )
 	return wchars;
 }
 
+#endif
+
 bool startsWith( const char * haystack, char * needle )
 {
-    if (!needle || !haystack)
+	if (!needle || !haystack)
 		return false;
 
-    size_t lenHaystack = strlen(haystack);
-    size_t lenNeedle = strlen(needle);
-    if (lenNeedle > lenHaystack)
-        return false;
+	size_t lenHaystack = strlen(haystack);
+	size_t lenNeedle = strlen(needle);
+	if (lenNeedle > lenHaystack)
+		return false;
 
 	return _strnicmp( haystack, needle, lenNeedle ) == 0;
 }
 
 bool endsWith( const char * haystack, char * needle )
 {
-    if (!needle || !haystack)
+	if (!needle || !haystack)
 		return false;
 
-    size_t lenHaystack = strlen(haystack);
-    size_t lenNeedle = strlen(needle);
-    if (lenNeedle >  lenHaystack)
-        return false;
+	size_t lenHaystack = strlen(haystack);
+	size_t lenNeedle = strlen(needle);
+	if (lenNeedle >  lenHaystack)
+		return false;
 
-    return _strnicmp( haystack + lenHaystack - lenNeedle, needle, lenNeedle) == 0;
+	return _strnicmp( haystack + lenHaystack - lenNeedle, needle, lenNeedle) == 0;
 }
 
 char *trimWhitespace( char * str )
@@ -261,7 +333,7 @@ char * getContentTypeEncoding( const char *contentTypeHeader )
 	{
 		debug("Parsed Content-Type: %s", ct);
 	}
-	delete [] ct;
+	free(ct);
 
 	char *charset = NULL;
 	if ( NULL != contentTypeHeader )
@@ -330,180 +402,325 @@ bool isContentTypeText ( const char *contentType )
 		);
 }
 
-// For structured text types (html or xml) look for embedded encoding.  Here is a good overview of the
-// state of this problem:
+// Helpers for getEncodingFromContent(), which work on a length-delimited buffer without copying it.
 //
-//     http://en.wikipedia.org/wiki/Character_encodings_in_HTML
-//
-char * getEncodingFromContent ( const char *contentType, const char *content )
+static bool isPrescanSpace( char c )
 {
-	// Note: This logic accomodates the fact that application/xhtml (and the -xml variant) is both XML
-	//       and HTML, and the rule is to use the XML encoding if present, else HTML.
-	//
-	char *charset = NULL;
-	
-	//debug("Looking for embedded encoding in content: %s", content);
-	
-	if ( isContentTypeXML( contentType ) )
+	return ( ' ' == c ) || ( '\t' == c ) || ( '\n' == c ) || ( '\r' == c ) || ( '\f' == c );
+}
+
+// Determines if the (lower case) keyword appears at the given index, ignoring case.
+static bool matchesKeyword( const char *text, size_t length, size_t index, const char *keyword )
+{
+	for ( ; 0 != *keyword; keyword++, index++ )
 	{
-		// Look in XML encoding meta header (ex: http://www.nasa.gov/rss/breaking_news.rss)
-		//
-		//   <?xml version="1.0" encoding="utf-8"?>
-		//
-		const char *xmlInitTagOpen = "<?xml ";
-		const char *tagContentBegin = strstr(content, xmlInitTagOpen);
-		if (NULL != tagContentBegin)
+		if ( ( index >= length ) || ( tolower( (unsigned char)text[index] ) != *keyword ) )
 		{
-			tagContentBegin += strlen(xmlInitTagOpen);
-			const char *tagContentEnd = strstr(tagContentBegin, "?>");
-			if (NULL != tagContentEnd)
-			{
-				int tagLen = tagContentEnd - tagContentBegin;
-				char *tagBody = new char[tagLen+1];
-				strncpy_s(tagBody, tagLen + 1, tagContentBegin, tagLen);
-				tagBody[tagLen] = 0;
-
-				// debug("Found XML init tag with body: %s", tagBody);
+			return false;
+		}
+	}
+	return true;
+}
 
-				const char *encodingAttrString = "encoding=";
-				char *encodingAttr = strstr(tagBody, encodingAttrString );
-				if (NULL != encodingAttr)
-				{
-					encodingAttr += strlen(encodingAttrString);
-					if ( (*encodingAttr == '\"') || (*encodingAttr == '\'\"') )
-					{
-						encodingAttr++;
-						char *encodingAttrEnd = strpbrk(encodingAttr, "\'\"");
-						if (NULL != encodingAttrEnd)
-						{
-							*encodingAttrEnd = 0;
-							charset = _strdup(encodingAttr);
-							_strlwr_s(charset, strlen(charset) + 1);
-							debug("Found encoding in XML init tag: %s", charset);
-						}
-					}
-				}
+// Determines if the text from "begin" to "end" is the (lower case) keyword, ignoring case.
+static bool equalsKeyword( const char *text, size_t begin, size_t end, const char *keyword )
+{
+	return ( strlen( keyword ) == end - begin ) && matchesKeyword( text, end, begin, keyword );
+}
 
-				delete [] tagBody;
-			}
+// Gets the index of the first occurrence of the keyword at or after the given index, or "length" if there is none.
+static size_t findKeyword( const char *text, size_t length, size_t index, const char *keyword )
+{
+	for ( ; index < length; index++ )
+	{
+		if ( matchesKeyword( text, length, index, keyword ) )
+		{
+			return index;
 		}
 	}
-	
-	if ( ( NULL == charset ) && ( isContentTypeHTML( contentType ) ) )
+	return length;
+}
+
+// Reads the next attribute of a tag, as in the "get an attribute" step of the WHATWG encoding prescan. The name
+// and value are returned as ranges of the text, and "index" is left after the attribute. Returns false once the
+// end of the tag (or of the text) is reached instead, with "index" left at the '>'.
+//
+static bool getPrescanAttribute( const char *text, size_t length, size_t *index, size_t *nameBegin, size_t *nameEnd, size_t *valueBegin, size_t *valueEnd )
+{
+	size_t i = *index;
+	while ( ( i < length ) && ( isPrescanSpace( text[i] ) || ( '/' == text[i] ) ) )
 	{
-		// Look in HTML meta "charset" tag (ex: http://www.android.com)
-		//
-		//   <meta charset="utf-8">
-		//
-		const char *xmlMetaTagOpen = "<meta ";
-		const char *tagContentBegin = strstr(content, xmlMetaTagOpen);
-		while ( (NULL == charset) && (NULL != tagContentBegin) )
-		{
-			tagContentBegin += strlen(xmlMetaTagOpen);
-			const char *tagContentEnd = strstr(tagContentBegin, ">");
-			if (NULL != tagContentEnd)
-			{
-				int tagLen = tagContentEnd - tagContentBegin;
-				char *tagBody = new char[tagLen+1];
-				strncpy_s(tagBody, tagLen + 1, tagContentBegin, tagLen);
-				tagBody[tagLen] = 0;
+		i++;
+	}
+	if ( ( i >= length ) || ( '>' == text[i] ) )
+	{
+		*index = i;
+		return false;
+	}
+
+	*nameBegin = i;
+	do
+	{
+		i++;
+	}
+	while ( ( i < length ) && !isPrescanSpace( text[i] ) && ( '/' != text[i] ) && ( '>' != text[i] ) && ( '=' != text[i] ) );
+	*nameEnd = i;
 
-				// debug("Found XML meta tag with body: %s", tagBody);
+	while ( ( i < length ) && isPrescanSpace( text[i] ) )
+	{
+		i++;
+	}
+	*valueBegin = *valueEnd = i;
+	if ( ( i >= length ) || ( '=' != text[i] ) )
+	{
+		*index = i;
+		return ( i < length );
+	}
 
-				_strlwr_s(tagBody, strlen(tagBody) + 1);
+	i++;
+	while ( ( i < length ) && isPrescanSpace( text[i] ) )
+	{
+		i++;
+	}
+	if ( ( i < length ) && ( ( '\"' == text[i] ) || ( '\'' == text[i] ) ) )
+	{
+		char quote = text[i++];
+		*valueBegin = i;
+		while ( ( i < length ) && ( quote != text[i] ) )
+		{
+			i++;
+		}
+		*valueEnd = i;
+		if ( i >= length )
+		{
+			// The value runs past the end of what we look at, so we can't trust it.
+			*index = length;
+			return false;
+		}
+		i++;
+	}
+	else
+	{
+		*valueBegin = i;
+		while ( ( i < length ) && !isPrescanSpace( text[i] ) && ( '>' != text[i] ) )
+		{
+			i++;
+		}
+		*valueEnd = i;
+	}
+	*index = i;
+	return true;
+}
 
-				// Look for a charset attribute with a quoted value (that distinguishes this from the
-				// http-equiv case below).  This is important, because we want to prioritize an explicit
-				// charset meta tag over an http-equiv meta tag with a charset in the Content-Type.
-				const char *encodingAttrString = "charset=";
-				char *encodingAttr = strstr(tagBody, encodingAttrString );
-				if (NULL != encodingAttr)
+// Finds the charset in the value of a meta http-equiv Content-Type "content" attribute, as in
+// "text/html; charset=utf-8".
+//
+static bool getCharsetFromMetaContent( const char *text, size_t begin, size_t end, size_t *charsetBegin, size_t *charsetEnd )
+{
+	size_t i = begin;
+	while ( ( i = findKeyword( text, end, i, "charset" ) ) < end )
+	{
+		i += strlen( "charset" );
+		while ( ( i < end ) && isPrescanSpace( text[i] ) )
+		{
+			i++;
+		}
+		if ( ( i < end ) && ( '=' == text[i] ) )
+		{
+			i++;
+			while ( ( i < end ) && isPrescanSpace( text[i] ) )
+			{
+				i++;
+			}
+			if ( ( i < end ) && ( ( '\"' == text[i] ) || ( '\'' == text[i] ) ) )
+			{
+				char quote = text[i++];
+				*charsetBegin = i;
+				while ( ( i < end ) && ( quote != text[i] ) )
 				{
-					encodingAttr += strlen(encodingAttrString);
-					if ( (*encodingAttr == '\"') || (*encodingAttr == '\'\"') )
-					{
-						encodingAttr++;
-						char *encodingAttrEnd = strpbrk(encodingAttr, "\'\"");
-						if (NULL != encodingAttrEnd)
-						{
-							*encodingAttrEnd = 0;
-							charset = _strdup(encodingAttr);
-							debug("Found encoding in XML meta tag: %s", charset);
-						}
-					}
+					i++;
 				}
-
-				delete [] tagBody;
-
-				tagContentBegin = strstr(tagContentEnd, xmlMetaTagOpen);
 			}
 			else
 			{
-				tagContentBegin = NULL;
+				*charsetBegin = i;
+				while ( ( i < end ) && !isPrescanSpace( text[i] ) && ( ';' != text[i] ) && ( '\"' != text[i] ) && ( '\'' != text[i] ) )
+				{
+					i++;
+				}
 			}
+			*charsetEnd = i;
+			return ( *charsetEnd > *charsetBegin );
+		}
+	}
+	return false;
+}
+
+// For structured text types (html or xml) look for embedded encoding.  Here is a good overview of the
+// state of this problem:
+//
+//     http://en.wikipedia.org/wiki/Character_encodings_in_HTML
+//
+// This follows the WHATWG encoding prescan: a single pass over only the first NETWORK_CHARSET_PRESCAN_LENGTH bytes
+// of the content, skipping comments and other tags, where the first XML declaration or meta tag that gives an
+// encoding wins. The content doesn't need to be null terminated, and is not copied.
+//
+char * getEncodingFromContent ( const char *contentType, const char *content, size_t contentLength )
+{
+	// Note: This logic accomodates the fact that application/xhtml (and the -xml variant) is both XML
+	//       and HTML. The XML declaration has to be the very first thing in a document, so it wins if present.
+	//
+	bool isXML = isContentTypeXML( contentType );
+	bool isHTML = isContentTypeHTML( contentType );
+	if ( ( !isXML && !isHTML ) || ( NULL == content ) )
+	{
+		return NULL;
+	}
+
+	size_t length = contentLength;
+	if ( length > NETWORK_CHARSET_PRESCAN_LENGTH )
+	{
+		length = NETWORK_CHARSET_PRESCAN_LENGTH;
+	}
+
+	size_t charsetBegin = 0;
+	size_t charsetEnd = 0;
+	bool isFromMetaTag = false;
+	size_t index = 0;
+	while ( ( charsetBegin == charsetEnd ) && ( index < length ) )
+	{
+		if ( '<' != content[index] )
+		{
+			index++;
+			continue;
 		}
 
-		if ( NULL == charset )
+		size_t nameBegin, nameEnd, valueBegin, valueEnd;
+		if ( matchesKeyword( content, length, index, "<!--" ) )
 		{
-			// Look in HTML HTTP Content-Type meta header (ex: http://www.cnn.com)
+			index = findKeyword( content, length, index + 4, "-->" ) + 3;
+		}
+		else if ( isXML && matchesKeyword( content, length, index, "<?xml" ) && ( index + 5 < length ) && isPrescanSpace( content[index + 5] ) )
+		{
+			// XML encoding declaration (ex: http://www.nasa.gov/rss/breaking_news.rss)
 			//
-			//   <meta http-equiv="Content-Type" content="text/html; charset=utf-8">
+			//   <?xml version="1.0" encoding="utf-8"?>
+			//
+			index += 5;
+			while ( getPrescanAttribute( content, length, &index, &nameBegin, &nameEnd, &valueBegin, &valueEnd ) )
+			{
+				if ( equalsKeyword( content, nameBegin, nameEnd, "encoding" ) )
+				{
+					charsetBegin = valueBegin;
+					charsetEnd = valueEnd;
+					debug("Found encoding in XML init tag");
+					break;
+				}
+			}
+		}
+		else if ( isHTML && matchesKeyword( content, length, index, "<meta" ) && ( index + 5 < length ) &&
+				  ( isPrescanSpace( content[index + 5] ) || ( '/' == content[index + 5] ) ) )
+		{
+			// HTML meta "charset" tag (ex: http://www.android.com)
+			//
+			//   <meta charset="utf-8">
 			//
-			// First we need to find the full tag for this header.  Since the attributes may be in any order, we will have to do a
-			// second pass to extract the charset out of the "content" attribute.
+			// or HTTP Content-Type meta header (ex: http://www.cnn.com), whose attributes may be in any order
 			//
-			tagContentBegin = strstr(content, xmlMetaTagOpen);
-			while ( (NULL == charset) && (NULL != tagContentBegin) )
+			//   <meta http-equiv="Content-Type" content="text/html; charset=utf-8">
+			//
+			size_t contentBegin = 0;
+			size_t contentEnd = 0;
+			bool isContentTypePragma = false;
+			index += 5;
+			while ( getPrescanAttribute( content, length, &index, &nameBegin, &nameEnd, &valueBegin, &valueEnd ) )
 			{
-				tagContentBegin += strlen(xmlMetaTagOpen);
-				const char *tagContentEnd = strstr(tagContentBegin, ">");
-				if (NULL != tagContentEnd)
+				if ( equalsKeyword( content, nameBegin, nameEnd, "charset" ) && ( charsetBegin == charsetEnd ) )
 				{
-					int tagLen = tagContentEnd - tagContentBegin;
-					char *tagBody = new char[tagLen+1];
-					strncpy_s(tagBody, tagLen + 1, tagContentBegin, tagLen);
-					tagBody[tagLen] = 0;
-
-					// debug("Found XML meta tag with body: %s", tagBody);
-
-					_strlwr_s(tagBody, strlen(tagBody) + 1);
-
-					// Make sure this is an http-equiv tag for Content-Type
-					if ( (NULL != strstr(tagBody, "http-equiv")) && (NULL != strstr(tagBody, "content-type")) )
-					{
-						// Look for an unquoted charset attribute (will be inside of quoted "content" attribute)
-						const char *encodingAttrString = "charset=";
-						char *encodingAttr = strstr(tagBody, encodingAttrString );
-						if (NULL != encodingAttr)
-						{
-							encodingAttr += strlen(encodingAttrString);
-							if ( isalpha(*encodingAttr) )
-							{
-								char *encodingAttrEnd = strpbrk(encodingAttr, " ;\'\""); // valid content attr terminators
-								if (NULL != encodingAttrEnd)
-								{
-									*encodingAttrEnd = 0;
-									charset = _strdup(encodingAttr);
-									debug("Found encoding in XML meta http-equiv tag: %s", charset);
-								}
-							}
-						}
-					}
-
-					delete [] tagBody;
-
-					tagContentBegin = strstr(tagContentEnd, xmlMetaTagOpen);
+					charsetBegin = valueBegin;
+					charsetEnd = valueEnd;
 				}
-				else
+				else if ( equalsKeyword( content, nameBegin, nameEnd, "content" ) )
 				{
-					tagContentBegin = NULL;
+					contentBegin = valueBegin;
+					contentEnd = valueEnd;
 				}
+				else if ( equalsKeyword( content, nameBegin, nameEnd, "http-equiv" ) )
+				{
+					isContentTypePragma = equalsKeyword( content, valueBegin, valueEnd, "content-type" );
+				}
+			}
+			if ( ( charsetBegin == charsetEnd ) && isContentTypePragma )
+			{
+				getCharsetFromMetaContent( content, contentBegin, contentEnd, &charsetBegin, &charsetEnd );
+			}
+			if ( ( charsetBegin != charsetEnd ) && ( index >= length ) )
+			{
+				// The tag was cut off by the end of what we look at, so it may not be what it seems.
+				charsetBegin = charsetEnd = 0;
+			}
+			if ( charsetBegin != charsetEnd )
+			{
+				isFromMetaTag = true;
+				debug("Found encoding in HTML meta tag");
 			}
 		}
+		else if ( ( index + 1 < length ) && ( isalpha( (unsigned char)content[index + 1] ) ||
+				  ( ( '/' == content[index + 1] ) && ( index + 2 < length ) && isalpha( (unsigned char)content[index + 2] ) ) ) )
+		{
+			// Any other tag, whose attribute values may contain a '>'.
+			index++;
+			while ( ( index < length ) && !isPrescanSpace( content[index] ) && ( '>' != content[index] ) )
+			{
+				index++;
+			}
+			while ( getPrescanAttribute( content, length, &index, &nameBegin, &nameEnd, &valueBegin, &valueEnd ) )
+			{
+			}
+		}
+		else if ( matchesKeyword( content, length, index, "<!" ) || matchesKeyword( content, length, index, "</" ) ||
+				  matchesKeyword( content, length, index, "<?" ) )
+		{
+			index = findKeyword( content, length, index + 2, ">" );
+		}
+		else
+		{
+			index++;
+		}
 	}
-	
-	// Caller will be responsible for deleting this
-	return charset;
+
+	// Trim the charset name and return it in lower case.
+	while ( ( charsetBegin < charsetEnd ) && isPrescanSpace( content[charsetBegin] ) )
+	{
+		charsetBegin++;
+	}
+	while ( ( charsetBegin < charsetEnd ) && isPrescanSpace( content[charsetEnd - 1] ) )
+	{
+		charsetEnd--;
+	}
+
+	char charsetName[64];
+	size_t charsetLength = charsetEnd - charsetBegin;
+	if ( ( 0 == charsetLength ) || ( charsetLength >= sizeof(charsetName) ) )
+	{
+		return NULL;
+	}
+	for ( size_t i = 0; i < charsetLength; i++ )
+	{
+		charsetName[i] = (char)tolower( (unsigned char)content[charsetBegin + i] );
+	}
+	charsetName[charsetLength] = 0;
+
+	// A page that could be read as ASCII to find this can't really be UTF-16, so the WHATWG rule is to use utf-8.
+	if ( isFromMetaTag && ( 0 == strncmp( charsetName, "utf-16", 6 ) ) )
+	{
+		memcpy( charsetName, "utf-8", sizeof("utf-8") );
+	}
+
+	debug("Found encoding in content: %s", charsetName);
+
+	// Caller will be responsible for freeing this
+	return _strdup( charsetName );
 }
 
 // --------------------------------------------------------------------------------------
@@ -565,7 +782,7 @@ RequestCanceller * RequestCanceller::checkWithLuaState( lua_State *luaState, int
 	return *(RequestCanceller **)luaL_checkudata(luaState, index, RequestCanceller::getMetatableName());
 }
 
-RequestCanceller::RequestCanceller(const std::shared_ptr<WinHttpRequestOperation>& requestOperation )
+RequestCanceller::RequestCanceller(const std::shared_ptr<NetworkRequestOperation>& requestOperation )
 {
 	fRequestOperation = requestOperation;
 	fRefCount = 0;
@@ -623,7 +840,7 @@ void RequestCanceller::cancel( )
 
 		if ( NULL != fRequestOperation )
 		{
-			fRequestOperation->RequestAbort();
+			fRequestOperation->RequestCancel();
 		}
 	}
 }
@@ -654,11 +871,32 @@ const char* getProgressDirectionName( ProgressDirection progressDirection )
 		return "UNKONWN";		
 }
 
+RequestPriority getRequestPriorityFromString( const char *priorityString )
+{
+	if (_strcmpi( "high", priorityString ) == 0)
+		return PriorityHigh;
+	else if (_strcmpi( "normal", priorityString ) == 0)
+		return PriorityNormal;
+	else if (_strcmpi( "low", priorityString ) == 0)
+		return PriorityLow;
+	else if (_strcmpi( "background", priorityString ) == 0)
+		return PriorityBackground;
+	else
+		return PriorityUnknown;
+}
+
 // --------------------------------------------------------------------------------------
 // NetworkRequestState
 // --------------------------------------------------------------------------------------
 
-NetworkRequestState::NetworkRequestState(const std::shared_ptr<WinHttpRequestOperation>& requestOperation, UTF8String url, bool isDebug )
+NetworkRequestState::NetworkRequestState(const std::shared_ptr<NetworkRequestOperation>& requestOperation, UTF8String url, bool isDebug )
+:	NetworkRequestState( new RequestCanceller( requestOperation ), url, isDebug )
+{
+}
+
+/// Creates the state of a request whose canceller was handed to Lua before the request was executed, such as a
+/// request that was queued by the scheduler.
+NetworkRequestState::NetworkRequestState( RequestCanceller *requestCanceller, UTF8String url, bool isDebug )
 {
 	fIsError = false;
 	fPhase = "began";
@@ -666,10 +904,13 @@ NetworkRequestState::NetworkRequestState(const std::shared_ptr<WinHttpRequestOpe
 	fRequestURL = url;
 	fResponseType = "text";
 	fResponseBody.bodyType = TYPE_NONE;
-	fRequestCanceller = new RequestCanceller( requestOperation );
+	fRequestCanceller = requestCanceller;
 	fRequestCanceller->AddRef();
 	fBytesEstimated = 0;
 	fBytesTransferred = 0;
+	fBytesDecoded = -1;
+	fBytesEncoded = -1;
+	fCacheResult = -1;
 
 	if ( isDebug )
 	{
@@ -680,35 +921,8 @@ NetworkRequestState::NetworkRequestState(const std::shared_ptr<WinHttpRequestOpe
 
 NetworkRequestState::~NetworkRequestState( )
 {
-	// Clean up response body...
-	//
 	debug("Deleting network request state");
-	switch (fResponseBody.bodyType)
-	{
-		case TYPE_STRING:
-		{
-			delete fResponseBody.bodyString;
-			fResponseBody.bodyString = NULL;
-			fResponseBody.bodyType = TYPE_NONE;
-		}
-		break;
-
-		case TYPE_BYTES:
-		{
-			delete fResponseBody.bodyBytes;
-			fResponseBody.bodyBytes = NULL;
-			fResponseBody.bodyType = TYPE_NONE;
-		}
-		break;
-
-		case TYPE_FILE:
-		{
-			delete fResponseBody.bodyFile;
-			fResponseBody.bodyFile = NULL;
-			fResponseBody.bodyType = TYPE_NONE;
-		}
-		break;
-	}
+	releaseResponseBody();
 
 	fRequestCanceller->Release();
 }
@@ -734,75 +948,60 @@ void NetworkRequestState::setStatus( int status )
 	fStatus = status;
 }
 
-void NetworkRequestState::setResponseHeaders( const char *headers )
+void NetworkRequestState::setResponseHeaders( const char *headers, size_t length )
 {
 	// This is the raw header body (all headers, separated by CRLF, double CRLF at the end).
 	// This first line will typically be the status line.
 	//
-	const char *headerDelims = "\r\n";
-	char *_headers = _strdup(headers);
+	fResponseHeaders.clear();
+	fResponseHeaders.parse(headers, length);
+}
 
-	char *nextHeader = NULL;
-	char *header = strtok_s(_headers, headerDelims, &nextHeader);
-	while (header)
-	{
-		char *value = NULL;
-		char *key = strtok_s(header, ":", &value);
+void NetworkRequestState::setResponseType( const char *responseType )
+{
+	fResponseType = responseType;
+}
 
-		if (NULL != value)
-		{
-			value = trimWhitespace(value);
-			if (0 == *value)
-			{
-				value = NULL;
-			}
-		}
+void NetworkRequestState::setBytesEstimated( long long nBytesEstimated )
+{
+	fBytesEstimated = nBytesEstimated;
+}
 
-		if (value == NULL)
-		{
-			value = key;
-			key = "HTTP-STATUS-LINE";
-		}
-
-		debug("Found header key: %s, value: %s", key, value);
-
-		// We have to concatenate multiple Set-Cookie headers because of the
-		// data structure used to save the headers
-		if (strcmp(key, "Set-Cookie") == 0 && ! fResponseHeaders[key].empty())
-		{
-			// Separate multiple cookies by a single comma (no space)
-			fResponseHeaders[key] += ",";
-			fResponseHeaders[key] += value;
-		}
-		else
-		{
-			fResponseHeaders[key] = value;
-		}
-
-		header = strtok_s(NULL, headerDelims, &nextHeader);
-	}
+void NetworkRequestState::setBytesTransferred( long long nBytesTransferred )
+{
+	fBytesTransferred = nBytesTransferred;
+}
 
-	free(_headers);
+void NetworkRequestState::incrementBytesTransferred( int newBytesTransferred )
+{
+	fBytesTransferred += newBytesTransferred;
 }
 
-void NetworkRequestState::setResponseType( const char *responseType )
+/// Sets the number of response body bytes after undoing the response's content coding, which is reported to Lua
+/// as "bytesDecoded" next to the number of bytes received ("bytesTransferred"). Not reported unless set.
+void NetworkRequestState::setBytesDecoded( long long nBytesDecoded )
 {
-	fResponseType = responseType;
+	fBytesDecoded = nBytesDecoded;
 }
 
-void NetworkRequestState::setBytesEstimated( long long nBytesEstimated )
+void NetworkRequestState::incrementBytesDecoded( long long newBytesDecoded )
 {
-	fBytesEstimated = nBytesEstimated;
+	fBytesDecoded += newBytesDecoded;
 }
 
-void NetworkRequestState::setBytesTransferred( long long nBytesTransferred )
+/// Sets the number of compressed request body bytes sent, which is reported to Lua as "bytesEncoded" next to the
+/// number of bytes of the body before compression ("bytesTransferred"). Not reported unless set.
+void NetworkRequestState::setBytesEncoded( long long nBytesEncoded )
 {
-	fBytesTransferred = nBytesTransferred;
+	fBytesEncoded = nBytesEncoded;
 }
 
-void NetworkRequestState::incrementBytesTransferred( int newBytesTransferred )
+/// Sets how the response cache was used for a request made with params.cache, which is reported to Lua as
+/// "cacheHit" (the response came from the cache) and "revalidated" (the server confirmed it was still valid).
+/// Not reported unless set.
+void NetworkRequestState::setCacheResult( bool isCacheHit, bool wasRevalidated )
 {
-	fBytesTransferred += newBytesTransferred;
+	fCacheResult = ( isCacheHit ? 1 : 0 ) | ( wasRevalidated ? 2 : 0 );
 }
 
 void NetworkRequestState::setDebugValue( char *debugKey, char *debugValue )
@@ -819,22 +1018,41 @@ bool NetworkRequestState::isError( )
 	return fIsError;
 }
 
-StringMap NetworkRequestState::getResponseHeaders( )
+bool NetworkRequestState::isDebug( )
+{
+	return ( fDebugValues.size() > 0 );
+}
+
+/// Gets the status of the response, or -1 if it has not arrived.
+int NetworkRequestState::getStatus( )
+{
+	return fStatus;
+}
+
+long long NetworkRequestState::getBytesTransferred( )
+{
+	return fBytesTransferred;
+}
+
+const HttpHeaderTable& NetworkRequestState::getResponseHeaders( )
 {
 	return fResponseHeaders;
 }
 
+/// Gets the value of the response header with the given name (ignoring case), or NULL if the response has none.
+/// If the header was repeated, the last value is returned. The value stays valid until the headers change.
+const char* NetworkRequestState::findResponseHeaderValue( const char *headerKey )
+{
+	return fResponseHeaders.getValue(headerKey);
+}
+
 UTF8String NetworkRequestState::getResponseHeaderValue( const char *headerKey )
 {
 	UTF8String value;
-	StringMap::iterator iter;
-	for (iter = fResponseHeaders.begin(); iter != fResponseHeaders.end(); iter++)
+	const char *headerValue = fResponseHeaders.getValue(headerKey);
+	if (NULL != headerValue)
 	{
-		UTF8String key = (*iter).first;
-		if (_strcmpi(key.c_str(), headerKey) == 0)
-		{
-			value = (*iter).second;
-		}
+		value = headerValue;
 	}
 
 	return value;
@@ -845,6 +1063,56 @@ Body* NetworkRequestState::getResponseBody( )
 	return &fResponseBody;
 }
 
+/// Gets the response's Content-Length header value, or -1 if the response has none.
+long long NetworkRequestState::getResponseContentLength( )
+{
+	const char *contentLengthText = fResponseHeaders.getValue("Content-Length");
+	if ((NULL != contentLengthText) && (0 != *contentLengthText))
+	{
+		return _strtoi64(contentLengthText, NULL, 10);
+	}
+	return -1;
+}
+
+/// Frees the response body. Called once the body has been handed to Lua, so that a large response
+/// is not kept in memory twice until the request's resources are released.
+void NetworkRequestState::releaseResponseBody( )
+{
+	switch (fResponseBody.bodyType)
+	{
+		case TYPE_STRING:
+		{
+			delete fResponseBody.bodyString;
+			fResponseBody.bodyString = NULL;
+			fResponseBody.bodyType = TYPE_NONE;
+		}
+		break;
+
+		case TYPE_BYTES:
+		{
+			delete fResponseBody.bodyBytes;
+			fResponseBody.bodyBytes = NULL;
+			fResponseBody.bodyType = TYPE_NONE;
+		}
+		break;
+
+		case TYPE_FILE:
+		{
+			delete fResponseBody.bodyFile;
+			fResponseBody.bodyFile = NULL;
+			fResponseBody.bodyType = TYPE_NONE;
+		}
+		break;
+
+		case TYPE_NONE:
+		case TYPE_LUA_STRING:
+		case TYPE_MULTIPART:
+		case TYPE_STREAM:
+			// No body, or a type only request bodies have.
+			break;
+	}
+}
+
 const char* NetworkRequestState::getPhase( )
 {
 	return fPhase.c_str();
@@ -856,6 +1124,13 @@ RequestCanceller* NetworkRequestState::getRequestCanceller( )
 }
 
 int NetworkRequestState::pushToLuaState( lua_State *luaState )
+{
+	return pushToLuaState( luaState, fRequestCanceller );
+}
+
+/// Pushes the state as the event of the request with the given canceller, which is either this state's request
+/// or a request coalesced onto it (see CoalescedRequest).
+int NetworkRequestState::pushToLuaState( lua_State *luaState, RequestCanceller *requestCanceller )
 {
 	int luaTableStackIndex = lua_gettop( luaState );
 	int nPushed = 0;
@@ -873,14 +1148,31 @@ int NetworkRequestState::pushToLuaState( lua_State *luaState )
 		lua_createtable( luaState, 0, fResponseHeaders.size() );
 		int luaHeaderTableStackIndex = lua_gettop( luaState );
 
-		StringMap::iterator iter;
-		for (iter = fResponseHeaders.begin(); iter != fResponseHeaders.end(); iter++)
+		for (size_t index = 0; index < fResponseHeaders.size(); index++)
 		{
-			UTF8String key = (*iter).first;
-			UTF8String value = (*iter).second;
+			const char *key = fResponseHeaders.getName( index );
 
-			lua_pushstring( luaState, value.c_str() );
-			lua_setfield( luaState, luaHeaderTableStackIndex, key.c_str() );
+			lua_pushlstring( luaState, fResponseHeaders.getValue( index ), fResponseHeaders.getValueLength( index ) );
+
+			// A repeated header replaces the earlier one, except for Set-Cookie, where all of the cookies
+			// are kept, separated by a single comma (no space).
+			if (strcmp(key, "Set-Cookie") == 0)
+			{
+				lua_getfield( luaState, luaHeaderTableStackIndex, key );
+				if ( lua_isstring( luaState, -1 ) )
+				{
+					lua_insert( luaState, -2 );
+					lua_pushstring( luaState, "," );
+					lua_insert( luaState, -2 );
+					lua_concat( luaState, 3 );
+				}
+				else
+				{
+					lua_pop( luaState, 1 );
+				}
+			}
+
+			lua_setfield( luaState, luaHeaderTableStackIndex, key );
 		}
 		
 		lua_setfield( luaState, luaTableStackIndex, "responseHeaders" );
@@ -897,7 +1189,8 @@ int NetworkRequestState::pushToLuaState( lua_State *luaState )
 		{
 			case TYPE_STRING:
 			{
-				lua_pushstring( luaState, fResponseBody.bodyString->c_str() );
+				// Pushed with its length, since a response body may contain embedded nulls.
+				lua_pushlstring( luaState, fResponseBody.bodyString->data(), fResponseBody.bodyString->size() );
 			}
 			break;
 
@@ -931,6 +1224,16 @@ int NetworkRequestState::pushToLuaState( lua_State *luaState )
 				lua_setfield( luaState, luaResponseTableStackIndex, "fullPath" );
 			}
 			break;
+
+			case TYPE_NONE:
+			case TYPE_LUA_STRING:
+			case TYPE_MULTIPART:
+			case TYPE_STREAM:
+			{
+				// Only request bodies are of these types.
+				lua_pushnil( luaState );
+			}
+			break;
 		}
 
 		lua_setfield( luaState, luaTableStackIndex, "response" );
@@ -945,13 +1248,20 @@ int NetworkRequestState::pushToLuaState( lua_State *luaState )
 	lua_setfield( luaState, luaTableStackIndex, "url" );
 	nPushed++;
 
-	if ( fRequestCanceller )
+	if ( requestCanceller )
 	{
-		fRequestCanceller->pushToLuaState( luaState );
+		requestCanceller->pushToLuaState( luaState );
 		lua_setfield( luaState, luaTableStackIndex, "requestId" );
 		nPushed++;
 	}
 
+	if ( requestCanceller != fRequestCanceller )
+	{
+		lua_pushboolean( luaState, 1 );
+		lua_setfield( luaState, luaTableStackIndex, "coalesced" );
+		nPushed++;
+	}
+
 	lua_pushnumber( luaState, (lua_Number)fBytesTransferred );
 	lua_setfield( luaState, luaTableStackIndex, "bytesTransferred" );
 	nPushed++;
@@ -960,6 +1270,31 @@ int NetworkRequestState::pushToLuaState( lua_State *luaState )
 	lua_setfield( luaState, luaTableStackIndex, "bytesEstimated" );
 	nPushed++;
 
+	if ( fBytesDecoded >= 0 )
+	{
+		lua_pushnumber( luaState, (lua_Number)fBytesDecoded );
+		lua_setfield( luaState, luaTableStackIndex, "bytesDecoded" );
+		nPushed++;
+	}
+
+	if ( fBytesEncoded >= 0 )
+	{
+		lua_pushnumber( luaState, (lua_Number)fBytesEncoded );
+		lua_setfield( luaState, luaTableStackIndex, "bytesEncoded" );
+		nPushed++;
+	}
+
+	if ( fCacheResult >= 0 )
+	{
+		lua_pushboolean( luaState, ( 0 != ( fCacheResult & 1 ) ) );
+		lua_setfield( luaState, luaTableStackIndex, "cacheHit" );
+		nPushed++;
+
+		lua_pushboolean( luaState, ( 0 != ( fCacheResult & 2 ) ) );
+		lua_setfield( luaState, luaTableStackIndex, "revalidated" );
+		nPushed++;
+	}
+
 	if ( fDebugValues.size() > 0 )
 	{
 		lua_createtable( luaState, 0, fDebugValues.size() );
@@ -1020,6 +1355,13 @@ LuaCallback::~LuaCallback()
 }
 
 bool LuaCallback::callWithNetworkRequestState( NetworkRequestState *networkRequestState )
+{
+	return callWithNetworkRequestState( networkRequestState, networkRequestState->getRequestCanceller() );
+}
+
+/// Calls the callback with the given state as the event of the request with the given canceller, which may be a
+/// request coalesced onto the state's own request.
+bool LuaCallback::callWithNetworkRequestState( NetworkRequestState *networkRequestState, RequestCanceller *requestCanceller )
 {
 	if ( NULL == fLuaReference )
 	{
@@ -1035,7 +1377,7 @@ bool LuaCallback::callWithNetworkRequestState( NetworkRequestState *networkReque
 	//   Note: In practice, the request cancel is immediate and we never see this case,
 	//         but we'll leave this in just in case it is possible with specific timing...
 	//
-	if ( networkRequestState->getRequestCanceller()->isCancelled() )
+	if ( requestCanceller->isCancelled() )
 	{
 		debug("Attempt to post call to callback after cancelling, ignoring");
 		return false; // We did not post the callback
@@ -1046,7 +1388,7 @@ bool LuaCallback::callWithNetworkRequestState( NetworkRequestState *networkReque
 	//
 	DWORD currentTime = GetTickCount();
 	if ( ( networkRequestState->getPhase() == fLastNotificationPhase ) && 
-		 ( WinTimer::CompareTicks( currentTime, fLastNotificationTime + fMinNotificationIntervalMs ) < 0 ) )
+		 ( compareTicks( currentTime, fLastNotificationTime + fMinNotificationIntervalMs ) < 0 ) )
 	{
 		debug("Attempt to post call to callback for phase \"%s\" within notification interval, ignoring", networkRequestState->getPhase());
 		return false; // We did not post the callback
@@ -1058,7 +1400,7 @@ bool LuaCallback::callWithNetworkRequestState( NetworkRequestState *networkReque
 	}
 
 	CoronaLuaNewEvent( fLuaState, "networkRequest" );
-	networkRequestState->pushToLuaState( fLuaState );
+	networkRequestState->pushToLuaState( fLuaState, requestCanceller );
 	debug("Dispatching event to callback...");
 	CoronaLuaDispatchEvent( fLuaState, fLuaReference, 0 );
 
@@ -1071,6 +1413,43 @@ void LuaCallback::unregister()
 	fLuaReference = NULL;
 }
 
+// --------------------------------------------------------------------------------------
+// LuaStringBody
+// --------------------------------------------------------------------------------------
+
+/// Pins the string at the given stack index, which must be a string.
+LuaStringBody::LuaStringBody( lua_State *luaState, int index, bool isText )
+{
+	// The reference is released on the main thread, even if the request was made from a coroutine.
+	lua_State *mainState = CoronaLuaGetCoronaThread( luaState );
+	fLuaState = ( NULL != mainState ) ? mainState : luaState;
+
+	fSize = 0;
+	fData = lua_tolstring( luaState, index, &fSize );
+	fLuaReference = CoronaLuaNewRef( luaState, index );
+	fIsText = isText;
+}
+
+LuaStringBody::~LuaStringBody()
+{
+	CoronaLuaDeleteRef( fLuaState, fLuaReference );
+}
+
+const char* LuaStringBody::getData( ) const
+{
+	return fData;
+}
+
+size_t LuaStringBody::getSize( ) const
+{
+	return fSize;
+}
+
+bool LuaStringBody::isText( ) const
+{
+	return fIsText;
+}
+
 // --------------------------------------------------------------------------------------
 // NetworkRequestParameters
 // --------------------------------------------------------------------------------------
@@ -1084,8 +1463,16 @@ NetworkRequestParameters::NetworkRequestParameters( lua_State *luaState )
 	fProgressDirection = None;
 	fIsBodyTypeText = true;
 	fTimeout = 30;
+	fReceiveBufferCount = NETWORK_DEFAULT_RECEIVE_BUFFER_COUNT;
+	fReceiveBufferSize = NETWORK_DEFAULT_RECEIVE_BUFFER_SIZE;
 	fIsDebug = false;
 	fHandleRedirects = true;
+	fIsCompressionEnabled = false;
+	fIsBodyCompressionEnabled = false;
+	fIsCacheEnabled = false;
+	fIsResumeEnabled = false;
+	fSegmentCount = 1;
+	fPriority = PriorityNormal;
 	fRequestBody.bodyType = TYPE_NONE;
 	fRequestBodySize = 0;
 	fResponseFile = NULL;
@@ -1266,6 +1653,8 @@ NetworkRequestParameters::NetworkRequestParameters( lua_State *luaState )
 			}
 			lua_pop( luaState, 1);
 
+			bool wasContentTypeHeaderGiven = wasRequestContentTypePresent;
+
 			//If this is a POST request and the user hasn't filled in the content-type
 			//we make an assumption (to preserve existing functionality)
 			if 	(fRequestHeaders.find("Content-Type") == fRequestHeaders.end() &&
@@ -1317,44 +1706,65 @@ NetworkRequestParameters::NetworkRequestParameters( lua_State *luaState )
 				{
 					case LUA_TSTRING:
 					{
+						// The string is sent as is, straight from Lua, unless a text body has to be transcoded to
+						// another charset (see transcodeRequestBody()).
+						//
 						if (fIsBodyTypeText)
 						{
 							debug("Request body from String (text)");
-							const char* requestValue = lua_tostring( luaState, -1);
-							fRequestBody.bodyType = TYPE_STRING;
-							fRequestBody.bodyString = new UTF8String( requestValue );
-							fRequestBodySize = fRequestBody.bodyString->size();
-
-							if (!wasRequestContentTypePresent)
-							{
-								fRequestHeaders["Content-Type"] = "text/plain; charset=UTF-8";
-								wasRequestContentTypePresent = true;
-							}
 						}
 						else
 						{
 							debug("Request body from String (binary)");
-							size_t dataSize;
-							const char* requestValue = lua_tolstring( luaState, -1, &dataSize );
-							fRequestBody.bodyType = TYPE_BYTES;
-							fRequestBody.bodyBytes = new ByteVector( dataSize );
-							memcpy(&fRequestBody.bodyBytes->at(0), requestValue, dataSize);
-							fRequestBodySize = dataSize;
-
-							if (!wasRequestContentTypePresent)
-							{
-								fRequestHeaders["Content-Type"] = "application/octet-stream";
-								wasRequestContentTypePresent = true;
-							}
+						}
+						fRequestBody.bodyType = TYPE_LUA_STRING;
+						fRequestBody.bodyLuaString = new LuaStringBody( luaState, -1, fIsBodyTypeText );
+						fRequestBodySize = fRequestBody.bodyLuaString->getSize();
+
+						if (!wasRequestContentTypePresent)
+						{
+							fRequestHeaders["Content-Type"] = fIsBodyTypeText ? "text/plain; charset=UTF-8" : "application/octet-stream";
+							wasRequestContentTypePresent = true;
 						}
 					}
 					break;
 
 					case LUA_TTABLE:
 					{
-						// Body type for body from file is always binary
+						// Body type for body from file (or from form parts) is always binary
 						//
 						fIsBodyTypeText = false;
+
+						lua_getfield( luaState, -1, "multipart" );
+						if (!lua_isnil( luaState, -1 ))
+						{
+							// The body names its own boundary in the Content-Type, so it can't be given one
+							//
+							if (wasContentTypeHeaderGiven)
+							{
+								paramValidationFailure( luaState, "Request Content-Type header must not be specified for a 'multipart' body, which sets its own" );
+								isInvalid = true;
+							}
+							else
+							{
+								MultipartBody *multipartBody = newMultipartBody( luaState, lua_gettop( luaState ) );
+								if ( NULL != multipartBody )
+								{
+									fRequestBody.bodyType = TYPE_MULTIPART;
+									fRequestBody.bodyMultipart = multipartBody;
+									fRequestBodySize = multipartBody->getSize();
+									fRequestHeaders["Content-Type"] = multipartBody->getContentType();
+									wasRequestContentTypePresent = true;
+								}
+								else
+								{
+									isInvalid = true;
+								}
+							}
+							lua_pop( luaState, 1 );
+							break;
+						}
+						lua_pop( luaState, 1 );
 						
 						// Extract filename/baseDirectory
 						//
@@ -1411,9 +1821,27 @@ NetworkRequestParameters::NetworkRequestParameters( lua_State *luaState )
 					}
 					break;
 
+					case LUA_TFUNCTION:
+					{
+						// A body of unknown length, which is pulled from the function as it is sent (see
+						// LuaRequestBodySource), and sent chunked.
+						//
+						debug("Request body from function");
+						fIsBodyTypeText = false;
+						fRequestBody.bodyType = TYPE_STREAM;
+						fRequestBody.bodyStream = new RequestBodyStream( new LuaRequestBodySource( luaState, -1 ) );
+
+						if (!wasRequestContentTypePresent)
+						{
+							fRequestHeaders["Content-Type"] = "application/octet-stream";
+							wasRequestContentTypePresent = true;
+						}
+					}
+					break;
+
 					default:
 					{
-						paramValidationFailure( luaState, "Either body string or table specifying body file is required if 'body' is specified" );
+						paramValidationFailure( luaState, "Either body string, table specifying body file (or multipart body), or body function is required if 'body' is specified" );
 						isInvalid = true;
 					}
 					break;
@@ -1522,6 +1950,61 @@ NetworkRequestParameters::NetworkRequestParameters( lua_State *luaState )
 				}
 			}
 			lua_pop( luaState, 1 );
+
+			lua_getfield( luaState, paramsTableStackIndex, "receiveBufferCount" );
+			if (!lua_isnil( luaState, -1 ))
+			{
+				if ( LUA_TNUMBER == lua_type( luaState, -1 ) )
+				{
+					fReceiveBufferCount = (int)lua_tonumber( luaState, -1 );
+					if ( fReceiveBufferCount < 1 )
+					{
+						fReceiveBufferCount = 1;
+					}
+					else if ( fReceiveBufferCount > NETWORK_MAX_RECEIVE_BUFFER_COUNT )
+					{
+						fReceiveBufferCount = NETWORK_MAX_RECEIVE_BUFFER_COUNT;
+					}
+					debug("Receive buffer count provided, was: %i", fReceiveBufferCount);
+				}
+				else
+				{
+					paramValidationFailure( luaState, "'receiveBufferCount' value of params table, if provided, should be a numeric value (got %s)", lua_typename(luaState, lua_type(luaState, -1)) );
+					isInvalid = true;
+				}
+			}
+			lua_pop( luaState, 1 );
+
+			lua_getfield( luaState, paramsTableStackIndex, "receiveBufferSize" );
+			if (!lua_isnil( luaState, -1 ))
+			{
+				if ( LUA_TNUMBER == lua_type( luaState, -1 ) )
+				{
+					fReceiveBufferSize = (int)lua_tonumber( luaState, -1 );
+					if ( fReceiveBufferSize < NETWORK_MIN_RECEIVE_BUFFER_SIZE )
+					{
+						fReceiveBufferSize = NETWORK_MIN_RECEIVE_BUFFER_SIZE;
+					}
+					else if ( fReceiveBufferSize > NETWORK_MAX_RECEIVE_BUFFER_SIZE )
+					{
+						fReceiveBufferSize = NETWORK_MAX_RECEIVE_BUFFER_SIZE;
+					}
+					debug("Receive buffer size provided, was: %i", fReceiveBufferSize);
+				}
+				else
+				{
+					paramValidationFailure( luaState, "'receiveBufferSize' value of params table, if provided, should be a numeric value (got %s)", lua_typename(luaState, lua_type(luaState, -1)) );
+					isInvalid = true;
+				}
+			}
+			lua_pop( luaState, 1 );
+
+			// Fewer buffers are used if all of them would hold more than NETWORK_MAX_RECEIVE_BUFFER_BYTES.
+			if ( fReceiveBufferCount > NETWORK_MAX_RECEIVE_BUFFER_BYTES / fReceiveBufferSize )
+			{
+				fReceiveBufferCount = NETWORK_MAX_RECEIVE_BUFFER_BYTES / fReceiveBufferSize;
+				debug("Receive buffer count reduced to: %i", fReceiveBufferCount);
+			}
 			
 			fIsDebug = false;
 			lua_getfield( luaState, paramsTableStackIndex, "debug" );
@@ -1544,37 +2027,289 @@ NetworkRequestParameters::NetworkRequestParameters( lua_State *luaState )
 				}
 			}
 			lua_pop( luaState, 1 );
-		}
-		else
-		{
-			paramValidationFailure( luaState, "Fourth argument to network.request(), if provided, should be a params table (got %s)", lua_typename(luaState, lua_type(luaState, -1)) );
-			isInvalid = true;
-		}
-	}
-
-	fIsValid = !isInvalid;
-}
 
-NetworkRequestParameters::~NetworkRequestParameters()
-{
-	// Clean up request body...
-	//
-	switch (fRequestBody.bodyType)
-	{
-		case TYPE_STRING:
-		{
-			delete fRequestBody.bodyString;
-			fRequestBody.bodyString = NULL;
-			fRequestBody.bodyType = TYPE_NONE;
-		}
-		break;
+			lua_getfield( luaState, paramsTableStackIndex, "compression" );
+			if (!lua_isnil( luaState, -1 ))
+			{
+				if ( LUA_TSTRING == lua_type( luaState, -1 ) )
+				{
+					const char *compression = lua_tostring( luaState, -1 );
+					if ( _strcmpi( "auto", compression ) == 0 )
+					{
+						fIsCompressionEnabled = true;
+					}
+					else if ( _strcmpi( "none", compression ) != 0 )
+					{
+						paramValidationFailure( luaState, "'compression' value of params table, if provided, should be \"auto\" or \"none\" (got \"%s\")", compression );
+						isInvalid = true;
+					}
+				}
+				else
+				{
+					paramValidationFailure( luaState, "'compression' value of params table, if provided, should be a string value (got %s)", lua_typename(luaState, lua_type(luaState, -1)) );
+					isInvalid = true;
+				}
+			}
+			lua_pop( luaState, 1 );
 
-		case TYPE_BYTES:
-		{
-			delete fRequestBody.bodyBytes;
-			fRequestBody.bodyBytes = NULL;
-			fRequestBody.bodyType = TYPE_NONE;
-		}
+			lua_getfield( luaState, paramsTableStackIndex, "bodyCompression" );
+			if (!lua_isnil( luaState, -1 ))
+			{
+				if ( LUA_TSTRING == lua_type( luaState, -1 ) )
+				{
+					const char *bodyCompression = lua_tostring( luaState, -1 );
+					if ( _strcmpi( "gzip", bodyCompression ) == 0 )
+					{
+						fIsBodyCompressionEnabled = true;
+					}
+					else if ( _strcmpi( "none", bodyCompression ) != 0 )
+					{
+						paramValidationFailure( luaState, "'bodyCompression' value of params table, if provided, should be \"gzip\" or \"none\" (got \"%s\")", bodyCompression );
+						isInvalid = true;
+					}
+				}
+				else
+				{
+					paramValidationFailure( luaState, "'bodyCompression' value of params table, if provided, should be a string value (got %s)", lua_typename(luaState, lua_type(luaState, -1)) );
+					isInvalid = true;
+				}
+
+				if ( fIsBodyCompressionEnabled && ( NULL != getRequestHeaderValue("Content-Encoding") ) )
+				{
+					paramValidationFailure( luaState, "'bodyCompression' value of params table cannot be used with a Content-Encoding request header" );
+					isInvalid = true;
+				}
+			}
+			lua_pop( luaState, 1 );
+
+			lua_getfield( luaState, paramsTableStackIndex, "priority" );
+			if (!lua_isnil( luaState, -1 ))
+			{
+				if ( LUA_TSTRING == lua_type( luaState, -1 ) )
+				{
+					const char *priority = lua_tostring( luaState, -1 );
+					fPriority = getRequestPriorityFromString( priority );
+					if ( PriorityUnknown == fPriority )
+					{
+						paramValidationFailure( luaState, "'priority' value of params table, if provided, should be \"high\", \"normal\", \"low\" or \"background\" (got \"%s\")", priority );
+						fPriority = PriorityNormal;
+						isInvalid = true;
+					}
+				}
+				else
+				{
+					paramValidationFailure( luaState, "'priority' value of params table, if provided, should be a string value (got %s)", lua_typename(luaState, lua_type(luaState, -1)) );
+					isInvalid = true;
+				}
+			}
+			lua_pop( luaState, 1 );
+
+			lua_getfield( luaState, paramsTableStackIndex, "cache" );
+			if (!lua_isnil( luaState, -1 ))
+			{
+				if ( LUA_TBOOLEAN == lua_type( luaState, -1 ) )
+				{
+					fIsCacheEnabled = ( 0 != lua_toboolean( luaState, -1 ) );
+				}
+				else
+				{
+					paramValidationFailure( luaState, "'cache' value of params table, if provided, should be a boolean value (got %s)", lua_typename(luaState, lua_type(luaState, -1)) );
+					isInvalid = true;
+				}
+			}
+			lua_pop( luaState, 1 );
+
+			if ( fIsCacheEnabled )
+			{
+				// The cache lives in its own directory under system.CachesDirectory.
+				void *cachesDirectory = NULL;
+				lua_getglobal( luaState, "system" );
+				if ( LUA_TTABLE == lua_type( luaState, -1 ) )
+				{
+					lua_getfield( luaState, -1, "CachesDirectory" );
+					cachesDirectory = lua_touserdata( luaState, -1 );
+					lua_pop( luaState, 1 );
+				}
+				lua_pop( luaState, 1 );
+
+				int	numParams = 1;
+				lua_getglobal( luaState, "_network_pathForFile" );
+				lua_pushstring( luaState, HTTP_RESPONSE_CACHE_DIRECTORY_NAME );  // Push argument #1
+				if ( cachesDirectory )
+				{
+					lua_pushlightuserdata( luaState, cachesDirectory ); // Push argument #2
+					numParams++;
+				}
+
+				Corona::Lua::DoCall( luaState, numParams, 2); // 1/2 arguments, 2 returns
+
+				const char *path = lua_tostring( luaState, -2 );
+				if ( NULL != path )
+				{
+					fCacheDirectory = path;
+				}
+				else
+				{
+					fIsCacheEnabled = false;
+				}
+				lua_pop( luaState, 2 ); // Pop results
+
+				debug("Response cache directory: %s", fCacheDirectory.c_str());
+			}
+
+			lua_getfield( luaState, paramsTableStackIndex, "resume" );
+			if (!lua_isnil( luaState, -1 ))
+			{
+				if ( LUA_TBOOLEAN == lua_type( luaState, -1 ) )
+				{
+					fIsResumeEnabled = ( 0 != lua_toboolean( luaState, -1 ) );
+				}
+				else
+				{
+					paramValidationFailure( luaState, "'resume' value of params table, if provided, should be a boolean value (got %s)", lua_typename(luaState, lua_type(luaState, -1)) );
+					isInvalid = true;
+				}
+
+				if ( fIsResumeEnabled && ( ( NULL == fResponseFile ) || ( 0 != _strcmpi( "GET", fMethod.c_str() ) ) ) )
+				{
+					paramValidationFailure( luaState, "'resume' value of params table can only be used by a GET request with a 'response' file" );
+					fIsResumeEnabled = false;
+					isInvalid = true;
+				}
+			}
+			lua_pop( luaState, 1 );
+
+			lua_getfield( luaState, paramsTableStackIndex, "segments" );
+			if (!lua_isnil( luaState, -1 ))
+			{
+				if ( LUA_TNUMBER == lua_type( luaState, -1 ) )
+				{
+					fSegmentCount = (int)lua_tonumber( luaState, -1 );
+					if ( fSegmentCount < 1 )
+					{
+						fSegmentCount = 1;
+					}
+					else if ( fSegmentCount > NETWORK_MAX_DOWNLOAD_SEGMENTS )
+					{
+						fSegmentCount = NETWORK_MAX_DOWNLOAD_SEGMENTS;
+					}
+					debug("Download segments provided, was: %i", fSegmentCount);
+				}
+				else
+				{
+					paramValidationFailure( luaState, "'segments' value of params table, if provided, should be a numeric value (got %s)", lua_typename(luaState, lua_type(luaState, -1)) );
+					isInvalid = true;
+				}
+
+				if ( ( fSegmentCount > 1 ) && ( ( NULL == fResponseFile ) || ( 0 != _strcmpi( "GET", fMethod.c_str() ) ) ) )
+				{
+					paramValidationFailure( luaState, "'segments' value of params table can only be greater than 1 for a GET request with a 'response' file" );
+					fSegmentCount = 1;
+					isInvalid = true;
+				}
+				else if ( ( fSegmentCount > 1 ) && ( fIsCacheEnabled || fIsResumeEnabled ) )
+				{
+					paramValidationFailure( luaState, "'segments' value of params table can't be greater than 1 along with a 'cache' or 'resume' value of true" );
+					fSegmentCount = 1;
+					isInvalid = true;
+				}
+			}
+			lua_pop( luaState, 1 );
+		}
+		else
+		{
+			paramValidationFailure( luaState, "Fourth argument to network.request(), if provided, should be a params table (got %s)", lua_typename(luaState, lua_type(luaState, -1)) );
+			isInvalid = true;
+		}
+	}
+
+	fIsValid = !isInvalid;
+	if ( fIsValid )
+	{
+		prepareRequestHeaders();
+	}
+}
+
+/// Creates the parameters of a request made by a segmented download (see SegmentedDownload) for one of its
+/// segments, from the download's parameters. The request has no listener, as its events go to the segment.
+NetworkRequestParameters::NetworkRequestParameters( NetworkRequestParameters *requestParams, const std::shared_ptr<DownloadSegment>& downloadSegment )
+:	fDownloadSegment( downloadSegment )
+{
+	bool isWhole = ( DownloadSegment::kKindWhole == downloadSegment->getKind() );
+
+	fRequestUrl = requestParams->fRequestUrl;
+	fMethod = ( DownloadSegment::kKindProbe == downloadSegment->getKind() ) ? "HEAD" : requestParams->fMethod;
+	fProgressDirection = isWhole ? requestParams->fProgressDirection : Download;
+	fRequestHeaders = requestParams->fRequestHeaders;
+	fIsBodyTypeText = true;
+	fTimeout = requestParams->fTimeout;
+	fReceiveBufferCount = requestParams->fReceiveBufferCount;
+	fReceiveBufferSize = requestParams->fReceiveBufferSize;
+	fIsDebug = requestParams->fIsDebug;
+	fRequestBody.bodyType = TYPE_NONE;
+	fRequestBodySize = 0;
+	fResponseFile = ( isWhole && ( NULL != requestParams->fResponseFile ) ) ? new CoronaFileSpec( requestParams->fResponseFile ) : NULL;
+	fLuaCallback = NULL;
+	fIsValid = true;
+	fHandleRedirects = requestParams->fHandleRedirects;
+	fIsCompressionEnabled = isWhole && requestParams->fIsCompressionEnabled;
+	fIsBodyCompressionEnabled = false;
+	fIsCacheEnabled = false;
+	fIsResumeEnabled = false;
+	fSegmentCount = 1;
+	fPriority = requestParams->fPriority;
+
+	// The segments split the download's receive buffer limit between them, rather than each getting all of it.
+	int segmentBufferBytes = NETWORK_MAX_RECEIVE_BUFFER_BYTES / requestParams->fSegmentCount;
+	if ( fReceiveBufferSize > segmentBufferBytes )
+	{
+		fReceiveBufferSize = segmentBufferBytes;
+	}
+	if ( fReceiveBufferCount > segmentBufferBytes / fReceiveBufferSize )
+	{
+		fReceiveBufferCount = segmentBufferBytes / fReceiveBufferSize;
+	}
+
+	// The probe and the ranges ask for the body as is, since ranges of a compressed body can't be put together.
+	if ( !isWhole )
+	{
+		StringMap::iterator iter = fRequestHeaders.begin();
+		while ( iter != fRequestHeaders.end() )
+		{
+			if ( 0 == _strcmpi( "Accept-Encoding", (*iter).first.c_str() ) )
+			{
+				fRequestHeaders.erase( iter++ );
+			}
+			else
+			{
+				iter++;
+			}
+		}
+		fRequestHeaders["Accept-Encoding"] = "identity";
+	}
+	prepareRequestHeaders();
+}
+
+NetworkRequestParameters::~NetworkRequestParameters()
+{
+	// Clean up request body...
+	//
+	switch (fRequestBody.bodyType)
+	{
+		case TYPE_STRING:
+		{
+			delete fRequestBody.bodyString;
+			fRequestBody.bodyString = NULL;
+			fRequestBody.bodyType = TYPE_NONE;
+		}
+		break;
+
+		case TYPE_BYTES:
+		{
+			delete fRequestBody.bodyBytes;
+			fRequestBody.bodyBytes = NULL;
+			fRequestBody.bodyType = TYPE_NONE;
+		}
 		break;
 
 		case TYPE_FILE:
@@ -1584,6 +2319,33 @@ NetworkRequestParameters::~NetworkRequestParameters()
 			fRequestBody.bodyType = TYPE_NONE;
 		}
 		break;
+
+		case TYPE_LUA_STRING:
+		{
+			delete fRequestBody.bodyLuaString;
+			fRequestBody.bodyLuaString = NULL;
+			fRequestBody.bodyType = TYPE_NONE;
+		}
+		break;
+
+		case TYPE_MULTIPART:
+		{
+			delete fRequestBody.bodyMultipart;
+			fRequestBody.bodyMultipart = NULL;
+			fRequestBody.bodyType = TYPE_NONE;
+		}
+		break;
+
+		case TYPE_STREAM:
+		{
+			delete fRequestBody.bodyStream;
+			fRequestBody.bodyStream = NULL;
+			fRequestBody.bodyType = TYPE_NONE;
+		}
+		break;
+
+		case TYPE_NONE:
+			break;
 	}
 
 	if ( NULL != fLuaCallback )
@@ -1607,22 +2369,249 @@ ProgressDirection NetworkRequestParameters::getProgressDirection( )
 	return fProgressDirection;
 }
 
-UTF8String NetworkRequestParameters::getRequestHeaderString( )
+/// Finishes the request headers once the parameters have been validated, and serializes them into the block sent
+/// with the request, so that executing the request doesn't have to build it.
+void NetworkRequestParameters::prepareRequestHeaders( )
 {
-	UTF8String requestHeaders;
+	// A text body is sent in the charset named by the Content-Type header (the request operation transcodes it),
+	// and in utf-8 if there is none, in which case we say so explicitly.
+	//
+	if ( isRequestBodyText() )
+	{
+		UTF8String *contentTypeValue = getRequestHeaderValue("Content-Type");
+		if (NULL != contentTypeValue)
+		{
+			char *contentEncoding = getContentTypeEncoding( contentTypeValue->c_str() );
+			if ( NULL != contentEncoding )
+			{
+				free(contentEncoding);
+			}
+			else
+			{
+				// No charset provided, adding explicit UTF-8
+				contentTypeValue->append("; charset=UTF-8");
+			}
+		}
+	}
+
+	// A compressed body says so. It is sent chunked, since its size is only known once it has all been compressed,
+	// which is up to the request operation. There is nothing to gain from compressing an empty body, while the size
+	// of a streamed body is not known at all.
+	//
+	if ( ( TYPE_NONE == fRequestBody.bodyType ) || ( ( TYPE_STREAM != fRequestBody.bodyType ) && ( fRequestBodySize <= 0 ) ) )
+	{
+		fIsBodyCompressionEnabled = false;
+	}
+	if ( fIsBodyCompressionEnabled )
+	{
+		fRequestHeaders["Content-Encoding"] = "gzip";
+	}
 
+	// Advertise the content codings we can decode, unless the caller asked for specific ones.
+	//
+	if ( fIsCompressionEnabled && ( NULL == getRequestHeaderValue("Accept-Encoding") ) )
+	{
+		fRequestHeaders["Accept-Encoding"] = CONTENT_DECODER_ACCEPT_ENCODING;
+	}
+
+	size_t headersLength = 0;
 	StringMap::iterator iter;
 	for (iter = fRequestHeaders.begin(); iter != fRequestHeaders.end(); iter++)
 	{
-		UTF8String key = (*iter).first;
-		UTF8String value = (*iter).second;
+		headersLength += (*iter).first.size() + (*iter).second.size() + 4;
+	}
+
+	fRequestHeaderString.clear();
+	fRequestHeaderString.reserve(headersLength);
+	for (iter = fRequestHeaders.begin(); iter != fRequestHeaders.end(); iter++)
+	{
+		fRequestHeaderString.append((*iter).first);
+		fRequestHeaderString.append(": ", 2);
+		fRequestHeaderString.append((*iter).second);
+		fRequestHeaderString.append("\r\n", 2);
+	}
+
+#ifdef _WIN32
+	fWideRequestHeaderString.clear();
+	if (fRequestHeaderString.size() > 0)
+	{
+		int wideLength = MultiByteToWideChar(CP_UTF8, 0, fRequestHeaderString.c_str(), (int)fRequestHeaderString.size(), NULL, 0);
+		if (wideLength > 0)
+		{
+			fWideRequestHeaderString.resize(wideLength);
+			MultiByteToWideChar(CP_UTF8, 0, fRequestHeaderString.c_str(), (int)fRequestHeaderString.size(), &fWideRequestHeaderString[0], wideLength);
+		}
+	}
+#endif
+}
+
+/// Returns true if the request body is text, which is sent in the charset named by its Content-Type header.
+bool NetworkRequestParameters::isRequestBodyText( )
+{
+	return ( TYPE_STRING == fRequestBody.bodyType ) ||
+		( ( TYPE_LUA_STRING == fRequestBody.bodyType ) && fRequestBody.bodyLuaString->isText() );
+}
+
+/// Builds a multipart/form-data body (params.body.multipart) from the list of parts at the given stack index. Each
+/// part is a table with a "name" and either a string "value" or a "filename" (and optional "baseDirectory") naming a
+/// file to send, and may give the part's "contentType".
+/// @return Returns the body, or NULL (once the validation failure has been reported) if the parts are invalid.
+MultipartBody* NetworkRequestParameters::newMultipartBody( lua_State *luaState, int partsIndex )
+{
+	if ( LUA_TTABLE != lua_type( luaState, partsIndex ) )
+	{
+		paramValidationFailure( luaState, "body 'multipart' value should be a table of parts (got %s)", lua_typename(luaState, lua_type(luaState, partsIndex)) );
+		return NULL;
+	}
+
+	MultipartBody *multipartBody = new MultipartBody();
+	if ( !multipartBody->hasBoundary() )
+	{
+		paramValidationFailure( luaState, "body 'multipart' boundary could not be generated" );
+		delete multipartBody;
+		return NULL;
+	}
+	bool isInvalid = false;
+	int partNumber = 1;
+	for ( ; !isInvalid; partNumber++ )
+	{
+		lua_rawgeti( luaState, partsIndex, partNumber );
+		if ( lua_isnil( luaState, -1 ) )
+		{
+			lua_pop( luaState, 1 );
+			break;
+		}
+		if ( LUA_TTABLE != lua_type( luaState, -1 ) )
+		{
+			paramValidationFailure( luaState, "body 'multipart' part %d should be a table (got %s)", partNumber, lua_typename(luaState, lua_type(luaState, -1)) );
+			isInvalid = true;
+			lua_pop( luaState, 1 );
+			break;
+		}
+		int partIndex = lua_gettop( luaState );
+
+		UTF8String name;
+		lua_getfield( luaState, partIndex, "name" ); // required
+		if ( LUA_TSTRING == lua_type( luaState, -1 ) )
+		{
+			name = lua_tostring( luaState, -1 );
+		}
+		else
+		{
+			paramValidationFailure( luaState, "body 'multipart' part %d 'name' value is required and must be a string value", partNumber );
+			isInvalid = true;
+		}
+		lua_pop( luaState, 1 );
+
+		UTF8String contentType;
+		lua_getfield( luaState, partIndex, "contentType" ); // optional
+		if ( LUA_TSTRING == lua_type( luaState, -1 ) )
+		{
+			contentType = lua_tostring( luaState, -1 );
+		}
+		else if ( !lua_isnil( luaState, -1 ) )
+		{
+			paramValidationFailure( luaState, "body 'multipart' part %d 'contentType' value, if provided, should be a string value (got %s)", partNumber, lua_typename(luaState, lua_type(luaState, -1)) );
+			isInvalid = true;
+		}
+		lua_pop( luaState, 1 );
+
+		lua_getfield( luaState, partIndex, "value" );
+		bool hasValue = ( LUA_TSTRING == lua_type( luaState, -1 ) );
+		if ( hasValue && !isInvalid )
+		{
+			debug("Multipart body field: %s", name.c_str());
+			multipartBody->addField( name, luaState, -1, contentType );
+		}
+		lua_pop( luaState, 1 );
+
+		lua_getfield( luaState, partIndex, "filename" );
+		bool hasFilename = ( LUA_TSTRING == lua_type( luaState, -1 ) );
+		if ( hasValue == hasFilename )
+		{
+			if ( !isInvalid )
+			{
+				paramValidationFailure( luaState, "body 'multipart' part %d requires either a string 'value' or a string 'filename', but not both", partNumber );
+				isInvalid = true;
+			}
+		}
+		else if ( hasFilename && !isInvalid )
+		{
+			const char *filename = lua_tostring( luaState, -1 );
+
+			void *baseDirectory = NULL;
+			lua_getfield( luaState, partIndex, "baseDirectory"); // optional
+			if (!lua_isnoneornil( luaState, -1 ))
+			{
+				baseDirectory = lua_touserdata( luaState, -1 );
+			}
+			lua_pop( luaState, 1 );
+
+			// Prepare and call Lua function
+			int	numParams = 1;
+			lua_getglobal( luaState, "_network_pathForFile" );
+			lua_pushstring( luaState, filename );  // Push argument #1
+			if ( baseDirectory )
+			{
+				lua_pushlightuserdata( luaState, baseDirectory ); // Push argument #2
+				numParams++;
+			}
+
+			Corona::Lua::DoCall( luaState, numParams, 2); // 1/2 arguments, 2 returns
+
+			bool isResourceFile = ( 0 != lua_toboolean( luaState, -1 ) );
+			const char *path = lua_tostring( luaState, -2 );
+			CoronaFileSpec *file = new CoronaFileSpec(filename, baseDirectory, path ? path : "", isResourceFile);
+			lua_pop( luaState, 2 ); // Pop results
+
+			debug("Multipart body file: %s", file->getFullPath().c_str());
+
+			// The size of every part has to be known up front, for the Content-Length of the body
+			//
+			struct _stat64 buf;
+			if ( ( NULL != path ) && ( _stati64(file->getFullPath().c_str(), &buf) == 0 ) )
+			{
+				multipartBody->addFile( name, file, buf.st_size, contentType );
+			}
+			else
+			{
+				paramValidationFailure( luaState, "body 'multipart' part %d file could not be found: %s", partNumber, filename );
+				isInvalid = true;
+				delete file;
+			}
+		}
+		lua_pop( luaState, 1 );
 
-		requestHeaders += key + ": " + value + "\r\n";
+		lua_pop( luaState, 1 ); // Pop part
 	}
 
-	return requestHeaders; 
+	if ( !isInvalid && ( 1 == partNumber ) )
+	{
+		paramValidationFailure( luaState, "body 'multipart' value should have at least one part" );
+		isInvalid = true;
+	}
+	if ( isInvalid )
+	{
+		delete multipartBody;
+		return NULL;
+	}
+
+	multipartBody->finish();
+	return multipartBody;
+}
+
+const UTF8String& NetworkRequestParameters::getRequestHeaderString( )
+{
+	return fRequestHeaderString;
 }
 
+#ifdef _WIN32
+const std::wstring& NetworkRequestParameters::getWideRequestHeaderString( )
+{
+	return fWideRequestHeaderString;
+}
+#endif
+
 StringMap* NetworkRequestParameters::getRequestHeaders( )
 {
 	return &fRequestHeaders;
@@ -1661,6 +2650,50 @@ long long NetworkRequestParameters::getRequestBodySize( )
 	return fRequestBodySize;
 }
 
+/// Converts a text request body from utf-8 to the charset named by its Content-Type header, if it names another.
+/// A body sent straight from a Lua string is only copied if it has to be converted. Called on the main thread by
+/// the request operation, before the body is sent.
+/// @return Returns false if the body could not be converted, in which case it must not be sent, as it would not
+///         match its Content-Type.
+bool NetworkRequestParameters::transcodeRequestBody( )
+{
+	UTF8String *contentTypeValue = getRequestHeaderValue("Content-Type");
+	if ( !isRequestBodyText() || ( NULL == contentTypeValue ) )
+	{
+		return true;
+	}
+
+	char *contentEncoding = getContentTypeEncoding( contentTypeValue->c_str() );
+	if ( NULL == contentEncoding )
+	{
+		return true;
+	}
+	debug("Got request content encoding of: %s", contentEncoding);
+
+	bool wasSuccessful = true;
+
+	if ( 0 != _strcmpi( "utf-8", contentEncoding ) )
+	{
+		// Found content encoding other than utf-8
+		//
+		if ( TYPE_LUA_STRING == fRequestBody.bodyType )
+		{
+			LuaStringBody *luaString = fRequestBody.bodyLuaString;
+			fRequestBody.bodyType = TYPE_STRING;
+			fRequestBody.bodyString = new UTF8String( luaString->getData(), luaString->getSize() );
+			delete luaString;
+		}
+		debug("Transcoding request body from utf-8 to %s", contentEncoding);
+		if (!fRequestBody.bodyString->empty() && !CharsetTranscoder::transcode(fRequestBody.bodyString, "utf-8", contentEncoding))
+		{
+			CORONA_LOG("Error transcoding request body from utf-8 to %s", contentEncoding);
+			wasSuccessful = false;
+		}
+	}
+	free(contentEncoding);
+	return wasSuccessful;
+}
+
 CoronaFileSpec* NetworkRequestParameters::getResponseFile( )
 {
 	return fResponseFile;
@@ -1681,11 +2714,69 @@ bool NetworkRequestParameters::getHandleRedirects( )
 	return fHandleRedirects;
 }
 
+/// Determines if the request body is to be gzip compressed as it is sent.
+bool NetworkRequestParameters::isBodyCompressionEnabled( )
+{
+	return fIsBodyCompressionEnabled;
+}
+
+/// Determines if the response body is to be decoded as it arrives, if the server compressed it.
+bool NetworkRequestParameters::isCompressionEnabled( )
+{
+	return fIsCompressionEnabled;
+}
+
+/// Determines if the response may be served from, and stored in, the response cache (params.cache).
+bool NetworkRequestParameters::isCacheEnabled( )
+{
+	return fIsCacheEnabled;
+}
+
+/// Gets the directory of the response cache, if isCacheEnabled().
+const UTF8String& NetworkRequestParameters::getCacheDirectory( )
+{
+	return fCacheDirectory;
+}
+
+/// Determines if an interrupted download to the response file is kept, to be resumed by the next attempt.
+bool NetworkRequestParameters::isResumeEnabled( )
+{
+	return fIsResumeEnabled;
+}
+
+/// Gets the number of connections a download is split over (see SegmentedDownload), or 1 if it is not split.
+int NetworkRequestParameters::getSegmentCount( )
+{
+	return fSegmentCount;
+}
+
+/// Gets the segment of a segmented download that the request was made for, or NULL if it is a request of its own.
+DownloadSegment* NetworkRequestParameters::getDownloadSegment( )
+{
+	return fDownloadSegment.get();
+}
+
+/// Gets the class the request is scheduled in, which decides which queued requests are started first.
+RequestPriority NetworkRequestParameters::getPriority( )
+{
+	return fPriority;
+}
+
 int NetworkRequestParameters::getTimeout( )
 {
 	return fTimeout;
 }
 
+int NetworkRequestParameters::getReceiveBufferCount( )
+{
+	return fReceiveBufferCount;
+}
+
+int NetworkRequestParameters::getReceiveBufferSize( )
+{
+	return fReceiveBufferSize;
+}
+
 bool NetworkRequestParameters::isValid()
 {
 	return fIsValid;
@@ -12,8 +12,14 @@
 #ifndef _WindowsNetworkSupport_H_
 #define _WindowsNetworkSupport_H_
 
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN             // Exclude rarely-used stuff from Windows headers
 #include <windows.h>
+#else
+#include "LinuxNetworkCompat.h"
+#endif
+
+#include "HttpHeaderTable.h"
 
 #include <map>
 #include <vector>
@@ -24,8 +30,14 @@ typedef std::map<std::string, std::string>	StringMap;
 typedef std::vector<unsigned char>			ByteVector;
 typedef std::string							UTF8String;
 
+class DownloadSegment;
+class MultipartBody;
+class RequestBodyStream;
+
 void debug( char *message, ... );
 
+int compareTicks( DWORD x, DWORD y );
+
 // ----------------------------------------------------------------------------
 
 void paramValidationFailure( lua_State *luaState, char *message, ... );
@@ -40,6 +52,15 @@ UTF8String pathForTemporaryFileWithPrefix(const char *prefix, UTF8String pathDir
 
 // ----------------------------------------------------------------------------
 
+/// Number of bytes reserved for a response body collected in memory when the response has no Content-Length,
+/// and the most that is reserved up front when it does (a larger body still grows to its full size as it arrives).
+#define NETWORK_DEFAULT_RESPONSE_BODY_RESERVE 8192
+#define NETWORK_MAX_RESPONSE_BODY_RESERVE (256 * 1024 * 1024)
+
+size_t getResponseBodyReserve( long long contentLength );
+
+// ----------------------------------------------------------------------------
+
 char * getContentType( const char *contentTypeHeader );
 char * getContentTypeEncoding( const char *contentTypeHeader );
 
@@ -49,17 +70,36 @@ bool isContentTypeHTML ( const char *contentType );
 
 bool isContentTypeText ( const char *contentType );
 
-char * getEncodingFromContent ( const char *contentType, const char *content );
+/// Number of bytes at the start of an HTML or XML document searched for an embedded charset.
+#define NETWORK_CHARSET_PRESCAN_LENGTH 1024
+
+char * getEncodingFromContent ( const char *contentType, const char *content, size_t contentLength );
 
 // ----------------------------------------------------------------------------
 
+#ifdef _WIN32
 UTF8String utf8_encode( const WCHAR * wideString );
 UTF8String utf8_encode( const WCHAR * wideString, int wideStringLen );
 const WCHAR * getWCHARs ( UTF8String string );
+#endif
 
 // ----------------------------------------------------------------------------
 
-class WinHttpRequestOperation;
+// Interface implemented by each platform's request operation (WinHttpRequestOperation on Windows,
+// EpollRequestOperation on Linux), so that the shared request state and canceller don't depend on a
+// particular request engine.
+//
+class NetworkRequestOperation
+{
+public:
+	virtual ~NetworkRequestOperation( ) { }
+
+	virtual void RequestAbort( ) = 0;
+
+	// Called when the request is cancelled from Lua. An operation that other requests were coalesced onto (see
+	// CoalescedRequest) only aborts once none of them still wants the response.
+	virtual void RequestCancel( ) { RequestAbort( ); }
+};
 
 class RequestCanceller
 {
@@ -70,7 +110,7 @@ public:
 
 	static RequestCanceller * checkWithLuaState( lua_State * L, int index );
 
-	RequestCanceller(const std::shared_ptr<WinHttpRequestOperation>& requestOperation );
+	RequestCanceller(const std::shared_ptr<NetworkRequestOperation>& requestOperation );
 	~RequestCanceller( );
 
 	void AddRef();
@@ -83,7 +123,7 @@ public:
 
 private:
 
-	std::shared_ptr<WinHttpRequestOperation> fRequestOperation;
+	std::shared_ptr<NetworkRequestOperation> fRequestOperation;
 	int fRefCount;
 	bool fIsCancelled;
 
@@ -103,6 +143,21 @@ const char* getProgressDirectionName( ProgressDirection progressDirection );
 
 // ----------------------------------------------------------------------------
 
+// Scheduling classes of the "priority" request parameter, from the first to be started to the last.
+//
+typedef enum {
+	PriorityUnknown		= -1,
+	PriorityHigh		= 0,
+	PriorityNormal		= 1,
+	PriorityLow			= 2,
+	PriorityBackground	= 3,
+	PriorityCount		= 4,
+} RequestPriority;
+
+RequestPriority getRequestPriorityFromString( const char *priorityString );
+
+// ----------------------------------------------------------------------------
+
 class CoronaFileSpec
 {
 public:
@@ -164,8 +219,36 @@ typedef enum
 	TYPE_STRING,
 	TYPE_BYTES,
 	TYPE_FILE,
+	TYPE_LUA_STRING,
+	TYPE_MULTIPART,
+	TYPE_STREAM,
 } BodyType;
 
+/// A Lua string given as the request body (params.body), which is sent straight from the string's own bytes rather
+/// than from a copy. The string is pinned with a reference in the Lua registry, which keeps it from being collected
+/// (Lua never moves a string), until the request parameters are destroyed on the main thread.
+class LuaStringBody
+{
+public:
+
+	LuaStringBody( lua_State *luaState, int index, bool isText );
+	~LuaStringBody();
+
+	const char* getData( ) const;
+	size_t getSize( ) const;
+	bool isText( ) const;
+
+private:
+
+	lua_State* fLuaState;
+	CoronaLuaRef fLuaReference;
+	const char* fData;
+	size_t fSize;
+
+	/// Set if the string is text (params.bodyType = "text"), which is sent in the charset of its Content-Type.
+	bool fIsText;
+};
+
 typedef struct
 {
 	BodyType bodyType;
@@ -174,6 +257,9 @@ typedef struct
 		UTF8String* bodyString;
 		ByteVector* bodyBytes;
 		CoronaFileSpec* bodyFile;
+		LuaStringBody* bodyLuaString;
+		MultipartBody* bodyMultipart;
+		RequestBodyStream* bodyStream;
 	};
 } Body;
 
@@ -183,27 +269,39 @@ class NetworkRequestState
 {
 public:
 
-	NetworkRequestState(const std::shared_ptr<WinHttpRequestOperation>& requestOperation, UTF8String url, bool isDebug );
+	NetworkRequestState(const std::shared_ptr<NetworkRequestOperation>& requestOperation, UTF8String url, bool isDebug );
+	NetworkRequestState( RequestCanceller *requestCanceller, UTF8String url, bool isDebug );
 	~NetworkRequestState();
 	
 	void setError( UTF8String *message = NULL );
 	void setPhase( const char *phase );
 	void setStatus( int status );
-	void setResponseHeaders( const char *headers );
+	void setResponseHeaders( const char *headers, size_t length );
 	void setResponseType( const char *responseType );
 	void setBytesEstimated( long long nBytesTransferred );
 	void setBytesTransferred( long long nBytesTransferred );
 	void incrementBytesTransferred( int newBytesTransferred );
+	void setBytesDecoded( long long nBytesDecoded );
+	void incrementBytesDecoded( long long newBytesDecoded );
+	void setBytesEncoded( long long nBytesEncoded );
+	void setCacheResult( bool isCacheHit, bool wasRevalidated );
 	void setDebugValue( char *debugValue, char *debugKey );
 
 	bool isError( );
-	StringMap getResponseHeaders( );
+	bool isDebug( );
+	int getStatus( );
+	long long getBytesTransferred( );
+	const HttpHeaderTable& getResponseHeaders( );
+	const char* findResponseHeaderValue( const char *headerKey );
 	UTF8String getResponseHeaderValue( const char *headerKey );
+	long long getResponseContentLength( );
 	Body* getResponseBody( );
+	void releaseResponseBody( );
 	const char* getPhase( );
 	RequestCanceller* getRequestCanceller( );
 
 	int pushToLuaState( lua_State *L );
+	int pushToLuaState( lua_State *L, RequestCanceller *requestCanceller );
 
 private:
 
@@ -211,12 +309,15 @@ private:
 	UTF8String		fPhase;
 	int				fStatus;
 	UTF8String		fRequestURL;
-	StringMap		fResponseHeaders;
+	HttpHeaderTable	fResponseHeaders;
 	UTF8String		fResponseType;
 	Body			fResponseBody;
 	RequestCanceller* fRequestCanceller;
 	long long		fBytesEstimated;
 	long long		fBytesTransferred;
+	long long		fBytesDecoded;
+	long long		fBytesEncoded;
+	int				fCacheResult;
 	StringMap		fDebugValues;
 
 };
@@ -231,6 +332,7 @@ public:
 	~LuaCallback();
 
 	bool callWithNetworkRequestState( NetworkRequestState *requestState );
+	bool callWithNetworkRequestState( NetworkRequestState *requestState, RequestCanceller *requestCanceller );
 	void unregister();
 
 private:
@@ -246,11 +348,26 @@ private:
 
 // ----------------------------------------------------------------------------
 
+/// Defaults and limits of the "receiveBufferCount" and "receiveBufferSize" request parameters, which control how
+/// many response bytes the I/O thread may have in flight for the main thread before it stops reading. Together
+/// the buffers of a request (or of all the segments of a segmented download) hold no more than
+/// NETWORK_MAX_RECEIVE_BUFFER_BYTES.
+#define NETWORK_DEFAULT_RECEIVE_BUFFER_COUNT 4
+#define NETWORK_MAX_RECEIVE_BUFFER_COUNT 64
+#define NETWORK_DEFAULT_RECEIVE_BUFFER_SIZE 65536
+#define NETWORK_MIN_RECEIVE_BUFFER_SIZE 4096
+#define NETWORK_MAX_RECEIVE_BUFFER_SIZE (4 * 1024 * 1024)
+#define NETWORK_MAX_RECEIVE_BUFFER_BYTES (4 * 1024 * 1024)
+
+/// Most connections the "segments" request parameter may split a download into.
+#define NETWORK_MAX_DOWNLOAD_SEGMENTS 16
+
 class NetworkRequestParameters
 {
 public:
 
 	NetworkRequestParameters( lua_State *L );
+	NetworkRequestParameters( NetworkRequestParameters *requestParams, const std::shared_ptr<DownloadSegment>& downloadSegment );
 	~NetworkRequestParameters();
 
 	bool isValid( );
@@ -258,16 +375,30 @@ public:
 	UTF8String getRequestUrl( );
 	UTF8String getRequestMethod( );
 	ProgressDirection getProgressDirection( );
-	UTF8String getRequestHeaderString( );
+	const UTF8String& getRequestHeaderString( );
+#ifdef _WIN32
+	const std::wstring& getWideRequestHeaderString( );
+#endif
 	StringMap* getRequestHeaders( );
 	UTF8String* getRequestHeaderValue( const char *headerKey );
 	Body* getRequestBody( );
 	long long getRequestBodySize( );
+	bool transcodeRequestBody( );
 	CoronaFileSpec* getResponseFile( );
 	LuaCallback* getLuaCallback( );
 	int getTimeout( );
+	int getReceiveBufferCount( );
+	int getReceiveBufferSize( );
 	bool isDebug( );
 	bool getHandleRedirects( );
+	bool isCompressionEnabled( );
+	bool isBodyCompressionEnabled( );
+	bool isCacheEnabled( );
+	const UTF8String& getCacheDirectory( );
+	bool isResumeEnabled( );
+	int getSegmentCount( );
+	DownloadSegment* getDownloadSegment( );
+	RequestPriority getPriority( );
 
 private:
 
@@ -275,8 +406,17 @@ private:
 	UTF8String		fMethod;
 	ProgressDirection fProgressDirection;
 	StringMap		fRequestHeaders;
+
+	/// The request headers serialized as sent ("Name: value" lines, each ending in CRLF), built once the parameters
+	/// have been validated. Windows also keeps the UTF-16 form that WinHttp takes.
+	UTF8String		fRequestHeaderString;
+#ifdef _WIN32
+	std::wstring	fWideRequestHeaderString;
+#endif
 	bool			fIsBodyTypeText;
 	int				fTimeout;
+	int				fReceiveBufferCount;
+	int				fReceiveBufferSize;
 	bool			fIsDebug;
 	Body			fRequestBody;
 	long long		fRequestBodySize;
@@ -285,6 +425,19 @@ private:
 	LuaCallback*	fLuaCallback;
 	bool			fIsValid;
 	bool			fHandleRedirects;
+	bool			fIsCompressionEnabled;
+	bool			fIsBodyCompressionEnabled;
+	bool			fIsCacheEnabled;
+	UTF8String		fCacheDirectory;
+	bool			fIsResumeEnabled;
+	int				fSegmentCount;
+	RequestPriority	fPriority;
+
+	/// The part of a segmented download (see SegmentedDownload) that the request was made for, if any.
+	std::shared_ptr<DownloadSegment> fDownloadSegment;
+	void prepareRequestHeaders( );
+	bool isRequestBodyText( );
+	MultipartBody* newMultipartBody( lua_State *luaState, int partsIndex );
 };
 
 #endif